@@ -0,0 +1,199 @@
+/**
+ * @file        audio.c
+ * @brief       Audio output fed through a lock-free ring
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-16 20:11:52
+ * Licence:     GPL
+ *
+ * The callback runs on the real-time thread of SDL audio, it shall never
+ * wait: it does not lock, allocate or call the file system. It only takes
+ * decoded frames from the ring, adds the effects of sfx.c and scales them
+ * by the volume. The decoder is the only producer of the ring. Volume and
+ * pause are set by the game thread with atomic stores, so it never locks
+ * the audio device.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <SDL/SDL.h>
+
+#include "audio.h"
+#include "ringbuf.h"
+#include "sfx.h"
+#include "trace.h"
+
+#define AUDIO_FLUSH_TIMEOUT_MS  100
+
+static ringbuf_t    audio_ring;                 /* Decoded frames */
+static bool_t       audio_open = FALSE;
+static uint8_t      audio_volume = VOLUME_MAX;  /* Written by game thread */
+static bool_t       audio_paused = FALSE;       /* Written by game thread */
+static bool_t       audio_flush = FALSE;        /* Set by producer, cleared by callback */
+static bool_t       audio_had_data = FALSE;     /* Previous callback got frames */
+static uint32_t     audio_underruns = 0;        /* Callbacks which did not get enough frames */
+
+/**
+ * @brief audioCallback
+ * Fill the buffer of audio device.
+ */
+static void audioCallback (void* aUserData, Uint8* aStream, int aLength)
+{
+    int16_t* samples = (int16_t*) aStream;
+    uint32_t frames = aLength / AUDIO_FRAME_SIZE;
+    uint32_t got = 0;
+    uint32_t i;
+    int32_t gain;
+    bool_t paused = __atomic_load_n (&audio_paused, __ATOMIC_RELAXED);
+    TRACE_BEGIN(span);
+
+    (void) aUserData;
+    TRACE_THREAD("audio");
+
+    if (__atomic_load_n (&audio_flush, __ATOMIC_ACQUIRE))
+    {
+        ringbufRead (&audio_ring, NULL, ringbufUsed (&audio_ring));
+        audio_had_data = FALSE;     /* Silence after flush is not an underrun */
+        __atomic_store_n (&audio_flush, FALSE, __ATOMIC_RELEASE);
+    }
+    if (!paused)
+    {
+        got = ringbufRead (&audio_ring, aStream, frames);
+        if (got < frames && (got || audio_had_data))
+        {
+            __atomic_add_fetch (&audio_underruns, 1, __ATOMIC_RELAXED);
+        }
+        audio_had_data = got > 0;
+    }
+    memset (aStream + got * AUDIO_FRAME_SIZE, 0, aLength - got * AUDIO_FRAME_SIZE);
+
+    /* Effects are taken during pause too, so they are not played late */
+    sfxMix (samples, frames);
+    if (paused)
+    {
+        memset (aStream, 0, aLength);
+    }
+    else
+    {
+        /* Fixed point, 16 bit fraction */
+        gain = __atomic_load_n (&audio_volume, __ATOMIC_RELAXED) * 65536 / VOLUME_MAX;
+        for (i = 0; i < frames * AUDIO_CHANNELS; i++)
+        {
+            samples[i] = (samples[i] * gain) >> 16;
+        }
+    }
+    TRACE_END_ARG(span, "audioCallback", "music_frames", got);
+}
+
+/**
+ * @brief audioInit
+ * Open audio device. Audio subsystem of SDL is initialized only now, so
+ * it does not slow down the start of game.
+ *
+ * @return TRUE: device is playing.
+ */
+bool_t audioInit (void)
+{
+    SDL_AudioSpec wanted;
+
+    if (!SDL_WasInit (SDL_INIT_AUDIO) && SDL_InitSubSystem (SDL_INIT_AUDIO) < 0)
+    {
+        printf("%s: SDL_InitSubSystem() failed: %s\n", __FUNCTION__, SDL_GetError());
+        return FALSE;
+    }
+    if (!ringbufInit (&audio_ring, AUDIO_FRAME_SIZE, AUDIO_RING_FRAMES))
+    {
+        printf("%s: out of memory\n", __FUNCTION__);
+        SDL_QuitSubSystem (SDL_INIT_AUDIO);
+        return FALSE;
+    }
+
+    memset (&wanted, 0, sizeof (wanted));
+    wanted.freq = AUDIO_FREQ_HZ;
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = AUDIO_CHANNELS;
+    wanted.samples = AUDIO_DEVICE_FRAMES;
+    wanted.callback = audioCallback;
+    /* Without obtained spec SDL converts to the format of device */
+    if (SDL_OpenAudio (&wanted, NULL) < 0)
+    {
+        printf("%s: SDL_OpenAudio() failed: %s\n", __FUNCTION__, SDL_GetError());
+        ringbufFree (&audio_ring);
+        SDL_QuitSubSystem (SDL_INIT_AUDIO);
+        return FALSE;
+    }
+    audio_open = TRUE;
+    SDL_PauseAudio (0);
+
+    return TRUE;
+}
+
+/**
+ * @brief audioDone
+ * Close audio device. Producer shall be stopped before.
+ */
+void audioDone (void)
+{
+    if (audio_open)
+    {
+        SDL_CloseAudio ();
+        ringbufFree (&audio_ring);
+        SDL_QuitSubSystem (SDL_INIT_AUDIO);
+        audio_open = FALSE;
+        printf("%s: %u underruns\n", __FUNCTION__, audio_underruns);
+    }
+}
+
+/**
+ * @brief audioWrite
+ * Queue decoded frames. Called by the producer only.
+ *
+ * @return Number of frames queued, less than aCount if ring is full.
+ */
+uint32_t audioWrite (const int16_t* aFrames, uint32_t aCount)
+{
+    return ringbufWrite (&audio_ring, aFrames, aCount);
+}
+
+/**
+ * @brief audioSpace
+ * @return Number of frames which can be queued.
+ */
+uint32_t audioSpace (void)
+{
+    return AUDIO_RING_FRAMES - ringbufUsed (&audio_ring);
+}
+
+/**
+ * @brief audioFlush
+ * Drop queued frames, for example when the track is changed.
+ * Called by the producer only, it waits for the callback.
+ */
+void audioFlush (void)
+{
+    uint32_t i;
+
+    __atomic_store_n (&audio_flush, TRUE, __ATOMIC_RELEASE);
+    for (i = 0; i < AUDIO_FLUSH_TIMEOUT_MS && __atomic_load_n (&audio_flush, __ATOMIC_ACQUIRE); i++)
+    {
+        SDL_Delay (1);
+    }
+}
+
+void audioSetVolume (uint8_t aVolume)
+{
+    __atomic_store_n (&audio_volume, aVolume, __ATOMIC_RELAXED);
+}
+
+void audioSetPaused (bool_t aPaused)
+{
+    __atomic_store_n (&audio_paused, aPaused, __ATOMIC_RELAXED);
+}
+
+uint32_t audioUnderruns (void)
+{
+    return __atomic_load_n (&audio_underruns, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,32 @@
+/**
+ * @file        audio.h
+ * @brief       Audio output fed through a lock-free ring
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-16 20:11:52
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_AUDIO_H
+#define INCLUDE_AUDIO_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define AUDIO_FREQ_HZ           44100
+#define AUDIO_CHANNELS          2       /* Stereo, signed 16 bit */
+#define AUDIO_FRAME_SIZE        (AUDIO_CHANNELS * sizeof (int16_t))
+#define AUDIO_DEVICE_FRAMES     1024    /* Frames requested by one callback, 23 ms */
+#define AUDIO_RING_FRAMES       32768   /* Decoded ahead, 743 ms. Power of two! */
+
+bool_t audioInit (void);
+void audioDone (void);
+uint32_t audioWrite (const int16_t* aFrames, uint32_t aCount);
+uint32_t audioSpace (void);
+void audioFlush (void);
+void audioSetVolume (uint8_t aVolume);
+void audioSetPaused (bool_t aPaused);
+uint32_t audioUnderruns (void);
+
+#endif /* INCLUDE_AUDIO_H */
@@ -0,0 +1,385 @@
+/**
+ * @file        bench_rules.c
+ * @brief       Microbenchmark of game rules on a corpus of boards
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-19 20:14:37
+ * Licence:     GPL
+ *
+ * Usage: bench_rules [--min-ms N] board.map...
+ *
+ * Functions of game_common.c are timed on every board: collapseMap(),
+ * its reference collapseMapReference() of fuzz/collapse_ref.c, shiftDownColumn(), canMoveFigure*(), canRotateFigure() and isGameOver().
+ * Figure functions are called at every position of the figure inside the
+ * map, so their number of calls does not depend on the board. Result is JSON on stdout, one line per board and
+ * function, so runs of different builds can be compared by diff.
+ *
+ * game_common.c is compiled with RULES_STATS, so every read of a map
+ * cell is counted. The counter is part of every build of the benchmark,
+ * so the times remain comparable.
+ *
+ * Board files have MAP_SIZE_Y rows of MAP_SIZE_X characters: '.' is an
+ * empty cell, '1'..'6' is a block. Lines starting with '#' are comments.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "game_common.h"
+#include "game_gfx.h"
+#include "sfx.h"
+#include "collapse_ref.h"
+
+#define BENCH_VERSION           1       /* Changed when the output is not comparable */
+#define BENCH_MIN_MS            50      /* One run takes at least this long */
+#define BENCH_RUNS              5       /* Best run is reported */
+#define BENCH_BATCHES           64      /* Batches between reading the clock */
+#define BENCH_NAME_LENGTH       32
+#define BENCH_MAX_POSITIONS     (2 * MAP_SIZE_X * MAP_SIZE_Y)
+
+typedef enum
+{
+    OP_COLLAPSE_MAP = 0,
+    OP_COLLAPSE_MAP_REFERENCE,
+    OP_SHIFT_DOWN_COLUMN,
+    OP_CAN_MOVE_FIGURE_LEFT,
+    OP_CAN_MOVE_FIGURE_RIGHT,
+    OP_CAN_MOVE_FIGURE_DOWN,
+    OP_CAN_ROTATE_FIGURE,
+    OP_IS_GAME_OVER,
+    OP_NUM
+} bench_op_t;
+
+typedef struct
+{
+    uint8_t x;
+    uint8_t y;
+    bool_t vertical;
+} bench_position_t;
+
+static const char* bench_op_names[OP_NUM] =
+{
+    [OP_COLLAPSE_MAP] = "collapseMap",
+    [OP_COLLAPSE_MAP_REFERENCE] = "collapseMapReference",
+    [OP_SHIFT_DOWN_COLUMN] = "shiftDownColumn",
+    [OP_CAN_MOVE_FIGURE_LEFT] = "canMoveFigureLeft",
+    [OP_CAN_MOVE_FIGURE_RIGHT] = "canMoveFigureRight",
+    [OP_CAN_MOVE_FIGURE_DOWN] = "canMoveFigureDown",
+    [OP_CAN_ROTATE_FIGURE] = "canRotateFigure",
+    [OP_IS_GAME_OVER] = "isGameOver"
+};
+
+uint64_t rules_cells_scanned = 0;
+
+static uint8_t bench_board[MAP_SIZE_Y][MAP_SIZE_X];
+static bench_position_t bench_positions[BENCH_MAX_POSITIONS];
+static uint32_t bench_position_cntr;
+static volatile uint32_t bench_sink;     /* Results are stored, so calls are not optimized out */
+
+/* Drawing and sound are not part of the rules */
+void blinkMap (uint8_t blinkNum)
+{
+    (void) blinkNum;
+}
+
+void drawMap (void)
+{
+}
+
+void sfxPlay (sfx_id_t aId, uint8_t aPitch)
+{
+    (void) aId;
+    (void) aPitch;
+}
+
+static uint64_t getTimeNs (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * @brief loadBoard
+ * @return TRUE: board was read.
+ */
+static bool_t loadBoard (const char* aPath)
+{
+    char line[128];
+    FILE* f;
+    uint8_t x, y = 0;
+    bool_t ok = TRUE;
+
+    f = fopen (aPath, "r");
+    if (!f)
+    {
+        fprintf (stderr, "%s: cannot open %s\n", __FUNCTION__, aPath);
+        return FALSE;
+    }
+    while (ok && y < MAP_SIZE_Y && fgets (line, sizeof (line), f))
+    {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+        {
+            continue;
+        }
+        for (x = 0; x < MAP_SIZE_X && ok; x++)
+        {
+            if (line[x] == '.')
+            {
+                bench_board[y][x] = 0;
+            }
+            else if (line[x] >= '1' && line[x] <= '0' + MAX_BLOCK_TYPES)
+            {
+                bench_board[y][x] = line[x] - '0';
+            }
+            else
+            {
+                fprintf (stderr, "%s: %s:%i: bad cell '%c'\n", __FUNCTION__, aPath, y + 1, line[x]);
+                ok = FALSE;
+            }
+        }
+        y++;
+    }
+    fclose (f);
+    if (ok && y < MAP_SIZE_Y)
+    {
+        fprintf (stderr, "%s: %s: %i rows instead of %i\n", __FUNCTION__, aPath, y, MAP_SIZE_Y);
+        ok = FALSE;
+    }
+
+    return ok;
+}
+
+/**
+ * @brief findPositions
+ * Collect positions of figure inside the map.
+ */
+static void findPositions (void)
+{
+    uint8_t x, y;
+
+    bench_position_cntr = 0;
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        for (x = 0; x < MAP_SIZE_X; x++)
+        {
+            if (y + FIGURE_SIZE <= MAP_SIZE_Y)
+            {
+                bench_positions[bench_position_cntr++] = (bench_position_t) { x, y, TRUE };
+            }
+            if (x + FIGURE_SIZE <= MAP_SIZE_X)
+            {
+                bench_positions[bench_position_cntr++] = (bench_position_t) { x, y, FALSE };
+            }
+        }
+    }
+}
+
+static void setPosition (const bench_position_t* aPos)
+{
+    game.figure_x = aPos->x;
+    game.figure_y = aPos->y;
+    game.figure_is_vertical = aPos->vertical;
+}
+
+/**
+ * @brief runBatch
+ * Call the function on the board once or at every position.
+ *
+ * @return Number of calls.
+ */
+static uint32_t runBatch (bench_op_t aOp)
+{
+    uint32_t result = 0;
+    uint32_t i;
+    uint8_t x, y;
+
+    switch (aOp)
+    {
+        case OP_COLLAPSE_MAP:
+            memcpy (game.map, bench_board, sizeof (game.map));
+            result += collapseMap ();
+            bench_sink = result;
+            return 1;
+        case OP_COLLAPSE_MAP_REFERENCE:
+            memcpy (game.map, bench_board, sizeof (game.map));
+            result += collapseMapReference ();
+            bench_sink = result;
+            return 1;
+        case OP_SHIFT_DOWN_COLUMN:
+            /* Time does not depend on the content of column */
+            for (x = 0; x < MAP_SIZE_X; x++)
+            {
+                shiftDownColumn (x, MAP_SIZE_Y - 1);
+            }
+            bench_sink = game.map[MAP_SIZE_Y - 1][0];
+            return MAP_SIZE_X;
+        case OP_IS_GAME_OVER:
+            bench_sink = isGameOver ();
+            return 1;
+        default:
+            break;
+    }
+    for (i = 0; i < bench_position_cntr; i++)
+    {
+        setPosition (&bench_positions[i]);
+        switch (aOp)
+        {
+            case OP_CAN_MOVE_FIGURE_LEFT:
+                result += canMoveFigureLeft ();
+                break;
+            case OP_CAN_MOVE_FIGURE_RIGHT:
+                result += canMoveFigureRight ();
+                break;
+            case OP_CAN_MOVE_FIGURE_DOWN:
+                result += canMoveFigureDown ();
+                break;
+            case OP_CAN_ROTATE_FIGURE:
+                result += canRotateFigure (&x, &y);
+                break;
+            default:
+                break;
+        }
+    }
+    bench_sink = result;
+
+    return bench_position_cntr;
+}
+
+/**
+ * @brief restoreCost
+ * @return Time of restoring the board for collapseMap() in nanoseconds.
+ */
+static double restoreCost (uint64_t aMinNs)
+{
+    uint64_t start, elapsed;
+    uint64_t ops = 0;
+    uint32_t i;
+
+    start = getTimeNs ();
+    do
+    {
+        for (i = 0; i < BENCH_BATCHES; i++)
+        {
+            memcpy (game.map, bench_board, sizeof (game.map));
+            bench_sink = game.map[i % MAP_SIZE_Y][0];
+        }
+        ops += BENCH_BATCHES;
+        elapsed = getTimeNs () - start;
+    } while (elapsed < aMinNs);
+
+    return (double) elapsed / ops;
+}
+
+/**
+ * @brief measure
+ * Time a function on the loaded board and print its result.
+ */
+static void measure (const char* aBoard, bench_op_t aOp, uint64_t aMinNs, double aRestoreNs,
+                     bool_t aLast)
+{
+    uint64_t start, elapsed;
+    uint64_t ops;
+    uint64_t cells;
+    uint32_t batch_ops;
+    double ns, best = 0.0;
+    uint8_t run;
+    uint32_t i;
+
+    memcpy (game.map, bench_board, sizeof (game.map));
+    rules_cells_scanned = 0;
+    batch_ops = runBatch (aOp);
+    cells = rules_cells_scanned;
+
+    for (run = 0; run < BENCH_RUNS; run++)
+    {
+        memcpy (game.map, bench_board, sizeof (game.map));
+        ops = 0;
+        start = getTimeNs ();
+        do
+        {
+            for (i = 0; i < BENCH_BATCHES; i++)
+            {
+                ops += runBatch (aOp);
+            }
+            elapsed = getTimeNs () - start;
+        } while (elapsed < aMinNs);
+        ns = (double) elapsed / ops;
+        if (aOp == OP_COLLAPSE_MAP || aOp == OP_COLLAPSE_MAP_REFERENCE)
+        {
+            ns -= aRestoreNs;
+        }
+        if (!run || ns < best)
+        {
+            best = ns;
+        }
+    }
+
+    printf("    { \"board\": \"%s\", \"op\": \"%s\", \"ns_per_op\": %.2f, \"cells_per_op\": %.2f }%s\n",
+           aBoard, bench_op_names[aOp], best,
+           batch_ops ? (double) cells / batch_ops : 0.0, aLast ? "" : ",");
+}
+
+/**
+ * @brief boardName
+ * Name of board is the file name without directory and extension.
+ */
+static void boardName (char* aName, const char* aPath)
+{
+    const char* base = strrchr (aPath, '/');
+    char* ext;
+
+    base = base ? base + 1 : aPath;
+    strncpy (aName, base, BENCH_NAME_LENGTH - 1);
+    aName[BENCH_NAME_LENGTH - 1] = 0;
+    ext = strrchr (aName, '.');
+    if (ext)
+    {
+        *ext = 0;
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    char name[BENCH_NAME_LENGTH];
+    uint64_t min_ns = BENCH_MIN_MS * 1000000ull;
+    double restore_ns;
+    int first = 1;
+    int i;
+    bench_op_t op;
+
+    if (argc > 2 && !strcmp (argv[1], "--min-ms"))
+    {
+        min_ns = strtoul (argv[2], NULL, 0) * 1000000ull;
+        first = 3;
+    }
+    if (first >= argc)
+    {
+        fprintf (stderr, "Usage: %s [--min-ms N] board.map...\n", argv[0]);
+        return 1;
+    }
+
+    printf("{\n  \"benchmark\": \"rules\",\n  \"version\": %i,\n  \"results\": [\n", BENCH_VERSION);
+    for (i = first; i < argc; i++)
+    {
+        if (!loadBoard (argv[i]))
+        {
+            return 1;
+        }
+        boardName (name, argv[i]);
+        findPositions ();
+        restore_ns = restoreCost (min_ns);
+        for (op = 0; op < OP_NUM; op++)
+        {
+            measure (name, op, min_ns, restore_ns, i == argc - 1 && op == OP_NUM - 1);
+        }
+    }
+    printf("  ]\n}\n");
+
+    return 0;
+}
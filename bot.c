@@ -0,0 +1,323 @@
+/**
+ * @file        bot.c
+ * @brief       Headless player for training and benchmarks
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-18 21:05:44
+ * Licence:     GPL
+ *
+ * The bot presses keys through the same path as the player, so the whole
+ * game runs: menus, movement, collapsing, drawing, saving and records.
+ * Only the automatic fall is not waited for. Games are played on every
+ * difficulty in turn. It is the workload of profile guided optimization
+ * (make pgo), run with SDL_VIDEODRIVER=dummy.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <SDL/SDL.h>
+
+#include "bot.h"
+
+typedef struct
+{
+    uint32_t games;
+    uint32_t figures;
+    uint64_t score;
+    uint8_t longest_cascade;
+} bot_stat_t;
+
+bool_t bot_playing = FALSE;
+
+static uint32_t     bot_games = 0;          /* Games to play */
+static uint32_t     bot_games_started = 0;
+static uint32_t     bot_games_done = 0;
+static bool_t       bot_in_game = FALSE;
+static uint64_t     bot_start_us;
+static bot_stat_t   bot_stat[RECORD_TYPES];
+
+/* Plan of actual figure */
+static uint32_t     bot_figure = 0;         /* figure_counter of the plan */
+static uint8_t      bot_target_x;
+static bool_t       bot_target_vertical;
+static bool_t       bot_stuck;              /* Target cannot be reached, drop */
+static uint16_t     bot_last_key;
+static uint8_t      bot_last_x;
+static bool_t       bot_last_vertical;
+
+/**
+ * @brief columnTop
+ * @return Row of the highest block in column, MAP_SIZE_Y: column is empty.
+ */
+static uint8_t columnTop (uint8_t aX)
+{
+    uint8_t y;
+
+    for (y = 0; y < MAP_SIZE_Y && MAP_IS_EMPTY(aX, y); y++)
+    {
+    }
+
+    return y;
+}
+
+/**
+ * @brief countSame
+ * @return Number of neighbour blocks which are the same as aBlock.
+ */
+static uint8_t countSame (int8_t aX, int8_t aY, uint8_t aBlock)
+{
+    int8_t dx, dy;
+    uint8_t cntr = 0;
+
+    for (dy = -1; dy <= 1; dy++)
+    {
+        for (dx = -1; dx <= 1; dx++)
+        {
+            if ((dx || dy) && aX + dx >= 0 && aX + dx < MAP_SIZE_X
+                    && aY + dy >= 0 && aY + dy < MAP_SIZE_Y
+                    && MAP(aX + dx, aY + dy) == aBlock)
+            {
+                cntr++;
+            }
+        }
+    }
+
+    return cntr;
+}
+
+/**
+ * @brief planFigure
+ * Choose column and orientation: deep landing and same neighbours are good.
+ */
+static void planFigure (void)
+{
+    int32_t best = -1;
+    int32_t value;
+    int16_t y;
+    uint8_t x, i;
+    uint8_t top;
+
+    bot_target_x = game.figure_x;
+    bot_target_vertical = TRUE;
+    for (x = 0; x < MAP_SIZE_X; x++)
+    {
+        /* Vertical */
+        y = (int16_t) columnTop (x) - FIGURE_SIZE;
+        if (y >= 0)
+        {
+            value = y * 2 + rand () % 2;
+            for (i = 0; i < FIGURE_SIZE; i++)
+            {
+                value += countSame (x, y + i, game.figure[i]) * 3;
+            }
+            if (value > best)
+            {
+                best = value;
+                bot_target_x = x;
+                bot_target_vertical = TRUE;
+            }
+        }
+
+        /* Horizontal */
+        if (x + FIGURE_SIZE > MAP_SIZE_X)
+        {
+            continue;
+        }
+        top = MAP_SIZE_Y;
+        for (i = 0; i < FIGURE_SIZE; i++)
+        {
+            if (columnTop (x + i) < top)
+            {
+                top = columnTop (x + i);
+            }
+        }
+        y = (int16_t) top - 1;
+        if (y >= 0)
+        {
+            value = y * 2 + rand () % 2;
+            for (i = 0; i < FIGURE_SIZE; i++)
+            {
+                value += countSame (x + i, y, game.figure[i]) * 3;
+            }
+            if (value > best)
+            {
+                best = value;
+                bot_target_x = x;
+                bot_target_vertical = FALSE;
+            }
+        }
+    }
+    /* Good games would never end, the rest are dropped to the middle */
+    bot_stuck = game.figure_counter > BOT_MAX_FIGURES;
+    bot_last_key = 0;
+}
+
+/**
+ * @brief moveFigure
+ * @return Key which moves figure towards the plan.
+ */
+static uint16_t moveFigure (void)
+{
+    uint16_t key;
+
+    if (bot_figure != game.figure_counter)
+    {
+        bot_figure = game.figure_counter;
+        planFigure ();
+    }
+    if (bot_last_key && bot_last_key != SDLK_DOWN
+            && bot_last_x == game.figure_x && bot_last_vertical == game.figure_is_vertical)
+    {
+        /* Previous key did nothing: wall or blocks are in the way */
+        bot_stuck = TRUE;
+    }
+    if (bot_stuck)
+    {
+        key = SDLK_DOWN;
+    }
+    else if (game.figure_is_vertical != bot_target_vertical)
+    {
+        key = SDLK_UP;
+    }
+    else if (game.figure_x < bot_target_x)
+    {
+        key = SDLK_RIGHT;
+    }
+    else if (game.figure_x > bot_target_x)
+    {
+        key = SDLK_LEFT;
+    }
+    else
+    {
+        key = SDLK_DOWN;
+    }
+    bot_last_key = key;
+    bot_last_x = game.figure_x;
+    bot_last_vertical = game.figure_is_vertical;
+
+    return key;
+}
+
+/**
+ * @brief endGame
+ * Collect result of a finished game.
+ */
+static void endGame (void)
+{
+    bot_stat_t* stat = &bot_stat[RECORD_TYPE(game.block_types)];
+
+    stat->games++;
+    stat->figures += game.figure_counter;
+    stat->score += game.score;
+    if (game.longest_cascade > stat->longest_cascade)
+    {
+        stat->longest_cascade = game.longest_cascade;
+    }
+    bot_in_game = FALSE;
+    bot_games_done++;
+}
+
+/**
+ * @brief botInit
+ * Play games instead of keyboard.
+ *
+ * @param aGames Number of games, difficulties are used in turn.
+ */
+void botInit (uint32_t aGames)
+{
+    bot_games = aGames ? aGames : BOT_DEFAULT_GAMES;
+    bot_playing = TRUE;
+    memset (bot_stat, 0, sizeof (bot_stat));
+    bot_start_us = getTimeUs ();
+}
+
+/**
+ * @brief botKey
+ * Called once in every loop of game.
+ *
+ * @return Key to press in this loop, 0: none.
+ */
+uint16_t botKey (void)
+{
+    uint8_t difficulty;
+
+    if (!bot_playing)
+    {
+        return 0;
+    }
+    if (bot_in_game && main_state_machine != STATE_running
+            && main_state_machine != STATE_paused)
+    {
+        endGame ();
+    }
+
+    switch (main_state_machine)
+    {
+        case STATE_load_game:
+            return SDLK_SPACE;
+        case STATE_difficulty_selection:
+            difficulty = MIN_BLOCK_TYPES + bot_games_started % RECORD_TYPES;
+            if (game.block_types < difficulty)
+            {
+                return SDLK_UP;
+            }
+            if (game.block_types > difficulty)
+            {
+                return SDLK_DOWN;
+            }
+            bot_games_started++;
+            bot_in_game = TRUE;
+            return SDLK_RETURN;
+        case STATE_running:
+            /* Do not wait for automatic fall */
+            gameTimer = 0;
+            return moveFigure ();
+        case STATE_game_over:
+            if (bot_games_done >= bot_games)
+            {
+                gameRunning = FALSE;
+                return 0;
+            }
+            return SDLK_RETURN;
+        case STATE_paused:
+        case STATE_select_name:
+        case STATE_set_name:
+            return SDLK_RETURN;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief botDone
+ * Print results.
+ */
+void botDone (void)
+{
+    uint64_t elapsed_us = getTimeUs () - bot_start_us;
+    uint32_t figures = 0;
+    uint8_t i;
+
+    if (!bot_playing)
+    {
+        return;
+    }
+    for (i = 0; i < RECORD_TYPES; i++)
+    {
+        if (bot_stat[i].games)
+        {
+            printf("bot: difficulty %i games %u figures %u avg score %llu longest cascade %u\n",
+                   i + MIN_BLOCK_TYPES, bot_stat[i].games, bot_stat[i].figures,
+                   (unsigned long long) (bot_stat[i].score / bot_stat[i].games),
+                   bot_stat[i].longest_cascade);
+        }
+        figures += bot_stat[i].figures;
+    }
+    printf("bot: %u games %u figures in %llu ms, %.1f figures/s\n",
+           bot_games_done, figures, (unsigned long long) (elapsed_us / 1000),
+           elapsed_us ? figures * 1e6 / elapsed_us : 0.0);
+    bot_playing = FALSE;
+}
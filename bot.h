@@ -0,0 +1,26 @@
+/**
+ * @file        bot.h
+ * @brief       Headless player for training and benchmarks
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-18 21:05:44
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_BOT_H
+#define INCLUDE_BOT_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define BOT_DEFAULT_GAMES       8       /* Games played by --bot */
+#define BOT_MAX_FIGURES         1000    /* Bot gives up the game, all levels are reached */
+
+extern bool_t bot_playing;      /* TRUE: bot plays instead of keyboard (--bot) */
+
+void botInit (uint32_t aGames);
+uint16_t botKey (void);
+void botDone (void);
+
+#endif /* INCLUDE_BOT_H */
@@ -0,0 +1,417 @@
+/**
+ * @file        colstore.c
+ * @brief       Append-only columnar files with compressed columns
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-25 18:41:09
+ * Licence:     GPL
+ *
+ * The writer collects rows in memory and encodes them into one block, which
+ * is appended to the file by the caller. The reader does not depend on SDL,
+ * it is used by tools/sometris_query.c as well.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "colstore.h"
+#include "savefile.h"
+
+#define COLSTORE_MAX_BODY       (8 + COLSTORE_MAX_COLUMNS * (2 + COLSTORE_NAME_LENGTH + COLSTORE_VARINT_MAX \
+                                 + COLSTORE_BLOCK_ROWS * (COLSTORE_VARINT_MAX + 3)))
+
+static uint64_t zigzag (int64_t aValue)
+{
+    return ((uint64_t) aValue << 1) ^ (uint64_t) (aValue >> 63);
+}
+
+static int64_t unzigzag (uint64_t aValue)
+{
+    return (int64_t) (aValue >> 1) ^ -(int64_t) (aValue & 1);
+}
+
+static uint8_t varintSize (uint64_t aValue)
+{
+    uint8_t size = 1;
+
+    while (aValue >= 0x80)
+    {
+        aValue >>= 7;
+        size++;
+    }
+
+    return size;
+}
+
+static uint8_t* putVarint (uint8_t* aBuf, uint64_t aValue)
+{
+    while (aValue >= 0x80)
+    {
+        *aBuf++ = (uint8_t) aValue | 0x80;
+        aValue >>= 7;
+    }
+    *aBuf++ = (uint8_t) aValue;
+
+    return aBuf;
+}
+
+/**
+ * @brief getVarint
+ * @return TRUE: value was read, FALSE: data is truncated or too long.
+ */
+static bool_t getVarint (const uint8_t** aPos, const uint8_t* aEnd, uint64_t* aValue)
+{
+    const uint8_t* p = *aPos;
+    uint64_t value = 0;
+    uint8_t shift = 0;
+
+    do
+    {
+        if (p >= aEnd || shift >= 64)
+        {
+            return FALSE;
+        }
+        value |= (uint64_t) (*p & 0x7F) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+    *aPos = p;
+    *aValue = value;
+
+    return TRUE;
+}
+
+/**
+ * @brief colstoreWriterInit
+ * Start collecting rows.
+ *
+ * @param aNames Names of columns, they shall be kept by the caller.
+ */
+void colstoreWriterInit (colstore_writer_t* aWriter, const char* const* aNames, uint8_t aColumns)
+{
+    aWriter->names = aNames;
+    aWriter->columns = MIN (aColumns, COLSTORE_MAX_COLUMNS);
+    aWriter->rows = 0;
+}
+
+/**
+ * @brief colstoreAppendRow
+ * Add a row, it has a value for every column.
+ *
+ * @return TRUE: block is full, it shall be encoded.
+ */
+bool_t colstoreAppendRow (colstore_writer_t* aWriter, const int64_t* aRow)
+{
+    uint8_t i;
+
+    if (aWriter->rows < COLSTORE_BLOCK_ROWS)
+    {
+        for (i = 0; i < aWriter->columns; i++)
+        {
+            aWriter->values[i][aWriter->rows] = aRow[i];
+        }
+        aWriter->rows++;
+    }
+
+    return aWriter->rows >= COLSTORE_BLOCK_ROWS;
+}
+
+/**
+ * @brief colstoreEncodedSize
+ * @return Size of buffer which is enough for colstoreEncode().
+ */
+uint32_t colstoreEncodedSize (const colstore_writer_t* aWriter)
+{
+    return COLSTORE_HEADER_SIZE + COLSTORE_VARINT_MAX + 1
+            + aWriter->columns * (2 + COLSTORE_NAME_LENGTH + COLSTORE_VARINT_MAX
+                                  + aWriter->rows * COLSTORE_VARINT_MAX);
+}
+
+static uint32_t encodedSize (const int64_t* aValues, uint32_t aRows, colstore_enc_t aEnc)
+{
+    uint32_t size = 0;
+    uint32_t i, run;
+
+    for (i = 0; i < aRows; i += run)
+    {
+        if (aEnc == COLSTORE_ENC_delta)
+        {
+            size += varintSize (zigzag ((uint64_t) aValues[i] - (i ? (uint64_t) aValues[i - 1] : 0)));
+            run = 1;
+        }
+        else
+        {
+            for (run = 1; i + run < aRows && aValues[i + run] == aValues[i]; run++)
+            {
+            }
+            size += varintSize (zigzag (aValues[i])) + varintSize (run);
+        }
+    }
+
+    return size;
+}
+
+static uint8_t* encodeColumn (uint8_t* aBuf, const int64_t* aValues, uint32_t aRows, colstore_enc_t aEnc)
+{
+    uint32_t i, run;
+
+    for (i = 0; i < aRows; i += run)
+    {
+        if (aEnc == COLSTORE_ENC_delta)
+        {
+            aBuf = putVarint (aBuf, zigzag ((uint64_t) aValues[i] - (i ? (uint64_t) aValues[i - 1] : 0)));
+            run = 1;
+        }
+        else
+        {
+            for (run = 1; i + run < aRows && aValues[i + run] == aValues[i]; run++)
+            {
+            }
+            aBuf = putVarint (aBuf, zigzag (aValues[i]));
+            aBuf = putVarint (aBuf, run);
+        }
+    }
+
+    return aBuf;
+}
+
+/**
+ * @brief colstoreEncode
+ * Encode collected rows into a block and start a new one.
+ *
+ * @param aBuf Buffer of colstoreEncodedSize() bytes.
+ * @return Length of block, 0: there was no row.
+ */
+uint32_t colstoreEncode (colstore_writer_t* aWriter, uint8_t* aBuf)
+{
+    uint8_t* body = aBuf + COLSTORE_HEADER_SIZE;
+    uint8_t* p = body;
+    uint32_t sizes[COLSTORE_ENC_size];
+    colstore_enc_t enc;
+    uint8_t name_length;
+    uint8_t i;
+
+    if (!aWriter->rows)
+    {
+        return 0;
+    }
+    p = putVarint (p, aWriter->rows);
+    *p++ = aWriter->columns;
+    for (i = 0; i < aWriter->columns; i++)
+    {
+        name_length = MIN (strlen (aWriter->names[i]), COLSTORE_NAME_LENGTH - 1u);
+        *p++ = name_length;
+        memcpy (p, aWriter->names[i], name_length);
+        p += name_length;
+        for (enc = 0; enc < COLSTORE_ENC_size; enc++)
+        {
+            sizes[enc] = encodedSize (aWriter->values[i], aWriter->rows, enc);
+        }
+        enc = sizes[COLSTORE_ENC_rle] < sizes[COLSTORE_ENC_delta] ? COLSTORE_ENC_rle : COLSTORE_ENC_delta;
+        *p++ = enc;
+        p = putVarint (p, sizes[enc]);
+        p = encodeColumn (p, aWriter->values[i], aWriter->rows, enc);
+    }
+    PUT_LE32 (&aBuf[0], COLSTORE_MAGIC);
+    PUT_LE32 (&aBuf[4], (uint32_t) (p - body));
+    PUT_LE32 (&aBuf[8], crc32c (0, body, p - body));
+    aWriter->rows = 0;
+
+    return p - aBuf;
+}
+
+/**
+ * @brief colstoreReadBlock
+ * Read the next block of a file, its columns are not decoded.
+ *
+ * @return TRUE: block was read. FALSE: end of file, or the rest is damaged
+ *         if aBlock->damaged is set.
+ */
+bool_t colstoreReadBlock (FILE* aFile, colstore_block_t* aBlock)
+{
+    uint8_t header[COLSTORE_HEADER_SIZE];
+    const uint8_t* p;
+    const uint8_t* end;
+    uint64_t value;
+    uint32_t length;
+    uint8_t i, name_length;
+
+    length = fread (header, 1, sizeof (header), aFile);
+    aBlock->damaged = (length != 0);
+    if (length != sizeof (header))
+    {
+        if (aBlock->damaged)
+        {
+            printf("%s: cut block header\n", __FUNCTION__);
+        }
+        return FALSE;
+    }
+    length = GET_LE32 (&header[4]);
+    if (GET_LE32 (&header[0]) != COLSTORE_MAGIC || length > COLSTORE_MAX_BODY)
+    {
+        printf("%s: bad block header\n", __FUNCTION__);
+        return FALSE;
+    }
+    if (length > aBlock->body_size)
+    {
+        free (aBlock->body);
+        aBlock->body = malloc (length);
+        aBlock->body_size = aBlock->body ? length : 0;
+        if (!aBlock->body)
+        {
+            printf("%s: out of memory\n", __FUNCTION__);
+            return FALSE;
+        }
+    }
+    if (fread (aBlock->body, 1, length, aFile) != length
+            || crc32c (0, aBlock->body, length) != GET_LE32 (&header[8]))
+    {
+        /* Last append was cut */
+        printf("%s: damaged block\n", __FUNCTION__);
+        return FALSE;
+    }
+
+    p = aBlock->body;
+    end = p + length;
+    if (!getVarint (&p, end, &value) || value > COLSTORE_BLOCK_ROWS || p >= end)
+    {
+        return FALSE;
+    }
+    aBlock->rows = value;
+    aBlock->columns = *p++;
+    if (aBlock->columns > COLSTORE_MAX_COLUMNS)
+    {
+        return FALSE;
+    }
+    for (i = 0; i < aBlock->columns; i++)
+    {
+        if (p >= end || (name_length = *p++) >= COLSTORE_NAME_LENGTH || end - p < name_length + 1)
+        {
+            return FALSE;
+        }
+        memcpy (aBlock->names[i], p, name_length);
+        aBlock->names[i][name_length] = 0;
+        p += name_length;
+        aBlock->encs[i] = *p++;
+        if (!getVarint (&p, end, &value) || value > (uint64_t) (end - p))
+        {
+            return FALSE;
+        }
+        aBlock->data[i] = p;
+        aBlock->lengths[i] = value;
+        p += value;
+    }
+    aBlock->damaged = FALSE;
+
+    return TRUE;
+}
+
+/**
+ * @brief colstoreRepair
+ * Cut the damaged tail of a file, which is left by an append cut by a
+ * crash. Otherwise the reader would stop there and the blocks appended
+ * later could not be read.
+ *
+ * @return FALSE: file is damaged and it could not be cut.
+ */
+bool_t colstoreRepair (const char* aPath)
+{
+    colstore_block_t block;
+    FILE* file = fopen (aPath, "rb+");
+    long good = 0;
+    bool_t ok = TRUE;
+
+    if (!file)
+    {
+        /* Not created yet */
+        return TRUE;
+    }
+    memset (&block, 0, sizeof (block));
+    while (colstoreReadBlock (file, &block))
+    {
+        good = ftell (file);
+    }
+    if (block.damaged)
+    {
+        printf("%s: %s is cut to %li bytes\n", __FUNCTION__, aPath, good);
+        fflush (file);
+        ok = (ftruncate (fileno (file), good) == 0);
+    }
+    colstoreFreeBlock (&block);
+    fclose (file);
+
+    return ok;
+}
+
+/**
+ * @brief colstoreFindColumn
+ * @return Index of column, -1: block has no such column.
+ */
+int8_t colstoreFindColumn (const colstore_block_t* aBlock, const char* aName)
+{
+    uint8_t i;
+
+    for (i = 0; i < aBlock->columns; i++)
+    {
+        if (!strcmp (aBlock->names[i], aName))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief colstoreDecodeColumn
+ * Decode values of a column.
+ *
+ * @param aValues Buffer of COLSTORE_BLOCK_ROWS values.
+ * @return TRUE: column was decoded.
+ */
+bool_t colstoreDecodeColumn (const colstore_block_t* aBlock, uint8_t aColumn, int64_t* aValues)
+{
+    const uint8_t* p = aBlock->data[aColumn];
+    const uint8_t* end = p + aBlock->lengths[aColumn];
+    uint64_t value, run;
+    int64_t prev = 0;
+    uint32_t i = 0;
+
+    switch (aBlock->encs[aColumn])
+    {
+        case COLSTORE_ENC_delta:
+            for (i = 0; i < aBlock->rows && getVarint (&p, end, &value); i++)
+            {
+                prev = (int64_t) ((uint64_t) prev + (uint64_t) unzigzag (value));
+                aValues[i] = prev;
+            }
+            break;
+        case COLSTORE_ENC_rle:
+            while (i < aBlock->rows && getVarint (&p, end, &value) && getVarint (&p, end, &run)
+                   && run <= aBlock->rows - i)
+            {
+                for (; run; run--)
+                {
+                    aValues[i++] = unzigzag (value);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+
+    return i == aBlock->rows && p == end;
+}
+
+/**
+ * @brief colstoreFreeBlock
+ * Free the buffer of colstoreReadBlock().
+ */
+void colstoreFreeBlock (colstore_block_t* aBlock)
+{
+    free (aBlock->body);
+    aBlock->body = NULL;
+    aBlock->body_size = 0;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file        colstore.h
+ * @brief       Append-only columnar files with compressed columns
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-25 18:41:09
+ * Licence:     GPL
+ *
+ * A file is a sequence of blocks, a block holds up to COLSTORE_BLOCK_ROWS
+ * rows column by column (all fields are little-endian):
+ *
+ *   magic (4) | length of body (4) | CRC32C of body (4) | body
+ *
+ *   body: rows (varint) | columns (1) | column...
+ *   column: name length (1) | name | encoding (1) | data length (varint) | data
+ *
+ * Every value is a signed 64 bit integer. Each column of a block is encoded
+ * by the shorter of:
+ *
+ * - COLSTORE_ENC_delta: zigzag varint of the difference to the previous
+ *   value, for counters and times.
+ * - COLSTORE_ENC_rle: zigzag varint of value and varint of run length, for
+ *   settings which rarely change.
+ *
+ * Blocks are self-describing, so columns can be added. A block which was
+ * cut by a crash fails its CRC, the reader stops there and reports damage;
+ * the writer cuts such a tail by colstoreRepair() before it appends.
+ */
+
+#ifndef INCLUDE_COLSTORE_H
+#define INCLUDE_COLSTORE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "game_common.h"
+
+#define COLSTORE_MAGIC          0x42435453u /* "STCB" */
+#define COLSTORE_HEADER_SIZE    12
+#define COLSTORE_BLOCK_ROWS     512
+#define COLSTORE_MAX_COLUMNS    16
+#define COLSTORE_NAME_LENGTH    16          /* With terminating zero */
+#define COLSTORE_VARINT_MAX     10          /* Bytes of a 64 bit varint */
+
+typedef enum
+{
+    COLSTORE_ENC_delta,
+    COLSTORE_ENC_rle,
+    COLSTORE_ENC_size
+} colstore_enc_t;
+
+/* Rows being collected by the writer */
+typedef struct
+{
+    const char* const* names;   /* Names of columns */
+    uint8_t columns;
+    uint32_t rows;
+    int64_t values[COLSTORE_MAX_COLUMNS][COLSTORE_BLOCK_ROWS];
+} colstore_writer_t;
+
+/* Block read from a file, columns are decoded on demand */
+typedef struct
+{
+    uint8_t* body;              /* Allocated by colstoreReadBlock() */
+    uint32_t body_size;
+    uint32_t rows;
+    uint8_t columns;
+    char names[COLSTORE_MAX_COLUMNS][COLSTORE_NAME_LENGTH];
+    colstore_enc_t encs[COLSTORE_MAX_COLUMNS];
+    const uint8_t* data[COLSTORE_MAX_COLUMNS];
+    uint32_t lengths[COLSTORE_MAX_COLUMNS];
+    bool_t damaged;             /* colstoreReadBlock() stopped at damage, not at end of file */
+} colstore_block_t;
+
+void colstoreWriterInit (colstore_writer_t* aWriter, const char* const* aNames, uint8_t aColumns);
+bool_t colstoreAppendRow (colstore_writer_t* aWriter, const int64_t* aRow);
+uint32_t colstoreEncodedSize (const colstore_writer_t* aWriter);
+uint32_t colstoreEncode (colstore_writer_t* aWriter, uint8_t* aBuf);
+
+bool_t colstoreReadBlock (FILE* aFile, colstore_block_t* aBlock);
+bool_t colstoreRepair (const char* aPath);
+int8_t colstoreFindColumn (const colstore_block_t* aBlock, const char* aName);
+bool_t colstoreDecodeColumn (const colstore_block_t* aBlock, uint8_t aColumn, int64_t* aValues);
+void colstoreFreeBlock (colstore_block_t* aBlock);
+
+#endif /* INCLUDE_COLSTORE_H */
@@ -56,7 +56,7 @@
 
 #define MAX_RECORD_NUM      10
 #define PLAYER_NAME_LENGTH  9
-#define MAX_PLAYERS         12
+#define MAX_PLAYERS         12  /* Name slots of old configuration */
 
 #define FSYS_FILENAME_MAX   255 // FIXME inherited from dingoo
 #define OS_TICKS_PER_SEC    1000
@@ -89,15 +89,14 @@ typedef struct
     uint8_t volume;         /* Range: VOLUME_MIN..VOLUME_MAX */
     bool_t music_paused;    /* Range: TRUE/FALSE */
     uint32_t game_counter;  /* To count played games */
-    uint8_t player_idx;
-    char player_names[MAX_PLAYERS][PLAYER_NAME_LENGTH];
-    record_t records[RECORD_TYPES][MAX_RECORD_NUM];
+    char player_name[PLAYER_NAME_LENGTH];   /* Selected player, see players.h */
     char music_file_path[FSYS_FILENAME_MAX];
 } config_t;
 
 /* Game related */
 extern uint32_t     gameTimer;      /* Game timer (automatic shift down of figure) */
 extern bool_t       gameRunning;    /* TRUE: game is running, FALSE: game shall exit! */
+extern uint32_t     loop_delay_us;  /* Sleep of game loop in microseconds (--loop-delay-us) */
 extern main_state_machine_t main_state_machine; /* Game state machine. @see handleMainStateMachine */
 
 /* Random related */
@@ -107,19 +106,14 @@ extern uint16_t     key_delta_ridx; /**< Read index for key_delta */
 
 /* Music playing */
 extern bool_t       music_initted;
-extern bool_t       playlist_loaded;
-extern uint32_t     playlist_file_cntr;
-extern uint32_t     playlist_file_pos;
-//extern char         musicFileName[16];
-//extern char         musicFilePath[FSYS_FILENAME_MAX];
 
 extern config_t     config; /* Actual configuration. */
+extern uint32_t     last_record_rank; /* Rank of last inserted record, 0: best */
 
 uint8_t myrand (void);
 bool_t saveConfig (void);
-char* getNextMusicFile (bool_t *aTurnOver);
-char* getPrevMusicFile (bool_t *aTurnOver);
 void key_task();
+uint64_t getTimeUs (void);
 
 #endif /* _INCLUDE_COMMON_H_ */
 
@@ -0,0 +1,17 @@
+/**
+ * @file        collapse_ref.h
+ * @brief       Reference implementation of collapsing the map
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-21 10:32:18
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_COLLAPSE_REF_H
+#define INCLUDE_COLLAPSE_REF_H
+
+#include <stdint.h>
+
+uint8_t collapseMapReference (void);
+
+#endif /* INCLUDE_COLLAPSE_REF_H */
@@ -0,0 +1,602 @@
+/**
+ * @file        fuzz_collapse.c
+ * @brief       Differential fuzzer of collapseMap() and its reference
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-21 11:05:52
+ * Licence:     GPL
+ *
+ * Usage: fuzz_collapse [-n runs] [-s seed] [-o dir] [input...]
+ *
+ * An input is a board and a sequence of figures. The board is collapsed,
+ * then the figures are dropped one by one and the map is collapsed after
+ * each of them, like in the game. Every collapse is done by collapseMap()
+ * and by collapseMapReference() from the same state and the results shall
+ * be the same: cascade, selected blocks and pitch of every round, final
+ * map and score.
+ *
+ * A failing board is shrunk: blocks are removed while the difference
+ * remains. It is written to the benchmark corpus (-o, default
+ * bench/corpus), so it is fuzzed and measured by make fuzz and make bench.
+ *
+ * Inputs are read from files (raw input or board in .map format of
+ * bench_rules), from stdin if there is no argument (AFL), or -n random
+ * inputs are generated. With FUZZ_LIBFUZZER defined there is no main(),
+ * but LLVMFuzzerTestOneInput(): clang -fsanitize=fuzzer.
+ *
+ * Format of raw input:
+ * - byte 0: number of block types, byte 1: level
+ * - MAP_SIZE_X * MAP_SIZE_Y bytes: cells row by row, missing cells are empty
+ * - 2 bytes per figure: column (bit 7: vertical) and blocks
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "game_common.h"
+#include "game_gfx.h"
+#include "sfx.h"
+#include "collapse_ref.h"
+
+#define FUZZ_MAX_ROUNDS     64      /* 3 blocks are removed at least in a round */
+#define FUZZ_MAX_FIGURES    64
+#define FUZZ_BOARD_OFFSET   2
+#define FUZZ_FIGURE_OFFSET  (FUZZ_BOARD_OFFSET + MAP_SIZE_X * MAP_SIZE_Y)
+#define FUZZ_INPUT_SIZE     (FUZZ_FIGURE_OFFSET + 2 * FUZZ_MAX_FIGURES)
+#define FUZZ_DEFAULT_DIR    "bench/corpus"
+#define FUZZ_PATH_LENGTH    256
+
+typedef struct
+{
+    uint8_t pitch;
+    uint8_t map[MAP_SIZE_Y][MAP_SIZE_X];    /* Selected blocks have 0x80 */
+} fuzz_round_t;
+
+typedef struct
+{
+    uint8_t cascade;
+    uint32_t rounds;
+    fuzz_round_t round[FUZZ_MAX_ROUNDS];
+    game_t game;                            /* After collapse */
+} fuzz_result_t;
+
+static fuzz_result_t    fuzz_ref;
+static fuzz_result_t    fuzz_opt;
+static fuzz_result_t*   fuzz_result = &fuzz_ref;   /* Rounds are recorded here */
+static uint8_t          fuzz_pitch;
+static const char*      fuzz_dir = FUZZ_DEFAULT_DIR;
+static uint32_t         fuzz_collapses = 0;
+static uint64_t         fuzz_rounds = 0;
+static uint8_t          fuzz_longest_cascade = 0;
+
+/* Drawing and sound record the rounds of collapse */
+void blinkMap (uint8_t blinkNum)
+{
+    fuzz_round_t* round;
+
+    (void) blinkNum;
+    if (fuzz_result->rounds < FUZZ_MAX_ROUNDS)
+    {
+        round = &fuzz_result->round[fuzz_result->rounds];
+        round->pitch = fuzz_pitch;
+        memcpy (round->map, game.map, sizeof (round->map));
+    }
+    fuzz_result->rounds++;
+}
+
+void drawMap (void)
+{
+}
+
+void sfxPlay (sfx_id_t aId, uint8_t aPitch)
+{
+    if (aId == SFX_CLEAR)
+    {
+        fuzz_pitch = aPitch;
+    }
+}
+
+static void printMap (const char* aTitle, uint8_t aMap[MAP_SIZE_Y][MAP_SIZE_X])
+{
+    uint8_t x, y;
+
+    printf("%s ('*': selected)\n", aTitle);
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        printf("    ");
+        for (x = 0; x < MAP_SIZE_X; x++)
+        {
+            if (aMap[y][x] & 0x80)
+            {
+                printf("*");
+            }
+            else
+            {
+                printf("%c", aMap[y][x] ? '0' + aMap[y][x] : '.');
+            }
+        }
+        printf("\n");
+    }
+}
+
+/**
+ * @brief runEngine
+ * Collapse the map of aStart by aEngine and record the result.
+ */
+static void runEngine (uint8_t (*aEngine) (void), const game_t* aStart, fuzz_result_t* aResult)
+{
+    game = *aStart;
+    fuzz_result = aResult;
+    aResult->rounds = 0;
+    aResult->cascade = aEngine ();
+    aResult->game = game;
+}
+
+/**
+ * @brief compareResults
+ * @return TRUE: collapseMap() and collapseMapReference() did the same.
+ */
+static bool_t compareResults (bool_t aVerbose)
+{
+    uint32_t i;
+
+    if (fuzz_ref.cascade != fuzz_opt.cascade || fuzz_ref.rounds != fuzz_opt.rounds)
+    {
+        if (aVerbose)
+        {
+            printf("cascade: reference %u (%u rounds), optimized %u (%u rounds)\n",
+                   fuzz_ref.cascade, fuzz_ref.rounds, fuzz_opt.cascade, fuzz_opt.rounds);
+        }
+        return FALSE;
+    }
+    for (i = 0; i < fuzz_ref.rounds && i < FUZZ_MAX_ROUNDS; i++)
+    {
+        if (memcmp (fuzz_ref.round[i].map, fuzz_opt.round[i].map, sizeof (fuzz_ref.round[i].map)))
+        {
+            if (aVerbose)
+            {
+                printf("round %u: selected blocks differ\n", i + 1);
+                printMap ("reference", fuzz_ref.round[i].map);
+                printMap ("optimized", fuzz_opt.round[i].map);
+            }
+            return FALSE;
+        }
+        if (fuzz_ref.round[i].pitch != fuzz_opt.round[i].pitch)
+        {
+            if (aVerbose)
+            {
+                printf("round %u: pitch: reference %u, optimized %u\n", i + 1,
+                       fuzz_ref.round[i].pitch, fuzz_opt.round[i].pitch);
+            }
+            return FALSE;
+        }
+    }
+    if (memcmp (fuzz_ref.game.map, fuzz_opt.game.map, sizeof (fuzz_ref.game.map)))
+    {
+        if (aVerbose)
+        {
+            printf("final map differs\n");
+            printMap ("reference", fuzz_ref.game.map);
+            printMap ("optimized", fuzz_opt.game.map);
+        }
+        return FALSE;
+    }
+    if (fuzz_ref.game.score != fuzz_opt.game.score)
+    {
+        if (aVerbose)
+        {
+            printf("score: reference %u, optimized %u\n", fuzz_ref.game.score, fuzz_opt.game.score);
+        }
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief checkCollapse
+ * Collapse the map of aStart by both engines.
+ *
+ * @return TRUE: results are the same, fuzz_ref.game is the state after.
+ */
+static bool_t checkCollapse (const game_t* aStart, bool_t aVerbose)
+{
+    runEngine (collapseMapReference, aStart, &fuzz_ref);
+    runEngine (collapseMap, aStart, &fuzz_opt);
+
+    return compareResults (aVerbose);
+}
+
+/**
+ * @brief writeBoard
+ * Write board to the corpus in the format of bench_rules.
+ */
+static void writeBoard (const game_t* aStart)
+{
+    char path[FUZZ_PATH_LENGTH];
+    uint32_t hash = 2166136261u;
+    FILE* f;
+    uint8_t x, y;
+
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        for (x = 0; x < MAP_SIZE_X; x++)
+        {
+            hash = (hash ^ aStart->map[y][x]) * 16777619u;
+        }
+    }
+    snprintf (path, sizeof (path), "%s/fuzz-%08x.map", fuzz_dir, hash);
+    f = fopen (path, "w");
+    if (!f)
+    {
+        fprintf (stderr, "%s: cannot write %s\n", __FUNCTION__, path);
+        return;
+    }
+    fprintf (f, "# Found by fuzz_collapse: collapseMap() differs from collapseMapReference()\n");
+    fprintf (f, "# level %u\n", aStart->level);
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        for (x = 0; x < MAP_SIZE_X; x++)
+        {
+            fputc (aStart->map[y][x] ? '0' + aStart->map[y][x] : '.', f);
+        }
+        fputc ('\n', f);
+    }
+    fclose (f);
+    printf("shrunk board is written to %s\n", path);
+}
+
+/**
+ * @brief reportFailure
+ * Print the difference, shrink the board and write it to the corpus.
+ */
+static void reportFailure (const game_t* aStart)
+{
+    game_t start = *aStart;
+    uint8_t block;
+    uint8_t x, y;
+    bool_t shrunk;
+
+    printf("fuzz_collapse: collapseMap() differs from collapseMapReference()\n");
+    printMap ("board", start.map);
+    checkCollapse (&start, TRUE);
+
+    start.level = 1;
+    if (checkCollapse (&start, FALSE))
+    {
+        start.level = aStart->level;
+    }
+    do
+    {
+        shrunk = FALSE;
+        for (y = 0; y < MAP_SIZE_Y; y++)
+        {
+            for (x = 0; x < MAP_SIZE_X; x++)
+            {
+                block = start.map[y][x];
+                if (block)
+                {
+                    start.map[y][x] = 0;
+                    if (checkCollapse (&start, FALSE))
+                    {
+                        start.map[y][x] = block;
+                    }
+                    else
+                    {
+                        shrunk = TRUE;
+                    }
+                }
+            }
+        }
+    } while (shrunk);
+
+    printMap ("shrunk board", start.map);
+    checkCollapse (&start, TRUE);
+    writeBoard (&start);
+}
+
+/**
+ * @brief fuzzBoard
+ * @return TRUE: collapse of the board is the same by both engines.
+ */
+static bool_t fuzzBoard (game_t* aGame)
+{
+    if (!checkCollapse (aGame, FALSE))
+    {
+        reportFailure (aGame);
+        return FALSE;
+    }
+    *aGame = fuzz_ref.game;
+    fuzz_collapses++;
+    fuzz_rounds += fuzz_ref.rounds;
+    if (fuzz_ref.cascade > fuzz_longest_cascade)
+    {
+        fuzz_longest_cascade = fuzz_ref.cascade;
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief dropFigure
+ * Drop a figure to the map of aGame.
+ *
+ * @return TRUE: figure was dropped, FALSE: no room for figure.
+ */
+static bool_t dropFigure (game_t* aGame, uint8_t aPlace, uint8_t aBlocks)
+{
+    uint8_t i;
+
+    game = *aGame;
+    game.figure_is_vertical = (aPlace & 0x80) != 0;
+    game.figure_x = (aPlace & 0x7F) % MAP_SIZE_X;
+    game.figure_y = 0;
+    if (!game.figure_is_vertical && game.figure_x > MAP_SIZE_X - FIGURE_SIZE)
+    {
+        game.figure_x = MAP_SIZE_X - FIGURE_SIZE;
+    }
+    for (i = 0; i < FIGURE_SIZE; i++)
+    {
+        game.figure[i] = 1 + aBlocks % game.block_types;
+        aBlocks /= game.block_types;
+        if ((game.figure_is_vertical && MAP_IS_NOT_EMPTY(game.figure_x, i))
+                || (!game.figure_is_vertical && MAP_IS_NOT_EMPTY(game.figure_x + i, 0)))
+        {
+            return FALSE;
+        }
+    }
+    while (canMoveFigureDown ())
+    {
+        game.figure_y++;
+    }
+    copyFigureToMap ();
+    *aGame = game;
+
+    return TRUE;
+}
+
+/**
+ * @brief fuzzInput
+ * Collapse the board of input, then drop its figures.
+ *
+ * @return TRUE: no difference was found.
+ */
+static bool_t fuzzInput (const uint8_t* aData, size_t aSize)
+{
+    game_t start;
+    size_t i, cell;
+
+    memset (&start, 0, sizeof (start));
+    start.block_types = MIN_BLOCK_TYPES + (aSize > 0 ? aData[0] : 0) % RECORD_TYPES;
+    start.level = (aSize > 1 && aData[1]) ? aData[1] : 1;
+    for (i = FUZZ_BOARD_OFFSET; i < aSize && i < FUZZ_FIGURE_OFFSET; i++)
+    {
+        cell = i - FUZZ_BOARD_OFFSET;
+        start.map[cell / MAP_SIZE_X][cell % MAP_SIZE_X] = aData[i] % (start.block_types + 1);
+    }
+    if (!fuzzBoard (&start))
+    {
+        return FALSE;
+    }
+    for (i = FUZZ_FIGURE_OFFSET; i + 1 < aSize; i += 2)
+    {
+        if (!dropFigure (&start, aData[i], aData[i + 1]))
+        {
+            break;
+        }
+        if (!fuzzBoard (&start))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+#ifdef FUZZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput (const uint8_t* aData, size_t aSize)
+{
+    if (!fuzzInput (aData, aSize))
+    {
+        abort ();
+    }
+
+    return 0;
+}
+
+#else
+
+static uint32_t fuzz_seed = 1;
+
+/* xorshift32, the same inputs are generated on every platform */
+static uint32_t fuzzRand (void)
+{
+    fuzz_seed ^= fuzz_seed << 13;
+    fuzz_seed ^= fuzz_seed >> 17;
+    fuzz_seed ^= fuzz_seed << 5;
+
+    return fuzz_seed;
+}
+
+/**
+ * @brief generateInput
+ * Random board with a random height, some holes and random figures.
+ *
+ * @return Size of input.
+ */
+static size_t generateInput (uint8_t* aData)
+{
+    uint8_t block_types;
+    uint8_t top;
+    uint8_t figures;
+    size_t size;
+    uint8_t x, y;
+
+    aData[0] = fuzzRand ();
+    block_types = MIN_BLOCK_TYPES + aData[0] % RECORD_TYPES;
+    aData[1] = (fuzzRand () % 4) ? 1 : fuzzRand ();
+    top = fuzzRand () % (MAP_SIZE_Y + 1);
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        for (x = 0; x < MAP_SIZE_X; x++)
+        {
+            aData[FUZZ_BOARD_OFFSET + y * MAP_SIZE_X + x] =
+                (y < top || fuzzRand () % 8 == 0) ? 0 : 1 + fuzzRand () % block_types;
+        }
+    }
+    figures = fuzzRand () % (FUZZ_MAX_FIGURES + 1);
+    size = FUZZ_FIGURE_OFFSET;
+    while (figures--)
+    {
+        aData[size++] = fuzzRand ();
+        aData[size++] = fuzzRand ();
+    }
+
+    return size;
+}
+
+/**
+ * @brief fuzzMapFile
+ * Collapse a board of the benchmark corpus.
+ *
+ * @return TRUE: no difference was found.
+ */
+static bool_t fuzzMapFile (const char* aPath)
+{
+    char line[128];
+    game_t start;
+    FILE* f;
+    unsigned level;
+    uint8_t x, y = 0;
+
+    f = fopen (aPath, "r");
+    if (!f)
+    {
+        fprintf (stderr, "%s: cannot open %s\n", __FUNCTION__, aPath);
+        return FALSE;
+    }
+    memset (&start, 0, sizeof (start));
+    start.block_types = MAX_BLOCK_TYPES;
+    start.level = 1;
+    while (y < MAP_SIZE_Y && fgets (line, sizeof (line), f))
+    {
+        if (sscanf (line, "# level %u", &level) == 1)
+        {
+            start.level = level;
+        }
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+        {
+            continue;
+        }
+        for (x = 0; x < MAP_SIZE_X && line[x] >= '.'; x++)
+        {
+            start.map[y][x] = (line[x] >= '1' && line[x] <= '0' + MAX_BLOCK_TYPES) ? line[x] - '0' : 0;
+        }
+        y++;
+    }
+    fclose (f);
+
+    return fuzzBoard (&start);
+}
+
+/**
+ * @brief fuzzFile
+ * @return TRUE: no difference was found.
+ */
+static bool_t fuzzFile (const char* aPath)
+{
+    uint8_t data[FUZZ_INPUT_SIZE];
+    const char* ext = strrchr (aPath, '.');
+    size_t size;
+    FILE* f;
+
+    if (ext && !strcmp (ext, ".map"))
+    {
+        return fuzzMapFile (aPath);
+    }
+    f = fopen (aPath, "rb");
+    if (!f)
+    {
+        fprintf (stderr, "%s: cannot open %s\n", __FUNCTION__, aPath);
+        return FALSE;
+    }
+    size = fread (data, 1, sizeof (data), f);
+    fclose (f);
+
+    return fuzzInput (data, size);
+}
+
+int main (int argc, char* argv[])
+{
+    uint8_t data[FUZZ_INPUT_SIZE];
+    uint32_t runs = 0;
+    uint32_t inputs = 0;
+    uint32_t i;
+    size_t size;
+    bool_t ok = TRUE;
+    int arg;
+
+    for (arg = 1; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+    {
+        if (!strcmp (argv[arg], "-n"))
+        {
+            runs = strtoul (argv[arg + 1], NULL, 0);
+        }
+        else if (!strcmp (argv[arg], "-s"))
+        {
+            fuzz_seed = strtoul (argv[arg + 1], NULL, 0);
+            if (!fuzz_seed)
+            {
+                fuzz_seed = time (NULL);
+            }
+        }
+        else if (!strcmp (argv[arg], "-o"))
+        {
+            fuzz_dir = argv[arg + 1];
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (arg < argc && argv[arg][0] == '-')
+    {
+        fprintf (stderr, "Usage: %s [-n runs] [-s seed (0: time)] [-o dir] [input...]\n", argv[0]);
+        return 1;
+    }
+
+    if (arg == argc && !runs)
+    {
+        /* AFL gives input on stdin, a difference is a crash */
+        size = fread (data, 1, sizeof (data), stdin);
+        if (!fuzzInput (data, size))
+        {
+            abort ();
+        }
+        return 0;
+    }
+
+    printf("fuzz_collapse: seed %u\n", fuzz_seed);
+    for (; ok && arg < argc; arg++)
+    {
+        ok = fuzzFile (argv[arg]);
+        inputs++;
+    }
+    for (i = 0; ok && i < runs; i++)
+    {
+        size = generateInput (data);
+        ok = fuzzInput (data, size);
+        inputs++;
+    }
+    printf("fuzz_collapse: %u inputs, %u collapses, %llu rounds, longest cascade %u: %s\n",
+           inputs, fuzz_collapses, (unsigned long long) fuzz_rounds, fuzz_longest_cascade,
+           ok ? "same" : "DIFFERENT");
+
+    return ok ? 0 : 1;
+}
+
+#endif /* FUZZ_LIBFUZZER */
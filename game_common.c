@@ -10,10 +10,19 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#ifdef DEBUG
+#include <stdio.h>
+#endif
 
 #include "game_common.h"
 #include "game_gfx.h"
+#include "sfx.h"
+#include "trace.h"
 
+#ifdef GAME_SESSION
+__thread game_context_t* game_context = NULL;
+#else
 game_t game =
 {
     .version = 1,
@@ -48,6 +57,30 @@ game_t game =
     .block_types = (MIN_BLOCK_TYPES + MAX_BLOCK_TYPES) / 2, /* Game difficulty */
     .level = 1
 };
+#endif
+
+/* Line of map where collapseMap() searches same blocks */
+typedef struct
+{
+    uint8_t x;          /* First cell */
+    uint8_t y;
+    int8_t dx;          /* Step to next cell */
+    int8_t dy;
+    uint8_t length;
+    uint8_t bottom;     /* Lowest row of cells */
+    uint16_t columns;   /* Columns of cells, bit 0: column 0 */
+    uint8_t factor;     /* Score multiplier */
+    bool_t closed;      /* FALSE: same blocks at end of line are not removed */
+} collapse_line_t;
+
+#define COLLAPSE_LINES  (MAP_SIZE_X + MAP_SIZE_Y + 2 * (MAP_SIZE_X + MAP_SIZE_Y))
+
+#ifndef GAME_SESSION
+collapse_stat_t collapse_stat;
+#endif
+
+static collapse_line_t collapse_lines[COLLAPSE_LINES];
+static uint8_t collapse_line_cntr = 0;
 
 /**
  * Clear map.
@@ -295,9 +328,10 @@ void generateFigure (void)
 
     game.figure_counter++;
 
-    if ((game.figure_counter % 250) == 0 && (game.level < 6))
+    if ((game.figure_counter % 250) == 0 && (game.level < MAX_LEVEL))
     {
         game.level++;
+        sfxPlay (SFX_LEVEL_UP, 0);
     }
 }
 
@@ -326,6 +360,25 @@ void copyFigureToMap (void)
     }
 }
 
+/**
+ * @brief shiftDownColumn
+ * Remove one block from map and move down the remaining blocks of column.
+ *
+ * @param x0 Coordinate X of block that shall be removed.
+ * @param y0 Coordinate Y of block that shall be removed.
+ */
+void shiftDownColumn (uint8_t x0, uint8_t y0)
+{
+    uint8_t y;
+
+    for (y = y0; y > 0; y--)
+    {
+        uint8_t block = MAP(x0, y - 1);
+        MAPW(x0, y) = block;
+    }
+    MAPW(x0, 0) = 0;
+}
+
 /**
  * Increase score.
  */
@@ -338,321 +391,318 @@ void incScore (uint8_t same_cntr, uint8_t factor)
 }
 
 /**
- * Search same blocks in a row/column/diagonal and remove them.
+ * @brief initCollapseLine
+ * Add a line of map to the table of collapseMap().
+ *
+ * @param x0 First cell of line.
+ * @param y0 First cell of line.
+ * @param dx Step of X: 0: column, 1: row or diagonal.
+ * @param dy Step of Y: 0: row, 1: column or falling diagonal, -1: rising diagonal.
+ * @param factor Score multiplier of matches in the line.
+ */
+static void initCollapseLine (uint8_t x0, uint8_t y0, int8_t dx, int8_t dy, uint8_t factor)
+{
+    collapse_line_t* line = &collapse_lines[collapse_line_cntr];
+    int8_t x = x0, y = y0;
+
+    line->x = x0;
+    line->y = y0;
+    line->dx = dx;
+    line->dy = dy;
+    line->factor = factor;
+    line->length = 0;
+    line->bottom = y0;
+    line->columns = 0;
+    while (x >= 0 && x < MAP_SIZE_X && y >= 0 && y < MAP_SIZE_Y)
+    {
+        line->length++;
+        line->bottom = MAX (line->bottom, y);
+        line->columns |= 1u << x;
+        x += dx;
+        y += dy;
+    }
+    /* Rising diagonals were never followed to the top row */
+    line->closed = (dy >= 0 || y - dy > 0);
+    if (line->length >= SAME_BLOCK_NUM)
+    {
+        collapse_line_cntr++;
+    }
+}
+
+/**
+ * @brief initCollapseLines
+ * Lines are in the order of scanning of the original implementation, because
+ * score depends on the order of matches. Diagonals from the left corners
+ * are scanned twice as they were.
+ * collapseMap() calls it first time, threads of the game server share the
+ * lines, so the server calls it before they are started.
  */
-void collapseMap (void)
+void initCollapseLines (void)
 {
     uint8_t x, y;
-    const uint8_t start_x = 0, start_y = 0;
-    const uint8_t end_x = MAP_SIZE_X, end_y = MAP_SIZE_Y;
-    uint8_t x1, y1;
-    uint8_t x2, y2;
-    uint8_t same_cntr = 0;
-    uint8_t same_start_x = 0;
-    uint8_t same_start_y = 0;
-    bool_t collapsed;
-    uint8_t round = 0;
 
-    do
+    collapse_line_cntr = 0;
+    /* VERTICAL, Fuggoleges */
+    for (x = 0; x < MAP_SIZE_X; x++)
+    {
+        initCollapseLine (x, 0, 0, 1, SAME_BLOCK_VERT_FACTOR);
+    }
+    /* HORIZONTAL, Vizszintes */
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        initCollapseLine (0, y, 1, 0, SAME_BLOCK_HORIZ_FACTOR);
+    }
+    /* DIAGONAL on Y, Atlos Y */
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        initCollapseLine (0, y, 1, 1, SAME_BLOCK_DIAG_FACTOR);
+        initCollapseLine (0, y, 1, -1, SAME_BLOCK_DIAG_FACTOR);
+    }
+    /* DIAGONAL on X, Atlos X */
+    for (x = 0; x < MAP_SIZE_X; x++)
+    {
+        initCollapseLine (x, 0, 1, 1, SAME_BLOCK_DIAG_FACTOR);
+        initCollapseLine (x, MAP_SIZE_Y - 1, 1, -1, SAME_BLOCK_DIAG_FACTOR);
+    }
+}
+
+/**
+ * @brief selectSame
+ * Score same blocks of a line and select them for remove.
+ *
+ * @param line Line of same blocks.
+ * @param start Index of first same block in line.
+ * @param same_cntr Number of same blocks.
+ * @param round Number of matches before, it is increased.
+ * @param lowest Lowest selected row of columns, it is updated.
+ */
+static void selectSame (const collapse_line_t* line, uint8_t start, uint8_t same_cntr,
+                        uint8_t* round, int8_t* lowest)
+{
+    uint8_t x = line->x + start * line->dx;
+    uint8_t y = line->y + start * line->dy;
+    uint8_t i;
+
+    (*round)++;
+    incScore (same_cntr, line->factor * *round);
+    for (i = 0; i < same_cntr; i++, x += line->dx, y += line->dy)
     {
-        /* VERTICAL, Fuggoleges */
-        collapsed = FALSE;
-        for (x = start_x; x < end_x; x++)
-        {
-            same_cntr = 0;
-            for (y = start_y; y < end_y; y++)
-            {
-                if (MAP_IS_NOT_EMPTY(x, y))
-                {
-                    if ((y < end_y - 1) && (MAP(x, y) == MAP(x, y + 1)))
-                    {
-                        if (!same_cntr)
-                        {
-                            same_start_y = y;
-                            same_cntr = 2;
-                        }
-                        else
-                        {
-                            same_cntr++;
-                        }
-                    }
-                    else
-                    {
-                        if (same_cntr >= SAME_BLOCK_NUM)
-                        {
-                            round++;
-                            incScore (same_cntr, SAME_BLOCK_VERT_FACTOR * round);
-                            for (y2 = same_start_y; y2 <= y; y2++)
-                            {
-#ifdef DEBUG
-                                printf("VERTICAL shift down x:%i y:%i\r\n", x, y2);
-#endif
-                                MAP_SELECT(x, y2);
-                            }
 #ifdef DEBUG
-                            drawMap();
+        printf("select x:%i y:%i\r\n", x, y);
 #endif
-                            collapsed = TRUE;
-                        }
-                        same_cntr = 0;
-                    }
-                }
-                else
-                {
-                    same_cntr = 0;
-                }
-            }
-        }
-        /* HORIZONTAL, Vizszintes */
-        for (y = start_y; y < end_y; y++)
+        MAP_SELECT(x, y);
+        if ((int8_t) y > lowest[x])
         {
-            same_cntr = 0;
-            for (x = start_x; x < end_x; x++)
-            {
-                if (MAP_IS_NOT_EMPTY(x, y))
-                {
-                    if ((x < end_x - 1) && (MAP(x, y) == MAP(x + 1, y)))
-                    {
-                        if (!same_cntr)
-                        {
-                            same_start_x = x;
-                            same_cntr = 2;
-                        }
-                        else
-                        {
-                            same_cntr++;
-                        }
-                    }
-                    else
-                    {
-                        if (same_cntr >= SAME_BLOCK_NUM)
-                        {
-                            round++;
-                            incScore (same_cntr, SAME_BLOCK_HORIZ_FACTOR * round);
-                            for (x2 = same_start_x; x2 <= x; x2++)
-                            {
+            lowest[x] = y;
+        }
+    }
 #ifdef DEBUG
-                                printf("HORIZONTAL shift down x:%i y:%i\r\n", x2, y);
+    drawMap();
 #endif
-                                MAP_SELECT(x2, y);
-                            }
-#ifdef DEBUG
-                            drawMap();
+}
+
+/**
+ * @brief scanLine
+ * Search same blocks in a line. Blocks are read once, by stepping in
+ * game.map instead of MAP().
+ *
+ * @return TRUE: same blocks were found.
+ */
+static bool_t scanLine (const collapse_line_t* line, uint8_t* round, int8_t* lowest)
+{
+    const uint8_t* cell = &game.map[line->y][line->x];
+    const int8_t step = line->dy * MAP_SIZE_X + line->dx;
+    const uint8_t length = line->length;
+    uint8_t i;
+    uint8_t block, prev = 0;
+    uint8_t same_cntr = 0;
+    uint8_t same_start = 0;
+    bool_t found = FALSE;
+
+#ifdef RULES_STATS
+    rules_cells_scanned += length;
 #endif
-                            collapsed = TRUE;
-                        }
-                        same_cntr = 0;
-                    }
-                }
-                else
-                {
-                    same_cntr = 0;
-                }
-            }
+    collapse_stat.cells += length;
+    for (i = 0; i < length; i++, cell += step)
+    {
+        block = *cell & 0x7F;
+        if (block && block == prev)
+        {
+            same_cntr++;
         }
-        /********* DIAGONAL *********/
-        for (y = start_y; y < end_y; y++)
+        else
         {
-            same_cntr = 0;
-            /* DIAGONAL RIGHT on Y, Atlos jobbra lejt Y */
-            for (x = start_x, y1 = y; x < end_x && y1 < end_y; x++, y1++)
+            if (same_cntr >= SAME_BLOCK_NUM)
             {
-                if (MAP_IS_NOT_EMPTY(x, y1))
-                {
-                    if ((x < end_x - 1) && (y1 < end_y - 1)
-                            && MAP(x, y1) == MAP(x + 1, y1 + 1))
-                    {
-                        if (!same_cntr)
-                        {
-                            same_start_x = x;
-                            same_start_y = y1;
-                            same_cntr = 2;
-                        }
-                        else
-                        {
-                            same_cntr++;
-                        }
-                    }
-                    else
-                    {
-                        if (same_cntr >= SAME_BLOCK_NUM)
-                        {
-                            round++;
-                            incScore (same_cntr, SAME_BLOCK_DIAG_FACTOR * round);
-                            for (x2 = same_start_x, y2 = same_start_y; x2 <= x && y2 <= y1; x2++, y2++)
-                            {
-#ifdef DEBUG
-                                printf("DIAGONAL RIGHT Y shift down x:%i y:%i\r\n", x2, y2);
-#endif
-                                MAP_SELECT(x2, y2);
-                            }
-#ifdef DEBUG
-                            drawMap();
-#endif
-                            collapsed = TRUE;
-                        }
-                        same_cntr = 0;
-                    }
-                }
-                else
-                {
-                    same_cntr = 0;
-                }
+                selectSame (line, same_start, same_cntr, round, lowest);
+                found = TRUE;
             }
-            /* DIAGONAL LEFT on Y, Atlos balra lejt Y */
-            for (x = start_x, y1 = y; x < end_x && y1 > 0; x++, y1--)
+            same_start = i;
+            same_cntr = 1;
+        }
+        prev = block;
+    }
+    if (line->closed && same_cntr >= SAME_BLOCK_NUM)
+    {
+        selectSame (line, same_start, same_cntr, round, lowest);
+        found = TRUE;
+    }
+
+    return found;
+}
+
+/**
+ * @brief isLineChanged
+ * @param columns Changed columns, bit 0: column 0.
+ * @param lowest Lowest changed row of columns.
+ * @return TRUE: a block of line was moved.
+ */
+static bool_t isLineChanged (const collapse_line_t* line, uint16_t columns, const int8_t* lowest)
+{
+    uint16_t mask = line->columns & columns;
+    uint8_t x;
+
+    while (mask)
+    {
+        x = __builtin_ctz (mask);
+        /* Row of line in column x, the top of column if line is vertical */
+        if (line->y + (x - line->x) * line->dy <= lowest[x])
+        {
+            return TRUE;
+        }
+        mask &= mask - 1;
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief removeSelected
+ * Remove selected blocks, the blocks above them fall down. Same as
+ * shiftDownColumn() for every selected block, but columns are moved once.
+ *
+ * @param lowest Lowest selected row of columns, -1: nothing to remove.
+ */
+static void removeSelected (const int8_t* lowest)
+{
+    uint8_t x;
+    int8_t y, to;
+    uint8_t block;
+
+    for (x = 0; x < MAP_SIZE_X; x++)
+    {
+        to = lowest[x];
+        collapse_stat.cells += to + 1;
+        for (y = lowest[x]; y >= 0; y--)
+        {
+            block = MAP_READ(x, y);
+            if (!(block & 0x80))
             {
-                if (MAP_IS_NOT_EMPTY(x, y1))
-                {
-                    if ((x < end_x - 1) && MAP(x, y1) == MAP(x + 1, y1 - 1))
-                    {
-                        if (!same_cntr)
-                        {
-                            same_start_x = x;
-                            same_start_y = y1;
-                            same_cntr = 2;
-                        }
-                        else
-                        {
-                            same_cntr++;
-                        }
-                    }
-                    else
-                    {
-                        if (same_cntr >= SAME_BLOCK_NUM)
-                        {
-                            round++;
-                            incScore (same_cntr, SAME_BLOCK_DIAG_FACTOR * round);
-                            for (x2 = same_start_x, y2 = same_start_y; x2 <= x && y2 >= y1; x2++, y2--)
-                            {
-#ifdef DEBUG
-                                printf("DIAGONAL LEFT Y shift down x:%i y:%i\r\n", x2, y2);
-#endif
-                                MAP_SELECT(x2, y2);
-                            }
-#ifdef DEBUG
-                            drawMap();
-#endif
-                            collapsed = TRUE;
-                        }
-                        same_cntr = 0;
-                    }
-                }
-                else
-                {
-                    same_cntr = 0;
-                }
+                MAPW(x, to--) = block;
             }
         }
-        for (x = start_x; x < end_x; x++)
+        for (; to >= 0; to--)
         {
-            same_cntr = 0;
-            /* DIAGONAL RIGHT on X, Atlos jobbra lejt X */
-            for (x1 = x, y = start_y; x1 < end_x && y < end_y; x1++, y++)
-            {
-                if (MAP_IS_NOT_EMPTY(x1, y))
-                {
-                    if ((x1 < end_x - 1) && (y < end_y - 1)
-                            && MAP(x1, y) == MAP(x1 + 1, y + 1))
-                    {
-                        if (!same_cntr)
-                        {
-                            same_start_x = x1;
-                            same_start_y = y;
-                            same_cntr = 2;
-                        }
-                        else
-                        {
-                            same_cntr++;
-                        }
-                    }
-                    else
-                    {
-                        if (same_cntr >= SAME_BLOCK_NUM)
-                        {
-                            round++;
-                            incScore (same_cntr, SAME_BLOCK_DIAG_FACTOR * round);
-                            for (x2 = same_start_x, y2 = same_start_y; x2 <= x1 && y2 <= y; x2++, y2++)
-                            {
-#ifdef DEBUG
-                                printf("DIAGONAL RIGHT X shift down x:%i y:%i\r\n", x2, y2);
-#endif
-                                MAP_SELECT(x2, y2);
-                            }
-#ifdef DEBUG
-                            drawMap();
+            MAPW(x, to) = 0;
+        }
+    }
+}
+
+/**
+ * @brief topRow
+ * Blocks lie on each other, so rows above the first one with a block are
+ * empty.
+ *
+ * @return First row with a block. MAP_SIZE_Y: map is empty.
+ */
+static uint8_t topRow (void)
+{
+    static const uint8_t empty_row[MAP_SIZE_X];
+    uint8_t y;
+
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        if (memcmp (game.map[y], empty_row, MAP_SIZE_X))
+        {
+            break;
+        }
+    }
+#ifdef RULES_STATS
+    rules_cells_scanned += MIN (y + 1, MAP_SIZE_Y) * MAP_SIZE_X;
 #endif
-                            collapsed = TRUE;
-                        }
-                        same_cntr = 0;
-                    }
-                }
-                else
-                {
-                    same_cntr = 0;
-                }
-            }
-            /* DIAGONAL LEFT on X, Atlos balra lejt X */
-            for (x1 = x, y = end_y - 1; x1 < end_x && y > 0; x1++, y--)
+
+    return y;
+}
+
+/**
+ * Search same blocks in a row/column/diagonal and remove them.
+ * Rules are the same as of collapseMapReference() of fuzz/collapse_ref.c,
+ * make fuzz compares them. A line above the top row of blocks is empty and
+ * it is not scanned. A line is scanned again in the next round only if its
+ * blocks were moved: it had no match otherwise.
+ *
+ * @return Number of rounds where blocks were removed (length of cascade).
+ */
+uint8_t collapseMap (void)
+{
+    int8_t lowest[MAP_SIZE_X];
+    int8_t changed[MAP_SIZE_X];
+    uint16_t columns;
+    uint16_t changed_columns;
+    bool_t collapsed;
+    uint8_t round = 0;
+    uint8_t cascade = 0;
+    uint8_t top;
+    uint8_t i;
+
+    if (!collapse_line_cntr)
+    {
+        initCollapseLines ();
+    }
+    /* First round scans all lines */
+    memset (changed, MAP_SIZE_Y, sizeof (changed));
+    changed_columns = (1u << MAP_SIZE_X) - 1;
+    collapse_stat.rounds = 0;
+    collapse_stat.cells = 0;
+    do
+    {
+        TRACE_BEGIN(span);
+
+        collapse_stat.rounds++;
+        collapsed = FALSE;
+        memset (lowest, -1, sizeof (lowest));
+        top = topRow ();
+        for (i = 0; i < collapse_line_cntr; i++)
+        {
+            if (collapse_lines[i].bottom >= top
+                    && isLineChanged (&collapse_lines[i], changed_columns, changed)
+                    && scanLine (&collapse_lines[i], &round, lowest))
             {
-                if (MAP_IS_NOT_EMPTY(x1, y))
-                {
-                    if ((x1 < end_x - 1) && MAP(x1, y) == MAP(x1 + 1, y - 1))
-                    {
-                        if (!same_cntr)
-                        {
-                            same_start_x = x1;
-                            same_start_y = y;
-                            same_cntr = 2;
-                        }
-                        else
-                        {
-                            same_cntr++;
-                        }
-                    }
-                    else
-                    {
-                        if (same_cntr >= SAME_BLOCK_NUM)
-                        {
-                            round++;
-                            incScore (same_cntr, SAME_BLOCK_DIAG_FACTOR * round);
-                            for (x2 = same_start_x, y2 = same_start_y; x2 <= x1 && y2 >= y; x2++, y2--)
-                            {
-#ifdef DEBUG
-                                printf("DIAGONAL LEFT X shift down x:%i y:%i\r\n", x2, y2);
-#endif
-                                MAP_SELECT(x2, y2);
-                            }
-#ifdef DEBUG
-                            drawMap();
-#endif
-                            collapsed = TRUE;
-                        }
-                        same_cntr = 0;
-                    }
-                }
-                else
-                {
-                    same_cntr = 0;
-                }
+                collapsed = TRUE;
             }
         }
         if (collapsed)
         {
+            cascade++;
+            /* Pitch rises with the cascade up to the top of its range */
+            sfxPlay (SFX_CLEAR, MIN ((cascade - 1) * SFX_CASCADE_PITCH, SFX_MAX_PITCH));
             blinkMap (2);
             /* Delete same blocks */
-            for (x = start_x; x < end_x; x++)
+            removeSelected (lowest);
+            memcpy (changed, lowest, sizeof (changed));
+            changed_columns = 0;
+            for (columns = 1, i = 0; i < MAP_SIZE_X; i++, columns <<= 1)
             {
-                for (y = start_y; y < end_y; y++)
+                if (lowest[i] >= 0)
                 {
-                    if (MAP_IS_SELECTED(x, y))
-                    {
-                        shiftDownColumn (x, y);
-                    }
+                    changed_columns |= columns;
                 }
             }
         }
+        TRACE_END_ARG(span, "collapseMap round", "cascade", cascade);
     } while (collapsed);
+
+    return cascade;
 }
 
 /**
@@ -14,9 +14,15 @@
 #define MAP_SIZE_Y              15
 #define MAP_IS_EMPTY(x,y)       (!MAP(x,y))         /* Cell is empty */
 #define MAP_IS_NOT_EMPTY(x,y)   (MAP(x,y))          /* Cell is not empty */
-#define MAP_IS_SELECTED(x,y)    (game.map[y][x] & 0x80)  /* Cell is selected for remove */
+#define MAP_IS_SELECTED(x,y)    (MAP_READ(x,y) & 0x80)   /* Cell is selected for remove */
 #define MAP_SELECT(x,y)         game.map[y][x] |= 0x80   /* Select cell for remove */
-#define MAP(x,y)                (game.map[y][x] & 0x7F)  /* Read map */
+#define MAP(x,y)                (MAP_READ(x,y) & 0x7F)   /* Read map */
+#ifdef RULES_STATS
+/* Reads of map are counted by benchmark, see bench/bench_rules.c */
+#define MAP_READ(x,y)           (rules_cells_scanned++, game.map[y][x])
+#else
+#define MAP_READ(x,y)           (game.map[y][x])
+#endif
 #define MAPW(x,y)               game.map[y][x]           /* Write map */
 
 #define MAX_BLOCK_TYPES         6   /* 0: no block, 1: diamond, 2: filled diamond, ... */
@@ -30,9 +36,15 @@
 #define SAME_BLOCK_DIAG_FACTOR  2   /* Score multiplier */
 
 #define FIGURE_SIZE             3
+#define MAX_LEVEL               6   /* Level grows every 250 figures up to this */
 
 //#define RAND()                  myrand()
+#ifdef GAME_SESSION
+/* Every session of the game server has its own sequence */
+#define RAND()                  rand_r (&game_context->rand_seed)
+#else
 #define RAND()                  rand() /* rand() may ineligible for this game! */
+#endif
 
 #include "common.h"
 
@@ -48,9 +60,36 @@ typedef struct
     uint32_t score;
     uint8_t block_types;
     uint8_t level;
+    uint8_t longest_cascade;    /* Most collapse rounds after one figure */
 } game_t;
 
+/* Work of the last collapseMap() */
+typedef struct
+{
+    uint8_t rounds;             /* Lines were scanned this many times */
+    uint32_t cells;             /* Cells read */
+} collapse_stat_t;
+
+#ifdef GAME_SESSION
+/* Game server: rules are applied to the session of the calling thread, see
+ * server/session.c. Field names differ from the macros below. */
+typedef struct
+{
+    game_t game_state;
+    collapse_stat_t collapse_stat_state;
+    unsigned int rand_seed;     /* State of rand_r() */
+} game_context_t;
+
+extern __thread game_context_t* game_context;
+#define game                    (game_context->game_state)
+#define collapse_stat           (game_context->collapse_stat_state)
+#else
 extern game_t game;
+extern collapse_stat_t collapse_stat;
+#endif
+#ifdef RULES_STATS
+extern uint64_t rules_cells_scanned;
+#endif
 
 void initMap (void);
 bool_t canMoveFigureRight (void);
@@ -62,7 +101,8 @@ void generateFigure (void);
 void copyFigureToMap (void);
 void shiftDownColumn (uint8_t x0, uint8_t y0);
 void incScore (uint8_t same_cntr, uint8_t factor);
-void collapseMap (void);
+void initCollapseLines (void);
+uint8_t collapseMap (void);
 bool_t isGameOver (void);
 
 #endif /* INCLUDE_GAME_H */
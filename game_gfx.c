@@ -19,10 +19,23 @@
 
 #include "game_common.h"
 #include "game_gfx.h"
+#include "leaderboard.h"
+#include "latency.h"
+#include "music.h"
+#include "playlist.h"
+#include "trace.h"
+#include "overlay.h"
+#include "stats.h"
+#include "watchdog.h"
 
 /* Block sprites */
 SDL_Surface * blocks[MAX_BLOCK_TYPES + 1];
 
+uint32_t frame_counter = 0; /* Number of frames shown */
+uint32_t blink_counter = 0; /* Number of blink frames shown */
+uint32_t blink_delay_ms = 200; /* Time of one blink frame (--blink-delay-ms) */
+uint32_t blit_counter = 0; /* Number of blits in the frame being drawn */
+
 SDL_Surface * loadImage(const char* filename)
 {
   SDL_Surface* loadedImage = NULL;
@@ -64,16 +77,27 @@ SDL_Surface * loadImage(const char* filename)
   return optimizedImage;
 }
 
-void loadBlocks()
+/**
+ * @brief loadBlocks
+ * @return FALSE: an image of blocks cannot be loaded.
+ */
+bool_t loadBlocks()
 {
   int i;
   char filename[64];
+  bool_t ok = TRUE;
 
   for ( i = 0; i <= MAX_BLOCK_TYPES; i++)
   {
     snprintf(filename, sizeof(filename), BLOCK_PNG, i);
     blocks[i] = loadImage(filename);
+    if (blocks[i] == NULL)
+    {
+      ok = FALSE;
+    }
   }
+
+  return ok;
 }
 
 void freeBlocks()
@@ -95,12 +119,14 @@ void drawBlock (uint8_t x, uint8_t y, uint8_t shape)
   offset.y = y * BLOCK_SIZE_Y_PX;
 
   // Blit the surface
-  SDL_BlitSurface( blocks[shape], NULL, screen, &offset );
+  gfx_blit( blocks[shape], &offset );
 }
 
 void printCommon (void)
 {
     char s[64];
+    uint32_t found;
+    TRACE_BEGIN(span);
 
     gfx_line_draw (MAP_SIZE_X_PX + 1, 0,
                    MAP_SIZE_X_PX + 1, MAP_SIZE_Y_PX,
@@ -109,9 +135,11 @@ void printCommon (void)
     gfx_font_print(TEXT_X(0), TEXT_YN(0), gameFontNormal, s);
     sprintf (s, "Level: %i", game.level);
     gfx_font_print(TEXT_X(0), TEXT_YN(1), gameFontNormal, s);
-#if 0
     if (music_initted)
     {
+        music_status_t music;
+
+        musicGetStatus (&music);
         gfx_line_draw (MAP_SIZE_X_PX + 1, TEXT_YN(2),
                        screen->w - 1, TEXT_YN(2),
                        gfx_color_rgb (0xFF, 0xFF, 0xFF));
@@ -124,19 +152,26 @@ void printCommon (void)
             sprintf (s, "** MUTED **");
         }
         gfx_font_print(TEXT_X(0), TEXT_YN(2), gameFontNormal, s);
-        if (playlist_loaded)
+        if (music.playing)
         {
-            gfx_font_print(TEXT_X(0), TEXT_YN(3), gameFontNormal, musicFileName);
-//            strncpy (s, mod.songname, 20);
+            gfx_font_print(TEXT_X(0), TEXT_YN(3), gameFontNormal, music.file_name);
+            strncpy (s, music.song_name, 20);
             s[20] = 0;
             gfx_font_print(TEXT_X(0), TEXT_YN(4) + 2, gameFontSmall, s);
-//            sprintf (s, "Pos: %i/%i", mod.play_position + 1, mod.songlength);
+            sprintf (s, "Pos: %i/%i", music.position + 1, music.length);
             gfx_font_print(TEXT_X(0), TEXT_YN(5), gameFontNormal, s);
-            sprintf (s, "File: %i/%i", playlist_file_pos, playlist_file_cntr);
-            gfx_font_print(TEXT_X(0), TEXT_YN(6), gameFontNormal, s);
+            if (music.file_pos)
+            {
+                sprintf (s, "File: %i/%i", music.file_pos, music.file_cntr);
+                gfx_font_print(TEXT_X(0), TEXT_YN(6), gameFontNormal, s);
+            }
         }
     }
-#endif
+    else if (getPlaylistProgress (&found))
+    {
+        sprintf (s, "Music: %u", found);
+        gfx_font_print(TEXT_X(0), TEXT_YN(3), gameFontNormal, s);
+    }
     if (GAME_IS_OVER())
     {
         gfx_font_print (TEXT_X_0, TEXT_YN(8), gameFontNormal, "** GAME **");
@@ -185,32 +220,45 @@ void printCommon (void)
     snprintf (s, sizeof (s), "v%lu.%lu.%lu", VERSION_MAJOR, VERSION_MINOR, VERSION_REVISION);
     gfx_font_print_fromright ((screen->w - 4),
                               (screen->h - FONT_SMALL_SIZE_Y_PX - 4), gameFontSmall, s);
+    TRACE_END(span, "printCommon");
 }
 
 static void drawRecord (uint8_t aBlockType)
 {
     uint8_t i;
+    uint32_t n;
     char s[32];
+    record_t records[MAX_RECORD_NUM];
 
     gfx_font_print (0, TEXT_YN(0), gameFontNormal,
             "Player   Level Score");
     gfx_font_print (0, TEXT_YN(1), gameFontNormal,
             "--------------------");
-    for (i = 0; i < MAX_RECORD_NUM; i++)
+    n = leaderboardGet (aBlockType, 0, MAX_RECORD_NUM, records);
+    /* Every game is in the leaderboard, games without score are not shown */
+    for (i = 0; i < n && records[i].score; i++)
     {
-        snprintf (s, sizeof (s), "%-8s %i   %7i",
-                config.records[RECORD_TYPE(aBlockType)][i].player_name,
-                config.records[RECORD_TYPE(aBlockType)][i].level,
-                config.records[RECORD_TYPE(aBlockType)][i].score
+        snprintf (s, sizeof (s), "%-8s %i   %7u",
+                records[i].player_name,
+                records[i].level,
+                records[i].score
                 );
         gfx_font_print (0, TEXT_YN(i + 2), gameFontNormal, s);
     }
+    if (GAME_IS_OVER() && last_record_rank != LEADERBOARD_NIL)
+    {
+        snprintf (s, sizeof (s), "Rank: %u/%u", last_record_rank + 1,
+                  leaderboardCount (aBlockType));
+        gfx_font_print (0, TEXT_YN(MAX_RECORD_NUM + 3), gameFontNormal, s);
+    }
 }
 
 void drawGameScreen (void)
 {
+    TRACE_BEGIN(span);
+
     // Restore background
-    SDL_BlitSurface( background, NULL, screen, NULL );
+    gfx_blit( background, NULL );
 
     printCommon ();
     if (GAME_IS_PAUSED() || GAME_IS_OVER())
@@ -223,7 +271,8 @@ void drawGameScreen (void)
         drawFigure ();
     }
 
-    SDL_Flip( screen );
+    flipScreen ();
+    TRACE_END(span, "drawGameScreen");
 }
 
 /**
@@ -237,6 +286,7 @@ void blinkMap (uint8_t blinkNum)
     uint8_t i;
     uint8_t x, y;
     SDL_Event event;
+    TRACE_BEGIN(span);
 
     /* Blink same blocks */
     for (i = 0; i < blinkNum * 2 && gameRunning; i++)
@@ -244,7 +294,7 @@ void blinkMap (uint8_t blinkNum)
         key_task();
         if (gameRunning)
         {
-          SDL_BlitSurface( background, NULL, screen, NULL );
+          gfx_blit( background, NULL );
           printCommon ();
 
           for (x = 0; x < MAP_SIZE_X; x++)
@@ -257,10 +307,15 @@ void blinkMap (uint8_t blinkNum)
               }
             }
           }
-          SDL_Flip( screen );
-          SDL_Delay( 200 ); /* 200 ms */
+          flipScreen ();
+          /* Delay is not work of the iteration */
+          watchdogEnd ();
+          SDL_Delay( blink_delay_ms );
+          watchdogBegin ();
+          blink_counter++;
         }
     }
+    TRACE_END(span, "blinkMap");
 }
 
 /**
@@ -334,33 +389,87 @@ void clearFigure (void)
 }
 
 /**
- * @brief shiftDownColumn
- * Remove one block from map and move down the remaining blocks of column.
+ * Prints message in the center of screen.
+ * Note: gameDisplay shall be initialized to use this function!
  *
- * @param x0 Coordinate X of block that shall be removed.
- * @param y0 Coordinate Y of block that shall be removed.
+ * @param aInfo Text to print.
  */
-void shiftDownColumn (uint8_t x0, uint8_t y0)
+void drawInfoScreen (const char* aInfo)
 {
-    uint8_t y;
+    gfx_blit( background, NULL );
+    gfx_font_print_center (screen->h / 2, gameFontNormal, aInfo);
+    flipScreen ();
+}
 
-    for (y = y0; y > 0; y--)
+/**
+ * @brief flipScreen
+ * Show the rendered frame.
+ */
+void flipScreen (void)
+{
+    TRACE_BEGIN(span);
+
+    if (overlay_visible)
+    {
+        overlayDraw ();
+    }
+    SDL_Flip (screen);
+    TRACE_END(span, "SDL_Flip");
+    overlayFrame ();
+    statsFrame ();
+    frame_counter++;
+    if (latency_bench)
     {
-        uint8_t block = MAP(x0, y - 1);
-        MAPW(x0, y) = block;
+        latencyFrame ();
     }
-    MAPW(x0, 0) = 0;
 }
 
 /**
- * Prints message in the center of screen.
- * Note: gameDisplay shall be initialized to use this function!
+ * @brief isBlockOnScreen
+ * Check whether a block is drawn at a map position of the screen.
+ * Transparent pixels of the block are not checked.
  *
- * @param aInfo Text to print.
+ * @return TRUE: pixels of the screen are the same as pixels of the block.
  */
-void drawInfoScreen (const char* aInfo)
+bool_t isBlockOnScreen (uint8_t x, uint8_t y, uint8_t shape)
 {
-    SDL_BlitSurface( background, NULL, screen, NULL );
-    gfx_font_print_center (screen->h / 2, gameFontNormal, aInfo);
-    SDL_Flip( screen );
+    SDL_Surface* block = blocks[shape];
+    uint8_t bpp = screen->format->BytesPerPixel;
+    bool_t same = TRUE;
+    int i, j;
+    uint32_t pixel, blockPixel;
+
+    if (x >= MAP_SIZE_X || y >= MAP_SIZE_Y || block->format->BytesPerPixel != bpp)
+    {
+        return FALSE;
+    }
+    SDL_LockSurface (screen);
+    SDL_LockSurface (block);
+    for (j = 0; j < block->h && j < BLOCK_SIZE_Y_PX && same; j++)
+    {
+        const uint8_t* row = (const uint8_t*) screen->pixels
+                + (y * BLOCK_SIZE_Y_PX + j) * screen->pitch + x * BLOCK_SIZE_X_PX * bpp;
+        const uint8_t* blockRow = (const uint8_t*) block->pixels + j * block->pitch;
+
+        for (i = 0; i < block->w && i < BLOCK_SIZE_X_PX; i++)
+        {
+            pixel = 0;
+            blockPixel = 0;
+            memcpy (&pixel, row + i * bpp, bpp);
+            memcpy (&blockPixel, blockRow + i * bpp, bpp);
+            if ((block->flags & SDL_SRCCOLORKEY) && blockPixel == block->format->colorkey)
+            {
+                continue;
+            }
+            if (pixel != blockPixel)
+            {
+                same = FALSE;
+                break;
+            }
+        }
+    }
+    SDL_UnlockSurface (block);
+    SDL_UnlockSurface (screen);
+
+    return same;
 }
@@ -50,15 +50,24 @@
 #define BLOCK_PNG               GFX_DIR "block%i.png"
 
 #define gfx_color_rgb(r,g,b)                    ( ( r << 24 ) | ( g << 16 ) | ( b << 8 ) | 0xFF )
+#define gfx_color_rgba(r,g,b,a)                 ( ( r << 24 ) | ( g << 16 ) | ( b << 8 ) | a )
 #define gfx_line_draw(x1, y1, x2, y2, color)    lineColor(screen, x1, y1, x2, y2, color)
-#define gfx_font_print(x,y,font,s)              stringColor(screen, x, y, s, gfx_color_rgb(0xFF, 0xFF, 0xFF));
-#define gfx_font_print_fromright(x,y,font,s)    stringColor(screen, x - strlen(s) * FONT_NORMAL_SIZE_X_PX, y, s, gfx_color_rgb(0xFF, 0xFF, 0xFF));
-#define gfx_font_print_center(y, font, s)       stringColor(screen, screen->w / 2 - strlen(s) / 2 * FONT_NORMAL_SIZE_X_PX, y, s, gfx_color_rgb(0xFF, 0xFF, 0xFF))
+#define gfx_vline_draw(x, y1, y2, color)        vlineColor(screen, x, y1, y2, color)
+#define gfx_box_draw(x1, y1, x2, y2, color)     boxColor(screen, x1, y1, x2, y2, color)
+/* Blits are counted for the overlay, a character of text is a blit */
+#define gfx_blit(surface, offset)               (blit_counter++, SDL_BlitSurface(surface, NULL, screen, offset))
+#define gfx_font_print(x,y,font,s)              (blit_counter += strlen(s), stringColor(screen, x, y, s, gfx_color_rgb(0xFF, 0xFF, 0xFF)));
+#define gfx_font_print_fromright(x,y,font,s)    (blit_counter += strlen(s), stringColor(screen, x - strlen(s) * FONT_NORMAL_SIZE_X_PX, y, s, gfx_color_rgb(0xFF, 0xFF, 0xFF)));
+#define gfx_font_print_center(y, font, s)       (blit_counter += strlen(s), stringColor(screen, screen->w / 2 - strlen(s) / 2 * FONT_NORMAL_SIZE_X_PX, y, s, gfx_color_rgb(0xFF, 0xFF, 0xFF)))
 
 extern SDL_Surface* background;
 extern SDL_Surface* screen;
+extern uint32_t frame_counter;
+extern uint32_t blink_counter;
+extern uint32_t blink_delay_ms;
+extern uint32_t blit_counter;
 
-void loadBlocks();
+bool_t loadBlocks();
 void freeBlocks();
 void drawBlock (uint8_t x, uint8_t y, uint8_t shape);
 void printCommon (void);
@@ -67,7 +76,8 @@ void blinkMap (uint8_t blinkNum);
 void drawMap (void);
 void drawFigure (void);
 void clearFigure (void);
-void shiftDownColumn (uint8_t x0, uint8_t y0);
 void drawInfoScreen (const char* aInfo);
+void flipScreen (void);
+bool_t isBlockOnScreen (uint8_t x, uint8_t y, uint8_t shape);
 
 #endif /* INCLUDE_GAME_GFX_H */
@@ -0,0 +1,267 @@
+/**
+ * @file        input.c
+ * @brief       Input thread with timestamped events
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-14 19:03:10
+ * Licence:     GPL
+ *
+ * Events are taken from SDL's queue by a dedicated thread every
+ * INPUT_POLL_US, stamped with the monotonic clock and passed to the game
+ * loop through a lock-free queue. So the time of a key press does not depend
+ * on when the game loop gets to it.
+ *
+ * SDL 1.2 fills its queue in SDL_PumpEvents(), which shall be called from
+ * the video thread unless SDL was initialized with SDL_INIT_EVENTTHREAD.
+ * Without event thread the game loop reads SDL's queue itself and
+ * timestamps are only as precise as the loop.
+ *
+ * When nothing is shown until a key arrives, the game loop sleeps in
+ * inputWait() and the input thread polls less often.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_thread.h>
+
+#include "input.h"
+#include "ringbuf.h"
+
+#define INPUT_PEEK_MAX      32      /* Events peeked from SDL's queue */
+
+static ringbuf_t    input_queue;
+static bool_t       input_running = FALSE;  /* FALSE: thread shall exit, accessed atomically */
+static bool_t       input_idle = FALSE;     /* TRUE: game loop waits for input */
+static SDL_Thread*  input_thread = NULL;
+static SDL_mutex*   input_mutex = NULL;
+static SDL_cond*    input_cond = NULL;      /* Signaled when events are queued */
+
+/**
+ * @brief convertEvent
+ * Keep the fields of an SDL event which are used by the game.
+ *
+ * @return TRUE: event is used by the game.
+ */
+static bool_t convertEvent (input_event_t* aEvent, const SDL_Event* aSdlEvent, uint64_t aTimeUs)
+{
+    switch (aSdlEvent->type)
+    {
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+            aEvent->sym = aSdlEvent->key.keysym.sym;
+            aEvent->mod = aSdlEvent->key.keysym.mod;
+            break;
+        case SDL_QUIT:
+        case SDL_VIDEOEXPOSE:
+        case SDL_ACTIVEEVENT:
+            aEvent->sym = 0;
+            aEvent->mod = 0;
+            break;
+        default:
+            return FALSE;
+    }
+    aEvent->type = aSdlEvent->type;
+    aEvent->timeUs = aTimeUs;
+
+    return TRUE;
+}
+
+/**
+ * @brief inputThread
+ * Move events from SDL's queue to the game's queue.
+ */
+static int inputThread (void* aData)
+{
+    SDL_Event events[16];
+    input_event_t event;
+    uint64_t now;
+    int n, i;
+
+    (void) aData;
+    while (__atomic_load_n (&input_running, __ATOMIC_RELAXED))
+    {
+        n = SDL_PeepEvents (events, sizeof (events) / sizeof (events[0]),
+                            SDL_GETEVENT, SDL_ALLEVENTS);
+        if (n <= 0)
+        {
+            usleep (__atomic_load_n (&input_idle, __ATOMIC_RELAXED)
+                    ? INPUT_IDLE_POLL_US : INPUT_POLL_US);
+            continue;
+        }
+        now = getTimeUs ();
+        for (i = 0; i < n; i++)
+        {
+            if (!convertEvent (&event, &events[i], now))
+            {
+                continue;
+            }
+            /* Game loop is stalled: wait, a lost key release would stick */
+            while (!ringbufPush (&input_queue, &event)
+                    && __atomic_load_n (&input_running, __ATOMIC_RELAXED))
+            {
+                usleep (INPUT_POLL_US);
+            }
+        }
+        /* Wake up game loop if it waits */
+        SDL_mutexP (input_mutex);
+        SDL_CondSignal (input_cond);
+        SDL_mutexV (input_mutex);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief inputInit
+ * Start input thread.
+ *
+ * @param aEventThread TRUE: SDL was initialized with SDL_INIT_EVENTTHREAD.
+ * @return TRUE: input thread is running. FALSE: inputPoll() reads SDL's
+ *         queue directly.
+ */
+bool_t inputInit (bool_t aEventThread)
+{
+    if (!aEventThread)
+    {
+        printf("%s: SDL has no event thread, events are read by game loop\n", __FUNCTION__);
+        return FALSE;
+    }
+    input_mutex = SDL_CreateMutex ();
+    input_cond = SDL_CreateCond ();
+    if (input_mutex && input_cond
+            && ringbufInit (&input_queue, sizeof (input_event_t), INPUT_QUEUE_SIZE))
+    {
+        __atomic_store_n (&input_running, TRUE, __ATOMIC_RELAXED);
+        input_thread = SDL_CreateThread (inputThread, NULL);
+        if (!input_thread)
+        {
+            __atomic_store_n (&input_running, FALSE, __ATOMIC_RELAXED);
+            ringbufFree (&input_queue);
+        }
+    }
+    if (!input_thread)
+    {
+        printf("%s: cannot start input thread\n", __FUNCTION__);
+    }
+
+    return input_thread != NULL;
+}
+
+/**
+ * @brief inputPoll
+ * Get next event. Called by game loop only.
+ *
+ * @return TRUE: event was got. FALSE: no more events.
+ */
+bool_t inputPoll (input_event_t* aEvent)
+{
+    SDL_Event event;
+
+    if (!input_thread)
+    {
+        while (SDL_PollEvent (&event))
+        {
+            if (convertEvent (aEvent, &event, getTimeUs ()))
+            {
+                return TRUE;
+            }
+        }
+        return FALSE;
+    }
+    return ringbufPop (&input_queue, aEvent);
+}
+
+/**
+ * @brief inputPeek
+ * Copy pending events without removing them. Called by game loop only.
+ *
+ * @param aEvents Buffer of events.
+ * @param aCount Size of aEvents.
+ * @return Number of events copied.
+ */
+uint32_t inputPeek (input_event_t* aEvents, uint32_t aCount)
+{
+    SDL_Event events[INPUT_PEEK_MAX];
+    int cnt, i;
+    uint32_t n = 0;
+
+    if (input_thread)
+    {
+        return ringbufPeek (&input_queue, aEvents, aCount);
+    }
+    /* Without input thread events are stamped when they are polled */
+    cnt = SDL_PeepEvents (events, MIN (aCount, INPUT_PEEK_MAX), SDL_PEEKEVENT, SDL_ALLEVENTS);
+    for (i = 0; i < cnt; i++)
+    {
+        if (convertEvent (&aEvents[n], &events[i], 0))
+        {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * @brief inputWait
+ * Sleep until an event arrives. Called by game loop only.
+ *
+ * @param aTimeoutUs Maximal time of waiting.
+ */
+void inputWait (uint32_t aTimeoutUs)
+{
+    if (!input_thread)
+    {
+        /* SDL 1.2 cannot block on its queue, SDL_WaitEvent() polls as well */
+        usleep (aTimeoutUs < INPUT_IDLE_POLL_US ? aTimeoutUs : INPUT_IDLE_POLL_US);
+        return;
+    }
+    SDL_mutexP (input_mutex);
+    if (!ringbufUsed (&input_queue))
+    {
+        SDL_CondWaitTimeout (input_cond, input_mutex, (aTimeoutUs + 999) / 1000);
+    }
+    SDL_mutexV (input_mutex);
+}
+
+/**
+ * @brief inputSetIdle
+ * Set polling period of input thread.
+ *
+ * @param aIdle TRUE: game loop waits for input, latency of the first event
+ *              may be up to INPUT_IDLE_POLL_US.
+ */
+void inputSetIdle (bool_t aIdle)
+{
+    __atomic_store_n (&input_idle, aIdle, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief inputDone
+ * Stop input thread.
+ */
+void inputDone (void)
+{
+    if (input_thread)
+    {
+        __atomic_store_n (&input_running, FALSE, __ATOMIC_RELAXED);
+        SDL_WaitThread (input_thread, NULL);
+        input_thread = NULL;
+        ringbufFree (&input_queue);
+    }
+    if (input_cond)
+    {
+        SDL_DestroyCond (input_cond);
+        input_cond = NULL;
+    }
+    if (input_mutex)
+    {
+        SDL_DestroyMutex (input_mutex);
+        input_mutex = NULL;
+    }
+}
@@ -0,0 +1,36 @@
+/**
+ * @file        input.h
+ * @brief       Input thread with timestamped events
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-14 19:03:10
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_INPUT_H
+#define INCLUDE_INPUT_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define INPUT_QUEUE_SIZE    256     /* Number of events, power of two */
+#define INPUT_POLL_US       1000    /* Polling period of input thread */
+#define INPUT_IDLE_POLL_US  10000   /* Polling period when game waits for input */
+
+typedef struct
+{
+    uint64_t timeUs;    /* When the event was taken from SDL, see getTimeUs() */
+    uint8_t type;       /* SDL_KEYDOWN, SDL_KEYUP, SDL_QUIT, SDL_VIDEOEXPOSE or SDL_ACTIVEEVENT */
+    uint16_t sym;       /* SDLKey */
+    uint16_t mod;       /* SDLMod */
+} input_event_t;
+
+bool_t inputInit (bool_t aEventThread);
+bool_t inputPoll (input_event_t* aEvent);
+uint32_t inputPeek (input_event_t* aEvents, uint32_t aCount);
+void inputWait (uint32_t aTimeoutUs);
+void inputSetIdle (bool_t aIdle);
+void inputDone (void);
+
+#endif /* INCLUDE_INPUT_H */
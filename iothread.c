@@ -0,0 +1,308 @@
+/**
+ * @file        iothread.c
+ * @brief       Background file writer
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-04 20:31:05
+ * Licence:     GPL
+ *
+ * Saving must not block the game loop, so serialized snapshots are queued
+ * to a worker thread. A queued job which was not started yet is replaced
+ * by a newer job of the same file, so only the latest snapshot is written.
+ * Appends are executed in order and never replaced. The caller never
+ * waits: if the queue is full, the new job is refused.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_thread.h>
+
+#include "iothread.h"
+#include "savefile.h"
+#include "trace.h"
+#include "stats.h"
+
+static io_job_t     io_jobs[IO_MAX_JOBS];   /* FIFO of pending jobs */
+static uint8_t      io_job_cntr = 0;        /* Number of pending jobs */
+static bool_t       io_busy = FALSE;        /* TRUE: worker executes a job */
+static bool_t       io_running = FALSE;     /* FALSE: worker shall exit */
+static SDL_Thread*  io_thread = NULL;
+static SDL_mutex*   io_mutex = NULL;
+static SDL_cond*    io_job_cond = NULL;     /* Signaled when a job is queued */
+static SDL_cond*    io_idle_cond = NULL;    /* Signaled when a job is finished */
+
+/**
+ * @brief ioExecute
+ * Execute a job. It is called without holding the mutex.
+ */
+static void ioExecute (io_job_t* aJob)
+{
+    uint64_t start_us = getTimeUs ();
+    TRACE_BEGIN(span);
+
+    switch (aJob->type)
+    {
+        case IO_JOB_write:
+            if (!saveFileWrite (aJob->path, aJob->data, aJob->length))
+            {
+                printf("%s: cannot write %s\n", __FUNCTION__, aJob->path);
+            }
+            statsSave (start_us);
+            break;
+        case IO_JOB_delete:
+            remove (aJob->path);
+            break;
+        case IO_JOB_append:
+            {
+                int fd = open (aJob->path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+                if (fd < 0 || write (fd, aJob->data, aJob->length) != (ssize_t) aJob->length)
+                {
+                    printf("%s: cannot append %s\n", __FUNCTION__, aJob->path);
+                }
+                if (fd >= 0)
+                {
+                    fdatasync (fd);
+                    close (fd);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    free (aJob->data);
+    aJob->data = NULL;
+    TRACE_END_ARG(span, "ioExecute", "length", aJob->length);
+}
+
+static int ioThread (void* aArg)
+{
+    io_job_t job;
+
+    (void) aArg;
+
+    TRACE_THREAD("io");
+    SDL_mutexP (io_mutex);
+    while (io_running || io_job_cntr)
+    {
+        if (!io_job_cntr)
+        {
+            SDL_CondWait (io_job_cond, io_mutex);
+            continue;
+        }
+        job = io_jobs[0];
+        io_job_cntr--;
+        memmove (&io_jobs[0], &io_jobs[1], io_job_cntr * sizeof (io_job_t));
+        io_busy = TRUE;
+        SDL_mutexV (io_mutex);
+
+        ioExecute (&job);
+
+        SDL_mutexP (io_mutex);
+        io_busy = FALSE;
+        SDL_CondBroadcast (io_idle_cond);
+    }
+    SDL_mutexV (io_mutex);
+
+    return 0;
+}
+
+/**
+ * @brief ioInit
+ * Start the worker thread. If it cannot be started, jobs are executed
+ * immediately by the caller.
+ *
+ * @return TRUE: worker is running.
+ */
+bool_t ioInit (void)
+{
+    io_mutex = SDL_CreateMutex ();
+    io_job_cond = SDL_CreateCond ();
+    io_idle_cond = SDL_CreateCond ();
+    if (io_mutex && io_job_cond && io_idle_cond)
+    {
+        io_running = TRUE;
+        io_thread = SDL_CreateThread (ioThread, NULL);
+        if (!io_thread)
+        {
+            io_running = FALSE;
+        }
+    }
+    if (!io_thread)
+    {
+        printf("%s: cannot start I/O thread, saving synchronously\n", __FUNCTION__);
+    }
+
+    return io_thread != NULL;
+}
+
+/**
+ * @brief ioQueue
+ * Put a job into the queue. Pending job of the same file is replaced.
+ *
+ * @return FALSE: out of memory or the queue is full.
+ */
+static bool_t ioQueue (io_job_type_t aType, const char* aPath, const uint8_t* aData, uint32_t aLength)
+{
+    io_job_t job;
+    uint8_t i;
+
+    job.type = aType;
+    strncpy (job.path, aPath, sizeof (job.path) - 1);
+    job.path[sizeof (job.path) - 1] = 0;
+    job.data = NULL;
+    job.length = aLength;
+    if (aLength)
+    {
+        job.data = malloc (aLength);
+        if (!job.data)
+        {
+            return FALSE;
+        }
+        memcpy (job.data, aData, aLength);
+    }
+
+    if (!io_thread)
+    {
+        ioExecute (&job);
+        return TRUE;
+    }
+
+    SDL_mutexP (io_mutex);
+    /* Find last pending job of the file */
+    for (i = io_job_cntr; i > 0; i--)
+    {
+        if (!strcmp (io_jobs[i - 1].path, job.path))
+        {
+            break;
+        }
+    }
+    if (i > 0 && aType != IO_JOB_append && io_jobs[i - 1].type != IO_JOB_append)
+    {
+        /* Coalesce: older snapshot is not needed anymore */
+        free (io_jobs[i - 1].data);
+        io_jobs[i - 1] = job;
+    }
+    else if (io_job_cntr < IO_MAX_JOBS)
+    {
+        io_jobs[io_job_cntr++] = job;
+    }
+    else
+    {
+        /* Disk is too slow, the game loop shall not wait for it */
+        SDL_mutexV (io_mutex);
+        printf("%s: queue is full, %s is not saved\n", __FUNCTION__, job.path);
+        free (job.data);
+        return FALSE;
+    }
+    SDL_CondSignal (io_job_cond);
+    SDL_mutexV (io_mutex);
+
+    return TRUE;
+}
+
+/**
+ * @brief ioWriteFile
+ * Queue file to be written atomically. Data is copied.
+ *
+ * @return TRUE: job was queued.
+ */
+bool_t ioWriteFile (const char* aPath, const uint8_t* aData, uint32_t aLength)
+{
+    return ioQueue (IO_JOB_write, aPath, aData, aLength);
+}
+
+/**
+ * @brief ioDeleteFile
+ * Queue file to be deleted. Pending write of the file is cancelled.
+ *
+ * @return TRUE: job was queued.
+ */
+bool_t ioDeleteFile (const char* aPath)
+{
+    return ioQueue (IO_JOB_delete, aPath, NULL, 0);
+}
+
+/**
+ * @brief ioAppendFile
+ * Queue data to be appended to a file. Data is copied.
+ *
+ * @return TRUE: job was queued.
+ */
+bool_t ioAppendFile (const char* aPath, const uint8_t* aData, uint32_t aLength)
+{
+    return ioQueue (IO_JOB_append, aPath, aData, aLength);
+}
+
+/**
+ * @brief ioFlush
+ * Wait until all queued jobs are executed.
+ */
+void ioFlush (void)
+{
+    if (io_thread)
+    {
+        SDL_mutexP (io_mutex);
+        while (io_job_cntr || io_busy)
+        {
+            SDL_CondWait (io_idle_cond, io_mutex);
+        }
+        SDL_mutexV (io_mutex);
+    }
+}
+
+/**
+ * @brief ioIsIdle
+ * @return TRUE: there is no pending job.
+ */
+bool_t ioIsIdle (void)
+{
+    bool_t idle = TRUE;
+
+    if (io_thread)
+    {
+        SDL_mutexP (io_mutex);
+        idle = !io_job_cntr && !io_busy;
+        SDL_mutexV (io_mutex);
+    }
+
+    return idle;
+}
+
+/**
+ * @brief ioDone
+ * Execute pending jobs and stop the worker thread.
+ */
+void ioDone (void)
+{
+    if (io_thread)
+    {
+        SDL_mutexP (io_mutex);
+        io_running = FALSE;
+        SDL_CondSignal (io_job_cond);
+        SDL_mutexV (io_mutex);
+        SDL_WaitThread (io_thread, NULL);
+        io_thread = NULL;
+    }
+    if (io_idle_cond)
+    {
+        SDL_DestroyCond (io_idle_cond);
+        io_idle_cond = NULL;
+    }
+    if (io_job_cond)
+    {
+        SDL_DestroyCond (io_job_cond);
+        io_job_cond = NULL;
+    }
+    if (io_mutex)
+    {
+        SDL_DestroyMutex (io_mutex);
+        io_mutex = NULL;
+    }
+}
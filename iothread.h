@@ -0,0 +1,43 @@
+/**
+ * @file        iothread.h
+ * @brief       Background file writer
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-04 20:31:05
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_IOTHREAD_H
+#define INCLUDE_IOTHREAD_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define IO_MAX_JOBS     64  /* Number of pending jobs, journal records are jobs too */
+
+typedef enum
+{
+    IO_JOB_none,
+    IO_JOB_write,       /**< Replace file atomically */
+    IO_JOB_delete,      /**< Remove file */
+    IO_JOB_append       /**< Append to file, never coalesced */
+} io_job_type_t;
+
+typedef struct
+{
+    io_job_type_t type;
+    char path[FSYS_FILENAME_MAX];
+    uint8_t* data;      /* Snapshot of file content, allocated by the queue */
+    uint32_t length;
+} io_job_t;
+
+bool_t ioInit (void);
+bool_t ioWriteFile (const char* aPath, const uint8_t* aData, uint32_t aLength);
+bool_t ioDeleteFile (const char* aPath);
+bool_t ioAppendFile (const char* aPath, const uint8_t* aData, uint32_t aLength);
+void ioFlush (void);
+bool_t ioIsIdle (void);
+void ioDone (void);
+
+#endif /* INCLUDE_IOTHREAD_H */
@@ -0,0 +1,239 @@
+/**
+ * @file        journal.c
+ * @brief       Append-only journal of game moves
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-07 10:15:22
+ * Licence:     GPL
+ *
+ * Every locked figure appends the changed cells and the new counters to
+ * the journal. Recovery loads the last checkpoint (saved game) and
+ * replays the journal of the same game ID and sequence number onto it.
+ *
+ * The header and the records are written by the I/O thread in the order
+ * of the other jobs, so a new journal replaces the old one only after the
+ * checkpoint queued before it is on the disk. If a record cannot be
+ * queued, the journal is closed: records after a gap would be applied to
+ * the wrong map. Every record has its own CRC, a torn record at the end is
+ * ignored.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "journal.h"
+#include "savefile.h"
+#include "iothread.h"
+
+uint32_t journal_records = 0;
+
+static char     journal_path[FSYS_FILENAME_MAX];    /* "": journal is closed */
+static uint8_t  journal_map[MAP_SIZE_Y][MAP_SIZE_X]; /* Map before the move */
+
+/**
+ * @brief journalOpen
+ * Queue new, empty journal. Existing file is replaced.
+ *
+ * @param aPath     Path of journal.
+ * @param aGameId   Identifier of the game.
+ * @param aSeq      Sequence number of the checkpoint the journal belongs to.
+ * @return TRUE: journal was queued.
+ */
+bool_t journalOpen (const char* aPath, uint32_t aGameId, uint32_t aSeq)
+{
+    uint8_t header[JOURNAL_HEADER_SIZE];
+
+    journalClose ();
+
+    PUT_LE32 (&header[0], JOURNAL_MAGIC);
+    PUT_LE32 (&header[4], aGameId);
+    PUT_LE32 (&header[8], aSeq);
+    PUT_LE32 (&header[12], crc32c (0, header, 12));
+    if (!ioWriteFile (aPath, header, sizeof (header)))
+    {
+        printf("%s: cannot open %s\n", __FUNCTION__, aPath);
+        return FALSE;
+    }
+    snprintf (journal_path, sizeof (journal_path), "%s", aPath);
+    journal_records = 0;
+
+    return TRUE;
+}
+
+/**
+ * @brief journalClose
+ * Close journal. The file is kept.
+ */
+void journalClose (void)
+{
+    journal_path[0] = 0;
+}
+
+/**
+ * @brief journalIsOpen
+ * @return TRUE: moves are journaled. FALSE: a checkpoint is needed.
+ */
+bool_t journalIsOpen (void)
+{
+    return journal_path[0] != 0;
+}
+
+/**
+ * @brief journalBeginMove
+ * Remember map before the figure is locked. @see journalCommitMove
+ */
+void journalBeginMove (const game_t* aGame)
+{
+    memcpy (journal_map, aGame->map, sizeof (journal_map));
+}
+
+/**
+ * @brief journalCommitMove
+ * Append changes since journalBeginMove() to the journal.
+ *
+ * @return TRUE: record was queued.
+ */
+bool_t journalCommitMove (const game_t* aGame)
+{
+    uint8_t rec[JOURNAL_RECORD_HEADER_SIZE + JOURNAL_MAX_PAYLOAD + 4];
+    uint8_t* p = &rec[JOURNAL_RECORD_HEADER_SIZE];
+    uint8_t* cell_cntr;
+    uint16_t length;
+    uint8_t x, y;
+
+    if (!journal_path[0])
+    {
+        return FALSE;
+    }
+
+    PUT_LE32 (p, aGame->figure_counter);
+    PUT_LE32 (p + 4, aGame->score);
+    p[8] = aGame->level;
+    p[9] = aGame->figure_x;
+    p[10] = aGame->figure_y;
+    p[11] = aGame->figure_is_vertical;
+    memcpy (&p[12], aGame->figure, FIGURE_SIZE);
+    p += 12 + FIGURE_SIZE;
+    cell_cntr = p++;
+    *cell_cntr = 0;
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        for (x = 0; x < MAP_SIZE_X; x++)
+        {
+            if (aGame->map[y][x] != journal_map[y][x])
+            {
+                *p++ = y * MAP_SIZE_X + x;
+                *p++ = aGame->map[y][x];
+                (*cell_cntr)++;
+            }
+        }
+    }
+    length = p - &rec[JOURNAL_RECORD_HEADER_SIZE];
+    rec[0] = JOURNAL_REC_lock;
+    PUT_LE16 (&rec[1], length);
+    PUT_LE32 (p, crc32c (0, rec, JOURNAL_RECORD_HEADER_SIZE + length));
+    length += JOURNAL_RECORD_HEADER_SIZE + 4;
+
+    if (!ioAppendFile (journal_path, rec, length))
+    {
+        printf("%s: record is lost, journal is closed until the next checkpoint\n", __FUNCTION__);
+        journalClose ();
+        return FALSE;
+    }
+    journal_records++;
+
+    return TRUE;
+}
+
+/**
+ * @brief journalApplyLock
+ * Apply a lock record to the game.
+ */
+static void journalApplyLock (const uint8_t* aData, uint16_t aLength, game_t* aGame)
+{
+    uint8_t cells;
+    uint8_t i;
+
+    if (aLength < 13 + FIGURE_SIZE)
+    {
+        return;
+    }
+    cells = aData[12 + FIGURE_SIZE];
+    if (aLength < 13 + FIGURE_SIZE + 2 * cells
+            || GET_LE32 (aData) <= aGame->figure_counter)
+    {
+        /* Damaged or already in the checkpoint */
+        return;
+    }
+    aGame->figure_counter = GET_LE32 (aData);
+    aGame->score = GET_LE32 (aData + 4);
+    aGame->level = aData[8];
+    aGame->figure_x = aData[9];
+    aGame->figure_y = aData[10];
+    aGame->figure_is_vertical = aData[11] ? TRUE : FALSE;
+    memcpy (aGame->figure, &aData[12], FIGURE_SIZE);
+    aData += 13 + FIGURE_SIZE;
+    for (i = 0; i < cells; i++)
+    {
+        if (aData[2 * i] < MAP_SIZE_X * MAP_SIZE_Y)
+        {
+            aGame->map[aData[2 * i] / MAP_SIZE_X][aData[2 * i] % MAP_SIZE_X] = aData[2 * i + 1];
+        }
+    }
+}
+
+/**
+ * @brief journalReplay
+ * Apply records of a journal to the game.
+ *
+ * @param aPath     Path of journal.
+ * @param aGameId   Expected game identifier.
+ * @param aSeq      Expected sequence number.
+ * @param aGame     Game to update, it shall contain the checkpoint.
+ * @return Number of records applied. -1: journal does not exist or it
+ *         belongs to an other game or checkpoint.
+ */
+int32_t journalReplay (const char* aPath, uint32_t aGameId, uint32_t aSeq, game_t* aGame)
+{
+    FILE* file;
+    uint8_t header[JOURNAL_HEADER_SIZE];
+    uint8_t rec[JOURNAL_RECORD_HEADER_SIZE + JOURNAL_MAX_PAYLOAD + 4];
+    uint16_t length;
+    int32_t records = -1;
+
+    file = fopen (aPath, "rb");
+    if (!file)
+    {
+        return -1;
+    }
+    if (fread (header, 1, sizeof (header), file) == sizeof (header)
+            && GET_LE32 (&header[0]) == JOURNAL_MAGIC
+            && GET_LE32 (&header[4]) == aGameId
+            && GET_LE32 (&header[8]) == aSeq
+            && GET_LE32 (&header[12]) == crc32c (0, header, 12))
+    {
+        records = 0;
+        while (fread (rec, 1, JOURNAL_RECORD_HEADER_SIZE, file) == JOURNAL_RECORD_HEADER_SIZE)
+        {
+            length = GET_LE16 (&rec[1]);
+            if (length > JOURNAL_MAX_PAYLOAD
+                    || fread (&rec[JOURNAL_RECORD_HEADER_SIZE], 1, length + 4, file) != length + 4u
+                    || crc32c (0, rec, JOURNAL_RECORD_HEADER_SIZE + length)
+                        != GET_LE32 (&rec[JOURNAL_RECORD_HEADER_SIZE + length]))
+            {
+                /* Torn write at the end */
+                break;
+            }
+            if (rec[0] == JOURNAL_REC_lock)
+            {
+                journalApplyLock (&rec[JOURNAL_RECORD_HEADER_SIZE], length, aGame);
+                records++;
+            }
+        }
+    }
+    fclose (file);
+
+    return records;
+}
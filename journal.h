@@ -0,0 +1,37 @@
+/**
+ * @file        journal.h
+ * @brief       Append-only journal of game moves
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-07 10:15:22
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_JOURNAL_H
+#define INCLUDE_JOURNAL_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define JOURNAL_MAGIC               0x4E4A5453u /* "STJN" */
+#define JOURNAL_HEADER_SIZE         16  /* Magic, game ID, sequence, CRC */
+#define JOURNAL_RECORD_HEADER_SIZE  3   /* Type, length */
+#define JOURNAL_MAX_PAYLOAD         (16 + 2 * MAP_SIZE_X * MAP_SIZE_Y)
+
+typedef enum
+{
+    JOURNAL_REC_none,
+    JOURNAL_REC_lock    /**< Figure was locked: counters, next figure, changed cells */
+} journal_rec_type_t;
+
+extern uint32_t journal_records;    /* Records queued since journalOpen() */
+
+bool_t journalOpen (const char* aPath, uint32_t aGameId, uint32_t aSeq);
+void journalClose (void);
+bool_t journalIsOpen (void);
+void journalBeginMove (const game_t* aGame);
+bool_t journalCommitMove (const game_t* aGame);
+int32_t journalReplay (const char* aPath, uint32_t aGameId, uint32_t aSeq, game_t* aGame);
+
+#endif /* INCLUDE_JOURNAL_H */
@@ -0,0 +1,329 @@
+/**
+ * @file        latency.c
+ * @brief       Input to photon latency benchmark
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-16 20:47:18
+ * Licence:     GPL
+ *
+ * A benchmark thread pushes synthetic key presses into SDL's queue while the
+ * game runs normally. Every flipped frame is checked: when the pixels show
+ * the figure at its new column and the column it left is empty, the sample
+ * is finished. So the whole path is measured: SDL queue, input thread, game
+ * loop delay, game logic, drawing and SDL_Flip().
+ *
+ * Samples which overlap blinking of collapsed blocks are also reported
+ * separately, see blink_delay_ms.
+ *
+ * The benchmark thread does not read the game: after every flip the game
+ * loop publishes what the frame shows in one atomic word, see
+ * publishView().
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_thread.h>
+
+#include "latency.h"
+#include "game_gfx.h"
+
+/* Frame published by publishView() */
+#define VIEW_RUNNING            BIT0                        /* State is STATE_running */
+#define VIEW_VERTICAL           BIT1                        /* Figure is vertical */
+#define VIEW_X(v)               (((v) >> 8) & 0xFF)         /* Column of figure */
+#define VIEW_BLINKS(v)          ((uint32_t) ((v) >> 32))    /* blink_counter */
+
+typedef struct
+{
+    uint32_t latencyUs;
+    bool_t blinked;     /* Blocks were blinking during the sample */
+} latency_sample_t;
+
+bool_t latency_bench = FALSE;
+
+static latency_sample_t* latency_samples;
+static uint32_t     latency_sample_num;     /* Number of samples to take */
+static uint32_t     latency_sample_cntr;    /* Number of samples taken */
+static uint32_t     latency_dropped = 0;    /* Move was not seen in time */
+static bool_t       latency_running = FALSE; /* FALSE: thread shall exit, accessed atomically */
+static SDL_Thread*  latency_thread = NULL;
+
+/* Probe: shared by benchmark thread and game loop */
+static uint32_t     probe_armed = 0;        /* 1: move is expected */
+static uint8_t      probe_old_x;            /* Column of figure before the move */
+static uint8_t      probe_new_x;            /* Column of figure after the move */
+static uint64_t     probe_time_us;          /* When the key was pushed */
+static uint32_t     probe_blink_counter;    /* Value of blink_counter at push */
+static uint64_t     probe_view = 0;         /* Last flipped frame, see publishView() */
+
+/**
+ * @brief pushKey
+ * Push key event into SDL's queue.
+ */
+static void pushKey (uint16_t aSym, bool_t aPressed)
+{
+    SDL_Event event;
+
+    memset (&event, 0, sizeof (event));
+    event.type = aPressed ? SDL_KEYDOWN : SDL_KEYUP;
+    event.key.state = aPressed ? SDL_PRESSED : SDL_RELEASED;
+    event.key.keysym.sym = aSym;
+    SDL_PushEvent (&event);
+}
+
+/**
+ * @brief isFigureAt
+ * Check the rendered frame: figure is drawn at column aX and cells it had
+ * at column aOldX are empty.
+ */
+static bool_t isFigureAt (uint8_t aX, uint8_t aOldX)
+{
+    uint8_t i;
+    uint8_t y = game.figure_y;
+
+    for (i = 0; i < FIGURE_SIZE; i++)
+    {
+        if (game.figure_is_vertical)
+        {
+            if (!isBlockOnScreen (aX, y + i, game.figure[i])
+                    || !isBlockOnScreen (aOldX, y + i, 0))
+            {
+                return FALSE;
+            }
+        }
+        else if (!isBlockOnScreen (aX + i, y, game.figure[i]))
+        {
+            return FALSE;
+        }
+    }
+    if (!game.figure_is_vertical)
+    {
+        /* Left column is freed by moving right, right column by moving left */
+        return isBlockOnScreen (aOldX < aX ? aOldX : aOldX + FIGURE_SIZE - 1, y, 0);
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief publishView
+ * Publish the state of the game in the flipped frame for the benchmark
+ * thread. Called by the game loop.
+ */
+static void publishView (void)
+{
+    uint64_t view = (uint64_t) blink_counter << 32 | (uint32_t) game.figure_x << 8;
+
+    if (game.figure_is_vertical)
+    {
+        view |= VIEW_VERTICAL;
+    }
+    if (main_state_machine == STATE_running)
+    {
+        view |= VIEW_RUNNING;
+    }
+    __atomic_store_n (&probe_view, view, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief latencyFrame
+ * Check frame which was just flipped. Called by flipScreen().
+ */
+void latencyFrame (void)
+{
+    uint64_t now;
+
+    publishView ();
+    if (!__atomic_load_n (&probe_armed, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    now = getTimeUs ();
+    if (main_state_machine == STATE_running && isFigureAt (probe_new_x, probe_old_x))
+    {
+        if (latency_sample_cntr < latency_sample_num)
+        {
+            latency_samples[latency_sample_cntr].latencyUs = now - probe_time_us;
+            latency_samples[latency_sample_cntr].blinked = blink_counter != probe_blink_counter;
+            __atomic_store_n (&latency_sample_cntr, latency_sample_cntr + 1, __ATOMIC_RELEASE);
+        }
+        __atomic_store_n (&probe_armed, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief latencyThread
+ * Inject key presses, one at a time.
+ */
+static int latencyThread (void* aData)
+{
+    uint64_t view;
+    uint8_t x;
+    uint16_t sym;
+    bool_t right = TRUE;
+    uint64_t start;
+
+    (void) aData;
+    usleep (500000);
+    while (__atomic_load_n (&latency_running, __ATOMIC_RELAXED)
+           && __atomic_load_n (&latency_sample_cntr, __ATOMIC_ACQUIRE) < latency_sample_num)
+    {
+        view = __atomic_load_n (&probe_view, __ATOMIC_ACQUIRE);
+        if (!(view & VIEW_RUNNING))
+        {
+            /* Start a game, go through name entry after game over */
+            pushKey (SDLK_RETURN, TRUE);
+            pushKey (SDLK_RETURN, FALSE);
+            usleep (150000);
+            continue;
+        }
+        x = VIEW_X (view);
+        if (x == 0)
+        {
+            right = TRUE;
+        }
+        else if (x + ((view & VIEW_VERTICAL) ? 1 : FIGURE_SIZE) >= MAP_SIZE_X)
+        {
+            right = FALSE;
+        }
+        probe_old_x = x;
+        probe_new_x = right ? x + 1 : x - 1;
+        sym = right ? SDLK_RIGHT : SDLK_LEFT;
+        right = !right;
+        probe_blink_counter = VIEW_BLINKS (view);
+        probe_time_us = getTimeUs ();
+        __atomic_store_n (&probe_armed, 1, __ATOMIC_RELEASE);
+        pushKey (sym, TRUE);
+        pushKey (sym, FALSE);
+
+        start = getTimeUs ();
+        while (__atomic_load_n (&probe_armed, __ATOMIC_ACQUIRE)
+               && getTimeUs () - start < LATENCY_TIMEOUT_US)
+        {
+            usleep (1000);
+        }
+        if (__atomic_exchange_n (&probe_armed, 0, __ATOMIC_ACQ_REL))
+        {
+            /* Blocked by wall or blocks, or figure was dropped */
+            latency_dropped++;
+        }
+        /* Gap is random, so samples do not lock to the game loop's phase */
+        usleep (LATENCY_GAP_MIN_US + rand () % (LATENCY_GAP_MAX_US - LATENCY_GAP_MIN_US));
+    }
+    if (__atomic_load_n (&latency_running, __ATOMIC_RELAXED))
+    {
+        SDL_Event event;
+
+        memset (&event, 0, sizeof (event));
+        event.type = SDL_QUIT;
+        SDL_PushEvent (&event);
+    }
+
+    return 0;
+}
+
+static int compareSamples (const void* aA, const void* aB)
+{
+    uint32_t a = ((const latency_sample_t*) aA)->latencyUs;
+    uint32_t b = ((const latency_sample_t*) aB)->latencyUs;
+
+    return (a > b) - (a < b);
+}
+
+/**
+ * @brief printStats
+ * Print percentiles of samples, which are sorted.
+ */
+static void printStats (const char* aName, const uint32_t* aLatencies, uint32_t aCount)
+{
+    if (!aCount)
+    {
+        printf("latency %s: samples=0\n", aName);
+        return;
+    }
+    printf("latency %s: samples=%u min=%u p50=%u p90=%u p99=%u max=%u us\n",
+           aName, aCount, aLatencies[0],
+           aLatencies[aCount * 50 / 100], aLatencies[aCount * 90 / 100],
+           aLatencies[aCount * 99 / 100], aLatencies[aCount - 1]);
+}
+
+/**
+ * @brief latencyInit
+ * Start benchmark thread.
+ *
+ * @param aSamples Number of samples to take, then game exits.
+ * @return TRUE: benchmark is started.
+ */
+bool_t latencyInit (uint32_t aSamples)
+{
+    if (aSamples > LATENCY_MAX_SAMPLES)
+    {
+        aSamples = LATENCY_MAX_SAMPLES;
+    }
+    latency_samples = malloc (aSamples * sizeof (latency_sample_t));
+    if (!latency_samples)
+    {
+        return FALSE;
+    }
+    latency_sample_num = aSamples;
+    __atomic_store_n (&latency_running, TRUE, __ATOMIC_RELAXED);
+    latency_thread = SDL_CreateThread (latencyThread, NULL);
+    if (!latency_thread)
+    {
+        __atomic_store_n (&latency_running, FALSE, __ATOMIC_RELAXED);
+        free (latency_samples);
+        latency_samples = NULL;
+        return FALSE;
+    }
+    latency_bench = TRUE;
+
+    return TRUE;
+}
+
+/**
+ * @brief latencyDone
+ * Stop benchmark and print the results.
+ */
+void latencyDone (void)
+{
+    uint32_t* all;
+    uint32_t* blinked;
+    uint32_t i, blinkedCntr = 0;
+
+    if (!latency_bench)
+    {
+        return;
+    }
+    __atomic_store_n (&latency_running, FALSE, __ATOMIC_RELAXED);
+    SDL_WaitThread (latency_thread, NULL);
+    latency_thread = NULL;
+    latency_bench = FALSE;
+
+    qsort (latency_samples, latency_sample_cntr, sizeof (latency_sample_t), compareSamples);
+    all = malloc ((latency_sample_cntr + 1) * sizeof (uint32_t));
+    blinked = malloc ((latency_sample_cntr + 1) * sizeof (uint32_t));
+    if (all && blinked)
+    {
+        for (i = 0; i < latency_sample_cntr; i++)
+        {
+            all[i] = latency_samples[i].latencyUs;
+            if (latency_samples[i].blinked)
+            {
+                blinked[blinkedCntr++] = latency_samples[i].latencyUs;
+            }
+        }
+        printf("latency: loop_delay_us=%u blink_delay_ms=%u dropped=%u\n",
+               loop_delay_us, blink_delay_ms, latency_dropped);
+        printStats ("all", all, latency_sample_cntr);
+        printStats ("blink", blinked, blinkedCntr);
+    }
+    free (all);
+    free (blinked);
+    free (latency_samples);
+    latency_samples = NULL;
+}
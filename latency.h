@@ -0,0 +1,28 @@
+/**
+ * @file        latency.h
+ * @brief       Input to photon latency benchmark
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-16 20:47:18
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_LATENCY_H
+#define INCLUDE_LATENCY_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define LATENCY_TIMEOUT_US      500000  /* Sample is dropped if move is not seen */
+#define LATENCY_MAX_SAMPLES     100000
+#define LATENCY_GAP_MIN_US      20000   /* Random gap between samples */
+#define LATENCY_GAP_MAX_US      60000
+
+extern bool_t latency_bench;    /* TRUE: benchmark is running (--latency-bench) */
+
+bool_t latencyInit (uint32_t aSamples);
+void latencyFrame (void);
+void latencyDone (void);
+
+#endif /* INCLUDE_LATENCY_H */
@@ -0,0 +1,679 @@
+/**
+ * @file        leaderboard.c
+ * @brief       Leaderboard store with rank queries
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-09 21:40:12
+ * Licence:     GPL
+ *
+ * Every finished game is kept, one file per difficulty. Records are indexed
+ * by a treap where every node knows the size of its subtree, so insertion,
+ * rank of a score and k-th record are O(log n). Nodes are stored in an array
+ * and linked by index.
+ *
+ * The file is mapped shared by every running instance, so a record inserted
+ * by one cabinet is seen by the others at once. Header is on its own page and
+ * holds a robust process-shared mutex, node array is remapped when another
+ * instance grew the file. A node is written before count is incremented, so
+ * if an instance dies while holding the mutex, the next owner rebuilds the
+ * tree from the first count nodes.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "leaderboard.h"
+
+#define BOOT_ID_PATH    "/proc/sys/kernel/random/boot_id"
+
+static leaderboard_t leaderboards[RECORD_TYPES];
+
+#define NODE(lb, i)     ((lb)->nodes[i])
+#define SIZE(lb, i)     ((i) == LEADERBOARD_NIL ? 0 : NODE(lb, i).size)
+
+/**
+ * @brief leaderboardRandom
+ * Xorshift generator for treap priorities. State is shared, mutex shall be
+ * locked.
+ */
+static uint32_t leaderboardRandom (leaderboard_t* aLb)
+{
+    uint32_t x = aLb->header->rand;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    aLb->header->rand = x;
+
+    return x;
+}
+
+/**
+ * @brief isBetter
+ * @return TRUE: node aA is ahead of node aB.
+ */
+static bool_t isBetter (const leaderboard_node_t* aA, const leaderboard_node_t* aB)
+{
+    return (aA->record.score > aB->record.score)
+            || (aA->record.score == aB->record.score && aA->seq < aB->seq);
+}
+
+static void update (leaderboard_t* aLb, uint32_t aNode)
+{
+    NODE(aLb, aNode).size = 1 + SIZE(aLb, NODE(aLb, aNode).left) + SIZE(aLb, NODE(aLb, aNode).right);
+}
+
+/**
+ * @brief treapInsert
+ * Insert node into subtree.
+ *
+ * @return New root of subtree.
+ */
+static uint32_t treapInsert (leaderboard_t* aLb, uint32_t aRoot, uint32_t aNode)
+{
+    uint32_t child;
+
+    if (aRoot == LEADERBOARD_NIL)
+    {
+        return aNode;
+    }
+    NODE(aLb, aRoot).size++;
+    if (isBetter (&NODE(aLb, aNode), &NODE(aLb, aRoot)))
+    {
+        child = treapInsert (aLb, NODE(aLb, aRoot).left, aNode);
+        NODE(aLb, aRoot).left = child;
+        if (NODE(aLb, child).prio > NODE(aLb, aRoot).prio)
+        {
+            /* Rotate right */
+            NODE(aLb, aRoot).left = NODE(aLb, child).right;
+            NODE(aLb, child).right = aRoot;
+            update (aLb, aRoot);
+            update (aLb, child);
+            aRoot = child;
+        }
+    }
+    else
+    {
+        child = treapInsert (aLb, NODE(aLb, aRoot).right, aNode);
+        NODE(aLb, aRoot).right = child;
+        if (NODE(aLb, child).prio > NODE(aLb, aRoot).prio)
+        {
+            /* Rotate left */
+            NODE(aLb, aRoot).right = NODE(aLb, child).left;
+            NODE(aLb, child).left = aRoot;
+            update (aLb, aRoot);
+            update (aLb, child);
+            aRoot = child;
+        }
+    }
+
+    return aRoot;
+}
+
+/**
+ * @brief rankOf
+ * @return Number of records with greater or equal score.
+ */
+static uint32_t rankOf (const leaderboard_t* aLb, uint32_t aScore)
+{
+    uint32_t rank = 0;
+    uint32_t i = aLb->header->root;
+
+    while (i != LEADERBOARD_NIL)
+    {
+        if (NODE(aLb, i).record.score >= aScore)
+        {
+            rank += SIZE(aLb, NODE(aLb, i).left) + 1;
+            i = NODE(aLb, i).right;
+        }
+        else
+        {
+            i = NODE(aLb, i).left;
+        }
+    }
+
+    return rank;
+}
+
+/**
+ * @brief readBootId
+ * Get identifier of current boot. Mutex and tree of a file which was written
+ * during a previous boot cannot be trusted.
+ */
+static void readBootId (char* aBootId)
+{
+    FILE* file;
+
+    memset (aBootId, 0, LEADERBOARD_BOOT_ID_LENGTH);
+    file = fopen (BOOT_ID_PATH, "r");
+    if (file)
+    {
+        if (!fgets (aBootId, LEADERBOARD_BOOT_ID_LENGTH, file))
+        {
+            aBootId[0] = 0;
+        }
+        fclose (file);
+    }
+}
+
+/**
+ * @brief initMutex
+ * Initialize robust, process-shared mutex of header.
+ */
+static bool_t initMutex (leaderboard_header_t* aHeader)
+{
+    pthread_mutexattr_t attr;
+    bool_t ok;
+
+    pthread_mutexattr_init (&attr);
+    pthread_mutexattr_setpshared (&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust (&attr, PTHREAD_MUTEX_ROBUST);
+    ok = pthread_mutex_init (&aHeader->mutex, &attr) == 0;
+    pthread_mutexattr_destroy (&attr);
+
+    return ok;
+}
+
+/**
+ * @brief rebuild
+ * Build treap again from valid nodes. Priorities are kept, so the result is
+ * the same tree as the one built by insertions.
+ */
+static void rebuild (leaderboard_t* aLb)
+{
+    uint32_t i;
+
+    aLb->header->root = LEADERBOARD_NIL;
+    for (i = 0; i < aLb->header->count; i++)
+    {
+        NODE(aLb, i).left = LEADERBOARD_NIL;
+        NODE(aLb, i).right = LEADERBOARD_NIL;
+        NODE(aLb, i).size = 1;
+        NODE(aLb, i).seq = i;
+        aLb->header->root = treapInsert (aLb, aLb->header->root, i);
+    }
+    printf("%s: %s, %u records\n", __FUNCTION__, aLb->path, aLb->header->count);
+}
+
+/**
+ * @brief mapNodes
+ * Map node array with the capacity given in the shared header.
+ *
+ * @return TRUE: if successfully mapped.
+ */
+static bool_t mapNodes (leaderboard_t* aLb)
+{
+    uint32_t capacity = aLb->header->capacity;
+    size_t length = (size_t) capacity * sizeof (leaderboard_node_t);
+    void* nodes;
+
+    if (aLb->fd < 0)
+    {
+        nodes = aLb->nodes ? mremap (aLb->nodes, (size_t) aLb->mapped * sizeof (leaderboard_node_t),
+                                     length, MREMAP_MAYMOVE)
+                           : mmap (NULL, length, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    else
+    {
+        if (aLb->nodes)
+        {
+            munmap (aLb->nodes, (size_t) aLb->mapped * sizeof (leaderboard_node_t));
+            aLb->nodes = NULL;
+            aLb->mapped = 0;
+        }
+        nodes = mmap (NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      aLb->fd, LEADERBOARD_HEADER_SIZE);
+    }
+    if (nodes == MAP_FAILED)
+    {
+        printf("%s: cannot map %u nodes of %s\n", __FUNCTION__, capacity, aLb->path);
+        return FALSE;
+    }
+    aLb->nodes = nodes;
+    aLb->mapped = capacity;
+
+    return TRUE;
+}
+
+/**
+ * @brief lock
+ * Lock shared leaderboard and follow growth made by other instances.
+ *
+ * @return TRUE: if locked and mapped.
+ */
+static bool_t lock (leaderboard_t* aLb)
+{
+    int ret;
+
+    if (!aLb->header)
+    {
+        return FALSE;
+    }
+    ret = pthread_mutex_lock (&aLb->header->mutex);
+    if (ret != 0 && ret != EOWNERDEAD)
+    {
+        printf("%s: %s: %s\n", __FUNCTION__, aLb->path, strerror (ret));
+        return FALSE;
+    }
+    if (aLb->mapped != aLb->header->capacity && !mapNodes (aLb))
+    {
+        pthread_mutex_unlock (&aLb->header->mutex);
+        return FALSE;
+    }
+    if (ret == EOWNERDEAD)
+    {
+        /* Other instance died while inserting */
+        rebuild (aLb);
+        pthread_mutex_consistent (&aLb->header->mutex);
+    }
+
+    return TRUE;
+}
+
+static void unlock (leaderboard_t* aLb)
+{
+    pthread_mutex_unlock (&aLb->header->mutex);
+}
+
+/**
+ * @brief grow
+ * Double capacity of leaderboard. Mutex shall be locked.
+ *
+ * @return TRUE: if successfully grown.
+ */
+static bool_t grow (leaderboard_t* aLb)
+{
+    uint32_t capacity = aLb->header->capacity * 2;
+
+    if (aLb->fd >= 0 && ftruncate (aLb->fd, LEADERBOARD_HEADER_SIZE
+                                   + (off_t) capacity * sizeof (leaderboard_node_t)) != 0)
+    {
+        printf("%s: cannot grow %s\n", __FUNCTION__, aLb->path);
+        return FALSE;
+    }
+    aLb->header->capacity = capacity;
+
+    return mapNodes (aLb);
+}
+
+/**
+ * @brief addNode
+ * Add record to the index. Mutex shall be locked.
+ *
+ * @return Rank of the new record (0: best). LEADERBOARD_NIL: out of memory.
+ */
+static uint32_t addNode (leaderboard_t* aLb, const record_t* aRecord)
+{
+    leaderboard_node_t* node;
+    uint32_t index = aLb->header->count;
+    uint32_t rank;
+
+    if (index == aLb->header->capacity && !grow (aLb))
+    {
+        return LEADERBOARD_NIL;
+    }
+    /* Older records with the same score stay ahead */
+    rank = rankOf (aLb, aRecord->score);
+    node = &aLb->nodes[index];
+    node->record = *aRecord;
+    node->record.player_name[PLAYER_NAME_LENGTH - 1] = 0;
+    node->seq = index;
+    node->prio = leaderboardRandom (aLb);
+    node->left = LEADERBOARD_NIL;
+    node->right = LEADERBOARD_NIL;
+    node->size = 1;
+    /* Node is valid from now on, tree can be rebuilt if linking is interrupted */
+    aLb->header->count = index + 1;
+    aLb->header->root = treapInsert (aLb, aLb->header->root, index);
+
+    return rank;
+}
+
+/**
+ * @brief initHeader
+ * Set up header of a new or unusable file.
+ */
+static void initHeader (leaderboard_header_t* aHeader, uint8_t aBlockType)
+{
+    memset (aHeader, 0, sizeof (leaderboard_header_t));
+    aHeader->magic = LEADERBOARD_MAGIC;
+    aHeader->version = LEADERBOARD_VERSION;
+    aHeader->block_types = aBlockType;
+    aHeader->capacity = LEADERBOARD_MIN_CAPACITY;
+    aHeader->root = LEADERBOARD_NIL;
+    aHeader->rand = 2463534242u;
+}
+
+/**
+ * @brief openFile
+ * Map leaderboard file of a difficulty. Opening is serialized by flock(),
+ * the first instance after boot initializes mutex and checks the tree.
+ *
+ * @return TRUE: if file is mapped.
+ */
+static bool_t openFile (leaderboard_t* aLb, uint8_t aBlockType)
+{
+    leaderboard_header_t* header;
+    char bootId[LEADERBOARD_BOOT_ID_LENGTH];
+    struct stat st;
+    uint32_t capacity;
+    bool_t ok = TRUE;
+
+    aLb->fd = open (aLb->path, O_RDWR | O_CREAT, 0644);
+    if (aLb->fd < 0)
+    {
+        return FALSE;
+    }
+    flock (aLb->fd, LOCK_EX);
+    if (fstat (aLb->fd, &st) != 0)
+    {
+        ok = FALSE;
+    }
+    if (ok && st.st_size < LEADERBOARD_HEADER_SIZE
+            && ftruncate (aLb->fd, LEADERBOARD_HEADER_SIZE
+                          + LEADERBOARD_MIN_CAPACITY * sizeof (leaderboard_node_t)) != 0)
+    {
+        ok = FALSE;
+    }
+    header = ok ? mmap (NULL, LEADERBOARD_HEADER_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, aLb->fd, 0) : MAP_FAILED;
+    if (header == MAP_FAILED)
+    {
+        flock (aLb->fd, LOCK_UN);
+        close (aLb->fd);
+        aLb->fd = -1;
+        return FALSE;
+    }
+    aLb->header = header;
+    readBootId (bootId);
+    if (header->magic != LEADERBOARD_MAGIC || header->version != LEADERBOARD_VERSION
+            || header->block_types != aBlockType)
+    {
+        if (st.st_size >= LEADERBOARD_HEADER_SIZE)
+        {
+            printf("%s: %s is not a leaderboard, recreated\n", __FUNCTION__, aLb->path);
+        }
+        initHeader (header, aBlockType);
+        memset (header->boot_id, 0, sizeof (header->boot_id));
+        ftruncate (aLb->fd, LEADERBOARD_HEADER_SIZE
+                   + LEADERBOARD_MIN_CAPACITY * sizeof (leaderboard_node_t));
+        fstat (aLb->fd, &st);
+    }
+    if (memcmp (header->boot_id, bootId, LEADERBOARD_BOOT_ID_LENGTH) || !bootId[0])
+    {
+        /* Nobody uses it since boot: mutex can be reset, tree may be torn */
+        capacity = (uint32_t) ((st.st_size - LEADERBOARD_HEADER_SIZE) / sizeof (leaderboard_node_t));
+        if (header->capacity > capacity || header->capacity < LEADERBOARD_MIN_CAPACITY)
+        {
+            header->capacity = capacity;
+        }
+        if (header->count > header->capacity)
+        {
+            header->count = header->capacity;
+        }
+        ok = initMutex (header) && mapNodes (aLb);
+        if (ok)
+        {
+            rebuild (aLb);
+            memcpy (header->boot_id, bootId, LEADERBOARD_BOOT_ID_LENGTH);
+        }
+    }
+    flock (aLb->fd, LOCK_UN);
+
+    return ok;
+}
+
+/**
+ * @brief openMemory
+ * Leaderboard which is not saved, used when the file cannot be mapped.
+ */
+static bool_t openMemory (leaderboard_t* aLb, uint8_t aBlockType)
+{
+    leaderboard_header_t* header;
+
+    aLb->fd = -1;
+    header = mmap (NULL, LEADERBOARD_HEADER_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (header == MAP_FAILED)
+    {
+        return FALSE;
+    }
+    aLb->header = header;
+    initHeader (header, aBlockType);
+
+    return initMutex (header) && mapNodes (aLb);
+}
+
+/**
+ * @brief leaderboardInit
+ * Map leaderboards of all difficulties.
+ *
+ * @param aDir Directory of leaderboard files.
+ * @return TRUE: if successfully initialized.
+ */
+bool_t leaderboardInit (const char* aDir)
+{
+    bool_t ok = TRUE;
+    uint8_t i;
+
+    for (i = 0; i < RECORD_TYPES; i++)
+    {
+        leaderboard_t* lb = &leaderboards[i];
+        uint8_t blockType = i + MIN_BLOCK_TYPES;
+
+        lb->header = NULL;
+        lb->nodes = NULL;
+        lb->mapped = 0;
+        snprintf (lb->path, sizeof (lb->path), "%s" LEADERBOARD_FILENAME, aDir, blockType);
+        if (!openFile (lb, blockType))
+        {
+            printf("%s: cannot map %s, records will not be saved\n", __FUNCTION__, lb->path);
+            if (lb->header)
+            {
+                munmap (lb->header, LEADERBOARD_HEADER_SIZE);
+                lb->header = NULL;
+            }
+            if (lb->fd >= 0)
+            {
+                close (lb->fd);
+            }
+            if (!openMemory (lb, blockType))
+            {
+                lb->header = NULL;
+                ok = FALSE;
+                continue;
+            }
+        }
+        printf("%s: %s, %u records\n", __FUNCTION__, lb->path, lb->header->count);
+    }
+
+    return ok;
+}
+
+/**
+ * @brief leaderboardDone
+ * Unmap leaderboards. Dirty pages are written back by the kernel.
+ */
+void leaderboardDone (void)
+{
+    uint8_t i;
+
+    for (i = 0; i < RECORD_TYPES; i++)
+    {
+        leaderboard_t* lb = &leaderboards[i];
+
+        if (lb->nodes)
+        {
+            munmap (lb->nodes, (size_t) lb->mapped * sizeof (leaderboard_node_t));
+        }
+        if (lb->header)
+        {
+            munmap (lb->header, LEADERBOARD_HEADER_SIZE);
+        }
+        if (lb->fd >= 0)
+        {
+            close (lb->fd);
+        }
+        lb->header = NULL;
+        lb->nodes = NULL;
+        lb->mapped = 0;
+        lb->fd = -1;
+    }
+}
+
+/**
+ * @brief leaderboardCount
+ * @return Number of records of a difficulty.
+ */
+uint32_t leaderboardCount (uint8_t aBlockType)
+{
+    leaderboard_t* lb = &leaderboards[RECORD_TYPE(aBlockType)];
+
+    return lb->header ? __atomic_load_n (&lb->header->count, __ATOMIC_ACQUIRE) : 0;
+}
+
+/**
+ * @brief leaderboardRank
+ * Get position of a new record.
+ *
+ * @param aBlockType Difficulty.
+ * @param aScore     Score of new record.
+ * @return Rank of the record if it would be inserted now (0: best).
+ */
+uint32_t leaderboardRank (uint8_t aBlockType, uint32_t aScore)
+{
+    leaderboard_t* lb = &leaderboards[RECORD_TYPE(aBlockType)];
+    uint32_t rank = 0;
+
+    if (lock (lb))
+    {
+        rank = rankOf (lb, aScore);
+        unlock (lb);
+    }
+
+    return rank;
+}
+
+/**
+ * @brief leaderboardInsert
+ * Add new record, it is visible for other instances at once.
+ *
+ * @return Rank of the new record (0: best).
+ */
+uint32_t leaderboardInsert (uint8_t aBlockType, const record_t* aRecord)
+{
+    leaderboard_t* lb = &leaderboards[RECORD_TYPE(aBlockType)];
+    uint32_t rank = LEADERBOARD_NIL;
+
+    if (lock (lb))
+    {
+        rank = addNode (lb, aRecord);
+        unlock (lb);
+    }
+
+    return rank;
+}
+
+/**
+ * @brief collect
+ * Copy records of subtree in rank order, skipping aFirst records.
+ */
+static uint32_t collect (leaderboard_t* aLb, uint32_t aNode, uint32_t aFirst,
+                         uint32_t aCount, record_t* aRecords)
+{
+    uint32_t n = 0;
+    uint32_t leftSize;
+
+    while (aNode != LEADERBOARD_NIL && n < aCount)
+    {
+        leftSize = SIZE(aLb, NODE(aLb, aNode).left);
+        if (aFirst < leftSize)
+        {
+            n += collect (aLb, NODE(aLb, aNode).left, aFirst, aCount - n, aRecords + n);
+            aFirst = 0;
+        }
+        else
+        {
+            aFirst -= leftSize;
+        }
+        if (aFirst)
+        {
+            aFirst--;
+        }
+        else if (n < aCount)
+        {
+            aRecords[n++] = NODE(aLb, aNode).record;
+        }
+        aNode = NODE(aLb, aNode).right;
+    }
+
+    return n;
+}
+
+/**
+ * @brief leaderboardGet
+ * Get a page of records.
+ *
+ * @param[in]  aBlockType Difficulty.
+ * @param[in]  aFirst     Rank of first record to get (0: best).
+ * @param[in]  aCount     Number of records to get.
+ * @param[out] aRecords   Records.
+ * @return Number of records copied.
+ */
+uint32_t leaderboardGet (uint8_t aBlockType, uint32_t aFirst, uint32_t aCount, record_t* aRecords)
+{
+    leaderboard_t* lb = &leaderboards[RECORD_TYPE(aBlockType)];
+    uint32_t n = 0;
+
+    if (lock (lb))
+    {
+        n = collect (lb, lb->header->root, aFirst, aCount, aRecords);
+        unlock (lb);
+    }
+
+    return n;
+}
+
+/**
+ * @brief leaderboardImport
+ * Fill empty leaderboard with records of old configuration. Its
+ * placeholders are not real games, they are skipped.
+ *
+ * @param aBlockType Difficulty.
+ * @param aRecords   Records in rank order.
+ * @param aCount     Number of records.
+ */
+void leaderboardImport (uint8_t aBlockType, const record_t* aRecords, uint32_t aCount)
+{
+    leaderboard_t* lb = &leaderboards[RECORD_TYPE(aBlockType)];
+    uint32_t i;
+
+    if (!aCount || !lock (lb))
+    {
+        return;
+    }
+    if (!lb->header->count)
+    {
+        for (i = 0; i < aCount; i++)
+        {
+            if (aRecords[i].score <= MAX_RECORD_NUM
+                    && !strcmp (aRecords[i].player_name, LEADERBOARD_NO_NAME))
+            {
+                continue;
+            }
+            addNode (lb, &aRecords[i]);
+        }
+    }
+    unlock (lb);
+}
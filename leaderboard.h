@@ -0,0 +1,73 @@
+/**
+ * @file        leaderboard.h
+ * @brief       Leaderboard store with rank queries
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-09 21:40:12
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_LEADERBOARD_H
+#define INCLUDE_LEADERBOARD_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "game_common.h"
+
+#define LEADERBOARD_FILENAME        "/stboard%u.map"    /* Parameter: number of block types */
+#define LEADERBOARD_MAGIC           0x424C5453u         /* "STLB" */
+#define LEADERBOARD_VERSION         2
+#define LEADERBOARD_HEADER_SIZE     4096    /* Header has its own page, it is never remapped */
+#define LEADERBOARD_MIN_CAPACITY    1024    /* Number of nodes of a new file */
+#define LEADERBOARD_BOOT_ID_LENGTH  40
+#define LEADERBOARD_NIL             0xFFFFFFFFu
+
+/* Name of a record without player. Old configuration was filled with such
+ * records of score 1..MAX_RECORD_NUM as placeholders. */
+#define LEADERBOARD_NO_NAME         "Valaki"
+
+typedef struct
+{
+    record_t record;
+    uint32_t seq;       /* Insertion order: older record is ahead on equal score */
+    uint32_t prio;      /* Heap priority of treap */
+    uint32_t left;      /* Better records */
+    uint32_t right;     /* Worse records */
+    uint32_t size;      /* Number of nodes in subtree */
+} leaderboard_node_t;
+
+/* Shared by all instances, stored at the beginning of the file */
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint8_t block_types;
+    uint8_t reserved;
+    uint32_t capacity;      /* Number of nodes the file has room for */
+    uint32_t count;         /* Number of valid nodes */
+    uint32_t root;          /* Root of treap */
+    uint32_t rand;          /* State of priority generator */
+    char boot_id[LEADERBOARD_BOOT_ID_LENGTH]; /* Boot when mutex was initialized */
+    pthread_mutex_t mutex;  /* Robust, process-shared */
+} leaderboard_header_t;
+
+/* Mapping of one instance */
+typedef struct
+{
+    int fd;                         /* -1: anonymous memory, nothing is saved */
+    leaderboard_header_t* header;
+    leaderboard_node_t* nodes;
+    uint32_t mapped;                /* Number of nodes mapped */
+    char path[FSYS_FILENAME_MAX];
+} leaderboard_t;
+
+bool_t leaderboardInit (const char* aDir);
+void leaderboardDone (void);
+uint32_t leaderboardCount (uint8_t aBlockType);
+uint32_t leaderboardRank (uint8_t aBlockType, uint32_t aScore);
+uint32_t leaderboardInsert (uint8_t aBlockType, const record_t* aRecord);
+uint32_t leaderboardGet (uint8_t aBlockType, uint32_t aFirst, uint32_t aCount, record_t* aRecords);
+void leaderboardImport (uint8_t aBlockType, const record_t* aRecords, uint32_t aCount);
+
+#endif /* INCLUDE_LEADERBOARD_H */
@@ -13,6 +13,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -27,17 +28,38 @@
 
 #include "game_common.h"
 #include "game_gfx.h"
+#include "savefile.h"
+#include "iothread.h"
+#include "journal.h"
+#include "leaderboard.h"
+#include "players.h"
+#include "input.h"
+#include "latency.h"
+#include "playlist.h"
+#include "music.h"
+#include "sfx.h"
+#include "bot.h"
+#include "trace.h"
+#include "overlay.h"
+#include "watchdog.h"
+#include "stats.h"
+#include "telemetry.h"
 
 #define CONFIG_DIR              "/.sometris"
 #define CONFIG_FILENAME         CONFIG_DIR "/stconfig.bin"
 #define GAME_FILENAME           CONFIG_DIR "/stgame.bin"    /**< Saved game */
-//#define PLAYLIST_FILENAME       "playlist.txt"  /**< Path of your music collection (MOD/S3M/XM) */
-//#define PLAYLIST_MEM_LIMIT      (32768)         /**< 32 KiB */
-//#define DEFAULT_MUSIC_FILENAME  "music.mod"
-//#define SOUND_FREQ_HZ           44100
-//#define SOUND_CHANNELS          1       /* 1: mono, 2: stereo, FIXME stereo decoding not OK! */
-//#define OS_DIR_SEP_CHR          '\\'
-//#define OS_DIR_SEP_STR          "\\"
+#define JOURNAL_FILENAME        CONFIG_DIR "/stgame.jn%u"   /**< Journal of saved game, two generations */
+#define TRACE_FILENAME          CONFIG_DIR "/trace%u.json"  /**< Chrome trace, see ENABLE_TRACE */
+#define WATCHDOG_FILENAME       CONFIG_DIR "/slowframe%u.log" /**< Slow frames, two generations */
+#define FIGURES_FILENAME        CONFIG_DIR "/figures.col"   /**< Telemetry of figures */
+#define GAMES_FILENAME          CONFIG_DIR "/games.col"     /**< Telemetry of games */
+#define JOURNAL_CHECKPOINT_RECORDS  100                     /**< Save whole game after this number of moves */
+#define JOURNAL_CHECKPOINT_TICKS    (30 * OS_TICKS_PER_SEC) /**< Save whole game this often if there were moves */
+#define CONFIG_FORMAT_VERSION   1   /**< Version of tagged configuration file */
+#define GAME_FORMAT_VERSION     1   /**< Version of tagged saved game file */
+#define LEGACY_CONFIG_VERSION   6   /**< Raw config_t dump of v1.2.1 */
+#define LEGACY_GAME_VERSION     1   /**< Raw game_t dump of v1.2.1 */
+#define GAME_MAP_PACKED_SIZE    ((MAP_SIZE_X * MAP_SIZE_Y + 1) / 2)
 
 #define MAX_KEYS                6
 #define KEY_UP                  0
@@ -48,21 +70,74 @@
 #define KEY_SPACE               5
 
 #define FAST_REPEAT_TICK        150
+#define IDLE_WAIT_MAX_US        1000000 /**< Idle loop wakes up at least this often */
+#define LATE_INIT_POLL_US       10000   /**< Idle loop wakes up this often until lateInit() is done */
 #define NORMAL_REPEAT_TICK      250
 
-typedef struct linkedListElement_tag
+#define STARTUP_TRACE_MAX       16
+
+/* Records of configuration file. Never renumber them! */
+typedef enum
+{
+    CONFIG_TAG_VOLUME = 1,
+    CONFIG_TAG_MUSIC_PAUSED,
+    CONFIG_TAG_GAME_COUNTER,
+    CONFIG_TAG_PLAYER_IDX,      /* Only read, imported into the player store */
+    CONFIG_TAG_PLAYER_NAME,     /* Index (1), name. Only read, imported into the player store */
+    CONFIG_TAG_RECORD,          /* Record type (1), position (1), level (1), score (4), name.
+                                   Only read to import into the leaderboard. */
+    CONFIG_TAG_MUSIC_FILE_PATH,
+    CONFIG_TAG_PLAYER           /* Name of selected player */
+} config_tag_t;
+
+/* Records of saved game file. Never renumber them! */
+typedef enum
+{
+    GAME_TAG_MAP = 1,           /* Size X (1), size Y (1), cells (4 bits each) */
+    GAME_TAG_FIGURE,            /* X (1), Y (1), vertical (1), blocks (FIGURE_SIZE) */
+    GAME_TAG_FIGURE_COUNTER,
+    GAME_TAG_SCORE,
+    GAME_TAG_BLOCK_TYPES,
+    GAME_TAG_LEVEL,
+    GAME_TAG_JOURNAL,           /* Game ID (4), sequence number (4) */
+    GAME_TAG_LONGEST_CASCADE
+} game_tag_t;
+
+/* Configuration of v1.2.1, it was saved as raw dump */
+typedef struct
 {
-    void* item;                            /* Data to store in the element */
-    struct linkedListElement_tag* next;    /* Next element, NULL if it is the last one. */
-    struct linkedListElement_tag* prev;    /* Previous element, NULL if it is the first one. */
-    uint16_t pos;
-} linkedListElement_t;
+    uint8_t version;
+    uint8_t volume;
+    bool_t music_paused;
+    uint32_t game_counter;
+    uint8_t player_idx;
+    char player_names[MAX_PLAYERS][PLAYER_NAME_LENGTH];
+    record_t records[RECORD_TYPES][MAX_RECORD_NUM];
+    char music_file_path[FSYS_FILENAME_MAX];
+} legacy_config_t;
+
+typedef struct
+{
+    const char* phase;      /* Name of finished startup phase */
+    uint64_t timeUs;        /* Time when the phase finished, see getTimeUs() */
+} startup_trace_t;
+
+/* Steps of lateInit(), one is done in an iteration of the game loop */
+typedef enum
+{
+    LATE_INIT_load,         /* Configuration, records and saved game */
+    LATE_INIT_playlist,
+    LATE_INIT_scan,         /* Walkers are reading directories */
+    LATE_INIT_sfx,
+    LATE_INIT_music,
+    LATE_INIT_done
+} late_init_step_t;
 
 typedef struct
 {
   bool_t pressed;
   bool_t changed;
-  uint32_t pressTick;
+  uint64_t repeatUs;    /* Time of next auto-repeat, counted from the press */
   uint32_t repeatTick;
 } mykey_t;
 
@@ -98,20 +173,23 @@ uint16_t     key_delta_widx = 0;
 uint16_t     key_delta_ridx = 0;
 
 bool_t       can_load_game = FALSE;
+uint32_t     journal_game_id = 0;       /**< Identifier of actual game's journal, 0: no journal */
+uint32_t     journal_seq = 0;           /**< Sequence number of last checkpoint */
+uint32_t     journal_checkpoint_tick = 0; /**< Time of last checkpoint */
+bool_t       late_init_done = FALSE;    /**< TRUE: non-critical initialization is done. @see lateInit */
+late_init_step_t late_init_step = LATE_INIT_load;
+uint64_t     late_init_max_us = 0;      /**< Longest step of lateInit, input waited this much at most */
+
+/* Startup profiling */
+bool_t       startup_profile = FALSE;   /**< TRUE: print startup trace (--startup-profile) */
+uint32_t     loop_delay_us = 10000;     /**< Sleep of game loop (--loop-delay-us) */
+bool_t       screen_dirty = TRUE;       /**< Screen of an idle state shall be drawn again */
+uint64_t     startup_time_us = 0;       /**< Time when main() was entered */
+startup_trace_t startup_trace[STARTUP_TRACE_MAX];
+uint8_t      startup_trace_cntr = 0;
 
 /* Music playing */
 bool_t       music_initted = FALSE;
-bool_t       playlist_loaded = FALSE;
-linkedListElement_t* playlist_first = NULL;     /**< First MOD file name */
-linkedListElement_t* playlist_last = NULL;      /**< Last MOD file name */
-linkedListElement_t* playlist_actual = NULL;    /**< Actual file name in playlist which is played */
-linkedListElement_t** playlist_it = NULL;       /**< Playlist iterator. Used to build playlist. */
-linkedListElement_t* playlist_it_prev = NULL;   /**< Playlist previous element. Used to build playlist. */
-uint32_t     playlist_file_cntr = 0;            /**< Number of files in the playlist */
-uint32_t     playlist_file_pos = 0;             /**< Current file's number. */
-size_t       playlist_mem_size = 0; /**< Allocated memory for playlist. */
-char         musicFileName[16];
-char         musicFilePath[FSYS_FILENAME_MAX];
 bool_t       playEnd = FALSE;
 
 mykey_t      keys[MAX_KEYS] = { 0 };
@@ -130,6 +208,15 @@ mykey_t      keys[MAX_KEYS] = { 0 };
 #define enterChanged  keys[KEY_ENTER].changed
 #define spaceChanged  keys[KEY_SPACE].changed
 
+/* Records of old configuration, imported into the leaderboard */
+record_t     legacy_records[RECORD_TYPES][MAX_RECORD_NUM];
+bool_t       legacy_records_found = FALSE;
+/* Players of old configuration, imported into the player store */
+char         legacy_player_names[MAX_PLAYERS][PLAYER_NAME_LENGTH];
+uint8_t      legacy_player_idx = 0;
+bool_t       legacy_players_found = FALSE;
+uint32_t     last_record_rank = LEADERBOARD_NIL;
+
 /* Default configuration, could be overwritten by loadConfig() */
 config_t config =
 {
@@ -137,7 +224,7 @@ config_t config =
     .volume = (VOLUME_MAX - VOLUME_MIN) / 2,
     .music_paused = FALSE,
     .game_counter = 0,
-    .player_idx = 0,
+    .player_name = { 0 },
     .music_file_path = { 0 }
 };
 
@@ -145,632 +232,786 @@ config_t config =
 SDL_Surface* background = NULL;
 SDL_Surface* screen = NULL;
 bool_t textInputIsStarted = FALSE;
+bool_t textInputSpace = TRUE;   /* FALSE: space is not typed into text */
 char * text = NULL;
 uint32_t textLength = 0;
 
+/* Name picker */
+char picker_prefix[PLAYER_NAME_LENGTH];     /* Typed beginning of name */
+char picker_last_prefix[PLAYER_NAME_LENGTH];
+uint32_t picker_first = 0;                  /* Number of matching players before page */
+uint8_t picker_row = 0;                     /* Selected row of page */
+char new_player_name[PLAYER_NAME_LENGTH];
+
 /**
- * Set up default configuration and load if configuration file exists.
+ * @brief getFilePath
+ * Get path of a file in the configuration directory.
+ *
+ * @param[out] aPath     Path of the file.
+ * @param[in]  aSize     Size of aPath buffer.
+ * @param[in]  aFileName File name, for example CONFIG_FILENAME.
+ * @return aPath
  */
-void loadConfig (void)
+char* getFilePath (char* aPath, size_t aSize, const char* aFileName)
 {
-    uint16_t i, j;
-    FILE* configFile;
-    config_t configTemp;
-    uint8_t path[256];
+    snprintf (aPath, aSize, "%s%s", homeDir, aFileName);
 
-    drawInfoScreen ("Loading configuration...");
+    return aPath;
+}
 
-    /* Fill records with default data */
-    for (j = 0; j < RECORD_TYPES; j++)
+/**
+ * @brief serializeConfig
+ * Convert current configuration to save file format.
+ *
+ * @param[out] aBuf  Output buffer.
+ * @param[in]  aSize Size of output buffer.
+ * @return Length of serialized configuration. 0: buffer is too small.
+ */
+uint32_t serializeConfig (uint8_t* aBuf, uint32_t aSize)
+{
+    save_writer_t writer;
+
+    saveWriterInit (&writer, aBuf, aSize, SAVEFILE_MAGIC_CONFIG, CONFIG_FORMAT_VERSION);
+    saveWriteU8 (&writer, CONFIG_TAG_VOLUME, config.volume);
+    saveWriteU8 (&writer, CONFIG_TAG_MUSIC_PAUSED, config.music_paused);
+    saveWriteU32 (&writer, CONFIG_TAG_GAME_COUNTER, config.game_counter);
+    saveWriteString (&writer, CONFIG_TAG_PLAYER, config.player_name, PLAYER_NAME_LENGTH - 1);
+    saveWriteString (&writer, CONFIG_TAG_MUSIC_FILE_PATH, config.music_file_path,
+                     sizeof (config.music_file_path) - 1);
+
+    return saveWriterFinish (&writer);
+}
+
+/**
+ * @brief parseConfig
+ * Load known records of configuration file. Missing records keep their
+ * default values, unknown ones (written by a newer version) are skipped.
+ */
+void parseConfig (save_reader_t* aReader)
+{
+    uint16_t tag;
+    const uint8_t* data;
+    uint16_t length;
+
+    if (aReader->version > CONFIG_FORMAT_VERSION)
     {
-        for (i = 0; i < MAX_RECORD_NUM; i++)
-        {
-            strcpy (config.records[j][i].player_name, "Valaki");
-            config.records[j][i].score = MAX_RECORD_NUM - i;
-        }
+        printf("%s: configuration of newer version (%i), unknown fields are ignored\n",
+               __FUNCTION__, aReader->version);
     }
-    /* All user names are empty by default */
-    for (i = 0; i < MAX_PLAYERS; i++)
+    while (saveReadNext (aReader, &tag, &data, &length))
     {
-        config.player_names[i][0] = 0;
+        switch (tag)
+        {
+            case CONFIG_TAG_VOLUME:
+                if (length >= 1 && data[0] <= VOLUME_MAX)
+                {
+                    config.volume = data[0];
+                }
+                break;
+            case CONFIG_TAG_MUSIC_PAUSED:
+                if (length >= 1)
+                {
+                    config.music_paused = data[0] ? TRUE : FALSE;
+                }
+                break;
+            case CONFIG_TAG_GAME_COUNTER:
+                if (length >= 4)
+                {
+                    config.game_counter = GET_LE32 (data);
+                }
+                break;
+            case CONFIG_TAG_PLAYER_IDX:
+                if (length >= 1 && data[0] < MAX_PLAYERS)
+                {
+                    legacy_player_idx = data[0];
+                }
+                break;
+            case CONFIG_TAG_PLAYER_NAME:
+                if (length >= 1 && data[0] < MAX_PLAYERS)
+                {
+                    saveReadString (legacy_player_names[data[0]], PLAYER_NAME_LENGTH,
+                                    data + 1, length - 1);
+                    legacy_players_found = TRUE;
+                }
+                break;
+            case CONFIG_TAG_PLAYER:
+                saveReadString (config.player_name, sizeof (config.player_name), data, length);
+                break;
+            case CONFIG_TAG_RECORD:
+                if (length >= 7 && data[0] < RECORD_TYPES && data[1] < MAX_RECORD_NUM)
+                {
+                    record_t* record = &legacy_records[data[0]][data[1]];
+
+                    record->level = data[2];
+                    record->score = GET_LE32 (&data[3]);
+                    saveReadString (record->player_name, PLAYER_NAME_LENGTH,
+                                    data + 7, length - 7);
+                    legacy_records_found = TRUE;
+                }
+                break;
+            case CONFIG_TAG_MUSIC_FILE_PATH:
+                saveReadString (config.music_file_path, sizeof (config.music_file_path),
+                                data, length);
+                break;
+            default:
+                /* Unknown record */
+                break;
+        }
     }
-    strncpy(path, homeDir, sizeof(path));
-    strncat(path, CONFIG_FILENAME, sizeof(path));
+}
+
+/**
+ * Set up default configuration and load if configuration file exists.
+ */
+void loadConfig (void)
+{
+    uint16_t i;
+    char path[FSYS_FILENAME_MAX];
+    uint8_t buf[SAVEFILE_MAX_SIZE];
+    int32_t length;
+    save_reader_t reader;
+    legacy_config_t legacy;
+
+    getFilePath (path, sizeof (path), CONFIG_FILENAME);
     printf("%s: %s\n", __FUNCTION__, path);
-    configFile = fopen (path, "rb");
-    if (configFile)
+    length = saveFileRead (path, buf, sizeof (buf));
+    if (length > 0)
     {
-        size_t size;
-        size = fread (&configTemp, 1, sizeof (configTemp), configFile);
-        if (size == sizeof (configTemp) && configTemp.version == config.version)
+        if (saveReaderInit (&reader, buf, length, SAVEFILE_MAGIC_CONFIG))
+        {
+            parseConfig (&reader);
+        }
+        else if (length == sizeof (legacy_config_t) && buf[0] == LEGACY_CONFIG_VERSION)
+        {
+            /* Raw configuration of v1.2.1, it will be saved in new format */
+            printf("%s: migrating old configuration\n", __FUNCTION__);
+            memcpy (&legacy, buf, sizeof (legacy));
+            config.volume = legacy.volume;
+            config.music_paused = legacy.music_paused;
+            config.game_counter = legacy.game_counter;
+            legacy_player_idx = legacy.player_idx < MAX_PLAYERS ? legacy.player_idx : 0;
+            memcpy (legacy_player_names, legacy.player_names, sizeof (legacy_player_names));
+            legacy_players_found = TRUE;
+            memcpy (legacy_records, legacy.records, sizeof (legacy_records));
+            legacy_records_found = TRUE;
+            memcpy (config.music_file_path, legacy.music_file_path, sizeof (config.music_file_path));
+            config.music_file_path[sizeof (config.music_file_path) - 1] = 0;
+            for (i = 0; i < MAX_PLAYERS; i++)
+            {
+                legacy_player_names[i][PLAYER_NAME_LENGTH - 1] = 0;
+            }
+        }
+        else
         {
-            /* Configuration is OK, copy it */
-            memcpy (&config, &configTemp, sizeof (config));
+            printf("%s: invalid configuration, using defaults\n", __FUNCTION__);
         }
-        fclose (configFile);
     }
 }
 
 /**
- * Save current configuration.
+ * Save current configuration. The file is written by the I/O thread.
  */
 bool_t saveConfig (void)
 {
     bool_t ok = FALSE;
-    FILE* configFile;
-    uint8_t path[256];
-
-    drawInfoScreen ("Saving configuration...");
+    char path[FSYS_FILENAME_MAX];
+    uint8_t buf[SAVEFILE_MAX_SIZE];
+    uint32_t length;
 
-    strncpy (config.music_file_path, musicFilePath, sizeof (config.music_file_path));
-    strncpy(path, homeDir, sizeof(path));
-    strncat(path, CONFIG_FILENAME, sizeof(path));
-    printf("%s: %s\n", __FUNCTION__, path);
-    configFile = fopen (path, "wb");
-    if (configFile)
+    if (music_initted && playlist_loaded)
     {
-        size_t size;
-        size = fwrite (&config, 1, sizeof (config), configFile);
-        if (size == sizeof (config))
+        music_status_t music;
+
+        /* Keep position of a playlist which is not available now */
+        musicGetStatus (&music);
+        if (music.playing)
         {
-            ok = TRUE;
+            snprintf (config.music_file_path, sizeof (config.music_file_path), "%s", music.file_path);
         }
-        fclose (configFile);
+    }
+    length = serializeConfig (buf, sizeof (buf));
+    getFilePath (path, sizeof (path), CONFIG_FILENAME);
+    printf("%s: %s\n", __FUNCTION__, path);
+    if (length && ioWriteFile (path, buf, length))
+    {
+        ok = TRUE;
     }
     else
     {
-      drawInfoScreen("Cannot save configuration!");
-      SDL_Delay(500);
+        printf("%s: cannot save configuration!\n", __FUNCTION__);
     }
 
     return ok;
 }
 
 /**
- * Check whether valid saved game exists.
+ * @brief serializeGame
+ * Convert actual game to save file format.
+ *
+ * @param[out] aBuf  Output buffer.
+ * @param[in]  aSize Size of output buffer.
+ * @return Length of serialized game. 0: buffer is too small.
  */
-bool_t canLoadGame (void)
+uint32_t serializeGame (uint8_t* aBuf, uint32_t aSize)
 {
-    FILE* gameFile;
-    bool_t canLoad = FALSE;
-    uint8_t version;
-    uint8_t path[256];
-
-    strncpy(path, homeDir, sizeof(path));
-    strncat(path, GAME_FILENAME, sizeof(path));
-    printf("%s: %s\n", __FUNCTION__, path);
-    gameFile = fopen (path, "rb");
-    if (gameFile)
+    save_writer_t writer;
+    uint8_t data[2 + GAME_MAP_PACKED_SIZE] = { 0 };
+    uint8_t x, y;
+    uint16_t i;
+
+    saveWriterInit (&writer, aBuf, aSize, SAVEFILE_MAGIC_GAME, GAME_FORMAT_VERSION);
+    /* Two cells per byte */
+    data[0] = MAP_SIZE_X;
+    data[1] = MAP_SIZE_Y;
+    for (y = 0; y < MAP_SIZE_Y; y++)
     {
-        size_t size;
-        size = fread (&version, 1, sizeof (version), gameFile);
-        if (size == sizeof (version) && version == game.version)
+        for (x = 0; x < MAP_SIZE_X; x++)
         {
-            canLoad = TRUE;
+            i = y * MAP_SIZE_X + x;
+            data[2 + i / 2] |= MAP(x, y) << ((i & 1) * 4);
         }
-        fclose (gameFile);
     }
-
-    return canLoad;
+    saveWriteBytes (&writer, GAME_TAG_MAP, data, 2 + GAME_MAP_PACKED_SIZE);
+    data[0] = game.figure_x;
+    data[1] = game.figure_y;
+    data[2] = game.figure_is_vertical;
+    memcpy (&data[3], game.figure, FIGURE_SIZE);
+    saveWriteBytes (&writer, GAME_TAG_FIGURE, data, 3 + FIGURE_SIZE);
+    saveWriteU32 (&writer, GAME_TAG_FIGURE_COUNTER, game.figure_counter);
+    saveWriteU32 (&writer, GAME_TAG_SCORE, game.score);
+    saveWriteU8 (&writer, GAME_TAG_BLOCK_TYPES, game.block_types);
+    saveWriteU8 (&writer, GAME_TAG_LEVEL, game.level);
+    PUT_LE32 (&data[0], journal_game_id);
+    PUT_LE32 (&data[4], journal_seq);
+    saveWriteBytes (&writer, GAME_TAG_JOURNAL, data, 8);
+    saveWriteU8 (&writer, GAME_TAG_LONGEST_CASCADE, game.longest_cascade);
+
+    return saveWriterFinish (&writer);
 }
 
 /**
- * Load saved game.
+ * @brief parseGame
+ * Load known records of a saved game.
+ *
+ * @param[in]  aReader Reader of save file.
+ * @param[out] aGame   Game to fill. Missing records are not changed.
+ * @param[out] aGameId Identifier of game's journal. 0: no journal.
+ * @param[out] aSeq    Sequence number of checkpoint.
  */
-void loadGame (void)
+void parseGame (save_reader_t* aReader, game_t* aGame, uint32_t* aGameId, uint32_t* aSeq)
 {
-    FILE* gameFile;
-    game_t gameTemp;
-    uint8_t path[256];
+    uint16_t tag;
+    const uint8_t* data;
+    uint16_t length;
+    uint16_t i;
 
-    drawInfoScreen ("Loading game...");
-
-    strncpy(path, homeDir, sizeof(path));
-    strncat(path, GAME_FILENAME, sizeof(path));
-    printf("%s: %s\n", __FUNCTION__, path);
-    gameFile = fopen (path, "rb");
-    if (gameFile)
+    while (saveReadNext (aReader, &tag, &data, &length))
     {
-        size_t size;
-        size = fread (&gameTemp, 1, sizeof (gameTemp), gameFile);
-        if (size == sizeof (gameTemp) && gameTemp.version == game.version)
+        switch (tag)
         {
-            /* Configuration is OK, copy it */
-            memcpy (&game, &gameTemp, sizeof (game));
+            case GAME_TAG_MAP:
+                if (length == 2 + GAME_MAP_PACKED_SIZE
+                        && data[0] == MAP_SIZE_X && data[1] == MAP_SIZE_Y)
+                {
+                    for (i = 0; i < MAP_SIZE_X * MAP_SIZE_Y; i++)
+                    {
+                        aGame->map[i / MAP_SIZE_X][i % MAP_SIZE_X] = (data[2 + i / 2] >> ((i & 1) * 4)) & 0x0F;
+                    }
+                }
+                break;
+            case GAME_TAG_FIGURE:
+                if (length >= 3 + FIGURE_SIZE)
+                {
+                    aGame->figure_x = data[0];
+                    aGame->figure_y = data[1];
+                    aGame->figure_is_vertical = data[2] ? TRUE : FALSE;
+                    memcpy (aGame->figure, &data[3], FIGURE_SIZE);
+                }
+                break;
+            case GAME_TAG_FIGURE_COUNTER:
+                if (length >= 4)
+                {
+                    aGame->figure_counter = GET_LE32 (data);
+                }
+                break;
+            case GAME_TAG_SCORE:
+                if (length >= 4)
+                {
+                    aGame->score = GET_LE32 (data);
+                }
+                break;
+            case GAME_TAG_BLOCK_TYPES:
+                if (length >= 1 && data[0] >= MIN_BLOCK_TYPES && data[0] <= MAX_BLOCK_TYPES)
+                {
+                    aGame->block_types = data[0];
+                }
+                break;
+            case GAME_TAG_LEVEL:
+                if (length >= 1)
+                {
+                    aGame->level = data[0];
+                }
+                break;
+            case GAME_TAG_JOURNAL:
+                if (length >= 8)
+                {
+                    *aGameId = GET_LE32 (&data[0]);
+                    *aSeq = GET_LE32 (&data[4]);
+                }
+                break;
+            case GAME_TAG_LONGEST_CASCADE:
+                if (length >= 1)
+                {
+                    aGame->longest_cascade = data[0];
+                }
+                break;
+            default:
+                /* Unknown record */
+                break;
         }
-        fclose (gameFile);
     }
 }
 
 /**
- * Save actual game.
+ * @brief isValidGame
+ * Check ranges of a loaded game, the rules index the map by its fields.
+ * Blocks are checked against MAX_BLOCK_TYPES, not the difficulty: the
+ * first figure is generated before the difficulty is selected.
+ *
+ * @return TRUE: figure is on the map, blocks and level are in range.
  */
-bool_t saveGame (void)
+static bool_t isValidGame (const game_t* aGame)
 {
-    bool_t ok = FALSE;
-    FILE* gameFile;
-    uint8_t path[256];
-
-    drawInfoScreen ("Saving game...");
+    uint8_t x, y, i;
 
-    strncpy(path, homeDir, sizeof(path));
-    strncat(path, GAME_FILENAME, sizeof(path));
-    printf("%s: %s\n", __FUNCTION__, path);
-    gameFile = fopen (path, "wb");
-    if (gameFile)
+    if (aGame->block_types < MIN_BLOCK_TYPES || aGame->block_types > MAX_BLOCK_TYPES
+            || aGame->level < 1 || aGame->level > MAX_LEVEL)
+    {
+        return FALSE;
+    }
+    if (aGame->figure_is_vertical
+            ? aGame->figure_x >= MAP_SIZE_X || aGame->figure_y > MAP_SIZE_Y - FIGURE_SIZE
+            : aGame->figure_x > MAP_SIZE_X - FIGURE_SIZE || aGame->figure_y >= MAP_SIZE_Y)
+    {
+        return FALSE;
+    }
+    for (i = 0; i < FIGURE_SIZE; i++)
     {
-        size_t size;
-        size = fwrite (&game, 1, sizeof (game), gameFile);
-        if (size == sizeof (game))
+        if (!aGame->figure[i] || aGame->figure[i] > MAX_BLOCK_TYPES)
         {
-            ok = TRUE;
+            return FALSE;
+        }
+    }
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        for (x = 0; x < MAP_SIZE_X; x++)
+        {
+            if (aGame->map[y][x] > MAX_BLOCK_TYPES)
+            {
+                return FALSE;
+            }
         }
-        fclose (gameFile);
     }
 
-    return ok;
+    return TRUE;
 }
 
 /**
- * Delete saved game.
+ * @brief getJournalPath
+ * Get path of journal. Checkpoints use two journal files alternately.
+ *
+ * @param[out] aPath Path of journal.
+ * @param[in]  aSize Size of aPath buffer.
+ * @param[in]  aSeq  Sequence number of checkpoint.
+ * @return aPath
  */
-void deleteGame (void)
+char* getJournalPath (char* aPath, size_t aSize, uint32_t aSeq)
 {
-    remove (GAME_FILENAME);
-    can_load_game = FALSE;
+    snprintf (aPath, aSize, "%s" JOURNAL_FILENAME, homeDir, aSeq & 1u);
+
+    return aPath;
 }
 
 /**
- * Check if current score should be recorded.
+ * @brief readGame
+ * Read saved game file and replay its journal. If the replayed game is
+ * out of range, the checkpoint is used without the journal.
  *
- * @return 0xFF is current score is not to be recorded. Otherwise: record position.
+ * @param[out] aGame Loaded game. It shall be initialized with defaults.
+ * @return TRUE: valid saved game was read.
  */
-uint8_t getNewRecordPos (uint8_t aBlockType, uint8_t aScore)
+bool_t readGame (game_t* aGame)
 {
-    uint8_t i;
-    uint8_t pos = 0xFF;
-
-    for (i = 0; i < MAX_RECORD_NUM; i++)
+    bool_t ok = FALSE;
+    char path[FSYS_FILENAME_MAX];
+    uint8_t buf[SAVEFILE_MAX_SIZE];
+    int32_t length;
+    save_reader_t reader;
+    uint32_t gameId = 0;
+    uint32_t seq = 0;
+    int32_t records, more;
+    game_t checkpoint;
+    uint64_t startUs = getTimeUs ();
+
+    getFilePath (path, sizeof (path), GAME_FILENAME);
+    printf("%s: %s\n", __FUNCTION__, path);
+    length = saveFileRead (path, buf, sizeof (buf));
+    if (length > 0)
     {
-        if (aScore > config.records[RECORD_TYPE(aBlockType)][i].score)
+        if (saveReaderInit (&reader, buf, length, SAVEFILE_MAGIC_GAME))
         {
-            pos = i;
-            break;
+            parseGame (&reader, aGame, &gameId, &seq);
+            ok = TRUE;
+        }
+        else if (length == sizeof (game_t) && buf[0] == LEGACY_GAME_VERSION)
+        {
+            /* Raw game of v1.2.1, new fields were padding */
+            memcpy (aGame, buf, offsetof (game_t, longest_cascade));
+            aGame->longest_cascade = 0;
+            ok = TRUE;
+        }
+    }
+    if (ok && !isValidGame (aGame))
+    {
+        printf("%s: game is out of range\n", __FUNCTION__);
+        ok = FALSE;
+    }
+    if (ok && gameId)
+    {
+        /* Moves after the checkpoint. If the next checkpoint was not
+         * written yet, its journal continues this one. */
+        checkpoint = *aGame;
+        records = journalReplay (getJournalPath (path, sizeof (path), seq), gameId, seq, aGame);
+        if (records >= 0)
+        {
+            more = journalReplay (getJournalPath (path, sizeof (path), seq + 1), gameId, seq + 1, aGame);
+            if (more > 0)
+            {
+                records += more;
+            }
+            printf("%s: %i moves replayed in %u us\n", __FUNCTION__, records,
+                   (uint32_t) (getTimeUs () - startUs));
+        }
+        if (!isValidGame (aGame))
+        {
+            /* Records passed their CRC, but the rules shall not index
+             * the map by what they contain */
+            printf("%s: replayed game is out of range, checkpoint is loaded\n", __FUNCTION__);
+            *aGame = checkpoint;
         }
     }
 
-    return pos;
+    return ok;
 }
 
 /**
- * Put record into right position. Configuration shall be saved.
- * @see saveConfig()
+ * Check whether valid saved game exists.
  */
-void insertRecord (uint8_t aBlockType, uint8_t aScore)
+bool_t canLoadGame (void)
 {
-    uint8_t i;
-    uint8_t pos;
-
-    pos = getNewRecordPos (aBlockType, aScore);
+    game_t gameTemp = game;
 
-    if (pos != 0xFF)
-    {
-        /* Shift down */
-        for (i = MAX_RECORD_NUM - 1; i > pos; i--)
-        {
-            memcpy (&config.records[RECORD_TYPE(aBlockType)][i],
-                    &config.records[RECORD_TYPE(aBlockType)][i - 1], sizeof (record_t));
-        }
-        /* Insert new record */
-        strncpy (config.records[RECORD_TYPE(aBlockType)][pos].player_name,
-                 config.player_names[config.player_idx], PLAYER_NAME_LENGTH);
-        config.records[RECORD_TYPE(aBlockType)][pos].level = game.level;
-        config.records[RECORD_TYPE(aBlockType)][pos].score = game.score;
-    }
+    return readGame (&gameTemp);
 }
 
-void startTextInput(char * atext, uint32_t length)
+/**
+ * Load saved game.
+ */
+void loadGame (void)
 {
-  textInputIsStarted = TRUE;
-  text = atext;
-  textLength = length;
-}
+    game_t gameTemp = game;
 
-void stopTextInput(void)
-{
-  if (textInputIsStarted)
-  {
-    textInputIsStarted = FALSE;
-  }
+    drawInfoScreen ("Loading game...");
+
+    if (readGame (&gameTemp))
+    {
+        /* Saved game is OK, copy it */
+        memcpy (&game, &gameTemp, sizeof (game));
+    }
 }
 
-#if 0
 /**
- * @brief getFileName
- * Return filename from full path.
- * @param[out]  aFileName       Filename from full path. Example: "DATA.DAT"
- * @param[in]   aPath           Full path. Example: "A:\\GAME\\\DATA.DAT"
- * @param[in]   aFileNameLength Size of aFileName buffer.
- * @return
+ * Save actual game as checkpoint of the journal.
+ * The file is written by the I/O thread.
  */
-char* getFileName (char* aFileName, const char* aPath, size_t aFileNameLength)
+bool_t saveGame (void)
 {
-    char *pos;
+    bool_t ok = FALSE;
+    char path[FSYS_FILENAME_MAX];
+    uint8_t buf[SAVEFILE_MAX_SIZE];
+    uint32_t length;
 
-    pos = strrchr (aPath, OS_DIR_SEP_CHR);
-    if (pos)
-    {
-        ++pos;
-        strncpy (aFileName, pos, aFileNameLength);
-    }
-    else
+    length = serializeGame (buf, sizeof (buf));
+    getFilePath (path, sizeof (path), GAME_FILENAME);
+    printf("%s: %s\n", __FUNCTION__, path);
+    if (length && ioWriteFile (path, buf, length))
     {
-        /* Directory separator (\) not found */
-        strncpy (aFileName, aPath, aFileNameLength);
+        ok = TRUE;
     }
 
-    return aFileName;
+    return ok;
 }
 
 /**
- * Allocate memory for a new element of linked list.
+ * @brief checkpointGame
+ * Save whole game and continue in a new journal. The journal file of the
+ * new sequence number replaces the one before the previous checkpoint.
+ * Both are queued to the I/O thread, which writes them in order after the
+ * pending jobs, so the previous checkpoint is on the disk by then. Nothing
+ * waits for the disk.
  *
- * @param[in] aItem Linked list item to store.
- * @param[in] aPrev Previous linked list item.
- * @param[in] aPos Number of linked list item.
+ * @param aForce TRUE: queue it after the pending previous checkpoint.
+ *               FALSE: do nothing if the previous one is still pending.
+ * @return TRUE: checkpoint was queued.
  */
-linkedListElement_t* addElement (void* aItem, linkedListElement_t* aPrev, uint16_t aPos)
+bool_t checkpointGame (bool_t aForce)
 {
-    linkedListElement_t* linkedList = NULL;
+    char path[FSYS_FILENAME_MAX];
 
-    linkedList = malloc (sizeof (linkedListElement_t));
-    if (linkedList)
+    if (!aForce && !ioIsIdle ())
     {
-        linkedList->item = aItem;
-        linkedList->prev = aPrev;
-        linkedList->pos = aPos;
+        return FALSE;
     }
+    /* Moves from now on belong to the new checkpoint */
+    journalClose ();
+    journal_seq++;
+    if (!saveGame ())
+    {
+        journal_seq--;
+        return FALSE;
+    }
+    journalOpen (getJournalPath (path, sizeof (path), journal_seq), journal_game_id, journal_seq);
+    journal_checkpoint_tick = SDL_GetTicks ();
 
-    return linkedList;
+    return TRUE;
 }
 
 /**
- * @brief freeElement
- * Releases memory of a linked list's item and linked list element too.
- *
- * @param aLinkedList
- * @return
+ * @brief startJournal
+ * Start journaling actual game with a new game identifier.
  */
-linkedListElement_t* freeElement (linkedListElement_t* aLinkedList)
+void startJournal (void)
 {
-    linkedListElement_t* next = NULL;
+    do
+    {
+        journal_game_id = (uint32_t) time (NULL) ^ (uint32_t) getTimeUs () ^ ((uint32_t) rand () << 8);
+    } while (!journal_game_id);
+    journal_seq = 0;
+    checkpointGame (TRUE);
+}
 
-    if (aLinkedList)
+/**
+ * @brief checkpointIfNeeded
+ * Save whole game periodically, so the journal does not grow forever.
+ */
+void checkpointIfNeeded (void)
+{
+    if (journal_game_id
+            && (!journalIsOpen ()
+                || (journal_records >= JOURNAL_CHECKPOINT_RECORDS)
+                || (journal_records
+                    && SDL_GetTicks () - journal_checkpoint_tick >= JOURNAL_CHECKPOINT_TICKS)))
     {
-        next = aLinkedList->next;
-        if (aLinkedList->item)
-        {
-            free (aLinkedList->item);
-        }
-        free (aLinkedList);
+        checkpointGame (FALSE);
     }
-
-    return next;
 }
 
 /**
- * @brief freeLinkedList
- * @param aFirstLinkedList
+ * Delete saved game and its journal.
  */
-void freeLinkedList (linkedListElement_t* aFirstLinkedList)
+void deleteGame (void)
 {
-    linkedListElement_t* linkedList = aFirstLinkedList;
-    bool_t end = FALSE;
-    bool_t first = TRUE;
+    char path[FSYS_FILENAME_MAX];
 
-    while (linkedList && !end)
-    {
-        if (!first && linkedList == aFirstLinkedList)
-        {
-            end = TRUE;
-        }
-        linkedList = freeElement (linkedList);
-        first = FALSE;
-    }
+    /* Jobs of a new journal are queued after these ones */
+    journalClose ();
+    ioDeleteFile (getJournalPath (path, sizeof (path), 0));
+    ioDeleteFile (getJournalPath (path, sizeof (path), 1));
+    journal_game_id = 0;
+    ioDeleteFile (getFilePath (path, sizeof (path), GAME_FILENAME));
+    can_load_game = FALSE;
 }
 
 /**
- * @brief getPrevMusicFile
- * @param[out] aTurnOver The playlist's beginning was reached.
- * @return Previous music file's name.
+ * @brief importLegacyRecords
+ * Move records of old configuration file into the leaderboard.
  */
-char* getPrevMusicFile (bool_t* aTurnOver)
+void importLegacyRecords (void)
 {
-    if (aTurnOver)
+    uint8_t i, j;
+
+    if (!legacy_records_found)
     {
-        *aTurnOver = FALSE;
+        return;
     }
-    if (playlist_loaded)
+    for (j = 0; j < RECORD_TYPES; j++)
     {
-        if (playlist_actual && playlist_actual->prev)
+        for (i = 0; i < MAX_RECORD_NUM && legacy_records[j][i].score; i++)
         {
-            if (playlist_actual->prev == playlist_last && aTurnOver)
-            {
-                *aTurnOver = TRUE;
-            }
-            playlist_actual = playlist_actual->prev;
-            if (playlist_actual->item)
-            {
-                playlist_file_pos = playlist_actual->pos;
-                strncpy (musicFilePath, (char*) playlist_actual->item, sizeof (musicFilePath));
-            }
+            legacy_records[j][i].player_name[PLAYER_NAME_LENGTH - 1] = 0;
         }
+        leaderboardImport (j + MIN_BLOCK_TYPES, legacy_records[j], i);
     }
-    else
-    {
-        strncpy (musicFilePath, DEFAULT_MUSIC_FILENAME, sizeof (musicFilePath));
-    }
-    /* Get filename */
-    getFileName (musicFileName, musicFilePath, sizeof (musicFileName));
-
-    return musicFilePath;
+    legacy_records_found = FALSE;
 }
 
 /**
- * @brief getNextMusicFile
- * @param[out] aTurnOver The playlist's end was reached.
- * @return Next music file's name.
+ * Move player names of old configuration into the player store.
  */
-char* getNextMusicFile (bool_t* aTurnOver)
+void importLegacyPlayers (void)
 {
-    if (aTurnOver)
+    uint8_t i;
+
+    if (!legacy_players_found)
     {
-        *aTurnOver = FALSE;
+        return;
     }
-    if (playlist_loaded)
+    for (i = 0; i < MAX_PLAYERS; i++)
     {
-        if (playlist_actual && playlist_actual->next)
-        {
-            if (playlist_actual->next == playlist_first && aTurnOver)
-            {
-                *aTurnOver = TRUE;
-            }
-            playlist_actual = playlist_actual->next;
-            if (playlist_actual->item)
-            {
-                playlist_file_pos = playlist_actual->pos;
-                strncpy (musicFilePath, (char*) playlist_actual->item, sizeof (musicFilePath));
-            }
-        }
+        playersAdd (legacy_player_names[i]);
     }
-    else
+    if (!config.player_name[0])
     {
-        strncpy (musicFilePath, DEFAULT_MUSIC_FILENAME, sizeof (musicFilePath));
+        strncpy (config.player_name, legacy_player_names[legacy_player_idx], PLAYER_NAME_LENGTH - 1);
     }
-    /* Get filename */
-    getFileName (musicFileName, musicFilePath, sizeof (musicFileName));
-
-    return musicFilePath;
+    playersSave ();
+    legacy_players_found = FALSE;
 }
 
-
 /**
- * @brief searchFiles
- * Search files in directory and add to playlist.
+ * Check if current score should be shown in the top list. A game without
+ * score is never a record, even if the list is not full.
  *
- * @param aPath         Path to search. Last character must be '\\'!
- * @param aExtension    Extensions to search. NULL means search all.
- * @param aRecursive    TRUE: search in subdirectories too!
- *
- * @return Number of files found.
+ * @return 0xFF is current score is not in top list. Otherwise: record position.
  */
-uint16_t searchFiles (const char* aPath, const char* aExtension, bool_t aRecursive)
+uint8_t getNewRecordPos (uint8_t aBlockType, uint32_t aScore)
 {
-    int ret = 0;
-    uint16_t file_cntr = 0;
-    char path[FSYS_FILENAME_MAX];
-    fsys_file_info_t file_info __attribute__ ((aligned (4))); /* FIXME why aligning is needed? */
-    bool_t mem_alloc_ok = TRUE;
+    uint32_t rank;
+    uint8_t pos = 0xFF;
 
-    if (aRecursive)
+    rank = leaderboardRank (aBlockType, aScore);
+    if (aScore && rank < MAX_RECORD_NUM)
     {
-        /* First search directories and enter them */
-        strncpy (path, aPath, sizeof (path));
-        strncat (path, "*", sizeof (path));
-        ret = fsys_findfirst (path, FSYS_ATTR_DIR, &file_info);
-        if (!ret)
-        {
-            do
-            {
-                strncpy (path, aPath, sizeof (path));
-                strncat (path, file_info.name, sizeof (path));
-                strncat (path, OS_DIR_SEP_STR, sizeof (path));
-                file_cntr += searchFiles (path, aExtension, aRecursive);
-            } while ((fsys_findnext (&file_info) == 0));
-            fsys_findclose (&file_info);
-        }
+        pos = rank;
     }
 
-    /* Search files */
-    strncpy (path, aPath, sizeof (path));
-    if (!aExtension)
-    {
-        strncat (path, "*", sizeof (path));
-    }
-    else
-    {
-        strncat (path, aExtension, sizeof (path));
-    }
+    return pos;
+}
+
+/**
+ * Add actual game to the leaderboard with the selected player's name.
+ */
+void insertRecord (uint8_t aBlockType, uint32_t aScore)
+{
+    record_t record;
 
-    ret = fsys_findfirst (path, FSYS_ATTR_FILE, &file_info);
-    if (!ret)
+    memset (&record, 0, sizeof (record));
+    snprintf (record.player_name, sizeof (record.player_name), "%s", config.player_name);
+    if (record.player_name[0])
     {
-        do
-        {
-            char* filename;
-            size_t filename_size = strlen (aPath) + strlen (file_info.name) + 1;
-            if (playlist_mem_size + filename_size < PLAYLIST_MEM_LIMIT)
-            {
-                filename = malloc (filename_size);
-                if (filename)
-                {
-                    playlist_mem_size += filename_size;
-                    strncpy (filename, aPath, filename_size);
-                    strncat (filename, file_info.name, filename_size);
-                    (*playlist_it) = addElement (filename, playlist_it_prev, playlist_file_cntr + 1);
-                    if (*playlist_it)
-                    {
-                        playlist_mem_size += sizeof (linkedListElement_t);
-                        playlist_last = (*playlist_it);
-                        playlist_it_prev = *playlist_it;
-                        playlist_it = &((*playlist_it)->next);
-                        file_cntr++;
-                        playlist_file_cntr++;
-                        if ((playlist_file_cntr % 50) == 0)
-                        {
-                            char s[32];
-                            gfx_render_target_clear (DEFAULT_BG_COLOR);
-                            gfx_font_print_center (TEXT_YN(5), gameFontNormal, "Scanning:");
-                            gfx_font_print_center (TEXT_YN(6), gameFontNormal, aPath);
-                            snprintf (s, sizeof (s), "%i files found.", playlist_file_cntr);
-                            gfx_font_print_center (TEXT_YN(7), gameFontNormal, s);
-                            display_flip (gameDisplay);
-                        }
-                    }
-                    else
-                    {
-                        mem_alloc_ok = FALSE;
-                    }
-                }
-                else
-                {
-                    mem_alloc_ok = FALSE;
-                }
-            }
-            else
-            {
-                mem_alloc_ok = FALSE;
-            }
-        } while ((fsys_findnext (&file_info) == 0) && mem_alloc_ok);
-        fsys_findclose (&file_info);
+        playersAddGame (record.player_name, aBlockType, aScore,
+                        game.figure_counter, game.longest_cascade);
     }
     else
     {
-        /* No files found */
+        strcpy (record.player_name, LEADERBOARD_NO_NAME);
     }
+    record.level = game.level;
+    record.score = aScore;
+    last_record_rank = leaderboardInsert (aBlockType, &record);
+}
+
+void startTextInput(char * atext, uint32_t length, bool_t allowSpace)
+{
+  textInputIsStarted = TRUE;
+  textInputSpace = allowSpace;
+  text = atext;
+  textLength = length;
+}
 
-    return file_cntr;
+void stopTextInput(void)
+{
+  if (textInputIsStarted)
+  {
+    textInputIsStarted = FALSE;
+  }
 }
 
 /**
- * @brief initPlaylist
- * Create playlist from playlist.txt and search previously listened music.
+ * @brief getTimeUs
+ * @return Monotonic time in microseconds.
  */
-void initPlaylist (void)
+uint64_t getTimeUs (void)
 {
-    FILE* playListFile;
-    uint16_t file_cntr = 0;
-    char line[FSYS_FILENAME_MAX + 1] = { 0 };
+    struct timespec ts;
 
-    playlist_loaded = FALSE;
-    playlist_file_cntr = 0;
-    playlist_file_pos = 1;
-    playlist_first = 0;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
 
-    playlist_it = &playlist_first;
-    playlist_it_prev = NULL;
+    return (uint64_t) ts.tv_sec * 1000000u + ts.tv_nsec / 1000u;
+}
 
-    playListFile = fopen (PLAYLIST_FILENAME, "r");
-    if (playListFile)
+/**
+ * @brief startupTrace
+ * Record the end of a startup phase.
+ *
+ * @param aPhase Name of the finished phase. It shall be a string literal.
+ */
+void startupTrace (const char* aPhase)
+{
+    if (startup_trace_cntr < STARTUP_TRACE_MAX)
     {
-        playlist_actual = playlist_first;
-        drawInfoScreen ("Searching music files...");
-
-        do
-        {
-            fgets (line, sizeof (line), playListFile);
-            /* Remove trailing new lines if needed */
-            char* eol = strchr (line, '\n');
-            if (eol)
-            {
-                *eol = 0;
-            }
-            eol = strchr (line, '\r');
-            if (eol)
-            {
-                *eol = 0;
-            }
-            if (strlen (line) > 0)
-            {
-                /* Append trailing backslash if it is missing */
-                if (line[strlen (line) - 1] != OS_DIR_SEP_CHR)
-                {
-                    strncat (line, OS_DIR_SEP_STR, sizeof (line));
-                }
-                file_cntr += searchFiles (line, "*.MOD", TRUE);
-                file_cntr += searchFiles (line, "*.S3M", TRUE);
-                file_cntr += searchFiles (line, "*.XM", TRUE);
-            }
-        } while (!feof (playListFile));
+        startup_trace[startup_trace_cntr].phase = aPhase;
+        startup_trace[startup_trace_cntr].timeUs = getTimeUs ();
+        startup_trace_cntr++;
+    }
+}
 
-        fclose (playListFile);
+#ifdef ENABLE_TRACE
+/**
+ * @brief dumpTrace
+ * Write trace of the last frames into the configuration directory (F9, exit).
+ */
+void dumpTrace (void)
+{
+    static uint32_t dump_cntr = 0;
+    char name[64];
+    char path[256];
 
-        if (file_cntr)
-        {
-            playlist_loaded = TRUE;
-            /* Make playlist endless */
-            playlist_it_prev->next = playlist_first;
-            playlist_first->prev = playlist_it_prev;
-            playlist_actual = playlist_first;
-            /* Copy first item of playlist */
-            if (playlist_actual->item)
-            {
-                playlist_file_pos = playlist_actual->pos;
-                strncpy (musicFilePath, (char*) playlist_actual->item, sizeof (musicFilePath));
-            }
-            /* Get filename */
-            getFileName (musicFileName, musicFilePath, sizeof (musicFileName));
-            if (strlen (config.music_file_path))
-            {
-                bool_t found = FALSE;
-                bool_t turnOver = FALSE;
-                do
-                {
-                    if (!strncmp (config.music_file_path, musicFilePath, sizeof (config.music_file_path)))
-                    {
-                        found = TRUE;
-                    }
-                    else
-                    {
-                        getNextMusicFile (&turnOver);
-                    }
-                } while (!found && !turnOver);
-            }
-        }
-    }
-    else
-    {
-        /* No playlist, using default filename */
-        strncpy (musicFilePath, DEFAULT_MUSIC_FILENAME, sizeof (musicFilePath));
-        /* Get filename */
-        getFileName (musicFileName, musicFilePath, sizeof (musicFileName));
-    }
+    snprintf (name, sizeof (name), TRACE_FILENAME, dump_cntr++);
+    traceDump (getFilePath (path, sizeof (path), name));
 }
+#endif
 
 /**
- * @brief donePlaylist
- * Free memory allocated for playlist.
+ * @brief printStartupProfile
+ * Print duration of startup phases. @see startupTrace
  */
-void donePlaylist (void)
+void printStartupProfile (void)
 {
-    if (playlist_first)
+    uint8_t i;
+    uint64_t prev = startup_time_us;
+
+    printf("Startup profile:\n");
+    for (i = 0; i < startup_trace_cntr; i++)
     {
-        /* Release allocated memory */
-        freeLinkedList (playlist_first);
-        playlist_mem_size = 0;
+        printf("  %-20s %8.3f ms (total: %8.3f ms)\n", startup_trace[i].phase,
+               (startup_trace[i].timeUs - prev) / 1000.0,
+               (startup_trace[i].timeUs - startup_time_us) / 1000.0);
+        prev = startup_trace[i].timeUs;
+        if (!strcmp (startup_trace[i].phase, "first frame"))
+        {
+            printf("  Time to first frame: %.3f ms\n",
+                   (startup_trace[i].timeUs - startup_time_us) / 1000.0);
+        }
+        if (!strcmp (startup_trace[i].phase, "canLoadGame"))
+        {
+            printf("  Time to input:       %.3f ms\n",
+                   (startup_trace[i].timeUs - startup_time_us) / 1000.0);
+        }
     }
+    /* Later phases include frames of the game, input waited only this much */
+    printf("  Longest late step:   %.3f ms\n", late_init_max_us / 1000.0);
 }
-#endif
 
 /**
  * @brief init
@@ -782,6 +1023,7 @@ bool_t init (void)
 {
     int i;
     uint8_t path[256];
+    bool_t event_thread = FALSE;
 
     srand(time(NULL));
 
@@ -794,14 +1036,44 @@ bool_t init (void)
     strncat(path, CONFIG_DIR, sizeof(path));
     printf("%s mkdir: %s\r\n", __FUNCTION__, path);
     mkdir(path, 0755);
+    ioInit ();
 
-    SDL_Init(SDL_INIT_EVERYTHING);
+    startupTrace ("config directory");
+
+    /* Audio, joystick and CD-ROM are not used. Event thread lets the input
+     * thread take events, it is not supported on every platform. */
+    if (SDL_Init (SDL_INIT_VIDEO | SDL_INIT_EVENTTHREAD) == 0)
+    {
+        event_thread = TRUE;
+    }
+    else if (SDL_Init (SDL_INIT_VIDEO) < 0)
+    {
+        printf("SDL_Init() Failed: %s\n", SDL_GetError());
+        return FALSE;
+    }
+    startupTrace ("SDL_Init");
 
     // Set up screen
     screen = SDL_SetVideoMode(320, 240, 32, SDL_SWSURFACE);
+    if (screen == NULL)
+    {
+        printf("SDL_SetVideoMode() Failed: %s\n", SDL_GetError());
+        SDL_Quit();
+        return FALSE;
+    }
+    startupTrace ("SDL_SetVideoMode");
+
+    inputInit (event_thread);
 
     // Load background image
     background = IMG_Load( BACKGROUND_PNG );
+    if (background == NULL)
+    {
+        printf("IMG_Load() Failed: %s: %s\n", BACKGROUND_PNG, SDL_GetError());
+        SDL_Quit();
+        return FALSE;
+    }
+    startupTrace ("load background");
 
     //Apply image to screen
     SDL_BlitSurface( background, NULL, screen, NULL );
@@ -857,7 +1129,12 @@ bool_t init (void)
     SDL_Flip( screen );
 #endif
 
-    loadBlocks();
+    if (!loadBlocks())
+    {
+        SDL_Quit();
+        return FALSE;
+    }
+    startupTrace ("load blocks");
 
     keys[KEY_UP].repeatTick = NORMAL_REPEAT_TICK;
     keys[KEY_DOWN].repeatTick = FAST_REPEAT_TICK;
@@ -874,11 +1151,81 @@ bool_t init (void)
         key_delta[i] = rand();
     }
 
-    loadConfig ();
+    return TRUE;
+}
 
-    can_load_game = canLoadGame ();
+/**
+ * @brief lateInit
+ * Non-critical initialization. It is started after the first interactive
+ * frame was shown and a step is done in every iteration of the game loop,
+ * so input is handled between the steps. Music directories are scanned
+ * in the background, audio is started when they are done.
+ */
+void lateInit (void)
+{
+    char path[FSYS_FILENAME_MAX];
+    uint64_t startUs = getTimeUs ();
 
-    return TRUE;
+    getFilePath (path, sizeof (path), CONFIG_DIR);
+    switch (late_init_step)
+    {
+        case LATE_INIT_load:
+            /* Input may start a game, so it is not handled before the
+             * saved game is checked */
+            startupTrace ("first frame");
+            loadConfig ();
+            startupTrace ("loadConfig");
+            leaderboardInit (path);
+            importLegacyRecords ();
+            startupTrace ("leaderboard");
+            playersInit (path);
+            importLegacyPlayers ();
+            startupTrace ("players");
+            can_load_game = canLoadGame ();
+            if (can_load_game && (main_state_machine == STATE_difficulty_selection))
+            {
+                main_state_machine = STATE_load_game;
+                screen_dirty = TRUE;
+            }
+            startupTrace ("canLoadGame");
+            break;
+        case LATE_INIT_playlist:
+            startPlaylist (path);
+            break;
+        case LATE_INIT_scan:
+            if (!pollPlaylist ())
+            {
+                /* Walkers are still reading, check again later */
+                return;
+            }
+            screen_dirty = TRUE;
+            startupTrace ("playlist");
+            break;
+        case LATE_INIT_sfx:
+            sfxInit ();
+            startupTrace ("sfx");
+            break;
+        case LATE_INIT_music:
+            music_initted = musicInit ();
+            screen_dirty = TRUE;
+            startupTrace ("music");
+            break;
+        default:
+            break;
+    }
+    if (getTimeUs () - startUs > late_init_max_us)
+    {
+        late_init_max_us = getTimeUs () - startUs;
+    }
+    late_init_step++;
+    if (late_init_step == LATE_INIT_done)
+    {
+        late_init_done = TRUE;
+        if (startup_profile)
+        {
+            printStartupProfile ();
+        }
+    }
 }
 
 void collectRandomNumbers (void)
@@ -903,6 +1250,8 @@ void collectRandomNumbers (void)
  */
 void handleMovement (void)
 {
+    TRACE_BEGIN(span);
+
     if (rightPressed && rightChanged)
     {
         /* Right */
@@ -948,9 +1297,20 @@ void handleMovement (void)
         }
         else
         {
+            uint8_t cascade;
+            uint32_t score = game.score;
+
+            journalBeginMove (&game);
             copyFigureToMap ();
-            collapseMap ();
+            sfxPlay (SFX_LOCK, 0);
+            cascade = collapseMap ();
+            if (cascade > game.longest_cascade)
+            {
+                game.longest_cascade = cascade;
+            }
+            telemetryLock (cascade, game.score - score);
             generateFigure ();
+            journalCommitMove (&game);
         }
 
         /* Delay time = 0.8 sec - level * 0.1 sec */
@@ -962,6 +1322,20 @@ void handleMovement (void)
         gameTimer = SDL_GetTicks() + ticks;
     }
 #endif
+    TRACE_END(span, "handleMovement");
+}
+
+/**
+ * @brief startNamePicker
+ * Prepare name picker: last player is searched, so Enter selects it.
+ */
+void startNamePicker (void)
+{
+    strncpy (picker_prefix, config.player_name, PLAYER_NAME_LENGTH - 1);
+    picker_prefix[PLAYER_NAME_LENGTH - 1] = 0;
+    strcpy (picker_last_prefix, picker_prefix);
+    picker_first = 0;
+    picker_row = 0;
 }
 
 /**
@@ -974,6 +1348,10 @@ bool_t handleMainStateMachine (void)
     bool_t replay = FALSE;
     char s[32];
     uint8_t i;
+    const player_t* page[PLAYERS_PAGE_SIZE];
+    uint32_t page_size;
+    uint32_t matches;
+    TRACE_BEGIN(span);
 
     switch (main_state_machine)
     {
@@ -984,6 +1362,9 @@ bool_t handleMainStateMachine (void)
                 {
                     loadGame ();
                     deleteGame ();
+                    startJournal ();
+                    telemetryGameStart (journal_game_id, TRUE);
+                    config.game_counter++;
                     main_state_machine = STATE_running;
                 }
                 if (spacePressed && spaceChanged)
@@ -991,12 +1372,12 @@ bool_t handleMainStateMachine (void)
                     deleteGame ();
                     main_state_machine = STATE_difficulty_selection;
                 }
-                SDL_BlitSurface( background, NULL, screen, NULL );
+                gfx_blit( background, NULL );
                 gfx_font_print_center (TEXT_YN(5), gameFontNormal, "Automatically saved");
                 gfx_font_print_center (TEXT_YN(6), gameFontNormal, "game found!");
                 gfx_font_print_center (TEXT_YN(7), gameFontNormal, "ENTER: Load");
                 gfx_font_print_center (TEXT_YN(8), gameFontNormal, "SPACE: Abandon");
-                SDL_Flip(screen);
+                flipScreen ();
             }
             else
             {
@@ -1016,9 +1397,12 @@ bool_t handleMainStateMachine (void)
             }
             if (enterPressed && enterChanged)
             {
+                startJournal ();
+                telemetryGameStart (journal_game_id, FALSE);
+                config.game_counter++;
                 main_state_machine = STATE_running;
             }
-            SDL_BlitSurface( background, NULL, screen, NULL );
+            gfx_blit( background, NULL );
             for (i = 0; i < sizeof(info) / sizeof(info[0]); i++)
             {
                 gfx_font_print (0, TEXT_Y(i), gameFontSmall, (char*) info[i]);
@@ -1026,36 +1410,47 @@ bool_t handleMainStateMachine (void)
             i++;
             snprintf (s, sizeof (s), ">>> Difficulty: %i <<<", game.block_types);
             gfx_font_print_center (TEXT_Y(i), gameFontSmall, s);
-            SDL_Flip(screen);
+            flipScreen ();
             break;
         case STATE_running:
             handleMovement ();
             if (enterPressed && enterChanged)
             {
+                telemetryPause (TRUE);
                 main_state_machine = STATE_paused;
             }
             if (isGameOver ())
             {
                 bool_t new_record;
+
+                sfxPlay (SFX_GAME_OVER, 0);
+                telemetryGameEnd (FALSE);
+                /* Nothing to continue */
+                deleteGame ();
                 new_record = getNewRecordPos (game.block_types, game.score) != 0xFF;
                 if (new_record)
                 {
                     /* New record! */
+                    startNamePicker ();
                     main_state_machine = STATE_select_name;
                 }
                 else
                 {
+                    /* Every game is kept in the leaderboard */
+                    insertRecord (game.block_types, game.score);
                     main_state_machine = STATE_game_over;
                 }
             }
             else
             {
+                checkpointIfNeeded ();
                 drawGameScreen ();
             }
             break;
         case STATE_paused:
             if (enterPressed && enterChanged)
             {
+                telemetryPause (FALSE);
                 main_state_machine = STATE_running;
             }
             drawGameScreen ();
@@ -1069,12 +1464,68 @@ bool_t handleMainStateMachine (void)
             drawGameScreen ();
             break;
         case STATE_select_name:
-            // Restore background
-            SDL_BlitSurface (background, NULL, screen, NULL);
+            if (!textInputIsStarted)
+            {
+                startTextInput (picker_prefix, PLAYER_NAME_LENGTH, FALSE);
+            }
+            if (strcmp (picker_prefix, picker_last_prefix))
+            {
+                /* Search changed */
+                strcpy (picker_last_prefix, picker_prefix);
+                picker_first = 0;
+                picker_row = 0;
+            }
+            matches = playersMatchCount (picker_prefix);
+            if (rightPressed && rightChanged && picker_first + PLAYERS_PAGE_SIZE < matches)
+            {
+                picker_first += PLAYERS_PAGE_SIZE;
+                picker_row = 0;
+            }
+            if (leftPressed && leftChanged && picker_first >= PLAYERS_PAGE_SIZE)
+            {
+                picker_first -= PLAYERS_PAGE_SIZE;
+                picker_row = 0;
+            }
+            if (downPressed && downChanged)
+            {
+                if (picker_row + 1 < PLAYERS_PAGE_SIZE && picker_first + picker_row + 1 < matches)
+                {
+                    picker_row++;
+                }
+                else if (picker_first + PLAYERS_PAGE_SIZE < matches)
+                {
+                    picker_first += PLAYERS_PAGE_SIZE;
+                    picker_row = 0;
+                }
+            }
+            if (upPressed && upChanged)
+            {
+                if (picker_row > 0)
+                {
+                    picker_row--;
+                }
+                else if (picker_first >= PLAYERS_PAGE_SIZE)
+                {
+                    picker_first -= PLAYERS_PAGE_SIZE;
+                    picker_row = PLAYERS_PAGE_SIZE - 1;
+                }
+            }
+            page_size = playersSearch (picker_prefix, picker_first, PLAYERS_PAGE_SIZE, page);
 
             if (enterPressed && enterChanged)
             {
-                if (strlen (config.player_names[config.player_idx]) > 0)
+                if (page_size > picker_row)
+                {
+                    strcpy (config.player_name, page[picker_row]->name);
+                }
+                else if (picker_prefix[0])
+                {
+                    /* Nobody found, typed name is a new player */
+                    playersAdd (picker_prefix);
+                    strcpy (config.player_name, picker_prefix);
+                }
+                stopTextInput ();
+                if (config.player_name[0])
                 {
                     insertRecord (game.block_types, game.score);
                     saveConfig ();
@@ -1082,60 +1533,58 @@ bool_t handleMainStateMachine (void)
                 }
                 else
                 {
+                    new_player_name[0] = 0;
                     main_state_machine = STATE_set_name;
                 }
+                break;
             }
             if (spacePressed && spaceChanged)
             {
+                stopTextInput ();
+                new_player_name[0] = 0;
                 main_state_machine = STATE_set_name;
+                break;
             }
-            if (downPressed && downChanged)
-            {
-                if (config.player_idx < MAX_PLAYERS - 1)
-                {
-                    config.player_idx++;
-                }
-            }
-            if (upPressed && upChanged)
-            {
-                if (config.player_idx > 0)
-                {
-                    config.player_idx--;
-                }
-            }
+
+            // Restore background
+            gfx_blit (background, NULL);
             printCommon ();
             gfx_font_print (0, TEXT_Y(0), gameFontSmall, "Select your name:");
-            for (i = 0; i < MAX_PLAYERS; i++)
+            snprintf (s, sizeof (s), "Search: %s_", picker_prefix);
+            gfx_font_print (0, TEXT_Y(1), gameFontSmall, s);
+            for (i = 0; i < page_size; i++)
             {
                 uint8_t c = ' ', c2 = ' ';
-                char name[PLAYER_NAME_LENGTH];
-                if (strlen (config.player_names[i]) > 0)
-                {
-                    strncpy (name, config.player_names[i], sizeof (name));
-                }
-                else
-                {
-                    strncpy (name, "-UNUSED-", sizeof (name));
-                }
-                if (i == config.player_idx)
+
+                if (i == picker_row)
                 {
                     c = '>';
                     c2 = '<';
                 }
-                snprintf (s, sizeof (s), "%c%c%c %-9s %c%c%c", c, c, c, name, c2, c2, c2);
-                gfx_font_print (0, TEXT_Y(i + 1), gameFontSmall, s);
+                snprintf (s, sizeof (s), "%c%c%c %-9s %c%c%c", c, c, c, page[i]->name, c2, c2, c2);
+                gfx_font_print (0, TEXT_Y(i + 2), gameFontSmall, s);
+            }
+            if (!page_size && picker_prefix[0])
+            {
+                snprintf (s, sizeof (s), ">>> %-9s <<< (new)", picker_prefix);
+                gfx_font_print (0, TEXT_Y(2), gameFontSmall, s);
             }
-            gfx_font_print (0, TEXT_Y(i + 2), gameFontSmall, "Enter: Select name");
-            gfx_font_print (0, TEXT_Y(i + 3), gameFontSmall, "Space: Change name");
-            SDL_Flip (screen);
+            snprintf (s, sizeof (s), "Page %u/%u",
+                      picker_first / PLAYERS_PAGE_SIZE + 1,
+                      matches ? (matches + PLAYERS_PAGE_SIZE - 1) / PLAYERS_PAGE_SIZE : 1);
+            gfx_font_print (0, TEXT_Y(PLAYERS_PAGE_SIZE + 2), gameFontSmall, s);
+            gfx_font_print (0, TEXT_Y(PLAYERS_PAGE_SIZE + 3), gameFontSmall, "Type: Search  Left/Right: Page");
+            gfx_font_print (0, TEXT_Y(PLAYERS_PAGE_SIZE + 4), gameFontSmall, "Enter: Select name");
+            gfx_font_print (0, TEXT_Y(PLAYERS_PAGE_SIZE + 5), gameFontSmall, "Space: New name");
+            flipScreen ();
             break;
         case STATE_set_name:
             if (!textInputIsStarted)
             {
-              startTextInput(config.player_names[config.player_idx], PLAYER_NAME_LENGTH);
+              startTextInput(new_player_name, PLAYER_NAME_LENGTH, TRUE);
             }
             // Restore background
-            SDL_BlitSurface (background, NULL, screen, NULL);
+            gfx_blit (background, NULL);
             gfx_font_print (0, TEXT_Y(0), gameFontNormal, "Set your name:");
             rectangleRGBA( screen, 1, TEXT_Y(1) - 2, FONT_NORMAL_SIZE_X_PX * PLAYER_NAME_LENGTH + 3, TEXT_Y(2) - 1,
                            255, 255, 255, 255);
@@ -1144,18 +1593,24 @@ bool_t handleMainStateMachine (void)
             if (enterPressed && enterChanged)
             {
                 stopTextInput();
+                if (new_player_name[0])
+                {
+                    playersAdd (new_player_name);
+                    strcpy (config.player_name, new_player_name);
+                }
                 insertRecord (game.block_types, game.score);
                 saveConfig ();
                 main_state_machine = STATE_game_over;
             }
             gfx_font_print (0, TEXT_Y(3), gameFontSmall, "Enter: Finish editing");
-            SDL_Flip (screen);
+            flipScreen ();
             break;
         default:
         case STATE_undefined:
             /* This should not happen */
             break;
     }
+    TRACE_END_ARG(span, "handleMainStateMachine", "state", main_state_machine);
 
     return replay;
 }
@@ -1177,7 +1632,7 @@ uint8_t myrand (void)
     return random;
 }
 
-void key_pressed(uint8_t key_index, bool_t pressed)
+void key_pressed(uint8_t key_index, bool_t pressed, uint64_t timeUs)
 {
     if (key_index < MAX_KEYS)
     {
@@ -1185,11 +1640,11 @@ void key_pressed(uint8_t key_index, bool_t pressed)
         keys[key_index].pressed = pressed;
         if (pressed)
         {
-            keys[key_index].pressTick = SDL_GetTicks() + keys[key_index].repeatTick;
+            keys[key_index].repeatUs = timeUs + keys[key_index].repeatTick * 1000u;
         }
         else
         {
-            keys[key_index].pressTick = 0;
+            keys[key_index].repeatUs = 0;
         }
     }
     else
@@ -1198,111 +1653,262 @@ void key_pressed(uint8_t key_index, bool_t pressed)
     }
 }
 
+/**
+ * @brief keyIndex
+ * @return Index of key in keys[]. MAX_KEYS: key is not used.
+ */
+uint8_t keyIndex (uint16_t sym)
+{
+    switch (sym)
+    {
+        case SDLK_UP:
+            return KEY_UP;
+        case SDLK_DOWN:
+            return KEY_DOWN;
+        case SDLK_LEFT:
+            return KEY_LEFT;
+        case SDLK_RIGHT:
+            return KEY_RIGHT;
+        case SDLK_RETURN:
+        case SDLK_KP_ENTER:
+            return KEY_ENTER;
+        case SDLK_SPACE:
+            return KEY_SPACE;
+        default:
+            return MAX_KEYS;
+    }
+}
+
+/**
+ * @brief handleMusicKey
+ * Music control: F4 pause, F5 previous, F6 next, F7/F8 volume.
+ */
+void handleMusicKey (uint16_t sym)
+{
+    if (!music_initted)
+    {
+        return;
+    }
+    switch (sym)
+    {
+        case SDLK_F4:
+            config.music_paused = !config.music_paused;
+            musicSetPaused (config.music_paused);
+            break;
+        case SDLK_F5:
+            musicPrev ();
+            break;
+        case SDLK_F6:
+            musicNext ();
+            break;
+        case SDLK_F7:
+            if (config.volume >= VOLUME_MIN + VOLUME_DELTA)
+            {
+                config.volume -= VOLUME_DELTA;
+                musicSetVolume (config.volume);
+            }
+            break;
+        case SDLK_F8:
+            if (config.volume <= VOLUME_MAX - VOLUME_DELTA)
+            {
+                config.volume += VOLUME_DELTA;
+                musicSetVolume (config.volume);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief handleKeyEvent
+ * Apply an input event to text input and key states.
+ */
+void handleKeyEvent (const input_event_t* event)
+{
+    uint8_t key_index = keyIndex (event->sym);
+
+    /* Typed text, key state or exposed window: idle screen shall be redrawn */
+    screen_dirty = TRUE;
+    if (event->type == SDL_KEYDOWN)
+    {
+        if (textInputIsStarted)
+        {
+          uint32_t len = strnlen(text, textLength);
+          if ((event->sym > 32 || (event->sym == 32 && textInputSpace))
+              && event->sym <= 126)
+          {
+            if (len < textLength - 1)
+            {
+                text[len] = event->sym;
+                if (event->mod & (KMOD_RSHIFT | KMOD_LSHIFT) )
+                {
+                  /* Make upper case */
+                  text[len] &= 0xDF;
+                }
+                text[len + 1] = 0;
+            }
+          }
+          if (event->sym == SDLK_BACKSPACE && len > 0)
+          {
+            text[len - 1] = 0;
+          }
+        }
+        handleMusicKey (event->sym);
+        if (event->sym == SDLK_F3)
+        {
+            overlay_visible = !overlay_visible;
+        }
+#ifdef ENABLE_TRACE
+        if (event->sym == SDLK_F9)
+        {
+            dumpTrace ();
+        }
+#endif
+        if (event->sym == SDLK_ESCAPE)
+        {
+            gameRunning = FALSE;
+        }
+        else if (key_index < MAX_KEYS)
+        {
+            key_pressed(key_index, TRUE, event->timeUs);
+        }
+    }
+    else if (event->type == SDL_KEYUP)
+    {
+        if (key_index < MAX_KEYS)
+        {
+            key_pressed(key_index, FALSE, event->timeUs);
+        }
+    }
+    else if (event->type == SDL_QUIT) /* If the user has Xed out the window */
+    {
+        /* Quit the program */
+        gameRunning = FALSE;
+    }
+}
+
 void key_task()
 {
+    static input_event_t event;
+    static bool_t event_pending = FALSE;   /* Event is left for the next tick */
+    uint64_t now;
+    uint8_t key_index;
     int i;
-    SDL_Event event;
+    TRACE_BEGIN(span);
 
     for (i = 0; i < MAX_KEYS; i++)
     {
         keys[i].changed = FALSE;
-        if (keys[i].pressed && keys[i].pressTick < SDL_GetTicks())
+    }
+
+    while (event_pending || inputPoll (&event))
+    {
+        event_pending = FALSE;
+        key_index = keyIndex (event.sym);
+        if (event.type != SDL_QUIT && key_index < MAX_KEYS && keys[key_index].changed)
         {
-            /* Simulate key has just pressed */
-            keys[i].changed = TRUE;
-            keys[i].pressTick = SDL_GetTicks() + keys[i].repeatTick;
+            /* Key has changed in this tick already, a short tap shall not be lost */
+            event_pending = TRUE;
+            break;
         }
+        statsInput (event.timeUs);
+        handleKeyEvent (&event);
     }
 
-    while (SDL_PollEvent(&event))
+    now = getTimeUs ();
+    for (i = 0; i < MAX_KEYS; i++)
     {
-        if (event.type == SDL_KEYDOWN)
+        if (keys[i].pressed && !keys[i].changed && keys[i].repeatUs <= now)
         {
-            if (textInputIsStarted)
+            /* Simulate key has just pressed. Next repeat is scheduled from
+             * the press, so the cadence does not depend on the loop. */
+            keys[i].changed = TRUE;
+            screen_dirty = TRUE;
+            keys[i].repeatUs += keys[i].repeatTick * 1000u;
+            if (keys[i].repeatUs + keys[i].repeatTick * 1000u < now)
             {
-              uint32_t len = strnlen(text, textLength);
-              if (event.key.keysym.sym >= 32 && event.key.keysym.sym <= 126)
-              {
-                if (len < textLength - 1)
-                {
-                    text[len] = event.key.keysym.sym;
-                    if (event.key.keysym.mod & (KMOD_RSHIFT | KMOD_LSHIFT) )
-                    {
-                      /* Make upper case */
-                      text[len] &= 0xDF;
-                    }
-                    text[len + 1] = 0;
-                }
-              }
-              if (event.key.keysym.sym == SDLK_BACKSPACE && len > 0)
-              {
-                text[len - 1] = 0;
-              }
+                /* Loop was stalled (blinking), missed repeats are dropped */
+                keys[i].repeatUs = now + keys[i].repeatTick * 1000u;
             }
+        }
+    }
+
+    //  collectRandomNumbers ();
+    TRACE_END(span, "key_task");
+}
+
+/**
+ * @brief botInput
+ * Key of the bot is handled like a typed one, it is released in the next loop.
+ */
+void botInput (void)
+{
+    static uint16_t sym = 0;
+    input_event_t event;
+
+    memset (&event, 0, sizeof (event));
+    event.timeUs = getTimeUs ();
+    if (sym)
+    {
+        event.type = SDL_KEYUP;
+        event.sym = sym;
+        handleKeyEvent (&event);
+    }
+    sym = botKey ();
+    if (sym)
+    {
+        event.type = SDL_KEYDOWN;
+        event.sym = sym;
+        handleKeyEvent (&event);
+    }
+}
+
+/**
+ * @brief isIdleState
+ * @return TRUE: screen of current state changes only on input.
+ */
+bool_t isIdleState (void)
+{
+    switch (main_state_machine)
+    {
+        case STATE_load_game:
+        case STATE_difficulty_selection:
+        case STATE_paused:
+        case STATE_select_name:
+        case STATE_set_name:
+        case STATE_game_over:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
 
-            switch (event.key.keysym.sym)
+/**
+ * @brief waitForInput
+ * Sleep until an input event arrives or a held key repeats.
+ */
+void waitForInput (void)
+{
+    uint64_t now = getTimeUs ();
+    uint32_t timeout = late_init_done ? IDLE_WAIT_MAX_US : LATE_INIT_POLL_US;
+    int i;
+
+    for (i = 0; i < MAX_KEYS; i++)
+    {
+        if (keys[i].pressed)
+        {
+            if (keys[i].repeatUs <= now)
             {
-                case SDLK_UP:
-                    key_pressed(KEY_UP, TRUE);
-                    break;
-                case SDLK_DOWN:
-                    key_pressed(KEY_DOWN, TRUE);
-                    break;
-                case SDLK_LEFT:
-                    key_pressed(KEY_LEFT, TRUE);
-                    break;
-                case SDLK_RIGHT:
-                    key_pressed(KEY_RIGHT, TRUE);
-                    break;
-                case SDLK_RETURN:
-                case SDLK_KP_ENTER:
-                    key_pressed(KEY_ENTER, TRUE);
-                    break;
-                case SDLK_SPACE:
-                    key_pressed(KEY_SPACE, TRUE);
-                    break;
-                case SDLK_ESCAPE:
-                    gameRunning = FALSE;
-                    break;
-                default:
-                    break;
+                return;
             }
-        }
-        else if (event.type == SDL_KEYUP)
-        {
-            switch (event.key.keysym.sym)
+            if (keys[i].repeatUs - now < timeout)
             {
-                case SDLK_UP:
-                    key_pressed(KEY_UP, FALSE);
-                    break;
-                case SDLK_DOWN:
-                    key_pressed(KEY_DOWN, FALSE);
-                    break;
-                case SDLK_LEFT:
-                    key_pressed(KEY_LEFT, FALSE);
-                    break;
-                case SDLK_RIGHT:
-                    key_pressed(KEY_RIGHT, FALSE);
-                    break;
-                case SDLK_RETURN:
-                case SDLK_KP_ENTER:
-                    key_pressed(KEY_ENTER, FALSE);
-                    break;
-                case SDLK_SPACE:
-                    key_pressed(KEY_SPACE, FALSE);
-                    break;
-                default:
-                    break;
+                timeout = keys[i].repeatUs - now;
             }
         }
-        else if (event.type == SDL_QUIT) /* If the user has Xed out the window */
-        {
-            /* Quit the program */
-            gameRunning = FALSE;
-        }
     }
-
-    //  collectRandomNumbers ();
+    inputWait (timeout);
 }
 
 /**
@@ -1312,13 +1918,16 @@ void key_task()
 void run (void)
 {
     bool_t   do_replay   = FALSE;
+    main_state_machine_t state;
 
 replay:
-    config.game_counter++;
-    main_state_machine = STATE_load_game;
+    screen_dirty = TRUE;
+    last_record_rank = LEADERBOARD_NIL;
+    main_state_machine = can_load_game ? STATE_load_game : STATE_difficulty_selection;
     game.score = 0;
     game.level = 1;
     game.figure_counter = 0;
+    game.longest_cascade = 0;
 #ifndef TEST_MAP
     initMap ();
 #endif
@@ -1326,13 +1935,42 @@ replay:
 
     while (gameRunning)
     {
+        if (!late_init_done && frame_counter)
+        {
+            /* First interactive frame is on the screen. Loading is not
+             * measured by the watchdog, input is handled after each step. */
+            lateInit ();
+        }
+        watchdogBegin ();
+        statsPublish ();
         key_task();
+        if (bot_playing)
+        {
+            botInput ();
+        }
+        inputSetIdle (isIdleState ());
+        if (isIdleState () && !screen_dirty)
+        {
+            /* Nothing changes on the screen, do not burn CPU */
+            waitForInput ();
+            continue;
+        }
+        screen_dirty = FALSE;
+        state = main_state_machine;
         do_replay = handleMainStateMachine ();
+        if (main_state_machine != state)
+        {
+            screen_dirty = TRUE;
+        }
+        watchdogEnd ();
         if (do_replay)
         {
             goto replay; /* Shh! Bad thing! */
         }
-        usleep( 10e3 );
+        if (!isIdleState ())
+        {
+            usleep( loop_delay_us );
+        }
     }
 }
 
@@ -1342,33 +1980,123 @@ replay:
  */
 void done (void)
 {
+    latencyDone ();
+    botDone ();
+
     if ((main_state_machine == STATE_running)
         || (main_state_machine == STATE_paused))
     {
-        saveGame ();
+        checkpointGame (TRUE);
+        telemetryGameEnd (TRUE);
     }
+    telemetryDone ();
+    journalClose ();
 
     saveConfig ();
+    if (music_initted)
+    {
+        musicDone ();
+        music_initted = FALSE;
+    }
+    sfxDone ();
+#ifdef ENABLE_TRACE
+    dumpTrace ();
+#endif
+
+    /* Wait for the I/O thread to write everything */
+    ioDone ();
+    leaderboardDone ();
+    playersDone ();
+    donePlaylist ();
 
+    inputDone ();
     freeBlocks();
 
     //Free the loaded image
     SDL_FreeSurface( background );
 
+    statsDone ();
+
     //Quit SDL
     SDL_Quit();
 }
 
 int main( int argc, char* argv[] )
 {
-    (void)argc;
-    (void)argv;
+    int i;
+    uint32_t latency_samples = 0;
+    bool_t bot = FALSE;
+    uint32_t bot_games = 0;
+    char path[FSYS_FILENAME_MAX];
+    char games_path[FSYS_FILENAME_MAX];
+
+    startup_time_us = getTimeUs ();
+#ifdef ENABLE_TRACE
+    traceInit ();
+#endif
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp (argv[i], "--startup-profile"))
+        {
+            startup_profile = TRUE;
+        }
+        else if (!strcmp (argv[i], "--latency-bench") && i + 1 < argc)
+        {
+            latency_samples = strtoul (argv[++i], NULL, 0);
+        }
+        else if (!strcmp (argv[i], "--bot"))
+        {
+            bot = TRUE;
+        }
+        else if (!strcmp (argv[i], "--bot-games") && i + 1 < argc)
+        {
+            bot = TRUE;
+            bot_games = strtoul (argv[++i], NULL, 0);
+        }
+        else if (!strcmp (argv[i], "--loop-delay-us") && i + 1 < argc)
+        {
+            loop_delay_us = strtoul (argv[++i], NULL, 0);
+        }
+        else if (!strcmp (argv[i], "--blink-delay-ms") && i + 1 < argc)
+        {
+            blink_delay_ms = strtoul (argv[++i], NULL, 0);
+        }
+        else if (!strcmp (argv[i], "--frame-budget-us") && i + 1 < argc)
+        {
+            watchdog_budget_us = strtoul (argv[++i], NULL, 0);
+        }
+        else
+        {
+            printf("Unknown option: %s\n", argv[i]);
+        }
+    }
 
     if (init ())
     {
+        statsInit ();
+        telemetryInit (getFilePath (path, sizeof (path), FIGURES_FILENAME),
+                       getFilePath (games_path, sizeof (games_path), GAMES_FILENAME));
+        if (watchdog_budget_us)
+        {
+            watchdogInit (getFilePath (path, sizeof (path), WATCHDOG_FILENAME));
+        }
+        if (latency_samples)
+        {
+            latencyInit (latency_samples);
+        }
+        if (bot)
+        {
+            botInit (bot_games);
+        }
         run ();
         done ();
     }
+    else
+    {
+        /* E.g. data is missing */
+        return 1;
+    }
 
     return 0;
 }
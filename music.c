@@ -0,0 +1,379 @@
+/**
+ * @file        music.c
+ * @brief       Module music player
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-16 20:48:31
+ * Licence:     GPL
+ *
+ * Files of the playlist are decoded by libxmp on a decoder thread into the
+ * ring of audio.c. When the ring is full, the decoder has time to load the
+ * next file of the playlist into a second context, so when the actual file
+ * ends, the next one is decoded into the ring at once, without a gap.
+ *
+ * The game thread never touches the decoder or the audio device: commands
+ * are atomic variables and the state is copied from a snapshot. While the
+ * decoder runs, it is the only user of the playlist.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_thread.h>
+#include <xmp.h>
+
+#include "music.h"
+#include "audio.h"
+#include "playlist.h"
+#include "trace.h"
+
+typedef struct
+{
+    xmp_context ctx;
+    bool_t loaded;
+    uint32_t file_pos;              /* Number of file in playlist, 0: default file */
+    char file_path[FSYS_FILENAME_MAX];
+    char file_name[16];
+} music_track_t;
+
+static music_track_t    music_tracks[2];
+static music_track_t*   music_current = &music_tracks[0];   /* Decoded now */
+static music_track_t*   music_next = &music_tracks[1];      /* Loaded ahead */
+static SDL_Thread*      music_thread = NULL;
+static SDL_mutex*       music_status_mutex = NULL;
+static music_status_t   music_status;                       /* Protected by music_status_mutex */
+static bool_t           music_running = FALSE;              /* FALSE: decoder shall exit */
+static int32_t          music_skip = 0;                     /* Files to skip, set by game thread */
+
+/**
+ * @brief stepPos
+ * @return Number of file aStep files away, the playlist is endless.
+ */
+static uint32_t stepPos (uint32_t aPos, int32_t aStep)
+{
+    int64_t pos;
+
+    if (!playlist_loaded)
+    {
+        return 0;
+    }
+    pos = ((int64_t) aPos - 1 + aStep) % (int64_t) playlist_file_cntr;
+    if (pos < 0)
+    {
+        pos += playlist_file_cntr;
+    }
+
+    return pos + 1;
+}
+
+static void releaseTrack (music_track_t* aTrack)
+{
+    if (aTrack->loaded)
+    {
+        xmp_release_module (aTrack->ctx);
+        aTrack->loaded = FALSE;
+    }
+}
+
+/**
+ * @brief loadTrack
+ * Load a file of playlist. Broken files are skipped in direction aDir.
+ *
+ * @return TRUE: file is loaded.
+ */
+static bool_t loadTrack (music_track_t* aTrack, uint32_t aPos, int8_t aDir)
+{
+    const char* path;
+    uint8_t i;
+
+    releaseTrack (aTrack);
+    for (i = 0; i < MUSIC_MAX_LOAD_FAILS; i++)
+    {
+        path = getMusicFile (aPos);
+        if (xmp_load_module (aTrack->ctx, (char*) path) == 0)
+        {
+            aTrack->loaded = TRUE;
+            aTrack->file_pos = aPos;
+            snprintf (aTrack->file_path, sizeof (aTrack->file_path), "%s", path);
+            snprintf (aTrack->file_name, sizeof (aTrack->file_name), "%s", musicFileName);
+            return TRUE;
+        }
+        printf("%s: cannot load %s\n", __FUNCTION__, path);
+        if (!playlist_loaded)
+        {
+            break;
+        }
+        aPos = stepPos (aPos, aDir);
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief startTrack
+ * Start decoding of a loaded file.
+ *
+ * @return TRUE: decoder is started.
+ */
+static bool_t startTrack (music_track_t* aTrack)
+{
+    struct xmp_module_info info;
+
+    if (!aTrack->loaded || xmp_start_player (aTrack->ctx, AUDIO_FREQ_HZ, 0) != 0)
+    {
+        return FALSE;
+    }
+    xmp_get_module_info (aTrack->ctx, &info);
+
+    SDL_mutexP (music_status_mutex);
+    music_status.playing = TRUE;
+    memcpy (music_status.file_name, aTrack->file_name, sizeof (music_status.file_name));
+    memcpy (music_status.file_path, aTrack->file_path, sizeof (music_status.file_path));
+    snprintf (music_status.song_name, sizeof (music_status.song_name), "%s", info.mod->name);
+    music_status.file_pos = aTrack->file_pos;
+    music_status.file_cntr = playlist_file_cntr;
+    music_status.position = 0;
+    music_status.length = info.mod->len;
+    SDL_mutexV (music_status_mutex);
+
+    return TRUE;
+}
+
+static void setStopped (void)
+{
+    SDL_mutexP (music_status_mutex);
+    music_status.playing = FALSE;
+    SDL_mutexV (music_status_mutex);
+}
+
+static void swapTracks (void)
+{
+    music_track_t* track = music_current;
+
+    music_current = music_next;
+    music_next = track;
+}
+
+/**
+ * @brief musicThread
+ * Decoder thread.
+ */
+static int musicThread (void* aArg)
+{
+    int16_t buf[MUSIC_DECODE_FRAMES * AUDIO_CHANNELS];
+    struct xmp_frame_info frame;
+    bool_t playing;
+    bool_t decoded;
+    bool_t prefetched = FALSE;      /* Loading of next file was tried */
+    int32_t skip;
+
+    (void) aArg;
+
+    TRACE_THREAD("music");
+    playing = loadTrack (music_current, playlist_file_pos, 1) && startTrack (music_current);
+    while (__atomic_load_n (&music_running, __ATOMIC_ACQUIRE))
+    {
+        skip = __atomic_exchange_n (&music_skip, 0, __ATOMIC_ACQ_REL);
+        if (skip)
+        {
+            audioFlush ();
+            if (playing)
+            {
+                xmp_end_player (music_current->ctx);
+            }
+            if (skip == 1 && prefetched && music_next->loaded)
+            {
+                releaseTrack (music_current);
+                swapTracks ();
+            }
+            else
+            {
+                releaseTrack (music_next);
+                loadTrack (music_current, stepPos (music_current->file_pos, skip), skip > 0 ? 1 : -1);
+            }
+            prefetched = FALSE;
+            playing = startTrack (music_current);
+            continue;
+        }
+        if (!playing)
+        {
+            setStopped ();
+            SDL_Delay (MUSIC_STOPPED_MS);
+            continue;
+        }
+        if (audioSpace () < MUSIC_DECODE_FRAMES)
+        {
+            /* Ring is full, there is time to load the next file */
+            if (!prefetched)
+            {
+                loadTrack (music_next, stepPos (music_current->file_pos, 1), 1);
+                prefetched = TRUE;
+            }
+            else
+            {
+                SDL_Delay (MUSIC_IDLE_MS);
+            }
+            continue;
+        }
+
+        {
+            TRACE_BEGIN(span);
+
+            decoded = xmp_play_buffer (music_current->ctx, buf, sizeof (buf), 1) == 0;
+            TRACE_END(span, "xmp_play_buffer");
+        }
+        if (decoded)
+        {
+            audioWrite (buf, MUSIC_DECODE_FRAMES);
+            xmp_get_frame_info (music_current->ctx, &frame);
+            SDL_mutexP (music_status_mutex);
+            music_status.position = frame.pos;
+            SDL_mutexV (music_status_mutex);
+        }
+        else
+        {
+            /* End of file, the next one follows without gap */
+            xmp_end_player (music_current->ctx);
+            releaseTrack (music_current);
+            if (!prefetched)
+            {
+                loadTrack (music_next, stepPos (music_current->file_pos, 1), 1);
+            }
+            swapTracks ();
+            prefetched = FALSE;
+            playing = startTrack (music_current);
+        }
+    }
+    if (playing)
+    {
+        xmp_end_player (music_current->ctx);
+    }
+    releaseTrack (music_current);
+    releaseTrack (music_next);
+
+    return 0;
+}
+
+static void musicFree (void)
+{
+    uint8_t i;
+
+    for (i = 0; i < 2; i++)
+    {
+        if (music_tracks[i].ctx)
+        {
+            xmp_free_context (music_tracks[i].ctx);
+            music_tracks[i].ctx = NULL;
+        }
+    }
+    if (music_status_mutex)
+    {
+        SDL_DestroyMutex (music_status_mutex);
+        music_status_mutex = NULL;
+    }
+}
+
+/**
+ * @brief musicInit
+ * Open audio device and start decoding the actual file of playlist.
+ * Volume and pause are taken from the configuration.
+ *
+ * @return TRUE: music is playing.
+ */
+bool_t musicInit (void)
+{
+    uint8_t i;
+
+    music_status_mutex = SDL_CreateMutex ();
+    for (i = 0; i < 2; i++)
+    {
+        music_tracks[i].ctx = xmp_create_context ();
+        music_tracks[i].loaded = FALSE;
+    }
+    if (!music_status_mutex || !music_tracks[0].ctx || !music_tracks[1].ctx)
+    {
+        printf("%s: out of memory\n", __FUNCTION__);
+        musicFree ();
+        return FALSE;
+    }
+    if (!audioInit ())
+    {
+        musicFree ();
+        return FALSE;
+    }
+    audioSetVolume (config.volume);
+    audioSetPaused (config.music_paused);
+
+    music_current = &music_tracks[0];
+    music_next = &music_tracks[1];
+    music_skip = 0;
+    music_running = TRUE;
+    music_thread = SDL_CreateThread (musicThread, NULL);
+    if (!music_thread)
+    {
+        printf("%s: cannot start decoder thread\n", __FUNCTION__);
+        music_running = FALSE;
+        audioDone ();
+        musicFree ();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief musicDone
+ * Stop decoder and close audio device.
+ */
+void musicDone (void)
+{
+    if (music_thread)
+    {
+        __atomic_store_n (&music_running, FALSE, __ATOMIC_RELEASE);
+        SDL_WaitThread (music_thread, NULL);
+        music_thread = NULL;
+        audioDone ();
+        musicFree ();
+    }
+}
+
+void musicNext (void)
+{
+    __atomic_add_fetch (&music_skip, 1, __ATOMIC_RELEASE);
+}
+
+void musicPrev (void)
+{
+    __atomic_sub_fetch (&music_skip, 1, __ATOMIC_RELEASE);
+}
+
+void musicSetVolume (uint8_t aVolume)
+{
+    audioSetVolume (aVolume);
+}
+
+void musicSetPaused (bool_t aPaused)
+{
+    audioSetPaused (aPaused);
+}
+
+/**
+ * @brief musicGetStatus
+ * Copy the state of decoder.
+ */
+void musicGetStatus (music_status_t* aStatus)
+{
+    if (music_status_mutex)
+    {
+        SDL_mutexP (music_status_mutex);
+        *aStatus = music_status;
+        SDL_mutexV (music_status_mutex);
+    }
+    else
+    {
+        memset (aStatus, 0, sizeof (music_status_t));
+    }
+}
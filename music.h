@@ -0,0 +1,44 @@
+/**
+ * @file        music.h
+ * @brief       Module music player
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-16 20:48:31
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_MUSIC_H
+#define INCLUDE_MUSIC_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define MUSIC_DECODE_FRAMES     2048    /* Frames decoded at once */
+#define MUSIC_IDLE_MS           10      /* Decoder sleeps if the ring is full */
+#define MUSIC_STOPPED_MS        100     /* Decoder sleeps if nothing can be played */
+#define MUSIC_MAX_LOAD_FAILS    16      /* Broken files skipped in a row */
+#define MUSIC_SONG_NAME_LENGTH  64
+
+/* Snapshot of decoder for the display */
+typedef struct
+{
+    bool_t playing;
+    char file_name[16];
+    char file_path[FSYS_FILENAME_MAX];
+    char song_name[MUSIC_SONG_NAME_LENGTH];
+    uint32_t file_pos;      /* Number of file in playlist, 1: first */
+    uint32_t file_cntr;     /* Number of files in playlist */
+    uint16_t position;      /* Order of decoder, it is ahead of the speaker */
+    uint16_t length;        /* Number of orders */
+} music_status_t;
+
+bool_t musicInit (void);
+void musicDone (void);
+void musicNext (void);
+void musicPrev (void);
+void musicSetVolume (uint8_t aVolume);
+void musicSetPaused (bool_t aPaused);
+void musicGetStatus (music_status_t* aStatus);
+
+#endif /* INCLUDE_MUSIC_H */
@@ -0,0 +1,132 @@
+/**
+ * @file        overlay.c
+ * @brief       Frame time and counters overlay
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-22 16:40:03
+ * Licence:     GPL
+ *
+ * F3 shows FPS, minimum, average and 99th percentile of frame time over
+ * the last OVERLAY_FRAMES frames, their graph, blits of the frame and work
+ * of collapseMap() at the last lock of figure. Frame time is the time
+ * between two flips of screen, so it contains waiting for input in menus.
+ *
+ * Collecting is a clock read per frame, so it is always compiled in.
+ * Statistics are only computed while the overlay is visible.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_gfxPrimitives.h>
+
+#include "overlay.h"
+#include "game_gfx.h"
+
+#define OVERLAY_X               2
+#define OVERLAY_Y               2
+#define OVERLAY_LINE_PX         10
+#define OVERLAY_LINES           6
+
+bool_t overlay_visible = FALSE;
+
+static uint32_t overlay_frame_us[OVERLAY_FRAMES];  /* Ring of frame times */
+static uint32_t overlay_frame_cntr = 0;
+static uint64_t overlay_last_flip_us = 0;
+
+/**
+ * @brief overlayFrame
+ * Called after every flip of screen.
+ */
+void overlayFrame (void)
+{
+    uint64_t now = getTimeUs ();
+    uint64_t frame_us = now - overlay_last_flip_us;
+
+    if (overlay_last_flip_us)
+    {
+        overlay_frame_us[overlay_frame_cntr % OVERLAY_FRAMES] =
+            frame_us < UINT32_MAX ? frame_us : UINT32_MAX;
+        overlay_frame_cntr++;
+    }
+    overlay_last_flip_us = now;
+    blit_counter = 0;
+}
+
+static int compareUs (const void* aA, const void* aB)
+{
+    uint32_t a = *(const uint32_t*) aA;
+    uint32_t b = *(const uint32_t*) aB;
+
+    return a < b ? -1 : a > b;
+}
+
+/**
+ * @brief drawGraph
+ * Frame times from the oldest, frames over budget are red.
+ */
+static void drawGraph (int16_t aX, int16_t aBottom, uint32_t aFrames)
+{
+    uint32_t i;
+    uint32_t us;
+    int16_t h;
+
+    for (i = 0; i < aFrames; i++)
+    {
+        us = overlay_frame_us[(overlay_frame_cntr - aFrames + i) % OVERLAY_FRAMES];
+        h = (us < OVERLAY_GRAPH_MAX_US ? us : OVERLAY_GRAPH_MAX_US)
+            * OVERLAY_GRAPH_HEIGHT / OVERLAY_GRAPH_MAX_US;
+        gfx_vline_draw (aX + OVERLAY_FRAMES - aFrames + i, aBottom - h, aBottom,
+                        us > OVERLAY_BUDGET_US ? gfx_color_rgb (0xFF, 0x40, 0x40)
+                                               : gfx_color_rgb (0x40, 0xFF, 0x40));
+    }
+    h = OVERLAY_BUDGET_US * OVERLAY_GRAPH_HEIGHT / OVERLAY_GRAPH_MAX_US;
+    gfx_line_draw (aX, aBottom - h, aX + OVERLAY_FRAMES - 1, aBottom - h,
+                   gfx_color_rgb (0xFF, 0xFF, 0x40));
+}
+
+/**
+ * @brief overlayDraw
+ * Draw overlay to the top left corner of the map.
+ */
+void overlayDraw (void)
+{
+    uint32_t sorted[OVERLAY_FRAMES];
+    uint32_t blits = blit_counter;
+    uint32_t frames = overlay_frame_cntr < OVERLAY_FRAMES ? overlay_frame_cntr : OVERLAY_FRAMES;
+    uint64_t sum = 0;
+    uint32_t i;
+    int16_t x = OVERLAY_X + 2;
+    int16_t y = OVERLAY_Y + 2;
+    char s[32];
+
+    gfx_box_draw (OVERLAY_X, OVERLAY_Y,
+                  OVERLAY_X + OVERLAY_FRAMES + 3,
+                  OVERLAY_Y + OVERLAY_LINES * OVERLAY_LINE_PX + OVERLAY_GRAPH_HEIGHT + 5,
+                  gfx_color_rgba (0x00, 0x00, 0x00, 0xB0));
+    for (i = 0; i < frames; i++)
+    {
+        sorted[i] = overlay_frame_us[(overlay_frame_cntr - frames + i) % OVERLAY_FRAMES];
+        sum += sorted[i];
+    }
+    if (sum)
+    {
+        qsort (sorted, frames, sizeof (sorted[0]), compareUs);
+        snprintf (s, sizeof (s), "FPS %.1f", frames * 1e6 / sum);
+        gfx_font_print (x, y, gameFontSmall, s);
+        snprintf (s, sizeof (s), "min %.1f ms", sorted[0] / 1000.0);
+        gfx_font_print (x, y + OVERLAY_LINE_PX, gameFontSmall, s);
+        snprintf (s, sizeof (s), "avg %.1f ms", sum / 1000.0 / frames);
+        gfx_font_print (x, y + 2 * OVERLAY_LINE_PX, gameFontSmall, s);
+        snprintf (s, sizeof (s), "p99 %.1f ms", sorted[(frames * 99 + 99) / 100 - 1] / 1000.0);
+        gfx_font_print (x, y + 3 * OVERLAY_LINE_PX, gameFontSmall, s);
+    }
+    snprintf (s, sizeof (s), "blits %u", blits);
+    gfx_font_print (x, y + 4 * OVERLAY_LINE_PX, gameFontSmall, s);
+    snprintf (s, sizeof (s), "lock %ur %uc", collapse_stat.rounds, collapse_stat.cells);
+    gfx_font_print (x, y + 5 * OVERLAY_LINE_PX, gameFontSmall, s);
+    drawGraph (x, y + OVERLAY_LINES * OVERLAY_LINE_PX + OVERLAY_GRAPH_HEIGHT, frames);
+}
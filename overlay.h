@@ -0,0 +1,27 @@
+/**
+ * @file        overlay.h
+ * @brief       Frame time and counters overlay
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-22 16:40:03
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_OVERLAY_H
+#define INCLUDE_OVERLAY_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define OVERLAY_FRAMES          128     /* Sliding window, one pixel of graph per frame */
+#define OVERLAY_GRAPH_HEIGHT    32
+#define OVERLAY_GRAPH_MAX_US    33333   /* Top of graph: 30 FPS */
+#define OVERLAY_BUDGET_US       16667   /* Line in graph: 60 FPS */
+
+extern bool_t overlay_visible;  /* Toggled by F3 */
+
+void overlayFrame (void);
+void overlayDraw (void);
+
+#endif /* INCLUDE_OVERLAY_H */
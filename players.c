@@ -0,0 +1,512 @@
+/**
+ * @file        players.c
+ * @brief       Player profiles with statistics
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-11 20:05:33
+ * Licence:     GPL
+ *
+ * Profiles are stored in an array. A hash table of indices finds a player by
+ * name, an index sorted case-insensitively gives the range of names starting
+ * with a prefix by two binary searches, so the name picker does not depend on
+ * the number of players.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "players.h"
+#include "savefile.h"
+#include "iothread.h"
+
+#define PLAYERS_NIL             0xFFFFFFFFu
+#define PLAYERS_RECORD_MAX      (SAVEFILE_RECORD_SIZE * 4 + PLAYER_NAME_LENGTH + 4 + 4 + 1 \
+                                 + RECORD_TYPES * (SAVEFILE_RECORD_SIZE + 5))
+
+typedef enum
+{
+    PLAYERS_TAG_NAME = 1,       /* Starts a new player */
+    PLAYERS_TAG_GAMES,
+    PLAYERS_TAG_FIGURES,
+    PLAYERS_TAG_CASCADE,
+    PLAYERS_TAG_BEST            /* Block types (1), score (4) */
+} players_tag_t;
+
+static player_t* players;
+static uint32_t  players_count;
+static uint32_t  players_capacity;
+static uint32_t* players_hash;      /* Index of player, PLAYERS_NIL: empty slot */
+static uint32_t  players_hash_size; /* Power of two */
+static uint32_t* players_sorted;    /* Indices in order of names */
+static char      players_path[FSYS_FILENAME_MAX];
+
+/**
+ * @brief hashName
+ * FNV-1a hash of name.
+ */
+static uint32_t hashName (const char* aName)
+{
+    uint32_t hash = 2166136261u;
+    uint8_t i;
+
+    for (i = 0; i < PLAYER_NAME_LENGTH && aName[i]; i++)
+    {
+        hash ^= (uint8_t) aName[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief compareNames
+ * Order of names: case-insensitive, then case-sensitive.
+ */
+static int compareNames (const char* aA, const char* aB)
+{
+    int ret = strcasecmp (aA, aB);
+
+    return ret ? ret : strcmp (aA, aB);
+}
+
+/**
+ * @brief findSlot
+ * @return Slot of name in hash table, or the empty slot where it belongs.
+ */
+static uint32_t findSlot (const char* aName)
+{
+    uint32_t mask = players_hash_size - 1;
+    uint32_t slot = hashName (aName) & mask;
+
+    while (players_hash[slot] != PLAYERS_NIL
+           && strcmp (players[players_hash[slot]].name, aName))
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+/**
+ * @brief rehash
+ * Resize hash table to keep it at most half full.
+ */
+static bool_t rehash (uint32_t aSize)
+{
+    uint32_t* hash = malloc (aSize * sizeof (uint32_t));
+    uint32_t i;
+
+    if (!hash)
+    {
+        return FALSE;
+    }
+    free (players_hash);
+    players_hash = hash;
+    players_hash_size = aSize;
+    memset (players_hash, 0xFF, aSize * sizeof (uint32_t));
+    for (i = 0; i < players_count; i++)
+    {
+        players_hash[findSlot (players[i].name)] = i;
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief lowerBound
+ * @return Position of first name in sorted index which is not less than
+ *         aName, comparing at most aLength characters case-insensitively.
+ */
+static uint32_t lowerBound (const char* aName, size_t aLength)
+{
+    uint32_t lo = 0, hi = players_count, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (strncasecmp (players[players_sorted[mid]].name, aName, aLength) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * @brief upperBound
+ * @return Position after the last name starting with aPrefix.
+ */
+static uint32_t upperBound (const char* aPrefix, size_t aLength)
+{
+    uint32_t lo = 0, hi = players_count, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (strncasecmp (players[players_sorted[mid]].name, aPrefix, aLength) <= 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * @brief addPlayer
+ * Add new player, name shall not be in the store.
+ *
+ * @return Index of player. PLAYERS_NIL: out of memory.
+ */
+static uint32_t addPlayer (const char* aName)
+{
+    uint32_t index = players_count;
+    uint32_t pos, lo, hi, mid;
+
+    if (players_count == players_capacity)
+    {
+        uint32_t capacity = players_capacity ? players_capacity * 2 : 64;
+        player_t* p = realloc (players, capacity * sizeof (player_t));
+        uint32_t* sorted;
+
+        if (!p)
+        {
+            return PLAYERS_NIL;
+        }
+        players = p;
+        sorted = realloc (players_sorted, capacity * sizeof (uint32_t));
+        if (!sorted)
+        {
+            return PLAYERS_NIL;
+        }
+        players_sorted = sorted;
+        players_capacity = capacity;
+    }
+    if ((players_count + 1) * 2 > players_hash_size
+            && !rehash (players_hash_size ? players_hash_size * 2 : 128))
+    {
+        return PLAYERS_NIL;
+    }
+    memset (&players[index], 0, sizeof (player_t));
+    strncpy (players[index].name, aName, PLAYER_NAME_LENGTH - 1);
+    players_hash[findSlot (players[index].name)] = index;
+    /* Insert into sorted index */
+    lo = 0;
+    hi = players_count;
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (compareNames (players[players_sorted[mid]].name, players[index].name) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    pos = lo;
+    memmove (&players_sorted[pos + 1], &players_sorted[pos], (players_count - pos) * sizeof (uint32_t));
+    players_sorted[pos] = index;
+    players_count++;
+
+    return index;
+}
+
+/**
+ * @brief loadPlayers
+ * Read player file.
+ */
+static void loadPlayers (void)
+{
+    struct stat st;
+    save_reader_t reader;
+    uint8_t* buf;
+    int32_t length;
+    uint16_t tag;
+    const uint8_t* data;
+    uint16_t dataLength;
+    char name[PLAYER_NAME_LENGTH];
+    player_t* player = NULL;
+    uint32_t index;
+
+    if (stat (players_path, &st) != 0 || st.st_size <= 0)
+    {
+        return;
+    }
+    buf = malloc (st.st_size);
+    if (!buf)
+    {
+        return;
+    }
+    length = saveFileRead (players_path, buf, st.st_size);
+    if (length > 0 && saveReaderInit (&reader, buf, length, SAVEFILE_MAGIC_PLAYERS))
+    {
+        while (saveReadNext (&reader, &tag, &data, &dataLength))
+        {
+            if (tag == PLAYERS_TAG_NAME)
+            {
+                saveReadString (name, sizeof (name), data, dataLength);
+                player = NULL;
+                if (name[0] && players_hash_size
+                        && players_hash[findSlot (name)] != PLAYERS_NIL)
+                {
+                    /* Duplicated name, ignore its records */
+                    continue;
+                }
+                index = name[0] ? addPlayer (name) : PLAYERS_NIL;
+                if (index != PLAYERS_NIL)
+                {
+                    player = &players[index];
+                }
+                continue;
+            }
+            if (!player)
+            {
+                continue;
+            }
+            switch (tag)
+            {
+                case PLAYERS_TAG_GAMES:
+                    if (dataLength >= 4)
+                    {
+                        player->games = GET_LE32 (data);
+                    }
+                    break;
+                case PLAYERS_TAG_FIGURES:
+                    if (dataLength >= 4)
+                    {
+                        player->figures = GET_LE32 (data);
+                    }
+                    break;
+                case PLAYERS_TAG_CASCADE:
+                    if (dataLength >= 1)
+                    {
+                        player->longest_cascade = data[0];
+                    }
+                    break;
+                case PLAYERS_TAG_BEST:
+                    if (dataLength >= 5 && data[0] >= MIN_BLOCK_TYPES && data[0] <= MAX_BLOCK_TYPES)
+                    {
+                        player->best_score[RECORD_TYPE(data[0])] = GET_LE32 (&data[1]);
+                    }
+                    break;
+                default:
+                    /* Unknown record, probably from a newer version */
+                    break;
+            }
+        }
+    }
+    else
+    {
+        printf("%s: invalid player file %s\n", __FUNCTION__, players_path);
+    }
+    free (buf);
+}
+
+/**
+ * @brief playersInit
+ * Load player profiles.
+ *
+ * @param aDir Directory of player file.
+ * @return TRUE: if successfully initialized.
+ */
+bool_t playersInit (const char* aDir)
+{
+    snprintf (players_path, sizeof (players_path), "%s" PLAYERS_FILENAME, aDir);
+    loadPlayers ();
+    printf("%s: %s, %u players\n", __FUNCTION__, players_path, players_count);
+
+    return TRUE;
+}
+
+/**
+ * @brief playersDone
+ * Free memory of player store.
+ */
+void playersDone (void)
+{
+    free (players);
+    free (players_hash);
+    free (players_sorted);
+    players = NULL;
+    players_hash = NULL;
+    players_sorted = NULL;
+    players_count = 0;
+    players_capacity = 0;
+    players_hash_size = 0;
+}
+
+/**
+ * @brief playersCount
+ * @return Number of players.
+ */
+uint32_t playersCount (void)
+{
+    return players_count;
+}
+
+/**
+ * @brief playersFind
+ * Find player by exact name. Pointer is valid until a player is added.
+ *
+ * @return Player. NULL: not found.
+ */
+const player_t* playersFind (const char* aName)
+{
+    uint32_t index;
+
+    if (!players_hash_size || !aName[0])
+    {
+        return NULL;
+    }
+    index = players_hash[findSlot (aName)];
+
+    return index == PLAYERS_NIL ? NULL : &players[index];
+}
+
+/**
+ * @brief playersAdd
+ * Add player if it is not in the store yet.
+ *
+ * @return Player. NULL: empty name or out of memory.
+ */
+const player_t* playersAdd (const char* aName)
+{
+    const player_t* player = playersFind (aName);
+    uint32_t index;
+
+    if (player || !aName[0])
+    {
+        return player;
+    }
+    index = addPlayer (aName);
+
+    return index == PLAYERS_NIL ? NULL : &players[index];
+}
+
+/**
+ * @brief playersMatchCount
+ * @return Number of players whose name starts with aPrefix (case-insensitive).
+ */
+uint32_t playersMatchCount (const char* aPrefix)
+{
+    size_t length = strnlen (aPrefix, PLAYER_NAME_LENGTH);
+
+    return upperBound (aPrefix, length) - lowerBound (aPrefix, length);
+}
+
+/**
+ * @brief playersSearch
+ * Get a page of players whose name starts with aPrefix, in order of names.
+ *
+ * @param[in]  aPrefix  Beginning of name (case-insensitive). "": every player.
+ * @param[in]  aFirst   Number of matching players to skip.
+ * @param[in]  aCount   Size of aPlayers.
+ * @param[out] aPlayers Players. Valid until a player is added.
+ * @return Number of players copied.
+ */
+uint32_t playersSearch (const char* aPrefix, uint32_t aFirst, uint32_t aCount, const player_t** aPlayers)
+{
+    size_t length = strnlen (aPrefix, PLAYER_NAME_LENGTH);
+    uint32_t pos = lowerBound (aPrefix, length) + aFirst;
+    uint32_t n = 0;
+
+    while (n < aCount && pos < players_count
+           && !strncasecmp (players[players_sorted[pos]].name, aPrefix, length))
+    {
+        aPlayers[n++] = &players[players_sorted[pos++]];
+    }
+
+    return n;
+}
+
+/**
+ * @brief playersAddGame
+ * Update statistics of player with a finished game and save the store.
+ *
+ * @param aName      Name of player, added if it is new.
+ * @param aBlockType Difficulty.
+ * @param aScore     Score of game.
+ * @param aFigures   Number of figures played.
+ * @param aCascade   Longest cascade of game.
+ */
+void playersAddGame (const char* aName, uint8_t aBlockType, uint32_t aScore,
+                     uint32_t aFigures, uint8_t aCascade)
+{
+    player_t* player = (player_t*) playersAdd (aName);
+
+    if (!player)
+    {
+        return;
+    }
+    player->games++;
+    player->figures += aFigures;
+    if (aCascade > player->longest_cascade)
+    {
+        player->longest_cascade = aCascade;
+    }
+    if (aScore > player->best_score[RECORD_TYPE(aBlockType)])
+    {
+        player->best_score[RECORD_TYPE(aBlockType)] = aScore;
+    }
+    playersSave ();
+}
+
+/**
+ * @brief playersSave
+ * Write player file on the I/O thread.
+ */
+void playersSave (void)
+{
+    save_writer_t writer;
+    uint32_t size = SAVEFILE_HEADER_SIZE + SAVEFILE_TRAILER_SIZE + players_count * PLAYERS_RECORD_MAX;
+    uint8_t* buf = malloc (size);
+    uint8_t data[5];
+    uint32_t length;
+    uint32_t i;
+    uint8_t j;
+
+    if (!buf)
+    {
+        return;
+    }
+    saveWriterInit (&writer, buf, size, SAVEFILE_MAGIC_PLAYERS, PLAYERS_FORMAT_VERSION);
+    for (i = 0; i < players_count; i++)
+    {
+        const player_t* player = &players[players_sorted[i]];
+
+        saveWriteString (&writer, PLAYERS_TAG_NAME, player->name, PLAYER_NAME_LENGTH - 1);
+        saveWriteU32 (&writer, PLAYERS_TAG_GAMES, player->games);
+        saveWriteU32 (&writer, PLAYERS_TAG_FIGURES, player->figures);
+        saveWriteU8 (&writer, PLAYERS_TAG_CASCADE, player->longest_cascade);
+        for (j = 0; j < RECORD_TYPES; j++)
+        {
+            if (player->best_score[j])
+            {
+                data[0] = j + MIN_BLOCK_TYPES;
+                PUT_LE32 (&data[1], player->best_score[j]);
+                saveWriteBytes (&writer, PLAYERS_TAG_BEST, data, sizeof (data));
+            }
+        }
+    }
+    length = saveWriterFinish (&writer);
+    if (length)
+    {
+        ioWriteFile (players_path, buf, length);
+    }
+    free (buf);
+}
@@ -0,0 +1,41 @@
+/**
+ * @file        players.h
+ * @brief       Player profiles with statistics
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-11 20:05:33
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_PLAYERS_H
+#define INCLUDE_PLAYERS_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define PLAYERS_FILENAME        "/stplayers.bin"
+#define PLAYERS_FORMAT_VERSION  1
+#define PLAYERS_PAGE_SIZE       10  /* Number of players listed by name picker */
+
+typedef struct
+{
+    char name[PLAYER_NAME_LENGTH];
+    uint8_t longest_cascade;            /* Most collapse rounds after one figure */
+    uint32_t games;                     /* Number of finished games */
+    uint32_t figures;                   /* Number of figures played */
+    uint32_t best_score[RECORD_TYPES];  /* Per difficulty */
+} player_t;
+
+bool_t playersInit (const char* aDir);
+void playersDone (void);
+uint32_t playersCount (void);
+const player_t* playersFind (const char* aName);
+const player_t* playersAdd (const char* aName);
+uint32_t playersMatchCount (const char* aPrefix);
+uint32_t playersSearch (const char* aPrefix, uint32_t aFirst, uint32_t aCount, const player_t** aPlayers);
+void playersAddGame (const char* aName, uint8_t aBlockType, uint32_t aScore,
+                     uint32_t aFigures, uint8_t aCascade);
+void playersSave (void);
+
+#endif /* INCLUDE_PLAYERS_H */
@@ -0,0 +1,1311 @@
+/**
+ * @file        playlist.c
+ * @brief       Music playlist built from directories of playlist.txt
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-14 18:42:10
+ * Licence:     GPL
+ *
+ * Every line of playlist.txt is a directory which is searched recursively
+ * for MOD/S3M/XM files. Directories are read by several walker threads, each
+ * of them collects names into its own string arena. When all directories are
+ * read the arenas are merged into one sorted index: every directory path is
+ * stored once and a file is only its name and the index of its directory.
+ * Stepping in the playlist is O(1), a file is found by a hash lookup.
+ *
+ * The index is saved and it is mapped at the next start. Then walkers only
+ * check the modification time of every known directory: unchanged
+ * directories are taken from the index, changed ones are read again.
+ * If nothing has changed, the mapped index is the playlist.
+ *
+ * Scanning runs in the background: a scan thread starts the walkers and
+ * builds the playlist when all of them are done, the game loop only polls
+ * it.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_thread.h>
+
+#include "playlist.h"
+#include "iothread.h"
+#include "savefile.h"
+
+#define PLAYLIST_SEP_CHR        '/'
+#define PLAYLIST_HASH_INIT      2166136261u /* FNV-1a */
+#define PLAYLIST_HASH_PRIME     16777619u
+
+typedef struct
+{
+    const playlist_index_header_t* header;
+    const playlist_dir_t* dirs;         /* Sorted by path */
+    const playlist_entry_t* entries;    /* Sorted by directory, then by name */
+    const uint32_t* hash;               /* Index of file + 1, 0: empty slot */
+    const char* strings;                /* Directory paths and file names */
+    void* mem;                          /* Mapped file or allocated memory */
+    size_t mem_size;
+    bool_t mapped;
+} playlist_index_t;
+
+typedef struct                  /* Directory to be read by a walker */
+{
+    char* path;                 /* Path of new directory, NULL: directory of cache */
+    uint32_t cached;            /* Index of directory in cache */
+} playlist_job_t;
+
+typedef struct                  /* Directory collected by a walker */
+{
+    uint32_t path;              /* Offset of path in strings of walker */
+    uint32_t cached;            /* Index of unchanged directory in cache, PLAYLIST_NONE: it was read */
+    uint32_t first;             /* Index of first name in names of walker */
+    uint32_t name_cntr;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} playlist_scan_dir_t;
+
+typedef struct
+{
+    SDL_Thread* thread;
+    char* strings;              /* Arena of paths and names */
+    uint32_t strings_size;
+    uint32_t strings_capacity;
+    playlist_scan_dir_t* dirs;
+    uint32_t dir_cntr;
+    uint32_t dir_capacity;
+    uint32_t* names;            /* Offset of names in strings */
+    uint32_t name_cntr;
+    uint32_t name_capacity;
+    uint32_t read_cntr;         /* Number of directories read from disk */
+} playlist_walker_t;
+
+typedef struct                  /* Directory to be sorted while merging */
+{
+    const char* path;
+    const playlist_walker_t* walker;
+    const playlist_scan_dir_t* dir;
+} playlist_dir_ref_t;
+
+static const char* playlist_extensions[] = { ".mod", ".s3m", ".xm" };
+
+bool_t       playlist_loaded = FALSE;
+uint32_t     playlist_file_cntr = 0;
+uint32_t     playlist_file_pos = 0;
+char         musicFileName[16];
+char         musicFilePath[FSYS_FILENAME_MAX];
+
+static playlist_index_t  playlist;                  /* Actual playlist */
+static playlist_index_t  playlist_cache;            /* Saved index while scanning */
+
+static playlist_job_t*   scan_queue = NULL;         /* Directories to be read */
+static uint32_t          scan_queue_cntr = 0;
+static uint32_t          scan_queue_capacity = 0;
+static uint32_t          scan_busy = 0;             /* Number of walkers reading a directory */
+static uint32_t          scan_found = 0;            /* Number of files found so far */
+static SDL_mutex*        scan_mutex = NULL;
+static SDL_cond*         scan_cond = NULL;          /* Signaled when a directory is queued */
+static bool_t            scan_stop = FALSE;         /* TRUE: walkers exit, queue is dropped */
+static bool_t            scan_running = FALSE;      /* TRUE: scan was started, see pollPlaylist() */
+static bool_t            scan_finished = FALSE;     /* TRUE: scan thread has built the playlist */
+static SDL_Thread*       scan_thread = NULL;
+static playlist_walker_t scan_walkers[PLAYLIST_MAX_THREADS];
+static uint8_t           scan_walker_cntr = 0;
+static uint32_t          scan_roots_crc = 0;        /* Checksum of playlist.txt */
+static uint32_t          scan_start_tick = 0;
+static char              scan_index_path[FSYS_FILENAME_MAX]; /* Saved index is replaced here */
+
+/**
+ * @brief grow
+ * Make room in a dynamic array.
+ *
+ * @param aBuf       Array.
+ * @param aCapacity  Number of allocated elements, updated.
+ * @param aNeeded    Number of needed elements.
+ * @param aElemSize  Size of an element.
+ * @return Array which can store aNeeded elements. NULL: out of memory,
+ *         aBuf is not changed.
+ */
+static void* grow (void* aBuf, uint32_t* aCapacity, uint32_t aNeeded, size_t aElemSize)
+{
+    uint32_t capacity = *aCapacity ? *aCapacity : 64;
+    void* buf;
+
+    if (aBuf && aNeeded <= *aCapacity)
+    {
+        return aBuf;
+    }
+    while (capacity < aNeeded)
+    {
+        capacity *= 2;
+    }
+    buf = realloc (aBuf, (size_t) capacity * aElemSize);
+    if (buf)
+    {
+        *aCapacity = capacity;
+    }
+
+    return buf;
+}
+
+static uint32_t hashString (uint32_t aHash, const char* aString)
+{
+    while (*aString)
+    {
+        aHash = (aHash ^ (uint8_t) *aString++) * PLAYLIST_HASH_PRIME;
+    }
+
+    return aHash;
+}
+
+/**
+ * @brief indexSize
+ * @return Size of an index without strings.
+ */
+static uint64_t indexSize (uint32_t aDirCntr, uint32_t aFileCntr, uint32_t aHashSize)
+{
+    return sizeof (playlist_index_header_t)
+           + (uint64_t) aDirCntr * sizeof (playlist_dir_t)
+           + (uint64_t) aFileCntr * sizeof (playlist_entry_t)
+           + (uint64_t) aHashSize * sizeof (uint32_t);
+}
+
+/**
+ * @brief setIndex
+ * Set pointers of sections of an index.
+ */
+static void setIndex (playlist_index_t* aIndex, void* aMem, size_t aSize, bool_t aMapped)
+{
+    const playlist_index_header_t* header = aMem;
+
+    aIndex->mem = aMem;
+    aIndex->mem_size = aSize;
+    aIndex->mapped = aMapped;
+    aIndex->header = header;
+    aIndex->dirs = (const playlist_dir_t*) (header + 1);
+    aIndex->entries = (const playlist_entry_t*) (aIndex->dirs + header->dir_cntr);
+    aIndex->hash = (const uint32_t*) (aIndex->entries + header->file_cntr);
+    aIndex->strings = (const char*) (aIndex->hash + header->hash_size);
+}
+
+static void freeIndex (playlist_index_t* aIndex)
+{
+    if (aIndex->mapped)
+    {
+        munmap (aIndex->mem, aIndex->mem_size);
+    }
+    else
+    {
+        free (aIndex->mem);
+    }
+    memset (aIndex, 0, sizeof (playlist_index_t));
+}
+
+/**
+ * @brief checkIndex
+ * Check offsets of a mapped index once, so they can be used without
+ * checking later.
+ *
+ * @return TRUE: index is consistent.
+ */
+static bool_t checkIndex (const playlist_index_t* aIndex)
+{
+    const playlist_index_header_t* header = aIndex->header;
+    uint32_t i;
+
+    if (aIndex->strings[header->strings_size - 1])
+    {
+        return FALSE;
+    }
+    for (i = 0; i < header->dir_cntr; i++)
+    {
+        if (aIndex->dirs[i].path >= header->strings_size
+            || (uint64_t) aIndex->dirs[i].first + aIndex->dirs[i].file_cntr > header->file_cntr)
+        {
+            return FALSE;
+        }
+    }
+    for (i = 0; i < header->file_cntr; i++)
+    {
+        if (aIndex->entries[i].dir >= header->dir_cntr
+            || aIndex->entries[i].name >= header->strings_size)
+        {
+            return FALSE;
+        }
+    }
+    for (i = 0; i < header->hash_size; i++)
+    {
+        if (aIndex->hash[i] > header->file_cntr)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief loadIndex
+ * Map saved index. Index of another playlist.txt is not used.
+ *
+ * @return TRUE: index is valid.
+ */
+static bool_t loadIndex (playlist_index_t* aIndex, const char* aPath, uint32_t aRootsCrc)
+{
+    const playlist_index_header_t* header;
+    struct stat st;
+    void* mem;
+    int fd;
+
+    fd = open (aPath, O_RDONLY);
+    if (fd < 0)
+    {
+        return FALSE;
+    }
+    if (fstat (fd, &st) || st.st_size < (off_t) sizeof (playlist_index_header_t)
+        || st.st_size > UINT32_MAX)
+    {
+        close (fd);
+        return FALSE;
+    }
+    mem = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (mem == MAP_FAILED)
+    {
+        return FALSE;
+    }
+
+    header = mem;
+    if (header->magic != PLAYLIST_INDEX_MAGIC
+        || header->version != PLAYLIST_INDEX_VERSION
+        || header->roots_crc != aRootsCrc
+        || header->size != st.st_size
+        || header->hash_size <= header->file_cntr
+        || (header->hash_size & (header->hash_size - 1))
+        || !header->strings_size
+        || indexSize (header->dir_cntr, header->file_cntr, header->hash_size)
+           + header->strings_size != header->size)
+    {
+        munmap (mem, st.st_size);
+        return FALSE;
+    }
+    setIndex (aIndex, mem, st.st_size, TRUE);
+    if (!checkIndex (aIndex))
+    {
+        printf("%s: %s is corrupted\n", __FUNCTION__, aPath);
+        freeIndex (aIndex);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief findDir
+ * Binary search of a directory in an index.
+ *
+ * @param aPath Path of directory, ends with '/'.
+ * @return Index of directory. PLAYLIST_NONE: not found.
+ */
+static uint32_t findDir (const playlist_index_t* aIndex, const char* aPath)
+{
+    uint32_t low = 0;
+    uint32_t high;
+    uint32_t mid;
+
+    if (!aIndex->header)
+    {
+        return PLAYLIST_NONE;
+    }
+    high = aIndex->header->dir_cntr;
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (strcmp (aIndex->strings + aIndex->dirs[mid].path, aPath) < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    if (low == aIndex->header->dir_cntr || strcmp (aIndex->strings + aIndex->dirs[low].path, aPath))
+    {
+        return PLAYLIST_NONE;
+    }
+
+    return low;
+}
+
+/**
+ * @brief addString
+ * Copy a string into the arena of walker.
+ *
+ * @return Offset of string. UINT32_MAX: out of memory.
+ */
+static uint32_t addString (playlist_walker_t* aWalker, const char* aString, size_t aLength)
+{
+    uint32_t offset = aWalker->strings_size;
+    char* strings;
+
+    strings = grow (aWalker->strings, &aWalker->strings_capacity,
+                    aWalker->strings_size + aLength + 1, 1);
+    if (!strings)
+    {
+        return UINT32_MAX;
+    }
+    aWalker->strings = strings;
+    memcpy (strings + offset, aString, aLength);
+    strings[offset + aLength] = 0;
+    aWalker->strings_size += aLength + 1;
+
+    return offset;
+}
+
+/**
+ * @brief addScanDir
+ * Add a directory to the walker.
+ *
+ * @param aPath   Path of read directory, NULL: unchanged directory of cache.
+ * @param aCached Index of directory in cache.
+ * @param aStat   Status of directory.
+ * @return Directory. NULL: out of memory.
+ */
+static playlist_scan_dir_t* addScanDir (playlist_walker_t* aWalker, const char* aPath,
+                                        uint32_t aCached, const struct stat* aStat)
+{
+    playlist_scan_dir_t* dirs;
+    playlist_scan_dir_t* dir;
+    uint32_t offset = PLAYLIST_NONE;
+
+    dirs = grow (aWalker->dirs, &aWalker->dir_capacity, aWalker->dir_cntr + 1,
+                 sizeof (playlist_scan_dir_t));
+    if (!dirs)
+    {
+        return NULL;
+    }
+    aWalker->dirs = dirs;
+    if (aPath)
+    {
+        offset = addString (aWalker, aPath, strlen (aPath));
+        if (offset == UINT32_MAX)
+        {
+            return NULL;
+        }
+    }
+    dir = &aWalker->dirs[aWalker->dir_cntr++];
+    dir->path = offset;
+    dir->cached = aCached;
+    dir->first = aWalker->name_cntr;
+    dir->name_cntr = 0;
+    dir->mtime_sec = aStat->st_mtim.tv_sec;
+    dir->mtime_nsec = aStat->st_mtim.tv_nsec;
+
+    return dir;
+}
+
+/**
+ * @brief queueDirectory
+ * Put a directory into the queue of walkers. Mutex shall be held.
+ *
+ * @param aPath   Path of new directory, last character must be '/'!
+ *                NULL: directory of cache.
+ * @param aCached Index of directory in cache.
+ */
+static void queueDirectory (const char* aPath, uint32_t aCached)
+{
+    playlist_job_t* queue;
+    char* path = NULL;
+
+    queue = grow (scan_queue, &scan_queue_capacity, scan_queue_cntr + 1, sizeof (playlist_job_t));
+    if (aPath)
+    {
+        path = strdup (aPath);
+    }
+    if (!queue || (aPath && !path))
+    {
+        printf("%s: out of memory, directory is skipped\n", __FUNCTION__);
+        free (path);
+        return;
+    }
+    scan_queue = queue;
+    scan_queue[scan_queue_cntr].path = path;
+    scan_queue[scan_queue_cntr].cached = aCached;
+    scan_queue_cntr++;
+    SDL_CondSignal (scan_cond);
+}
+
+/**
+ * @brief isMusicFile
+ * @return TRUE: file has an extension of a module.
+ */
+static bool_t isMusicFile (const char* aName, size_t aLength)
+{
+    uint8_t i;
+    size_t ext_length;
+
+    for (i = 0; i < sizeof (playlist_extensions) / sizeof (playlist_extensions[0]); i++)
+    {
+        ext_length = strlen (playlist_extensions[i]);
+        if (aLength > ext_length
+            && !strcasecmp (aName + aLength - ext_length, playlist_extensions[i]))
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief readDirectory
+ * Read a directory: queue new subdirectories and collect music files.
+ * Subdirectories which are in the cache are checked by their own job.
+ * Hidden entries are skipped, links to directories are not followed.
+ *
+ * @param aPath Path of directory. Last character must be '/'!
+ */
+static void readDirectory (playlist_walker_t* aWalker, const char* aPath)
+{
+    DIR* dir;
+    struct dirent* ent;
+    struct stat st;
+    char path[FSYS_FILENAME_MAX];
+    size_t path_length = strlen (aPath);
+    size_t name_length;
+    unsigned char type;
+    uint32_t* names;
+    uint32_t offset;
+
+    dir = opendir (aPath);
+    if (!dir)
+    {
+        return;
+    }
+    /* Time is taken before reading, so a change while reading is noticed next time */
+    if (fstat (dirfd (dir), &st) || !addScanDir (aWalker, aPath, PLAYLIST_NONE, &st))
+    {
+        closedir (dir);
+        return;
+    }
+    aWalker->read_cntr++;
+    memcpy (path, aPath, path_length);
+    while ((ent = readdir (dir)) != NULL)
+    {
+        if (ent->d_name[0] == '.')
+        {
+            continue;
+        }
+        name_length = strlen (ent->d_name);
+        if (path_length + name_length + 2 > sizeof (path))
+        {
+            /* Does not fit into musicFilePath */
+            continue;
+        }
+        memcpy (path + path_length, ent->d_name, name_length + 1);
+        type = ent->d_type;
+        if (type == DT_UNKNOWN || type == DT_LNK)
+        {
+            if (stat (path, &st))
+            {
+                continue;
+            }
+            if (S_ISREG (st.st_mode))
+            {
+                type = DT_REG;
+            }
+            else if (S_ISDIR (st.st_mode) && type == DT_UNKNOWN)
+            {
+                type = DT_DIR;
+            }
+        }
+
+        if (type == DT_DIR)
+        {
+            path[path_length + name_length] = PLAYLIST_SEP_CHR;
+            path[path_length + name_length + 1] = 0;
+            if (findDir (&playlist_cache, path) == PLAYLIST_NONE)
+            {
+                SDL_mutexP (scan_mutex);
+                queueDirectory (path, PLAYLIST_NONE);
+                SDL_mutexV (scan_mutex);
+            }
+        }
+        else if (type == DT_REG && isMusicFile (ent->d_name, name_length))
+        {
+            names = grow (aWalker->names, &aWalker->name_capacity,
+                          aWalker->name_cntr + 1, sizeof (uint32_t));
+            offset = addString (aWalker, ent->d_name, name_length);
+            if (!names || offset == UINT32_MAX)
+            {
+                break;
+            }
+            aWalker->names = names;
+            aWalker->names[aWalker->name_cntr++] = offset;
+            /* Directory of this file is the last one added */
+            aWalker->dirs[aWalker->dir_cntr - 1].name_cntr++;
+            __atomic_add_fetch (&scan_found, 1, __ATOMIC_RELAXED);
+        }
+    }
+    closedir (dir);
+}
+
+/**
+ * @brief checkDirectory
+ * Check a directory of cache. Unchanged directory is taken from the cache,
+ * changed one is read again, removed one is dropped.
+ */
+static void checkDirectory (playlist_walker_t* aWalker, uint32_t aCached)
+{
+    const playlist_dir_t* cached = &playlist_cache.dirs[aCached];
+    const char* path = playlist_cache.strings + cached->path;
+    playlist_scan_dir_t* scan_dir;
+    struct stat st;
+
+    if (stat (path, &st) || !S_ISDIR (st.st_mode))
+    {
+        return;
+    }
+    if (st.st_mtim.tv_sec == cached->mtime_sec && st.st_mtim.tv_nsec == cached->mtime_nsec)
+    {
+        scan_dir = addScanDir (aWalker, NULL, aCached, &st);
+        if (scan_dir)
+        {
+            scan_dir->name_cntr = cached->file_cntr;
+            __atomic_add_fetch (&scan_found, cached->file_cntr, __ATOMIC_RELAXED);
+        }
+    }
+    else
+    {
+        readDirectory (aWalker, path);
+    }
+}
+
+/**
+ * @brief walkerThread
+ * Read directories of the queue until it is empty and no other walker
+ * can add more.
+ */
+static int walkerThread (void* aArg)
+{
+    playlist_walker_t* walker = aArg;
+    playlist_job_t job;
+
+    SDL_mutexP (scan_mutex);
+    while ((scan_queue_cntr || scan_busy) && !scan_stop)
+    {
+        if (!scan_queue_cntr)
+        {
+            SDL_CondWait (scan_cond, scan_mutex);
+            continue;
+        }
+        job = scan_queue[--scan_queue_cntr];
+        scan_busy++;
+        SDL_mutexV (scan_mutex);
+
+        if (job.path)
+        {
+            readDirectory (walker, job.path);
+            free (job.path);
+        }
+        else
+        {
+            checkDirectory (walker, job.cached);
+        }
+
+        SDL_mutexP (scan_mutex);
+        scan_busy--;
+        if (!scan_queue_cntr && !scan_busy)
+        {
+            /* Wake up idle walkers to exit */
+            SDL_CondBroadcast (scan_cond);
+        }
+    }
+    SDL_mutexV (scan_mutex);
+
+    return 0;
+}
+
+static int compareDirRefs (const void* aA, const void* aB)
+{
+    return strcmp (((const playlist_dir_ref_t*) aA)->path, ((const playlist_dir_ref_t*) aB)->path);
+}
+
+static int compareStrings (const void* aA, const void* aB)
+{
+    return strcmp (*(const char* const*) aA, *(const char* const*) aB);
+}
+
+/**
+ * @brief mergeWalkers
+ * Build the sorted index from the arenas of walkers and from unchanged
+ * directories of cache. Directory which was found more times (overlapping
+ * lines of playlist.txt) is added only once.
+ *
+ * @return TRUE: index is built.
+ */
+static bool_t mergeWalkers (const playlist_walker_t* aWalkers, uint8_t aWalkerCntr, uint32_t aRootsCrc)
+{
+    playlist_index_header_t* header;
+    playlist_dir_t* dirs;
+    playlist_entry_t* entries;
+    uint32_t* hash;
+    char* strings;
+    playlist_dir_ref_t* refs;
+    const char** names = NULL;
+    const playlist_scan_dir_t* dir;
+    uint8_t* mem = NULL;
+    uint32_t dir_cntr = 0;
+    uint32_t file_cntr = 0;
+    uint32_t max_names = 0;
+    uint32_t hash_size = 1;
+    uint64_t strings_size = 0;
+    uint64_t size;
+    uint32_t pos = 0;
+    size_t length;
+    uint32_t i, j, k, slot;
+
+    for (i = 0; i < aWalkerCntr; i++)
+    {
+        dir_cntr += aWalkers[i].dir_cntr;
+        strings_size += aWalkers[i].strings_size;
+    }
+    if (!dir_cntr)
+    {
+        return FALSE;
+    }
+    if (playlist_cache.header)
+    {
+        strings_size += playlist_cache.header->strings_size;
+    }
+    refs = malloc (dir_cntr * sizeof (playlist_dir_ref_t));
+    if (!refs)
+    {
+        printf("%s: out of memory\n", __FUNCTION__);
+        return FALSE;
+    }
+    k = 0;
+    for (i = 0; i < aWalkerCntr; i++)
+    {
+        for (j = 0; j < aWalkers[i].dir_cntr; j++)
+        {
+            dir = &aWalkers[i].dirs[j];
+            refs[k].walker = &aWalkers[i];
+            refs[k].dir = dir;
+            if (dir->cached != PLAYLIST_NONE)
+            {
+                refs[k].path = playlist_cache.strings + playlist_cache.dirs[dir->cached].path;
+            }
+            else
+            {
+                refs[k].path = aWalkers[i].strings + dir->path;
+            }
+            k++;
+        }
+    }
+    qsort (refs, dir_cntr, sizeof (playlist_dir_ref_t), compareDirRefs);
+
+    /* Drop duplicated directories and count files */
+    k = 0;
+    for (i = 0; i < dir_cntr; i++)
+    {
+        if (k && !strcmp (refs[i].path, refs[k - 1].path))
+        {
+            continue;
+        }
+        refs[k++] = refs[i];
+        file_cntr += refs[i].dir->name_cntr;
+        if (refs[i].dir->name_cntr > max_names)
+        {
+            max_names = refs[i].dir->name_cntr;
+        }
+    }
+    dir_cntr = k;
+    while (hash_size < 2 * file_cntr + 1)
+    {
+        hash_size *= 2;
+    }
+    size = indexSize (dir_cntr, file_cntr, hash_size) + strings_size;
+    if (size <= UINT32_MAX)
+    {
+        names = malloc ((max_names + 1) * sizeof (const char*));
+        mem = calloc (1, size);
+    }
+    if (!names || !mem)
+    {
+        printf("%s: playlist is too big\n", __FUNCTION__);
+        free (mem);
+        free (names);
+        free (refs);
+        return FALSE;
+    }
+
+    header = (playlist_index_header_t*) mem;
+    header->magic = PLAYLIST_INDEX_MAGIC;
+    header->version = PLAYLIST_INDEX_VERSION;
+    header->roots_crc = aRootsCrc;
+    header->dir_cntr = dir_cntr;
+    header->file_cntr = file_cntr;
+    header->hash_size = hash_size;
+    dirs = (playlist_dir_t*) (header + 1);
+    entries = (playlist_entry_t*) (dirs + dir_cntr);
+    hash = (uint32_t*) (entries + file_cntr);
+    strings = (char*) (hash + hash_size);
+
+    file_cntr = 0;
+    for (i = 0; i < dir_cntr; i++)
+    {
+        dir = refs[i].dir;
+        length = strlen (refs[i].path) + 1;
+        memcpy (strings + pos, refs[i].path, length);
+        dirs[i].path = pos;
+        dirs[i].first = file_cntr;
+        dirs[i].file_cntr = dir->name_cntr;
+        dirs[i].mtime_sec = dir->mtime_sec;
+        dirs[i].mtime_nsec = dir->mtime_nsec;
+        pos += length;
+
+        if (dir->cached != PLAYLIST_NONE)
+        {
+            /* Names of cache are sorted already */
+            for (j = 0; j < dir->name_cntr; j++)
+            {
+                names[j] = playlist_cache.strings
+                           + playlist_cache.entries[playlist_cache.dirs[dir->cached].first + j].name;
+            }
+        }
+        else
+        {
+            for (j = 0; j < dir->name_cntr; j++)
+            {
+                names[j] = refs[i].walker->strings + refs[i].walker->names[dir->first + j];
+            }
+            qsort (names, dir->name_cntr, sizeof (const char*), compareStrings);
+        }
+        for (j = 0; j < dir->name_cntr; j++)
+        {
+            length = strlen (names[j]) + 1;
+            memcpy (strings + pos, names[j], length);
+            entries[file_cntr].dir = i;
+            entries[file_cntr].name = pos;
+            pos += length;
+
+            slot = hashString (hashString (PLAYLIST_HASH_INIT, refs[i].path), names[j]) & (hash_size - 1);
+            while (hash[slot])
+            {
+                slot = (slot + 1) & (hash_size - 1);
+            }
+            hash[slot] = file_cntr + 1;
+            file_cntr++;
+        }
+    }
+    free (names);
+    free (refs);
+
+    /* Strings are the last section, unused part of the buffer is not saved */
+    header->strings_size = pos;
+    header->size = indexSize (dir_cntr, file_cntr, hash_size) + pos;
+    setIndex (&playlist, mem, header->size, FALSE);
+
+    return TRUE;
+}
+
+/**
+ * @brief getFileName
+ * Return filename from full path.
+ * @param[out]  aFileName       Filename from full path. Example: "DATA.DAT"
+ * @param[in]   aPath           Full path. Example: "/home/music/DATA.DAT"
+ * @param[in]   aFileNameLength Size of aFileName buffer.
+ * @return aFileName
+ */
+static char* getFileName (char* aFileName, const char* aPath, size_t aFileNameLength)
+{
+    const char *pos;
+    size_t length;
+
+    pos = strrchr (aPath, PLAYLIST_SEP_CHR);
+    if (pos)
+    {
+        ++pos;
+    }
+    else
+    {
+        /* Directory separator not found */
+        pos = aPath;
+    }
+    /* Long names are truncated */
+    length = strlen (pos);
+    if (length >= aFileNameLength)
+    {
+        length = aFileNameLength - 1;
+    }
+    memcpy (aFileName, pos, length);
+    aFileName[length] = 0;
+
+    return aFileName;
+}
+
+/**
+ * @brief setMusicFile
+ * Make a file of playlist actual.
+ *
+ * @param aIdx Index of file, 0: first.
+ */
+static void setMusicFile (uint32_t aIdx)
+{
+    const playlist_entry_t* entry = &playlist.entries[aIdx];
+
+    playlist_file_pos = aIdx + 1;
+    snprintf (musicFilePath, sizeof (musicFilePath), "%s%s",
+              playlist.strings + playlist.dirs[entry->dir].path,
+              playlist.strings + entry->name);
+    getFileName (musicFileName, musicFilePath, sizeof (musicFileName));
+}
+
+/**
+ * @brief setDefaultMusicFile
+ * No playlist, using default filename.
+ */
+static void setDefaultMusicFile (void)
+{
+    snprintf (musicFilePath, sizeof (musicFilePath), "%s", DEFAULT_MUSIC_FILENAME);
+    getFileName (musicFileName, musicFilePath, sizeof (musicFileName));
+}
+
+/**
+ * @brief findMusicFile
+ * Hash lookup of a file in the playlist.
+ *
+ * @param[in]  aPath Full path of file.
+ * @param[out] aIdx  Index of file.
+ * @return TRUE: file is in the playlist.
+ */
+static bool_t findMusicFile (const char* aPath, uint32_t* aIdx)
+{
+    const playlist_entry_t* entry;
+    const char* dir;
+    size_t dir_length;
+    uint32_t mask;
+    uint32_t slot;
+    uint32_t i;
+
+    if (!playlist.header || !playlist.header->file_cntr)
+    {
+        return FALSE;
+    }
+    mask = playlist.header->hash_size - 1;
+    slot = hashString (PLAYLIST_HASH_INIT, aPath) & mask;
+    for (i = 0; i < playlist.header->hash_size && playlist.hash[slot]; i++)
+    {
+        entry = &playlist.entries[playlist.hash[slot] - 1];
+        dir = playlist.strings + playlist.dirs[entry->dir].path;
+        dir_length = strlen (dir);
+        if (!strncmp (aPath, dir, dir_length)
+            && !strcmp (aPath + dir_length, playlist.strings + entry->name))
+        {
+            *aIdx = playlist.hash[slot] - 1;
+            return TRUE;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief readPlaylistFile
+ * Queue directories of playlist.txt.
+ *
+ * @param[in]  aDir       Directory of playlist.txt.
+ * @param[out] aRootsCrc  Checksum of playlist.txt.
+ * @return TRUE: playlist.txt was found.
+ */
+static bool_t readPlaylistFile (const char* aDir, uint32_t* aRootsCrc)
+{
+    FILE* playListFile;
+    char line[FSYS_FILENAME_MAX + 1] = { 0 };
+    char* eol;
+    size_t length;
+
+    snprintf (line, sizeof (line), "%s" PLAYLIST_FILENAME, aDir);
+    playListFile = fopen (line, "r");
+    if (!playListFile)
+    {
+        return FALSE;
+    }
+    *aRootsCrc = 0;
+    while (fgets (line, sizeof (line) - 1, playListFile))
+    {
+        *aRootsCrc = crc32c (*aRootsCrc, line, strlen (line));
+        /* Remove trailing new lines if needed */
+        eol = strpbrk (line, "\r\n");
+        if (eol)
+        {
+            *eol = 0;
+        }
+        length = strlen (line);
+        if (length > 0 && line[0] != '#')
+        {
+            /* Append trailing separator if it is missing */
+            if (line[length - 1] != PLAYLIST_SEP_CHR)
+            {
+                line[length] = PLAYLIST_SEP_CHR;
+                line[length + 1] = 0;
+            }
+            queueDirectory (line, PLAYLIST_NONE);
+        }
+    }
+    fclose (playListFile);
+
+    return TRUE;
+}
+
+/**
+ * @brief queueCache
+ * Queue every directory of cache to be checked. Directories of
+ * playlist.txt which are in the cache are checked this way too.
+ */
+static void queueCache (void)
+{
+    uint32_t i;
+    uint32_t j = 0;
+
+    for (i = 0; i < scan_queue_cntr; i++)
+    {
+        if (findDir (&playlist_cache, scan_queue[i].path) != PLAYLIST_NONE)
+        {
+            free (scan_queue[i].path);
+        }
+        else
+        {
+            scan_queue[j++] = scan_queue[i];
+        }
+    }
+    scan_queue_cntr = j;
+    for (i = 0; i < playlist_cache.header->dir_cntr; i++)
+    {
+        queueDirectory (NULL, i);
+    }
+}
+
+/**
+ * @brief freeScan
+ * Free what was allocated for scanning. Scan thread shall not run.
+ */
+static void freeScan (void)
+{
+    uint8_t i;
+
+    /* Queue is not empty if playlist.txt was not found or scan was stopped */
+    while (scan_queue_cntr)
+    {
+        free (scan_queue[--scan_queue_cntr].path);
+    }
+    free (scan_queue);
+    scan_queue = NULL;
+    scan_queue_capacity = 0;
+    for (i = 0; i < scan_walker_cntr; i++)
+    {
+        free (scan_walkers[i].strings);
+        free (scan_walkers[i].dirs);
+        free (scan_walkers[i].names);
+    }
+    memset (scan_walkers, 0, sizeof (scan_walkers));
+    scan_walker_cntr = 0;
+    freeIndex (&playlist_cache);
+    if (scan_cond)
+    {
+        SDL_DestroyCond (scan_cond);
+        scan_cond = NULL;
+    }
+    if (scan_mutex)
+    {
+        SDL_DestroyMutex (scan_mutex);
+        scan_mutex = NULL;
+    }
+    scan_running = FALSE;
+}
+
+/**
+ * @brief scanThread
+ * Read directories by walkers and build the playlist from their result.
+ * Playlist is not used by others until pollPlaylist() has seen it done.
+ */
+static int scanThread (void* aArg)
+{
+    uint32_t dir_cntr = 0;
+    uint32_t read_cntr = 0;
+    long cpus;
+    uint8_t i;
+
+    (void) aArg;
+
+    /* Reading directories waits mostly for the disk, so there are more
+     * walkers than CPUs */
+    cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    scan_walker_cntr = (cpus > 0 && cpus < PLAYLIST_MAX_THREADS / 2) ? cpus * 2 : PLAYLIST_MAX_THREADS;
+    for (i = 0; i < scan_walker_cntr; i++)
+    {
+        scan_walkers[i].thread = SDL_CreateThread (walkerThread, &scan_walkers[i]);
+        if (!scan_walkers[i].thread)
+        {
+            break;
+        }
+    }
+    scan_walker_cntr = i;
+    if (scan_walker_cntr)
+    {
+        for (i = 0; i < scan_walker_cntr; i++)
+        {
+            SDL_WaitThread (scan_walkers[i].thread, NULL);
+        }
+    }
+    else
+    {
+        /* No threads: read everything by this one */
+        walkerThread (&scan_walkers[0]);
+        scan_walker_cntr = 1;
+    }
+
+    for (i = 0; i < scan_walker_cntr; i++)
+    {
+        dir_cntr += scan_walkers[i].dir_cntr;
+        read_cntr += scan_walkers[i].read_cntr;
+    }
+    if (__atomic_load_n (&scan_stop, __ATOMIC_RELAXED))
+    {
+        /* Result is not complete */
+    }
+    else if (playlist_cache.header && !read_cntr && dir_cntr == playlist_cache.header->dir_cntr)
+    {
+        /* Nothing has changed, mapped cache is the playlist */
+        playlist = playlist_cache;
+        memset (&playlist_cache, 0, sizeof (playlist_cache));
+    }
+    else if (mergeWalkers (scan_walkers, scan_walker_cntr, scan_roots_crc))
+    {
+        ioWriteFile (scan_index_path, playlist.mem, playlist.header->size);
+    }
+    printf("%s: %u of %u directories read, %u ms\n", __FUNCTION__,
+           read_cntr, dir_cntr, SDL_GetTicks () - scan_start_tick);
+    __atomic_store_n (&scan_finished, TRUE, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/**
+ * @brief startPlaylist
+ * Start creating playlist from playlist.txt. Directories are scanned and
+ * the playlist is built in the background, the game does not wait for it.
+ * @see pollPlaylist
+ *
+ * @param aDir Directory of playlist.txt and the saved index.
+ */
+void startPlaylist (const char* aDir)
+{
+    donePlaylist ();
+    setDefaultMusicFile ();
+
+    scan_start_tick = SDL_GetTicks ();
+    scan_mutex = SDL_CreateMutex ();
+    scan_cond = SDL_CreateCond ();
+    scan_found = 0;
+    scan_stop = FALSE;
+    scan_finished = FALSE;
+    if (!scan_mutex || !scan_cond || !readPlaylistFile (aDir, &scan_roots_crc))
+    {
+        freeScan ();
+        return;
+    }
+    snprintf (scan_index_path, sizeof (scan_index_path), "%s" PLAYLIST_INDEX_FILENAME, aDir);
+    if (loadIndex (&playlist_cache, scan_index_path, scan_roots_crc))
+    {
+        queueCache ();
+    }
+
+    scan_running = TRUE;
+    scan_thread = SDL_CreateThread (scanThread, NULL);
+    if (!scan_thread)
+    {
+        /* No threads: scan by this one */
+        scanThread (NULL);
+    }
+}
+
+/**
+ * @brief pollPlaylist
+ * Check whether scanning has finished. It is called from the game loop,
+ * so it never waits for the disk.
+ *
+ * @return TRUE: playlist is ready (or there is none). FALSE: scanning.
+ */
+bool_t pollPlaylist (void)
+{
+    uint32_t idx = 0;
+
+    if (!scan_running)
+    {
+        return TRUE;
+    }
+    if (!__atomic_load_n (&scan_finished, __ATOMIC_ACQUIRE))
+    {
+        return FALSE;
+    }
+    if (scan_thread)
+    {
+        SDL_WaitThread (scan_thread, NULL);
+        scan_thread = NULL;
+    }
+    freeScan ();
+
+    if (playlist.header)
+    {
+        playlist_file_cntr = playlist.header->file_cntr;
+        playlist_loaded = playlist_file_cntr > 0;
+    }
+    printf("%s: %u files\n", __FUNCTION__, playlist_file_cntr);
+    if (playlist_loaded)
+    {
+        findMusicFile (config.music_file_path, &idx);
+        setMusicFile (idx);
+    }
+    else
+    {
+        donePlaylist ();
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief getPlaylistProgress
+ * @param[out] aFound Number of music files found so far.
+ * @return TRUE: directories are being scanned.
+ */
+bool_t getPlaylistProgress (uint32_t* aFound)
+{
+    *aFound = __atomic_load_n (&scan_found, __ATOMIC_RELAXED);
+
+    return scan_running;
+}
+
+/**
+ * @brief donePlaylist
+ * Stop scanning and free memory allocated for playlist.
+ */
+void donePlaylist (void)
+{
+    if (scan_running)
+    {
+        /* Walkers finish the directory they read, the rest is dropped */
+        SDL_mutexP (scan_mutex);
+        __atomic_store_n (&scan_stop, TRUE, __ATOMIC_RELAXED);
+        SDL_CondBroadcast (scan_cond);
+        SDL_mutexV (scan_mutex);
+        if (scan_thread)
+        {
+            SDL_WaitThread (scan_thread, NULL);
+            scan_thread = NULL;
+        }
+        freeScan ();
+    }
+    freeIndex (&playlist);
+    playlist_file_cntr = 0;
+    playlist_file_pos = 0;
+    playlist_loaded = FALSE;
+}
+
+/**
+ * @brief getMusicFile
+ * @param aPos Number of file, 1: first.
+ * @return Music file's name.
+ */
+char* getMusicFile (uint32_t aPos)
+{
+    if (playlist_loaded && aPos >= 1 && aPos <= playlist_file_cntr)
+    {
+        setMusicFile (aPos - 1);
+    }
+    else
+    {
+        setDefaultMusicFile ();
+    }
+
+    return musicFilePath;
+}
+
+/**
+ * @brief getPrevMusicFile
+ * @param[out] aTurnOver The playlist's beginning was reached.
+ * @return Previous music file's name.
+ */
+char* getPrevMusicFile (bool_t* aTurnOver)
+{
+    bool_t turnOver = FALSE;
+
+    if (playlist_loaded)
+    {
+        /* playlist_file_pos - 1 is the index of actual file */
+        if (playlist_file_pos <= 1)
+        {
+            turnOver = TRUE;
+            setMusicFile (playlist_file_cntr - 1);
+        }
+        else
+        {
+            setMusicFile (playlist_file_pos - 2);
+        }
+    }
+    else
+    {
+        setDefaultMusicFile ();
+    }
+    if (aTurnOver)
+    {
+        *aTurnOver = turnOver;
+    }
+
+    return musicFilePath;
+}
+
+/**
+ * @brief getNextMusicFile
+ * @param[out] aTurnOver The playlist's end was reached.
+ * @return Next music file's name.
+ */
+char* getNextMusicFile (bool_t* aTurnOver)
+{
+    bool_t turnOver = FALSE;
+
+    if (playlist_loaded)
+    {
+        if (playlist_file_pos >= playlist_file_cntr)
+        {
+            turnOver = TRUE;
+            setMusicFile (0);
+        }
+        else
+        {
+            setMusicFile (playlist_file_pos);
+        }
+    }
+    else
+    {
+        setDefaultMusicFile ();
+    }
+    if (aTurnOver)
+    {
+        *aTurnOver = turnOver;
+    }
+
+    return musicFilePath;
+}
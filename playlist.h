@@ -0,0 +1,70 @@
+/**
+ * @file        playlist.h
+ * @brief       Music playlist built from directories of playlist.txt
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-14 18:42:10
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_PLAYLIST_H
+#define INCLUDE_PLAYLIST_H
+
+#include <stdint.h>
+
+#include "common.h"
+
+#define PLAYLIST_FILENAME       "/playlist.txt" /**< Directories of your music collection (MOD/S3M/XM) */
+#define PLAYLIST_INDEX_FILENAME "/stplaylist.idx" /**< Index of scanned directories */
+#define PLAYLIST_INDEX_MAGIC    0x49505453u     /* "STPI" */
+#define PLAYLIST_INDEX_VERSION  1
+#define PLAYLIST_MAX_THREADS    8               /**< Directory walker threads */
+#define PLAYLIST_NONE           0xFFFFFFFFu
+#define DEFAULT_MUSIC_FILENAME  "music.mod"
+
+/* Layout of index, it is used directly from the mapped file:
+ * header | dirs[dir_cntr] | entries[file_cntr] | hash[hash_size] | strings */
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t roots_crc;     /* CRC32C of playlist.txt */
+    uint32_t size;          /* Size of whole index */
+    uint32_t dir_cntr;
+    uint32_t file_cntr;
+    uint32_t hash_size;     /* Number of hash slots, power of 2 */
+    uint32_t strings_size;
+} playlist_index_header_t;
+
+typedef struct
+{
+    uint32_t path;          /* Offset of path in strings, ends with '/' */
+    uint32_t first;         /* Index of first file */
+    uint32_t file_cntr;     /* Number of music files, 0 is possible */
+    uint32_t reserved;
+    int64_t mtime_sec;      /* Modification time when directory was read */
+    int64_t mtime_nsec;
+} playlist_dir_t;
+
+typedef struct
+{
+    uint32_t dir;           /* Index of directory */
+    uint32_t name;          /* Offset of file name in strings */
+} playlist_entry_t;
+
+extern bool_t       playlist_loaded;
+extern uint32_t     playlist_file_cntr;         /**< Number of files in the playlist */
+extern uint32_t     playlist_file_pos;          /**< Current file's number, 1: first */
+extern char         musicFileName[16];
+extern char         musicFilePath[FSYS_FILENAME_MAX];  /**< Used by the music decoder while it runs */
+
+void startPlaylist (const char* aDir);
+bool_t pollPlaylist (void);
+bool_t getPlaylistProgress (uint32_t* aFound);
+void donePlaylist (void);
+char* getMusicFile (uint32_t aPos);
+char* getNextMusicFile (bool_t* aTurnOver);
+char* getPrevMusicFile (bool_t* aTurnOver);
+
+#endif /* INCLUDE_PLAYLIST_H */
@@ -0,0 +1,189 @@
+/**
+ * @file        ringbuf.c
+ * @brief       Lock-free single producer, single consumer queue
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-14 18:22:47
+ * Licence:     GPL
+ *
+ * One thread pushes, one other thread pops. Head and tail are free running
+ * counters, the producer publishes an element by storing head with release
+ * order after the element was copied, the consumer frees a slot the same way
+ * with tail.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ringbuf.h"
+
+/**
+ * @brief ringbufInit
+ * Allocate queue.
+ *
+ * @param aRing     Queue.
+ * @param aElemSize Size of one element in bytes.
+ * @param aCount    Number of elements, it shall be a power of two.
+ * @return TRUE: if successfully allocated.
+ */
+bool_t ringbufInit (ringbuf_t* aRing, uint32_t aElemSize, uint32_t aCount)
+{
+    aRing->head = 0;
+    aRing->tail = 0;
+    aRing->elem_size = aElemSize;
+    aRing->mask = aCount - 1;
+    aRing->buf = NULL;
+    if (!aCount || (aCount & (aCount - 1)))
+    {
+        return FALSE;
+    }
+    aRing->buf = malloc ((size_t) aElemSize * aCount);
+
+    return aRing->buf != NULL;
+}
+
+/**
+ * @brief ringbufFree
+ * Free queue. None of the threads shall use it.
+ */
+void ringbufFree (ringbuf_t* aRing)
+{
+    free (aRing->buf);
+    aRing->buf = NULL;
+}
+
+/**
+ * @brief ringbufPush
+ * Copy element to the queue. Called by producer only.
+ *
+ * @return TRUE: if pushed. FALSE: queue is full.
+ */
+bool_t ringbufPush (ringbuf_t* aRing, const void* aElem)
+{
+    uint32_t head = aRing->head;
+    uint32_t tail = __atomic_load_n (&aRing->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail > aRing->mask)
+    {
+        return FALSE;
+    }
+    memcpy (&aRing->buf[(head & aRing->mask) * aRing->elem_size], aElem, aRing->elem_size);
+    __atomic_store_n (&aRing->head, head + 1, __ATOMIC_RELEASE);
+
+    return TRUE;
+}
+
+/**
+ * @brief ringbufPop
+ * Copy oldest element from the queue. Called by consumer only.
+ *
+ * @return TRUE: if popped. FALSE: queue is empty.
+ */
+bool_t ringbufPop (ringbuf_t* aRing, void* aElem)
+{
+    uint32_t tail = aRing->tail;
+    uint32_t head = __atomic_load_n (&aRing->head, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+    {
+        return FALSE;
+    }
+    memcpy (aElem, &aRing->buf[(tail & aRing->mask) * aRing->elem_size], aRing->elem_size);
+    __atomic_store_n (&aRing->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return TRUE;
+}
+
+/**
+ * @brief ringbufWrite
+ * Copy more elements to the queue. Called by producer only.
+ *
+ * @param aElems Elements to copy.
+ * @param aCount Number of elements.
+ * @return Number of elements copied, less than aCount if queue is full.
+ */
+uint32_t ringbufWrite (ringbuf_t* aRing, const void* aElems, uint32_t aCount)
+{
+    uint32_t head = aRing->head;
+    uint32_t tail = __atomic_load_n (&aRing->tail, __ATOMIC_ACQUIRE);
+    uint32_t space = aRing->mask + 1 - (head - tail);
+    uint32_t pos = head & aRing->mask;
+    uint32_t first;
+
+    if (aCount > space)
+    {
+        aCount = space;
+    }
+    /* Elements may wrap around the end of buffer */
+    first = MIN (aCount, aRing->mask + 1 - pos);
+    memcpy (&aRing->buf[pos * aRing->elem_size], aElems, first * aRing->elem_size);
+    memcpy (aRing->buf, (const uint8_t*) aElems + first * aRing->elem_size,
+            (aCount - first) * aRing->elem_size);
+    __atomic_store_n (&aRing->head, head + aCount, __ATOMIC_RELEASE);
+
+    return aCount;
+}
+
+/**
+ * @brief ringbufPeek
+ * Copy elements from the queue without removing them. Called by consumer only.
+ *
+ * @param aElems Buffer of elements.
+ * @param aCount Size of aElems in elements.
+ * @return Number of elements copied, less than aCount if queue is shorter.
+ */
+uint32_t ringbufPeek (const ringbuf_t* aRing, void* aElems, uint32_t aCount)
+{
+    uint32_t tail = aRing->tail;
+    uint32_t head = __atomic_load_n (&aRing->head, __ATOMIC_ACQUIRE);
+    uint32_t pos = tail & aRing->mask;
+    uint32_t first;
+
+    if (aCount > head - tail)
+    {
+        aCount = head - tail;
+    }
+    first = MIN (aCount, aRing->mask + 1 - pos);
+    memcpy (aElems, &aRing->buf[pos * aRing->elem_size], first * aRing->elem_size);
+    memcpy ((uint8_t*) aElems + first * aRing->elem_size, aRing->buf,
+            (aCount - first) * aRing->elem_size);
+
+    return aCount;
+}
+
+/**
+ * @brief ringbufRead
+ * Copy more elements from the queue. Called by consumer only.
+ *
+ * @param aElems Buffer of elements, NULL: elements are dropped.
+ * @param aCount Number of elements.
+ * @return Number of elements copied, less than aCount if queue is empty.
+ */
+uint32_t ringbufRead (ringbuf_t* aRing, void* aElems, uint32_t aCount)
+{
+    uint32_t tail = aRing->tail;
+    uint32_t head = __atomic_load_n (&aRing->head, __ATOMIC_ACQUIRE);
+
+    if (aElems)
+    {
+        aCount = ringbufPeek (aRing, aElems, aCount);
+    }
+    else if (aCount > head - tail)
+    {
+        aCount = head - tail;
+    }
+    __atomic_store_n (&aRing->tail, tail + aCount, __ATOMIC_RELEASE);
+
+    return aCount;
+}
+
+/**
+ * @brief ringbufUsed
+ * @return Number of elements in queue. It may be outdated at once.
+ */
+uint32_t ringbufUsed (const ringbuf_t* aRing)
+{
+    return __atomic_load_n (&aRing->head, __ATOMIC_ACQUIRE)
+            - __atomic_load_n (&aRing->tail, __ATOMIC_ACQUIRE);
+}
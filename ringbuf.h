@@ -0,0 +1,35 @@
+/**
+ * @file        ringbuf.h
+ * @brief       Lock-free single producer, single consumer queue
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-14 18:22:47
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_RINGBUF_H
+#define INCLUDE_RINGBUF_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+typedef struct
+{
+    uint8_t* buf;           /* count * elem_size bytes */
+    uint32_t elem_size;     /* Size of one element in bytes */
+    uint32_t mask;          /* Number of elements - 1, number is power of two */
+    uint32_t head;          /* Written by producer only */
+    uint32_t tail;          /* Written by consumer only */
+} ringbuf_t;
+
+bool_t ringbufInit (ringbuf_t* aRing, uint32_t aElemSize, uint32_t aCount);
+void ringbufFree (ringbuf_t* aRing);
+bool_t ringbufPush (ringbuf_t* aRing, const void* aElem);
+bool_t ringbufPop (ringbuf_t* aRing, void* aElem);
+uint32_t ringbufWrite (ringbuf_t* aRing, const void* aElems, uint32_t aCount);
+uint32_t ringbufPeek (const ringbuf_t* aRing, void* aElems, uint32_t aCount);
+uint32_t ringbufRead (ringbuf_t* aRing, void* aElems, uint32_t aCount);
+uint32_t ringbufUsed (const ringbuf_t* aRing);
+
+#endif /* INCLUDE_RINGBUF_H */
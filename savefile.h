@@ -0,0 +1,72 @@
+/**
+ * @file        savefile.h
+ * @brief       Tagged binary save file format
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-02 19:12:40
+ * Licence:     GPL
+ *
+ * Layout of a save file (all fields are little-endian):
+ *
+ *   magic (4) | format version (2) | records... | CRC32C (4)
+ *
+ * Each record is: tag (2) | length (2) | data (length bytes).
+ * Unknown tags are skipped by the reader, so new fields can be added
+ * without breaking older files.
+ */
+
+#ifndef INCLUDE_SAVEFILE_H
+#define INCLUDE_SAVEFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "game_common.h"
+
+#define SAVEFILE_MAGIC_CONFIG   0x46435453u /* "STCF" */
+#define SAVEFILE_MAGIC_GAME     0x4D475453u /* "STGM" */
+#define SAVEFILE_MAGIC_PLAYERS  0x4C505453u /* "STPL" */
+
+#define SAVEFILE_HEADER_SIZE    6
+#define SAVEFILE_RECORD_SIZE    4   /* Tag and length of a record */
+#define SAVEFILE_TRAILER_SIZE   4
+#define SAVEFILE_MAX_SIZE       4096
+
+#define PUT_LE16(p, v)          do { (p)[0] = (uint8_t) (v); (p)[1] = (uint8_t) ((v) >> 8); } while (0)
+#define PUT_LE32(p, v)          do { PUT_LE16 (p, v); PUT_LE16 ((p) + 2, (v) >> 16); } while (0)
+#define GET_LE16(p)             ((uint16_t) ((p)[0] | ((p)[1] << 8)))
+#define GET_LE32(p)             ((uint32_t) GET_LE16 (p) | ((uint32_t) GET_LE16 ((p) + 2) << 16))
+
+typedef struct
+{
+    uint8_t* buf;       /* Output buffer */
+    uint32_t size;      /* Size of output buffer */
+    uint32_t len;       /* Number of bytes written */
+    bool_t overflow;    /* TRUE: buffer was too small */
+} save_writer_t;
+
+typedef struct
+{
+    const uint8_t* buf; /* Input buffer */
+    uint32_t len;       /* Length of payload (without trailer) */
+    uint32_t pos;       /* Read position */
+    uint16_t version;   /* Format version of the file */
+} save_reader_t;
+
+uint32_t crc32c (uint32_t aCrc, const void* aData, size_t aLength);
+
+void saveWriterInit (save_writer_t* aWriter, uint8_t* aBuf, uint32_t aSize, uint32_t aMagic, uint16_t aVersion);
+void saveWriteBytes (save_writer_t* aWriter, uint16_t aTag, const void* aData, uint16_t aLength);
+void saveWriteU8 (save_writer_t* aWriter, uint16_t aTag, uint8_t aValue);
+void saveWriteU32 (save_writer_t* aWriter, uint16_t aTag, uint32_t aValue);
+void saveWriteString (save_writer_t* aWriter, uint16_t aTag, const char* aString, size_t aMaxLength);
+uint32_t saveWriterFinish (save_writer_t* aWriter);
+
+bool_t saveReaderInit (save_reader_t* aReader, const uint8_t* aBuf, uint32_t aLength, uint32_t aMagic);
+bool_t saveReadNext (save_reader_t* aReader, uint16_t* aTag, const uint8_t** aData, uint16_t* aLength);
+void saveReadString (char* aString, size_t aSize, const uint8_t* aData, uint16_t aLength);
+
+bool_t saveFileWrite (const char* aPath, const uint8_t* aBuf, uint32_t aLength);
+int32_t saveFileRead (const char* aPath, uint8_t* aBuf, uint32_t aSize);
+
+#endif /* INCLUDE_SAVEFILE_H */
@@ -0,0 +1,465 @@
+/**
+ * @file        loadgen.c
+ * @brief       Load generator of the game server
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-28 14:26:19
+ * Licence:     GPL
+ *
+ * Usage: sometris-loadgen [-u path | -p port] [-c sessions] [-d seconds]
+ *                         [-r inputs_per_second] [-w spectators]
+ *
+ * Sessions are connected to the server, every one plays games with random
+ * keys. A new game is started when one is over. Spectators join after
+ * LOADGEN_WATCH_DELAY_MS, they watch the sessions in turn. Every client
+ * applies the messages to its copy of the game, see netproto.h, the copy
+ * is compared to every keyframe.
+ *
+ * At the end ticks and bytes received per client and second are printed,
+ * the number of ticks which arrived late (later than LOADGEN_LATE_MS after
+ * the previous one), keyframes which differed from the copy and damaged
+ * messages.
+ *
+ * Exit code: 0: every client received at least LOADGEN_MIN_RATE percent of
+ * ticks and every copy was right, 1: it was not or a client was closed,
+ * 2: server is not running.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "protocol.h"
+#include "netproto.h"
+#include "savefile.h"
+
+#define LOADGEN_UNIX_PATH       "/tmp/sometris.sock"
+#define LOADGEN_IN_SIZE         4096
+#define LOADGEN_EVENTS          256
+#define LOADGEN_LATE_MS         30
+#define LOADGEN_MIN_RATE        95      /* Percent of PROTOCOL_TICK_HZ */
+#define LOADGEN_WATCH_DELAY_MS  1000
+
+typedef struct
+{
+    int fd;                     /* -1: closed by server */
+    bool_t watcher;             /* Spectator */
+    uint32_t session;           /* Session of MSG_welcome */
+    netproto_state_t state;     /* Copy of the game */
+    uint8_t in[LOADGEN_IN_SIZE];
+    uint32_t in_length;
+    uint64_t start_us;          /* Connected */
+    uint64_t last_us;           /* Arrival of last tick */
+    uint64_t ticks;
+    uint64_t bytes;
+    uint32_t late;
+    uint32_t max_gap_us;
+    uint32_t games;
+    uint32_t diverged;          /* Keyframes which differed from the copy */
+    uint32_t invalid;           /* Damaged messages */
+} loadgen_client_t;
+
+static loadgen_client_t* loadgen_clients;
+static uint32_t loadgen_seed = 1;
+
+uint64_t getTimeUs (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000u + ts.tv_nsec / 1000u;
+}
+
+static void sendMessage (loadgen_client_t* aClient, protocol_msg_t aType, const uint8_t* aPayload,
+                         uint16_t aLength)
+{
+    uint8_t buf[PROTOCOL_HEADER_SIZE + PROTOCOL_MAX_PAYLOAD];
+
+    buf[0] = aType;
+    PUT_LE16 (&buf[1], aLength);
+    memcpy (&buf[PROTOCOL_HEADER_SIZE], aPayload, aLength);
+    /* Input is dropped if the socket is full, the server is slow anyway */
+    if (aClient->fd >= 0 && send (aClient->fd, buf, PROTOCOL_HEADER_SIZE + aLength, MSG_NOSIGNAL | MSG_DONTWAIT) < 0
+            && errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        close (aClient->fd);
+        aClient->fd = -1;
+    }
+}
+
+static void sendHello (loadgen_client_t* aClient)
+{
+    uint8_t payload[6];
+
+    payload[0] = PROTOCOL_VERSION;
+    payload[1] = MIN_BLOCK_TYPES + rand_r (&loadgen_seed) % RECORD_TYPES;
+    PUT_LE32 (&payload[2], rand_r (&loadgen_seed));
+    sendMessage (aClient, MSG_hello, payload, sizeof (payload));
+    aClient->last_us = 0;
+}
+
+static void sendWatch (loadgen_client_t* aClient, uint32_t aSession)
+{
+    uint8_t payload[5];
+
+    payload[0] = PROTOCOL_VERSION;
+    PUT_LE32 (&payload[1], aSession);
+    sendMessage (aClient, MSG_watch, payload, sizeof (payload));
+}
+
+static void handleMessage (loadgen_client_t* aClient, uint8_t aType, const uint8_t* aPayload, uint16_t aLength)
+{
+    uint64_t now, gap;
+
+    switch (netprotoApply (&aClient->state, aType, aPayload, aLength))
+    {
+        case NETPROTO_invalid:
+            aClient->invalid++;
+            return;
+        case NETPROTO_diverged:
+            aClient->diverged++;
+            return;
+        default:
+            break;
+    }
+    switch (aType)
+    {
+        case MSG_welcome:
+            if (aLength >= 5)
+            {
+                aClient->session = GET_LE32 (&aPayload[1]);
+            }
+            break;
+        case MSG_figure:
+            now = getTimeUs ();
+            if (aClient->last_us)
+            {
+                gap = now - aClient->last_us;
+                aClient->max_gap_us = MAX (aClient->max_gap_us, gap);
+                if (gap > LOADGEN_LATE_MS * 1000u)
+                {
+                    aClient->late++;
+                }
+            }
+            aClient->last_us = now;
+            aClient->ticks++;
+            break;
+        case MSG_over:
+            aClient->games++;
+            if (!aClient->watcher)
+            {
+                sendHello (aClient);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void readClient (loadgen_client_t* aClient)
+{
+    ssize_t length;
+    uint32_t pos;
+    uint16_t payload;
+
+    for (;;)
+    {
+        length = recv (aClient->fd, aClient->in + aClient->in_length, LOADGEN_IN_SIZE - aClient->in_length, 0);
+        if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            return;
+        }
+        if (length <= 0)
+        {
+            close (aClient->fd);
+            aClient->fd = -1;
+            return;
+        }
+        aClient->bytes += length;
+        aClient->in_length += length;
+        pos = 0;
+        while (aClient->in_length - pos >= PROTOCOL_HEADER_SIZE)
+        {
+            payload = GET_LE16 (&aClient->in[pos + 1]);
+            if (aClient->in_length - pos < PROTOCOL_HEADER_SIZE + (uint32_t) payload)
+            {
+                break;
+            }
+            handleMessage (aClient, aClient->in[pos], &aClient->in[pos + PROTOCOL_HEADER_SIZE], payload);
+            pos += PROTOCOL_HEADER_SIZE + payload;
+        }
+        aClient->in_length -= pos;
+        memmove (aClient->in, aClient->in + pos, aClient->in_length);
+    }
+}
+
+static int connectServer (const char* aPath, uint16_t aPort)
+{
+    struct sockaddr_un addr_un;
+    struct sockaddr_in addr_in;
+    int one = 1;
+    int fd;
+
+    if (aPort)
+    {
+        memset (&addr_in, 0, sizeof (addr_in));
+        addr_in.sin_family = AF_INET;
+        addr_in.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+        addr_in.sin_port = htons (aPort);
+        fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect (fd, (struct sockaddr*) &addr_in, sizeof (addr_in)))
+        {
+            close (fd);
+            fd = -1;
+        }
+        else if (fd >= 0)
+        {
+            setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+        }
+    }
+    else
+    {
+        memset (&addr_un, 0, sizeof (addr_un));
+        addr_un.sun_family = AF_UNIX;
+        strncpy (addr_un.sun_path, aPath, sizeof (addr_un.sun_path) - 1);
+        fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect (fd, (struct sockaddr*) &addr_un, sizeof (addr_un)))
+        {
+            close (fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0)
+    {
+        fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    return fd;
+}
+
+static void usage (const char* aName)
+{
+    fprintf (stderr, "Usage: %s [-u path | -p port] [-c sessions] [-d seconds] [-r inputs_per_second]"
+             " [-w spectators]\n", aName);
+    exit (2);
+}
+
+/**
+ * @brief addClient
+ * @return FALSE: server is not running.
+ */
+static bool_t addClient (loadgen_client_t* aClient, int aEpollFd, const char* aPath, uint16_t aPort)
+{
+    struct epoll_event event;
+
+    aClient->fd = connectServer (aPath, aPort);
+    if (aClient->fd < 0)
+    {
+        perror ("connect");
+        return FALSE;
+    }
+    aClient->start_us = getTimeUs ();
+    event.events = EPOLLIN;
+    event.data.ptr = aClient;
+    epoll_ctl (aEpollFd, EPOLL_CTL_ADD, aClient->fd, &event);
+
+    return TRUE;
+}
+
+static void printClients (const char* aName, uint32_t aFirst, uint32_t aCount, uint64_t aEndUs)
+{
+    loadgen_client_t* client;
+    uint64_t ticks = 0, bytes = 0;
+    double seconds = 0;
+    uint32_t i;
+
+    for (i = aFirst; i < aFirst + aCount; i++)
+    {
+        client = &loadgen_clients[i];
+        ticks += client->ticks;
+        bytes += client->bytes;
+        seconds += (aEndUs - client->start_us) / 1e6;
+    }
+    printf("loadgen: %s %u, ticks/s per client %.1f, bytes/s per client %.0f\n",
+           aName, aCount, ticks / seconds, bytes / seconds);
+}
+
+int main (int argc, char* argv[])
+{
+    struct itimerspec period = { { 0, 1000000000 / PROTOCOL_TICK_HZ }, { 0, 1000000000 / PROTOCOL_TICK_HZ } };
+    struct epoll_event event;
+    struct epoll_event events[LOADGEN_EVENTS];
+    struct rlimit limit;
+    loadgen_client_t* client;
+    const char* path = LOADGEN_UNIX_PATH;
+    uint16_t port = 0;
+    uint32_t sessions = 1000;
+    uint32_t watchers = 0;
+    uint32_t seconds = 10;
+    uint32_t rate = 5;
+    uint64_t start_us, end_us, watch_us, expirations;
+    uint64_t late = 0;
+    uint32_t games = 0, closed = 0, slow = 0, max_gap_us = 0, diverged = 0, invalid = 0;
+    bool_t watching = FALSE;
+    uint8_t keys;
+    uint32_t i;
+    int epoll_fd, timer_fd;
+    int count, j;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "u:p:c:d:r:w:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'u':
+                path = optarg;
+                break;
+            case 'p':
+                port = strtoul (optarg, NULL, 0);
+                break;
+            case 'c':
+                sessions = strtoul (optarg, NULL, 0);
+                break;
+            case 'd':
+                seconds = strtoul (optarg, NULL, 0);
+                break;
+            case 'r':
+                rate = strtoul (optarg, NULL, 0);
+                break;
+            case 'w':
+                watchers = strtoul (optarg, NULL, 0);
+                break;
+            default:
+                usage (argv[0]);
+        }
+    }
+    if (!sessions || optind != argc)
+    {
+        usage (argv[0]);
+    }
+    /* Every client is a file */
+    if (!getrlimit (RLIMIT_NOFILE, &limit))
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit (RLIMIT_NOFILE, &limit);
+    }
+
+    loadgen_clients = calloc (sessions + watchers, sizeof (*loadgen_clients));
+    epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (!loadgen_clients || epoll_fd < 0 || timer_fd < 0)
+    {
+        perror (argv[0]);
+        return 2;
+    }
+    for (i = 0; i < sessions; i++)
+    {
+        if (!addClient (&loadgen_clients[i], epoll_fd, path, port))
+        {
+            return 2;
+        }
+        sendHello (&loadgen_clients[i]);
+    }
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl (epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+    timerfd_settime (timer_fd, 0, &period, NULL);
+
+    start_us = getTimeUs ();
+    end_us = start_us + seconds * 1000000ull;
+    watch_us = start_us + LOADGEN_WATCH_DELAY_MS * 1000ull;
+    while (getTimeUs () < end_us)
+    {
+        if (!watching && getTimeUs () >= watch_us)
+        {
+            /* Spectators join games which were started */
+            for (i = sessions; i < sessions + watchers; i++)
+            {
+                client = &loadgen_clients[i];
+                client->watcher = TRUE;
+                if (!addClient (client, epoll_fd, path, port))
+                {
+                    return 2;
+                }
+                sendWatch (client, loadgen_clients[(i - sessions) % sessions].session);
+            }
+            watching = TRUE;
+        }
+        count = epoll_wait (epoll_fd, events, LOADGEN_EVENTS, 100);
+        for (j = 0; j < count; j++)
+        {
+            client = events[j].data.ptr;
+            if (client)
+            {
+                if (client->fd >= 0)
+                {
+                    readClient (client);
+                }
+                continue;
+            }
+            if (read (timer_fd, &expirations, sizeof (expirations)) < 0)
+            {
+                continue;
+            }
+            /* Random keys, rate per second on average */
+            for (i = 0; i < sessions; i++)
+            {
+                if ((uint32_t) rand_r (&loadgen_seed) % PROTOCOL_TICK_HZ < rate)
+                {
+                    keys = 1u << (rand_r (&loadgen_seed) % 4);
+                    sendMessage (&loadgen_clients[i], MSG_input, &keys, 1);
+                }
+            }
+        }
+    }
+    end_us = getTimeUs ();
+
+    for (i = 0; i < sessions + (watching ? watchers : 0); i++)
+    {
+        client = &loadgen_clients[i];
+        late += client->late;
+        games += client->watcher ? 0 : client->games;
+        diverged += client->diverged;
+        invalid += client->invalid;
+        max_gap_us = MAX (max_gap_us, client->max_gap_us);
+        if (client->fd < 0)
+        {
+            closed++;
+        }
+        else
+        {
+            close (client->fd);
+        }
+        if (client->ticks < (end_us - client->start_us) / 1e6 * PROTOCOL_TICK_HZ * LOADGEN_MIN_RATE / 100)
+        {
+            slow++;
+        }
+    }
+    printf("loadgen: %.1f s, games over %u\n", (end_us - start_us) / 1e6, games);
+    printClients ("sessions", 0, sessions, end_us);
+    if (watching && watchers)
+    {
+        printClients ("spectators", sessions, watchers, end_us);
+    }
+    printf("loadgen: late ticks %llu, max gap %.1f ms, slow clients %u, closed %u, diverged %u, invalid %u\n",
+           (unsigned long long) late, max_gap_us / 1e3, slow, closed, diverged, invalid);
+    close (timer_fd);
+    close (epoll_fd);
+    free (loadgen_clients);
+
+    return slow || closed || diverged || invalid ? 1 : 0;
+}
@@ -0,0 +1,436 @@
+/**
+ * @file        netproto.c
+ * @brief       Delta encoding of games for the clients of the game server
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-29 09:37:15
+ * Licence:     GPL
+ *
+ * A tick changes the position of the figure at most, the map is changed
+ * only when the figure is locked. So the server sends the position every
+ * tick, and the changed cells of the map when a figure was locked. Clients
+ * count ticks and figures themselves. Keyframes carry the whole game, they
+ * let spectators join and correct a client which diverged.
+ *
+ * Payloads (numbers are little endian):
+ *
+ *  MSG_keyframe: tick (32 bits), figure_counter (32), score (32),
+ *                block_types, level, longest_cascade, figure, position,
+ *                flags, cells of map row by row, two in a byte
+ *  MSG_figure:   position, flags, figure if NETPROTO_FLAG_FIGURE is set
+ *  MSG_lock:     score (32 bits), level, longest_cascade, changed rows (16),
+ *                then for every changed row: changed columns (16), cells
+ *                two in a byte
+ *
+ * Position is figure_x in the low and figure_y in the high four bits. A
+ * cell is 4 bits, the first one is in the low bits of a byte.
+ *
+ * MSG_lock is followed by the MSG_figure of the same tick, which carries
+ * the new figure. Encoders write into buffers of the caller, the decoder
+ * applies messages to the game of the client.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "netproto.h"
+#include "savefile.h"
+
+#if MAP_SIZE_X > 16 || MAP_SIZE_Y > 16 || MAX_BLOCK_TYPES > 15
+#error Position and cells do not fit into four bits!
+#endif
+
+#define NETPROTO_FLAG_VERTICAL  BIT0
+#define NETPROTO_FLAG_FIGURE    BIT1    /* Figure follows, it was changed */
+
+/* Writes cells two in a byte */
+typedef struct
+{
+    uint8_t* pos;
+    bool_t high;
+} nibble_writer_t;
+
+static void putCell (nibble_writer_t* aWriter, uint8_t aCell)
+{
+    if (aWriter->high)
+    {
+        *aWriter->pos++ |= (aCell & 0x0F) << 4;
+    }
+    else
+    {
+        *aWriter->pos = aCell & 0x0F;
+    }
+    aWriter->high = !aWriter->high;
+}
+
+/**
+ * @brief endCells
+ * @return End of cells.
+ */
+static uint8_t* endCells (nibble_writer_t* aWriter)
+{
+    return aWriter->high ? aWriter->pos + 1 : aWriter->pos;
+}
+
+static uint8_t getCell (const uint8_t* aCells, uint8_t aIndex)
+{
+    return (aCells[aIndex / 2] >> ((aIndex & 1) * 4)) & 0x0F;
+}
+
+static uint8_t position (const game_t* aGame)
+{
+    return aGame->figure_x | (aGame->figure_y << 4);
+}
+
+/**
+ * @brief netprotoPutHeader
+ * @return Payload of message.
+ */
+uint8_t* netprotoPutHeader (uint8_t* aBuf, protocol_msg_t aType, uint16_t aLength)
+{
+    aBuf[0] = aType;
+    PUT_LE16 (&aBuf[1], aLength);
+
+    return aBuf + PROTOCOL_HEADER_SIZE;
+}
+
+/**
+ * @brief netprotoPutKeyframe
+ * The whole game, every client of the session shall receive it, or it shall
+ * be sent between ticks, when aSync is not changed.
+ *
+ * @param aBuf Buffer of PROTOCOL_HEADER_SIZE + NETPROTO_KEYFRAME_SIZE bytes.
+ * @return Length of message.
+ */
+uint32_t netprotoPutKeyframe (uint8_t* aBuf, netproto_sync_t* aSync, const game_t* aGame, uint32_t aTick)
+{
+    uint8_t* p = netprotoPutHeader (aBuf, MSG_keyframe, NETPROTO_KEYFRAME_SIZE);
+    nibble_writer_t cells;
+    uint8_t x, y;
+
+    PUT_LE32 (&p[0], aTick);
+    PUT_LE32 (&p[4], aGame->figure_counter);
+    PUT_LE32 (&p[8], aGame->score);
+    p += 12;
+    *p++ = aGame->block_types;
+    *p++ = aGame->level;
+    *p++ = aGame->longest_cascade;
+    memcpy (p, aGame->figure, FIGURE_SIZE);
+    p += FIGURE_SIZE;
+    *p++ = position (aGame);
+    *p++ = aGame->figure_is_vertical ? NETPROTO_FLAG_VERTICAL : 0;
+    cells.pos = p;
+    cells.high = FALSE;
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        for (x = 0; x < MAP_SIZE_X; x++)
+        {
+            putCell (&cells, aGame->map[y][x]);
+        }
+    }
+
+    memcpy (aSync->map, aGame->map, sizeof (aSync->map));
+    memcpy (aSync->figure, aGame->figure, sizeof (aSync->figure));
+    aSync->figure_counter = aGame->figure_counter;
+
+    return endCells (&cells) - aBuf;
+}
+
+/**
+ * @brief putLock
+ * Changed cells of the map, score, level and longest cascade.
+ */
+static uint8_t* putLock (uint8_t* aBuf, netproto_sync_t* aSync, const game_t* aGame)
+{
+    uint8_t* p = aBuf + PROTOCOL_HEADER_SIZE;
+    uint8_t* rows_pos;
+    nibble_writer_t cells;
+    uint16_t rows = 0;
+    uint16_t columns;
+    uint8_t x, y;
+
+    PUT_LE32 (p, aGame->score);
+    p += 4;
+    *p++ = aGame->level;
+    *p++ = aGame->longest_cascade;
+    rows_pos = p;
+    p += 2;
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        columns = 0;
+        for (x = 0; x < MAP_SIZE_X; x++)
+        {
+            if (aGame->map[y][x] != aSync->map[y][x])
+            {
+                columns |= _BV(x);
+            }
+        }
+        if (!columns)
+        {
+            continue;
+        }
+        rows |= _BV(y);
+        PUT_LE16 (p, columns);
+        cells.pos = p + 2;
+        cells.high = FALSE;
+        for (x = 0; x < MAP_SIZE_X; x++)
+        {
+            if (columns & _BV(x))
+            {
+                putCell (&cells, aGame->map[y][x]);
+            }
+        }
+        p = endCells (&cells);
+        memcpy (aSync->map[y], aGame->map[y], MAP_SIZE_X);
+    }
+    PUT_LE16 (rows_pos, rows);
+    netprotoPutHeader (aBuf, MSG_lock, p - aBuf - PROTOCOL_HEADER_SIZE);
+
+    return p;
+}
+
+/**
+ * @brief netprotoPutTick
+ * Messages of a tick: MSG_lock if a figure was locked, then MSG_figure.
+ *
+ * @param aBuf Buffer of NETPROTO_MAX_TICK_SIZE bytes.
+ * @return Length of messages.
+ */
+uint32_t netprotoPutTick (uint8_t* aBuf, netproto_sync_t* aSync, const game_t* aGame)
+{
+    uint8_t* p = aBuf;
+    uint8_t* payload;
+
+    if (aGame->figure_counter != aSync->figure_counter)
+    {
+        p = putLock (p, aSync, aGame);
+        aSync->figure_counter = aGame->figure_counter;
+    }
+    payload = p + PROTOCOL_HEADER_SIZE;
+    payload[0] = position (aGame);
+    payload[1] = aGame->figure_is_vertical ? NETPROTO_FLAG_VERTICAL : 0;
+    /* New figure, or rotation reversed it */
+    if (memcmp (aGame->figure, aSync->figure, FIGURE_SIZE))
+    {
+        payload[1] |= NETPROTO_FLAG_FIGURE;
+        memcpy (&payload[2], aGame->figure, FIGURE_SIZE);
+        memcpy (aSync->figure, aGame->figure, FIGURE_SIZE);
+        netprotoPutHeader (p, MSG_figure, 2 + FIGURE_SIZE);
+        p += PROTOCOL_HEADER_SIZE + 2 + FIGURE_SIZE;
+    }
+    else
+    {
+        netprotoPutHeader (p, MSG_figure, 2);
+        p += PROTOCOL_HEADER_SIZE + 2;
+    }
+
+    return p - aBuf;
+}
+
+/**
+ * @brief netprotoPutOver
+ * @return Length of message.
+ */
+uint32_t netprotoPutOver (uint8_t* aBuf, const game_t* aGame, uint32_t aTick)
+{
+    uint8_t* p = netprotoPutHeader (aBuf, MSG_over, NETPROTO_OVER_SIZE);
+
+    PUT_LE32 (&p[0], aTick);
+    PUT_LE32 (&p[4], aGame->score);
+    PUT_LE32 (&p[8], aGame->figure_counter);
+
+    return PROTOCOL_HEADER_SIZE + NETPROTO_OVER_SIZE;
+}
+
+static bool_t isPosition (uint8_t aPosition)
+{
+    return (aPosition & 0x0F) < MAP_SIZE_X && (aPosition >> 4) < MAP_SIZE_Y;
+}
+
+static bool_t isFigure (const uint8_t* aFigure)
+{
+    uint8_t i;
+
+    for (i = 0; i < FIGURE_SIZE; i++)
+    {
+        if (!aFigure[i] || aFigure[i] > MAX_BLOCK_TYPES)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static bool_t isSameGame (const game_t* aGame1, const game_t* aGame2)
+{
+    return !memcmp (aGame1->map, aGame2->map, sizeof (aGame1->map))
+            && !memcmp (aGame1->figure, aGame2->figure, sizeof (aGame1->figure))
+            && !aGame1->figure_is_vertical == !aGame2->figure_is_vertical
+            && aGame1->figure_x == aGame2->figure_x
+            && aGame1->figure_y == aGame2->figure_y
+            && aGame1->figure_counter == aGame2->figure_counter
+            && aGame1->score == aGame2->score
+            && aGame1->block_types == aGame2->block_types
+            && aGame1->level == aGame2->level
+            && aGame1->longest_cascade == aGame2->longest_cascade;
+}
+
+static netproto_result_t applyKeyframe (netproto_state_t* aState, const uint8_t* aPayload, uint16_t aLength)
+{
+    const uint8_t* p = aPayload;
+    game_t game_copy;
+    uint32_t tick;
+    uint8_t x, y, i;
+    bool_t same;
+
+    if (aLength < NETPROTO_KEYFRAME_SIZE)
+    {
+        return NETPROTO_invalid;
+    }
+    memset (&game_copy, 0, sizeof (game_copy));
+    game_copy.version = 1;
+    tick = GET_LE32 (&p[0]);
+    game_copy.figure_counter = GET_LE32 (&p[4]);
+    game_copy.score = GET_LE32 (&p[8]);
+    p += 12;
+    game_copy.block_types = *p++;
+    game_copy.level = *p++;
+    game_copy.longest_cascade = *p++;
+    memcpy (game_copy.figure, p, FIGURE_SIZE);
+    p += FIGURE_SIZE;
+    if (!isFigure (game_copy.figure) || !isPosition (p[0]))
+    {
+        return NETPROTO_invalid;
+    }
+    game_copy.figure_x = p[0] & 0x0F;
+    game_copy.figure_y = p[0] >> 4;
+    game_copy.figure_is_vertical = (p[1] & NETPROTO_FLAG_VERTICAL) != 0;
+    p += 2;
+    for (i = 0, y = 0; y < MAP_SIZE_Y; y++)
+    {
+        for (x = 0; x < MAP_SIZE_X; x++, i++)
+        {
+            game_copy.map[y][x] = getCell (p, i);
+            if (game_copy.map[y][x] > MAX_BLOCK_TYPES)
+            {
+                return NETPROTO_invalid;
+            }
+        }
+    }
+
+    /* Tick 0: new game */
+    same = !aState->synced || !tick || (aState->tick == tick && isSameGame (&aState->mirror, &game_copy));
+    aState->mirror = game_copy;
+    aState->tick = tick;
+    aState->synced = TRUE;
+
+    return same ? NETPROTO_applied : NETPROTO_diverged;
+}
+
+static netproto_result_t applyFigure (netproto_state_t* aState, const uint8_t* aPayload, uint16_t aLength)
+{
+    game_t* game_copy = &aState->mirror;
+
+    if (aLength < 2 || !isPosition (aPayload[0]))
+    {
+        return NETPROTO_invalid;
+    }
+    if (aPayload[1] & NETPROTO_FLAG_FIGURE)
+    {
+        if (aLength < 2 + FIGURE_SIZE || !isFigure (&aPayload[2]))
+        {
+            return NETPROTO_invalid;
+        }
+        memcpy (game_copy->figure, &aPayload[2], FIGURE_SIZE);
+    }
+    game_copy->figure_x = aPayload[0] & 0x0F;
+    game_copy->figure_y = aPayload[0] >> 4;
+    game_copy->figure_is_vertical = (aPayload[1] & NETPROTO_FLAG_VERTICAL) != 0;
+    aState->tick++;
+
+    return NETPROTO_applied;
+}
+
+static netproto_result_t applyLock (netproto_state_t* aState, const uint8_t* aPayload, uint16_t aLength)
+{
+    game_t game_copy = aState->mirror;
+    const uint8_t* p = aPayload;
+    const uint8_t* end = aPayload + aLength;
+    uint16_t rows, columns;
+    uint8_t x, y, i;
+
+    if (aLength < 8)
+    {
+        return NETPROTO_invalid;
+    }
+    game_copy.score = GET_LE32 (p);
+    game_copy.level = p[4];
+    game_copy.longest_cascade = p[5];
+    rows = GET_LE16 (&p[6]);
+    p += 8;
+    if (rows >> MAP_SIZE_Y)
+    {
+        return NETPROTO_invalid;
+    }
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        if (!(rows & _BV(y)))
+        {
+            continue;
+        }
+        if (end - p < 2)
+        {
+            return NETPROTO_invalid;
+        }
+        columns = GET_LE16 (p);
+        p += 2;
+        if (!columns || columns >> MAP_SIZE_X || end - p < (__builtin_popcount (columns) + 1) / 2)
+        {
+            return NETPROTO_invalid;
+        }
+        for (i = 0, x = 0; x < MAP_SIZE_X; x++)
+        {
+            if (columns & _BV(x))
+            {
+                game_copy.map[y][x] = getCell (p, i++);
+                if (game_copy.map[y][x] > MAX_BLOCK_TYPES)
+                {
+                    return NETPROTO_invalid;
+                }
+            }
+        }
+        p += (i + 1) / 2;
+    }
+    game_copy.figure_counter++;
+    /* Whole message is valid */
+    aState->mirror = game_copy;
+
+    return NETPROTO_applied;
+}
+
+/**
+ * @brief netprotoApply
+ * Apply a message to the game of the client. Messages are ignored until
+ * the first keyframe.
+ */
+netproto_result_t netprotoApply (netproto_state_t* aState, uint8_t aType, const uint8_t* aPayload, uint16_t aLength)
+{
+    if (aType == MSG_keyframe)
+    {
+        return applyKeyframe (aState, aPayload, aLength);
+    }
+    if (!aState->synced)
+    {
+        return NETPROTO_ignored;
+    }
+    switch (aType)
+    {
+        case MSG_figure:
+            return applyFigure (aState, aPayload, aLength);
+        case MSG_lock:
+            return applyLock (aState, aPayload, aLength);
+        default:
+            return NETPROTO_ignored;
+    }
+}
@@ -0,0 +1,60 @@
+/**
+ * @file        netproto.h
+ * @brief       Delta encoding of games for the clients of the game server
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-29 09:37:15
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_NETPROTO_H
+#define INCLUDE_NETPROTO_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+#include "protocol.h"
+
+#define NETPROTO_KEYFRAME_TICKS 500     /* Keyframe every 5 seconds */
+
+/* Payloads, see netproto.c */
+#define NETPROTO_KEYFRAME_SIZE  (4 + 4 + 4 + 3 + FIGURE_SIZE + 2 + (MAP_SIZE_X * MAP_SIZE_Y + 1) / 2)
+#define NETPROTO_FIGURE_SIZE    (2 + FIGURE_SIZE)
+#define NETPROTO_LOCK_SIZE      (4 + 2 + 2 + MAP_SIZE_Y * (2 + (MAP_SIZE_X + 1) / 2))
+#define NETPROTO_OVER_SIZE      12
+
+/* Messages of one tick at most */
+#define NETPROTO_MAX_TICK_SIZE  (3 * PROTOCOL_HEADER_SIZE + NETPROTO_KEYFRAME_SIZE + NETPROTO_LOCK_SIZE \
+                                 + NETPROTO_FIGURE_SIZE + NETPROTO_OVER_SIZE)
+
+/* What the clients of a session know, it is kept by the server */
+typedef struct
+{
+    uint8_t map[MAP_SIZE_Y][MAP_SIZE_X];
+    uint8_t figure[FIGURE_SIZE];
+    uint32_t figure_counter;
+} netproto_sync_t;
+
+/* Game of a client, messages are applied to it */
+typedef struct
+{
+    game_t mirror;              /* Copy of the game of the server */
+    uint32_t tick;
+    bool_t synced;              /* Keyframe was received */
+} netproto_state_t;
+
+typedef enum
+{
+    NETPROTO_applied,
+    NETPROTO_ignored,           /* Not a message of the game, or no keyframe yet */
+    NETPROTO_invalid,           /* Message is damaged */
+    NETPROTO_diverged           /* Keyframe differed from the state, it was corrected */
+} netproto_result_t;
+
+uint8_t* netprotoPutHeader (uint8_t* aBuf, protocol_msg_t aType, uint16_t aLength);
+uint32_t netprotoPutKeyframe (uint8_t* aBuf, netproto_sync_t* aSync, const game_t* aGame, uint32_t aTick);
+uint32_t netprotoPutTick (uint8_t* aBuf, netproto_sync_t* aSync, const game_t* aGame);
+uint32_t netprotoPutOver (uint8_t* aBuf, const game_t* aGame, uint32_t aTick);
+netproto_result_t netprotoApply (netproto_state_t* aState, uint8_t aType, const uint8_t* aPayload, uint16_t aLength);
+
+#endif /* INCLUDE_NETPROTO_H */
@@ -0,0 +1,55 @@
+/**
+ * @file        protocol.h
+ * @brief       Messages between the game server and its clients
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-28 10:14:52
+ * Licence:     GPL
+ *
+ * Every message is a header of PROTOCOL_HEADER_SIZE bytes: type (8 bits)
+ * and length of payload (16 bits), then the payload. Numbers are little
+ * endian.
+ *
+ * A player sends MSG_hello to start a game, then MSG_input when keys are
+ * pressed. MSG_hello starts a new game at any time. A spectator sends
+ * MSG_watch with the session of a player instead, it may join at any time.
+ * The server answers MSG_welcome, then it sends the game to the player and
+ * its spectators, see netproto.h: MSG_figure every tick, after MSG_lock if
+ * the figure was locked; MSG_keyframe at start of game, after the messages
+ * of every NETPROTO_KEYFRAME_TICKS-th tick and to a spectator who joins;
+ * MSG_over when the game is over.
+ */
+
+#ifndef INCLUDE_PROTOCOL_H
+#define INCLUDE_PROTOCOL_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define PROTOCOL_VERSION        2
+#define PROTOCOL_HEADER_SIZE    3
+#define PROTOCOL_MAX_PAYLOAD    512     /* Longer messages are not valid */
+#define PROTOCOL_TICK_HZ        100     /* Ticks of sessions per second */
+
+/* Keys of MSG_input, pressed since the previous one */
+#define PROTOCOL_KEY_LEFT       BIT0
+#define PROTOCOL_KEY_RIGHT      BIT1
+#define PROTOCOL_KEY_DOWN       BIT2
+#define PROTOCOL_KEY_ROTATE     BIT3
+
+typedef enum
+{
+    /* Client to server */
+    MSG_hello = 0x01,           /* version, block_types, seed (32 bits) */
+    MSG_input = 0x02,           /* keys, see PROTOCOL_KEY_* */
+    MSG_watch = 0x03,           /* version, session (32 bits) */
+    /* Server to client */
+    MSG_welcome = 0x81,         /* version, session (32 bits), tick_hz */
+    MSG_keyframe = 0x82,        /* Whole game, see netproto.c */
+    MSG_over = 0x83,            /* tick, score, figure_counter (32 bits each) */
+    MSG_figure = 0x84,          /* Position of figure, see netproto.c */
+    MSG_lock = 0x85             /* Changed cells and score, see netproto.c */
+} protocol_msg_t;
+
+#endif /* INCLUDE_PROTOCOL_H */
@@ -0,0 +1,890 @@
+/**
+ * @file        server.c
+ * @brief       Game server: games of thin clients on one machine
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-28 11:02:40
+ * Licence:     GPL
+ *
+ * Usage: sometris-server [--unix path] [--tcp port] [--threads N]
+ *
+ * Clients connect to a Unix socket or to a TCP port of the loopback
+ * interface, see protocol.h for messages. Every connection is a session,
+ * see session.h. The main thread accepts connections and hands them to the
+ * workers in turn: session id modulo number of workers. A worker has its
+ * own epoll and a timer of PROTOCOL_TICK_HZ, it owns its connections, so
+ * sessions are not locked: every tick all of its sessions are stepped,
+ * then their messages are written, see netproto.h. Output of a client
+ * which does not read is buffered up to SERVER_OUT_SIZE, then the client
+ * is dropped.
+ *
+ * A spectator is moved to the worker of the session it watches, it gets
+ * the same messages as the player. Spectators are closed with the player.
+ *
+ * Statistics of workers are printed every SERVER_STATS_INTERVAL seconds.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "protocol.h"
+#include "netproto.h"
+#include "session.h"
+#include "savefile.h"
+
+#define SERVER_UNIX_PATH        "/tmp/sometris.sock"
+#define SERVER_MAX_THREADS      64
+#define SERVER_IN_SIZE          1024
+#define SERVER_OUT_SIZE         (16 * 1024)
+#define SERVER_EVENTS           256     /* Events of one epoll_wait() */
+#define SERVER_MAX_CATCHUP      4       /* Ticks run at once when a worker is late */
+#define SERVER_STATS_INTERVAL   10      /* Seconds */
+
+typedef struct server_conn
+{
+    int fd;                     /* -1: closed, it is freed after the events */
+    session_t session;
+    netproto_sync_t sync;       /* What the player and spectators know */
+    bool_t player;              /* MSG_hello was received */
+    uint32_t watch_id;          /* Session of spectator, 0: not a spectator */
+    bool_t moving;              /* Spectator is moved to another worker */
+    struct server_conn* watching;       /* Player of spectator */
+    struct server_conn* watchers;       /* Spectators of player */
+    struct server_conn* next_watcher;
+    uint8_t in[SERVER_IN_SIZE];
+    uint32_t in_length;
+    uint8_t out[SERVER_OUT_SIZE];
+    uint32_t out_start;         /* First byte to write */
+    uint32_t out_length;
+    bool_t out_waiting;         /* EPOLLOUT is watched */
+    struct server_conn* next;   /* Inbox of worker */
+} server_conn_t;
+
+typedef struct
+{
+    pthread_t thread;
+    int epoll_fd;
+    int timer_fd;
+    int inbox_fd;               /* Eventfd: connections are in the inbox */
+    pthread_mutex_t inbox_lock;
+    server_conn_t* inbox;       /* New connections from the main thread */
+    server_conn_t** conns;
+    uint32_t conn_cntr;
+    uint32_t conn_size;
+    uint8_t messages[NETPROTO_MAX_TICK_SIZE];   /* Messages of a session */
+    /* Statistics, they are taken by the main thread */
+    uint32_t sessions;
+    uint64_t ticks;
+    uint64_t late_ticks;        /* Ticks which were run late */
+    uint64_t lost_ticks;        /* Ticks which were not run */
+    uint64_t tick_us;           /* Sum of time of ticks */
+    uint64_t tick_max_us;
+    uint64_t out_bytes;
+    uint64_t dropped;           /* Slow clients */
+} server_worker_t;
+
+static server_worker_t server_workers[SERVER_MAX_THREADS];
+static uint32_t server_worker_cntr = 0;
+static uint32_t server_session_id = 0;
+static volatile sig_atomic_t server_running = TRUE;
+
+uint64_t getTimeUs (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000u + ts.tv_nsec / 1000u;
+}
+
+static void stop (int aSignal)
+{
+    (void) aSignal;
+    server_running = FALSE;
+}
+
+static void addStat (uint64_t* aStat, uint64_t aValue)
+{
+    __atomic_fetch_add (aStat, aValue, __ATOMIC_RELAXED);
+}
+
+static uint64_t takeStat (uint64_t* aStat)
+{
+    return __atomic_exchange_n (aStat, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief closeConn
+ * Connection is freed by sweepConns(), events of the same epoll_wait() may
+ * still point to it.
+ */
+static void closeConn (server_worker_t* aWorker, server_conn_t* aConn)
+{
+    server_conn_t** watcher;
+
+    if (aConn->fd < 0)
+    {
+        return;
+    }
+    epoll_ctl (aWorker->epoll_fd, EPOLL_CTL_DEL, aConn->fd, NULL);
+    close (aConn->fd);
+    aConn->fd = -1;
+    if (aConn->watching)
+    {
+        for (watcher = &aConn->watching->watchers; *watcher != aConn; watcher = &(*watcher)->next_watcher)
+        {
+        }
+        *watcher = aConn->next_watcher;
+        aConn->watching = NULL;
+    }
+    while (aConn->watchers)
+    {
+        aConn->watchers->watching = NULL;
+        closeConn (aWorker, aConn->watchers);
+        aConn->watchers = aConn->watchers->next_watcher;
+    }
+}
+
+static server_worker_t* workerOf (uint32_t aSessionId)
+{
+    return &server_workers[aSessionId % server_worker_cntr];
+}
+
+/**
+ * @brief moveConn
+ * Hand a connection to a worker, it is watched by the worker from then.
+ */
+static void moveConn (server_worker_t* aWorker, server_conn_t* aConn)
+{
+    uint64_t value = 1;
+
+    pthread_mutex_lock (&aWorker->inbox_lock);
+    aConn->next = aWorker->inbox;
+    aWorker->inbox = aConn;
+    pthread_mutex_unlock (&aWorker->inbox_lock);
+    if (write (aWorker->inbox_fd, &value, sizeof (value)) < 0)
+    {
+        perror (__FUNCTION__);
+    }
+}
+
+/**
+ * @brief sweepConns
+ * Free closed connections, move spectators to the worker of their session.
+ */
+static void sweepConns (server_worker_t* aWorker)
+{
+    server_conn_t* conn;
+    uint32_t i;
+
+    for (i = aWorker->conn_cntr; i-- > 0;)
+    {
+        conn = aWorker->conns[i];
+        if (conn->fd < 0 || conn->moving)
+        {
+            aWorker->conns[i] = aWorker->conns[--aWorker->conn_cntr];
+            if (conn->fd < 0)
+            {
+                free (conn);
+            }
+            else
+            {
+                conn->moving = FALSE;
+                moveConn (workerOf (conn->watch_id), conn);
+            }
+        }
+    }
+    __atomic_store_n (&aWorker->sessions, aWorker->conn_cntr, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief putOutput
+ * Put messages into the output of the connection.
+ */
+static void putOutput (server_worker_t* aWorker, server_conn_t* aConn, const uint8_t* aBuf, uint32_t aLength)
+{
+    if (aConn->fd < 0)
+    {
+        return;
+    }
+    if (aConn->out_start + aConn->out_length + aLength > SERVER_OUT_SIZE)
+    {
+        memmove (aConn->out, aConn->out + aConn->out_start, aConn->out_length);
+        aConn->out_start = 0;
+        if (aConn->out_length + aLength > SERVER_OUT_SIZE)
+        {
+            /* Client does not read */
+            addStat (&aWorker->dropped, 1);
+            closeConn (aWorker, aConn);
+            return;
+        }
+    }
+    memcpy (aConn->out + aConn->out_start + aConn->out_length, aBuf, aLength);
+    aConn->out_length += aLength;
+}
+
+/**
+ * @brief broadcast
+ * Put messages into the output of the player and its spectators.
+ */
+static void broadcast (server_worker_t* aWorker, server_conn_t* aConn, const uint8_t* aBuf, uint32_t aLength)
+{
+    server_conn_t* watcher;
+    server_conn_t* next;
+
+    putOutput (aWorker, aConn, aBuf, aLength);
+    for (watcher = aConn->watchers; watcher; watcher = next)
+    {
+        next = watcher->next_watcher;
+        putOutput (aWorker, watcher, aBuf, aLength);
+    }
+}
+
+static void putWelcome (server_worker_t* aWorker, server_conn_t* aConn, uint32_t aSessionId)
+{
+    uint8_t buf[PROTOCOL_HEADER_SIZE + 6];
+    uint8_t* p = netprotoPutHeader (buf, MSG_welcome, 6);
+
+    p[0] = PROTOCOL_VERSION;
+    PUT_LE32 (&p[1], aSessionId);
+    p[5] = PROTOCOL_TICK_HZ;
+    putOutput (aWorker, aConn, buf, sizeof (buf));
+}
+
+/**
+ * @brief attachWatcher
+ * Spectator joins the session of a player of the worker, it gets a
+ * keyframe if the game was started.
+ *
+ * @return FALSE: there is no such player.
+ */
+static bool_t attachWatcher (server_worker_t* aWorker, server_conn_t* aConn)
+{
+    server_conn_t* player = NULL;
+    uint32_t length;
+    uint32_t i;
+
+    for (i = 0; i < aWorker->conn_cntr && !player; i++)
+    {
+        if (aWorker->conns[i]->session.id == aConn->watch_id && !aWorker->conns[i]->watch_id
+                && aWorker->conns[i]->fd >= 0)
+        {
+            player = aWorker->conns[i];
+        }
+    }
+    if (!player)
+    {
+        return FALSE;
+    }
+    aConn->watching = player;
+    aConn->next_watcher = player->watchers;
+    player->watchers = aConn;
+    putWelcome (aWorker, aConn, player->session.id);
+    if (player->player)
+    {
+        /* Between ticks the clients know the whole game */
+        length = netprotoPutKeyframe (aWorker->messages, &player->sync, &player->session.context.game_state,
+                                      player->session.tick);
+        putOutput (aWorker, aConn, aWorker->messages, length);
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief flushConn
+ * Write the output of the connection as far as the socket takes it.
+ */
+static void flushConn (server_worker_t* aWorker, server_conn_t* aConn)
+{
+    struct epoll_event event;
+    ssize_t length;
+    bool_t waiting;
+
+    while (aConn->fd >= 0 && aConn->out_length)
+    {
+        length = send (aConn->fd, aConn->out + aConn->out_start, aConn->out_length, MSG_NOSIGNAL);
+        if (length > 0)
+        {
+            aConn->out_start += length;
+            aConn->out_length -= length;
+            addStat (&aWorker->out_bytes, length);
+        }
+        else if (length < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        else
+        {
+            closeConn (aWorker, aConn);
+            return;
+        }
+    }
+    if (aConn->fd < 0)
+    {
+        return;
+    }
+    if (!aConn->out_length)
+    {
+        aConn->out_start = 0;
+    }
+    waiting = aConn->out_length != 0;
+    if (waiting != aConn->out_waiting)
+    {
+        event.events = EPOLLIN | (waiting ? EPOLLOUT : 0);
+        event.data.ptr = aConn;
+        epoll_ctl (aWorker->epoll_fd, EPOLL_CTL_MOD, aConn->fd, &event);
+        aConn->out_waiting = waiting;
+    }
+}
+
+/**
+ * @brief handleMessage
+ * @return FALSE: message is not valid, client shall be dropped.
+ */
+static bool_t handleMessage (server_worker_t* aWorker, server_conn_t* aConn, uint8_t aType,
+                             const uint8_t* aPayload, uint16_t aLength)
+{
+    uint32_t length;
+
+    switch (aType)
+    {
+        case MSG_hello:
+            if (aLength < 6 || aPayload[0] != PROTOCOL_VERSION || aConn->watch_id)
+            {
+                return FALSE;
+            }
+            sessionStart (&aConn->session, aPayload[1], GET_LE32 (&aPayload[2]));
+            aConn->player = TRUE;
+            putWelcome (aWorker, aConn, aConn->session.id);
+            length = netprotoPutKeyframe (aWorker->messages, &aConn->sync, &game, aConn->session.tick);
+            broadcast (aWorker, aConn, aWorker->messages, length);
+            break;
+        case MSG_input:
+            if (aLength < 1)
+            {
+                return FALSE;
+            }
+            sessionInput (&aConn->session, aPayload[0]);
+            break;
+        case MSG_watch:
+            if (aLength < 5 || aPayload[0] != PROTOCOL_VERSION || aConn->player || aConn->watch_id)
+            {
+                return FALSE;
+            }
+            aConn->watch_id = GET_LE32 (&aPayload[1]);
+            if (workerOf (aConn->watch_id) == aWorker)
+            {
+                return attachWatcher (aWorker, aConn);
+            }
+            /* It is moved by sweepConns() */
+            epoll_ctl (aWorker->epoll_fd, EPOLL_CTL_DEL, aConn->fd, NULL);
+            aConn->out_waiting = FALSE;
+            aConn->moving = TRUE;
+            break;
+        default:
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void readConn (server_worker_t* aWorker, server_conn_t* aConn)
+{
+    ssize_t length;
+    uint32_t pos;
+    uint16_t payload;
+
+    for (;;)
+    {
+        length = recv (aConn->fd, aConn->in + aConn->in_length, SERVER_IN_SIZE - aConn->in_length, 0);
+        if (length < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        if (length <= 0)
+        {
+            closeConn (aWorker, aConn);
+            return;
+        }
+        aConn->in_length += length;
+        pos = 0;
+        while (aConn->in_length - pos >= PROTOCOL_HEADER_SIZE)
+        {
+            payload = GET_LE16 (&aConn->in[pos + 1]);
+            if (payload > PROTOCOL_MAX_PAYLOAD)
+            {
+                closeConn (aWorker, aConn);
+                return;
+            }
+            if (aConn->in_length - pos < PROTOCOL_HEADER_SIZE + (uint32_t) payload)
+            {
+                break;
+            }
+            if (!handleMessage (aWorker, aConn, aConn->in[pos], &aConn->in[pos + PROTOCOL_HEADER_SIZE], payload))
+            {
+                closeConn (aWorker, aConn);
+                return;
+            }
+            pos += PROTOCOL_HEADER_SIZE + payload;
+            if (aConn->moving)
+            {
+                /* The rest is read by the other worker */
+                aConn->in_length -= pos;
+                memmove (aConn->in, aConn->in + pos, aConn->in_length);
+                return;
+            }
+        }
+        aConn->in_length -= pos;
+        memmove (aConn->in, aConn->in + pos, aConn->in_length);
+    }
+}
+
+/**
+ * @brief tick
+ * Step every session of the worker and write their messages.
+ */
+static void tick (server_worker_t* aWorker)
+{
+    server_conn_t* conn;
+    uint32_t length;
+    bool_t over;
+    uint32_t i;
+
+    for (i = 0; i < aWorker->conn_cntr; i++)
+    {
+        conn = aWorker->conns[i];
+        if (conn->fd < 0 || !conn->session.playing)
+        {
+            continue;
+        }
+        over = sessionTick (&conn->session);
+        length = netprotoPutTick (aWorker->messages, &conn->sync, &game);
+        if (conn->session.tick % NETPROTO_KEYFRAME_TICKS == 0)
+        {
+            /* Clients compare it to their copy */
+            length += netprotoPutKeyframe (aWorker->messages + length, &conn->sync, &game, conn->session.tick);
+        }
+        if (over)
+        {
+            length += netprotoPutOver (aWorker->messages + length, &game, conn->session.tick);
+        }
+        broadcast (aWorker, conn, aWorker->messages, length);
+    }
+}
+
+/**
+ * @brief takeInbox
+ * Watch connections which were accepted by the main thread or moved by
+ * another worker. Spectators are attached when the player is taken, it may
+ * have been in the same inbox.
+ */
+static void takeInbox (server_worker_t* aWorker)
+{
+    struct epoll_event event;
+    server_conn_t* conn;
+    server_conn_t* next;
+    server_conn_t** conns;
+    uint32_t first = aWorker->conn_cntr;
+    uint64_t value;
+
+    if (read (aWorker->inbox_fd, &value, sizeof (value)) < 0)
+    {
+        return;
+    }
+    pthread_mutex_lock (&aWorker->inbox_lock);
+    conn = aWorker->inbox;
+    aWorker->inbox = NULL;
+    pthread_mutex_unlock (&aWorker->inbox_lock);
+    for (; conn; conn = next)
+    {
+        next = conn->next;
+        if (aWorker->conn_cntr == aWorker->conn_size)
+        {
+            conns = realloc (aWorker->conns, (aWorker->conn_size * 2 + 64) * sizeof (*conns));
+            if (!conns)
+            {
+                printf("%s: out of memory\n", __FUNCTION__);
+                close (conn->fd);
+                free (conn);
+                continue;
+            }
+            aWorker->conns = conns;
+            aWorker->conn_size = aWorker->conn_size * 2 + 64;
+        }
+        event.events = EPOLLIN;
+        event.data.ptr = conn;
+        if (epoll_ctl (aWorker->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event))
+        {
+            close (conn->fd);
+            free (conn);
+            continue;
+        }
+        aWorker->conns[aWorker->conn_cntr++] = conn;
+    }
+    for (; first < aWorker->conn_cntr; first++)
+    {
+        conn = aWorker->conns[first];
+        if (conn->watch_id && !attachWatcher (aWorker, conn))
+        {
+            closeConn (aWorker, conn);
+        }
+    }
+    __atomic_store_n (&aWorker->sessions, aWorker->conn_cntr, __ATOMIC_RELAXED);
+}
+
+static void* workerThread (void* aArg)
+{
+    server_worker_t* worker = aArg;
+    struct epoll_event events[SERVER_EVENTS];
+    server_conn_t* conn;
+    uint64_t expirations, start_us, us;
+    uint32_t i, n;
+    int count;
+
+    while (server_running)
+    {
+        count = epoll_wait (worker->epoll_fd, events, SERVER_EVENTS, 100);
+        for (i = 0; i < (uint32_t) MAX (count, 0); i++)
+        {
+            if (events[i].data.ptr == &worker->timer_fd)
+            {
+                if (read (worker->timer_fd, &expirations, sizeof (expirations)) != sizeof (expirations))
+                {
+                    continue;
+                }
+                n = MIN (expirations, SERVER_MAX_CATCHUP);
+                addStat (&worker->late_ticks, n - 1);
+                addStat (&worker->lost_ticks, expirations - n);
+                for (; n; n--)
+                {
+                    start_us = getTimeUs ();
+                    tick (worker);
+                    us = getTimeUs () - start_us;
+                    addStat (&worker->ticks, 1);
+                    addStat (&worker->tick_us, us);
+                    if (us > __atomic_load_n (&worker->tick_max_us, __ATOMIC_RELAXED))
+                    {
+                        __atomic_store_n (&worker->tick_max_us, us, __ATOMIC_RELAXED);
+                    }
+                }
+                for (n = 0; n < worker->conn_cntr; n++)
+                {
+                    flushConn (worker, worker->conns[n]);
+                }
+            }
+            else if (events[i].data.ptr == &worker->inbox_fd)
+            {
+                takeInbox (worker);
+            }
+            else
+            {
+                conn = events[i].data.ptr;
+                if (conn->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                {
+                    readConn (worker, conn);
+                }
+                if (conn->fd >= 0 && (events[i].events & EPOLLOUT))
+                {
+                    flushConn (worker, conn);
+                }
+            }
+        }
+        sweepConns (worker);
+    }
+
+    return NULL;
+}
+
+static bool_t initWorker (server_worker_t* aWorker)
+{
+    struct itimerspec period = { { 0, 1000000000 / PROTOCOL_TICK_HZ }, { 0, 1000000000 / PROTOCOL_TICK_HZ } };
+    struct epoll_event event;
+
+    memset (aWorker, 0, sizeof (*aWorker));
+    pthread_mutex_init (&aWorker->inbox_lock, NULL);
+    aWorker->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    aWorker->timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    aWorker->inbox_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (aWorker->epoll_fd < 0 || aWorker->timer_fd < 0 || aWorker->inbox_fd < 0
+            || timerfd_settime (aWorker->timer_fd, 0, &period, NULL))
+    {
+        perror (__FUNCTION__);
+        return FALSE;
+    }
+    event.events = EPOLLIN;
+    event.data.ptr = &aWorker->timer_fd;
+    epoll_ctl (aWorker->epoll_fd, EPOLL_CTL_ADD, aWorker->timer_fd, &event);
+    event.data.ptr = &aWorker->inbox_fd;
+    epoll_ctl (aWorker->epoll_fd, EPOLL_CTL_ADD, aWorker->inbox_fd, &event);
+    if (pthread_create (&aWorker->thread, NULL, workerThread, aWorker))
+    {
+        printf("%s: cannot start thread\n", __FUNCTION__);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void doneWorker (server_worker_t* aWorker)
+{
+    server_conn_t* conn;
+    uint32_t i;
+
+    pthread_join (aWorker->thread, NULL);
+    for (i = 0; i < aWorker->conn_cntr; i++)
+    {
+        closeConn (aWorker, aWorker->conns[i]);
+    }
+    sweepConns (aWorker);
+    free (aWorker->conns);
+    while ((conn = aWorker->inbox))
+    {
+        aWorker->inbox = conn->next;
+        close (conn->fd);
+        free (conn);
+    }
+    close (aWorker->epoll_fd);
+    close (aWorker->timer_fd);
+    close (aWorker->inbox_fd);
+    pthread_mutex_destroy (&aWorker->inbox_lock);
+}
+
+/**
+ * @brief acceptConn
+ * Accept a connection and hand it to the worker of its session.
+ */
+static void acceptConn (int aListenFd)
+{
+    server_conn_t* conn;
+    int one = 1;
+    int fd;
+
+    fd = accept4 (aListenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+    conn = calloc (1, sizeof (*conn));
+    if (!conn)
+    {
+        printf("%s: out of memory\n", __FUNCTION__);
+        close (fd);
+        return;
+    }
+    conn->fd = fd;
+    conn->session.id = ++server_session_id;
+    moveConn (workerOf (conn->session.id), conn);
+}
+
+static int listenUnix (const char* aPath)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strncpy (addr.sun_path, aPath, sizeof (addr.sun_path) - 1);
+    unlink (aPath);
+    fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind (fd, (struct sockaddr*) &addr, sizeof (addr)) || listen (fd, SOMAXCONN))
+    {
+        perror (aPath);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int listenTcp (uint16_t aPort)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+    int fd;
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    addr.sin_port = htons (aPort);
+    fd = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one))
+            || bind (fd, (struct sockaddr*) &addr, sizeof (addr)) || listen (fd, SOMAXCONN))
+    {
+        perror ("tcp");
+        return -1;
+    }
+
+    return fd;
+}
+
+static void printStats (uint64_t aUs)
+{
+    server_worker_t* worker;
+    uint64_t ticks = 0, late = 0, lost = 0, tick_us = 0, tick_max_us = 0, out_bytes = 0, dropped = 0;
+    uint64_t us;
+    uint32_t sessions = 0;
+    uint32_t i;
+
+    for (i = 0; i < server_worker_cntr; i++)
+    {
+        worker = &server_workers[i];
+        sessions += __atomic_load_n (&worker->sessions, __ATOMIC_RELAXED);
+        ticks += takeStat (&worker->ticks);
+        late += takeStat (&worker->late_ticks);
+        lost += takeStat (&worker->lost_ticks);
+        tick_us += takeStat (&worker->tick_us);
+        us = takeStat (&worker->tick_max_us);
+        tick_max_us = MAX (tick_max_us, us);
+        out_bytes += takeStat (&worker->out_bytes);
+        dropped += takeStat (&worker->dropped);
+    }
+    printf("server: sessions %u, ticks/s %.1f, tick avg %.1f us max %llu us, late %llu, lost %llu, "
+           "out %.1f kB/s, dropped %llu\n",
+           sessions, ticks * 1e6 / aUs / MAX (server_worker_cntr, 1u), ticks ? (double) tick_us / ticks : 0.0,
+           (unsigned long long) tick_max_us, (unsigned long long) late, (unsigned long long) lost,
+           out_bytes * 1e3 / aUs, (unsigned long long) dropped);
+    fflush (stdout);
+}
+
+int main (int argc, char* argv[])
+{
+    struct epoll_event event;
+    struct epoll_event events[2];
+    struct rlimit limit;
+    const char* unix_path = NULL;
+    uint16_t tcp_port = 0;
+    uint32_t threads = sysconf (_SC_NPROCESSORS_ONLN);
+    uint64_t stats_us;
+    int listen_fds[2];
+    int listen_cntr = 0;
+    int epoll_fd;
+    int count;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp (argv[i], "--unix") && i + 1 < argc)
+        {
+            unix_path = argv[++i];
+        }
+        else if (!strcmp (argv[i], "--tcp") && i + 1 < argc)
+        {
+            tcp_port = strtoul (argv[++i], NULL, 0);
+        }
+        else if (!strcmp (argv[i], "--threads") && i + 1 < argc)
+        {
+            threads = strtoul (argv[++i], NULL, 0);
+        }
+        else
+        {
+            printf("Usage: %s [--unix path] [--tcp port] [--threads N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!unix_path && !tcp_port)
+    {
+        unix_path = SERVER_UNIX_PATH;
+    }
+    threads = MAX (MIN (threads, SERVER_MAX_THREADS), 1u);
+
+    /* Every session is a file */
+    if (!getrlimit (RLIMIT_NOFILE, &limit))
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit (RLIMIT_NOFILE, &limit);
+    }
+    signal (SIGINT, stop);
+    signal (SIGTERM, stop);
+    signal (SIGPIPE, SIG_IGN);
+    /* Lines of collapseMap() are shared by the workers */
+    initCollapseLines ();
+
+    epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (unix_path)
+    {
+        listen_fds[listen_cntr++] = listenUnix (unix_path);
+    }
+    if (tcp_port)
+    {
+        listen_fds[listen_cntr++] = listenTcp (tcp_port);
+    }
+    for (i = 0; i < listen_cntr; i++)
+    {
+        if (listen_fds[i] < 0)
+        {
+            return 1;
+        }
+        event.events = EPOLLIN;
+        event.data.fd = listen_fds[i];
+        epoll_ctl (epoll_fd, EPOLL_CTL_ADD, listen_fds[i], &event);
+    }
+    for (server_worker_cntr = 0; server_worker_cntr < threads; server_worker_cntr++)
+    {
+        if (!initWorker (&server_workers[server_worker_cntr]))
+        {
+            server_running = FALSE;
+            break;
+        }
+    }
+    printf("server: %u threads, unix socket %s, TCP port %u\n", server_worker_cntr,
+           unix_path ? unix_path : "-", tcp_port);
+    fflush (stdout);
+
+    stats_us = getTimeUs ();
+    while (server_running)
+    {
+        count = epoll_wait (epoll_fd, events, 2, 1000);
+        for (i = 0; i < count; i++)
+        {
+            acceptConn (events[i].data.fd);
+        }
+        if (getTimeUs () - stats_us >= SERVER_STATS_INTERVAL * 1000000ull)
+        {
+            printStats (getTimeUs () - stats_us);
+            stats_us = getTimeUs ();
+        }
+    }
+
+    for (i = 0; i < (int) server_worker_cntr; i++)
+    {
+        doneWorker (&server_workers[i]);
+    }
+    for (i = 0; i < listen_cntr; i++)
+    {
+        close (listen_fds[i]);
+    }
+    close (epoll_fd);
+    if (unix_path)
+    {
+        unlink (unix_path);
+    }
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+/**
+ * @file        session.c
+ * @brief       Game of a client of the game server
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-28 10:31:07
+ * Licence:     GPL
+ *
+ * Same rules as handleMovement() of main.c, but time is counted in ticks
+ * of PROTOCOL_TICK_HZ. Functions of game_common.c are applied to
+ * game_context, which is set to the session by its functions.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "session.h"
+#include "protocol.h"
+#include "game_gfx.h"
+#include "sfx.h"
+
+/* Server draws and plays nothing */
+void blinkMap (uint8_t blinkNum)
+{
+    (void) blinkNum;
+}
+
+void drawMap (void)
+{
+}
+
+void sfxPlay (sfx_id_t aId, uint8_t aPitch)
+{
+    (void) aId;
+    (void) aPitch;
+}
+
+/**
+ * @brief fallTicks
+ * Delay time = 0.8 sec - level * 0.1 sec, at least 0.1 sec.
+ */
+static uint16_t fallTicks (void)
+{
+    int16_t ticks = PROTOCOL_TICK_HZ * 8 / 10 - game.level * PROTOCOL_TICK_HZ / 10;
+
+    return MAX (ticks, PROTOCOL_TICK_HZ / 10);
+}
+
+/**
+ * @brief sessionStart
+ * Start a new game.
+ *
+ * @param aBlockTypes Difficulty, it is limited to MIN_BLOCK_TYPES..MAX_BLOCK_TYPES.
+ * @param aSeed Seed of figures, same seed gives same figures.
+ */
+void sessionStart (session_t* aSession, uint8_t aBlockTypes, uint32_t aSeed)
+{
+    game_context = &aSession->context;
+    memset (game_context, 0, sizeof (*game_context));
+    game_context->rand_seed = aSeed;
+    game.version = 1;
+    game.block_types = MAX (MIN (aBlockTypes, MAX_BLOCK_TYPES), MIN_BLOCK_TYPES);
+    game.level = 1;
+    initMap ();
+    generateFigure ();
+    aSession->tick = 0;
+    aSession->fall_ticks = fallTicks ();
+    aSession->key_cntr = 0;
+    aSession->playing = TRUE;
+}
+
+/**
+ * @brief sessionInput
+ * Keys are applied at the next tick in order of arrival.
+ */
+void sessionInput (session_t* aSession, uint8_t aKeys)
+{
+    if (aSession->playing && aSession->key_cntr < SESSION_MAX_KEYS)
+    {
+        aSession->keys[aSession->key_cntr++] = aKeys;
+    }
+}
+
+static void handleKeys (uint8_t aKeys)
+{
+    uint8_t new_x = 0, new_y = 0;
+
+    if (aKeys & PROTOCOL_KEY_RIGHT)
+    {
+        if (canMoveFigureRight ())
+        {
+            game.figure_x++;
+        }
+    }
+    else if (aKeys & PROTOCOL_KEY_LEFT)
+    {
+        if (canMoveFigureLeft ())
+        {
+            game.figure_x--;
+        }
+    }
+    if ((aKeys & PROTOCOL_KEY_DOWN) && canMoveFigureDown ())
+    {
+        game.figure_y++;
+    }
+    if ((aKeys & PROTOCOL_KEY_ROTATE) && canRotateFigure (&new_x, &new_y))
+    {
+        rotateFigure (new_x, new_y);
+    }
+}
+
+/**
+ * @brief sessionTick
+ * Apply inputs and automatic fall of one tick.
+ *
+ * @return TRUE: game is over in this tick.
+ */
+bool_t sessionTick (session_t* aSession)
+{
+    uint8_t cascade;
+    uint8_t i;
+
+    if (!aSession->playing)
+    {
+        return FALSE;
+    }
+    game_context = &aSession->context;
+    aSession->tick++;
+    for (i = 0; i < aSession->key_cntr; i++)
+    {
+        handleKeys (aSession->keys[i]);
+    }
+    aSession->key_cntr = 0;
+    if (--aSession->fall_ticks == 0)
+    {
+        if (canMoveFigureDown ())
+        {
+            game.figure_y++;
+        }
+        else
+        {
+            copyFigureToMap ();
+            cascade = collapseMap ();
+            if (cascade > game.longest_cascade)
+            {
+                game.longest_cascade = cascade;
+            }
+            generateFigure ();
+        }
+        aSession->fall_ticks = fallTicks ();
+    }
+    if (isGameOver ())
+    {
+        aSession->playing = FALSE;
+        return TRUE;
+    }
+
+    return FALSE;
+}
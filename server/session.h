@@ -0,0 +1,34 @@
+/**
+ * @file        session.h
+ * @brief       Game of a client of the game server
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-28 10:31:07
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_SESSION_H
+#define INCLUDE_SESSION_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define SESSION_MAX_KEYS        8   /* Inputs of one tick, more are dropped */
+
+typedef struct
+{
+    game_context_t context;     /* Game, see game_common.h */
+    uint32_t id;
+    uint32_t tick;              /* Ticks since start of game */
+    uint16_t fall_ticks;        /* Ticks until the figure falls */
+    uint8_t keys[SESSION_MAX_KEYS];
+    uint8_t key_cntr;
+    bool_t playing;             /* FALSE: game is not started or it is over */
+} session_t;
+
+void sessionStart (session_t* aSession, uint8_t aBlockTypes, uint32_t aSeed);
+void sessionInput (session_t* aSession, uint8_t aKeys);
+bool_t sessionTick (session_t* aSession);
+
+#endif /* INCLUDE_SESSION_H */
@@ -0,0 +1,293 @@
+/**
+ * @file        sfx.c
+ * @brief       Sound effects mixed into the audio output
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-17 19:22:05
+ * Licence:     GPL
+ *
+ * Effects are synthesized at start in the format of the audio device, so
+ * the callback only adds samples. The game thread pushes triggers into a
+ * lock-free ring, the audio callback takes them at its next run and starts
+ * a voice of a fixed pool. Nothing is allocated or locked after sfxInit(),
+ * an effect is heard within one buffer of the audio device.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "sfx.h"
+#include "audio.h"
+#include "ringbuf.h"
+
+#define SFX_FRAMES(ms)          ((uint32_t) ((ms) * AUDIO_FREQ_HZ / 1000))
+#define SFX_ATTACK_MS           2       /* Fade in against clicks */
+
+typedef struct
+{
+    uint8_t id;
+    uint8_t pitch;                      /* Semitones */
+} sfx_trigger_t;
+
+typedef struct
+{
+    const int16_t* frames;              /* NULL: voice is free */
+    uint32_t count;                     /* Number of frames, below 65536 */
+    uint32_t pos;                       /* 16.16 fixed point */
+    uint32_t step;                      /* 16.16 fixed point, 0x10000: original pitch */
+} sfx_voice_t;
+
+static const uint16_t sfx_length_ms[SFX_NUM] =
+{
+    [SFX_LOCK] = 70,
+    [SFX_CLEAR] = 220,
+    [SFX_LEVEL_UP] = 400,
+    [SFX_GAME_OVER] = 900
+};
+
+static bool_t       sfx_ready = FALSE;
+static int16_t*     sfx_buf = NULL;                     /* Frames of all effects */
+static int16_t*     sfx_frames[SFX_NUM];
+static uint32_t     sfx_count[SFX_NUM];
+static uint32_t     sfx_pitch_step[SFX_MAX_PITCH + 1];
+static ringbuf_t    sfx_triggers;                       /* Game thread -> audio callback */
+static sfx_voice_t  sfx_voices[SFX_VOICES];             /* Used by audio callback only */
+
+/**
+ * @brief synthTone
+ * Add a decaying sine sweep to frames.
+ */
+static void synthTone (int16_t* aFrames, uint32_t aCount, double aFreqStart,
+                       double aFreqEnd, double aDecay, double aAmplitude)
+{
+    const uint32_t attack = SFX_FRAMES (SFX_ATTACK_MS);
+    double phase = 0.0;
+    double t, freq, level;
+    int32_t sample;
+    uint32_t i, ch;
+
+    for (i = 0; i < aCount; i++)
+    {
+        t = (double) i / AUDIO_FREQ_HZ;
+        freq = aFreqStart + (aFreqEnd - aFreqStart) * i / aCount;
+        phase += 2.0 * M_PI * freq / AUDIO_FREQ_HZ;
+        level = aAmplitude * 32767.0 * exp (-aDecay * t);
+        if (i < attack)
+        {
+            level = level * i / attack;
+        }
+        for (ch = 0; ch < AUDIO_CHANNELS; ch++)
+        {
+            sample = aFrames[i * AUDIO_CHANNELS + ch] + (int32_t) (level * sin (phase));
+            aFrames[i * AUDIO_CHANNELS + ch] = sample > INT16_MAX ? INT16_MAX
+                                             : sample < INT16_MIN ? INT16_MIN : sample;
+        }
+    }
+}
+
+static void synthEffects (void)
+{
+    const uint32_t note = SFX_FRAMES (100);
+    int16_t* f;
+
+    f = sfx_frames[SFX_LOCK];
+    synthTone (f, sfx_count[SFX_LOCK], 200.0, 90.0, 40.0, SFX_AMPLITUDE);
+
+    f = sfx_frames[SFX_CLEAR];
+    synthTone (f, sfx_count[SFX_CLEAR], 880.0, 880.0, 14.0, SFX_AMPLITUDE / 2);
+    synthTone (f, sfx_count[SFX_CLEAR], 1320.0, 1320.0, 18.0, SFX_AMPLITUDE / 2);
+
+    /* C-E-G */
+    f = sfx_frames[SFX_LEVEL_UP];
+    synthTone (f, note, 523.25, 523.25, 8.0, SFX_AMPLITUDE);
+    synthTone (f + note * AUDIO_CHANNELS, note, 659.25, 659.25, 8.0, SFX_AMPLITUDE);
+    synthTone (f + 2 * note * AUDIO_CHANNELS, sfx_count[SFX_LEVEL_UP] - 2 * note,
+               783.99, 783.99, 6.0, SFX_AMPLITUDE);
+
+    f = sfx_frames[SFX_GAME_OVER];
+    synthTone (f, sfx_count[SFX_GAME_OVER], 440.0, 110.0, 2.5, SFX_AMPLITUDE);
+}
+
+/**
+ * @brief sfxInit
+ * Synthesize effects. It shall be called before the audio device is opened.
+ *
+ * @return TRUE: effects can be played.
+ */
+bool_t sfxInit (void)
+{
+    uint32_t total = 0;
+    uint8_t i;
+
+    for (i = 0; i < SFX_NUM; i++)
+    {
+        sfx_count[i] = SFX_FRAMES (sfx_length_ms[i]);
+        total += sfx_count[i];
+    }
+    sfx_buf = calloc (total, AUDIO_FRAME_SIZE);
+    if (!sfx_buf || !ringbufInit (&sfx_triggers, sizeof (sfx_trigger_t), SFX_TRIGGERS))
+    {
+        printf("%s: out of memory\n", __FUNCTION__);
+        free (sfx_buf);
+        sfx_buf = NULL;
+        return FALSE;
+    }
+    total = 0;
+    for (i = 0; i < SFX_NUM; i++)
+    {
+        sfx_frames[i] = sfx_buf + total * AUDIO_CHANNELS;
+        total += sfx_count[i];
+    }
+    for (i = 0; i <= SFX_MAX_PITCH; i++)
+    {
+        sfx_pitch_step[i] = (uint32_t) (65536.0 * pow (2.0, i / 12.0) + 0.5);
+    }
+    synthEffects ();
+    memset (sfx_voices, 0, sizeof (sfx_voices));
+    sfx_ready = TRUE;
+
+    return TRUE;
+}
+
+/**
+ * @brief sfxDone
+ * Free effects. Audio device shall be closed before.
+ */
+void sfxDone (void)
+{
+    if (sfx_ready)
+    {
+        sfx_ready = FALSE;
+        ringbufFree (&sfx_triggers);
+        free (sfx_buf);
+        sfx_buf = NULL;
+    }
+}
+
+/**
+ * @brief sfxPlay
+ * Trigger an effect. Called by the game thread only, it never waits.
+ *
+ * @param aId Effect.
+ * @param aPitch Raise pitch by semitones, up to SFX_MAX_PITCH.
+ */
+void sfxPlay (sfx_id_t aId, uint8_t aPitch)
+{
+    sfx_trigger_t trigger;
+
+    if (sfx_ready && aId < SFX_NUM)
+    {
+        trigger.id = aId;
+        trigger.pitch = aPitch < SFX_MAX_PITCH ? aPitch : SFX_MAX_PITCH;
+        /* If the ring is full, the effect is dropped */
+        ringbufPush (&sfx_triggers, &trigger);
+    }
+}
+
+/**
+ * @brief startVoice
+ * Start a free voice. If all voices play, the oldest one is taken.
+ */
+static void startVoice (const sfx_trigger_t* aTrigger)
+{
+    sfx_voice_t* voice = &sfx_voices[0];
+    uint8_t i;
+
+    for (i = 0; i < SFX_VOICES; i++)
+    {
+        if (!sfx_voices[i].frames)
+        {
+            voice = &sfx_voices[i];
+            break;
+        }
+        if (sfx_voices[i].pos > voice->pos)
+        {
+            voice = &sfx_voices[i];
+        }
+    }
+    voice->frames = sfx_frames[aTrigger->id];
+    voice->count = sfx_count[aTrigger->id];
+    voice->pos = 0;
+    voice->step = sfx_pitch_step[aTrigger->pitch];
+}
+
+/**
+ * @brief mixVoice
+ * Add a voice to the accumulator, linear interpolation is used on pitch.
+ */
+static void mixVoice (sfx_voice_t* aVoice, int32_t* aAcc, uint32_t aCount)
+{
+    const int16_t* a;
+    int32_t frac;
+    uint32_t idx;
+    uint32_t i, ch;
+
+    for (i = 0; i < aCount; i++)
+    {
+        idx = aVoice->pos >> 16;
+        if (idx + 1 >= aVoice->count)
+        {
+            aVoice->frames = NULL;
+            break;
+        }
+        a = &aVoice->frames[idx * AUDIO_CHANNELS];
+        frac = aVoice->pos & 0xFFFF;
+        for (ch = 0; ch < AUDIO_CHANNELS; ch++)
+        {
+            aAcc[i * AUDIO_CHANNELS + ch] += a[ch] + (((a[ch + AUDIO_CHANNELS] - a[ch]) * frac) >> 16);
+        }
+        aVoice->pos += aVoice->step;
+    }
+}
+
+/**
+ * @brief sfxMix
+ * Start triggered effects and add playing ones to frames.
+ * Called by the audio callback.
+ */
+void sfxMix (int16_t* aFrames, uint32_t aCount)
+{
+    int32_t acc[SFX_MIX_FRAMES * AUDIO_CHANNELS];
+    sfx_trigger_t trigger;
+    bool_t active = FALSE;
+    uint32_t n, i;
+    uint8_t v;
+
+    if (!sfx_ready)
+    {
+        return;
+    }
+    while (ringbufPop (&sfx_triggers, &trigger))
+    {
+        startVoice (&trigger);
+    }
+    for (v = 0; v < SFX_VOICES; v++)
+    {
+        active |= sfx_voices[v].frames != NULL;
+    }
+    /* Chunks keep the accumulator on the stack */
+    while (active && aCount)
+    {
+        n = aCount < SFX_MIX_FRAMES ? aCount : SFX_MIX_FRAMES;
+        for (i = 0; i < n * AUDIO_CHANNELS; i++)
+        {
+            acc[i] = aFrames[i];
+        }
+        for (v = 0; v < SFX_VOICES; v++)
+        {
+            if (sfx_voices[v].frames)
+            {
+                mixVoice (&sfx_voices[v], acc, n);
+            }
+        }
+        for (i = 0; i < n * AUDIO_CHANNELS; i++)
+        {
+            aFrames[i] = acc[i] > INT16_MAX ? INT16_MAX : acc[i] < INT16_MIN ? INT16_MIN : acc[i];
+        }
+        aFrames += n * AUDIO_CHANNELS;
+        aCount -= n;
+    }
+}
@@ -0,0 +1,38 @@
+/**
+ * @file        sfx.h
+ * @brief       Sound effects mixed into the audio output
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-17 19:22:05
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_SFX_H
+#define INCLUDE_SFX_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define SFX_VOICES              8       /* Effects played at the same time */
+#define SFX_TRIGGERS            32      /* Queued triggers. Power of two! */
+#define SFX_MIX_FRAMES          256     /* Frames mixed at once */
+#define SFX_AMPLITUDE           0.3     /* Relative to full scale */
+#define SFX_MAX_PITCH           12      /* Semitones, one octave */
+#define SFX_CASCADE_PITCH       2       /* Semitones per round of cascade */
+
+typedef enum
+{
+    SFX_LOCK = 0,                       /* Figure reached the ground */
+    SFX_CLEAR,                          /* Same blocks removed */
+    SFX_LEVEL_UP,
+    SFX_GAME_OVER,
+    SFX_NUM
+} sfx_id_t;
+
+bool_t sfxInit (void);
+void sfxDone (void);
+void sfxPlay (sfx_id_t aId, uint8_t aPitch);
+void sfxMix (int16_t* aFrames, uint32_t aCount);
+
+#endif /* INCLUDE_SFX_H */
@@ -5,9 +5,63 @@ CONFIG -= qt
 include(other.pro)
 SOURCES += ./game_common.c \
 ./game_gfx.c \
-./main.c
+./audio.c \
+./bot.c \
+./colstore.c \
+./input.c \
+./iothread.c \
+./journal.c \
+./latency.c \
+./leaderboard.c \
+./music.c \
+./overlay.c \
+./players.c \
+./playlist.c \
+./ringbuf.c \
+./main.c \
+./savefile.c \
+./sfx.c \
+./stats.c \
+./telemetry.c \
+./trace.c \
+./watchdog.c
 
 HEADERS += ./common.h \
 ./game_common.h \
 ./game_gfx.h \
+./audio.h \
+./bot.h \
+./colstore.h \
+./input.h \
+./iothread.h \
+./journal.h \
+./latency.h \
+./leaderboard.h \
+./music.h \
+./overlay.h \
+./players.h \
+./playlist.h \
+./ringbuf.h \
+./savefile.h \
+./sfx.h \
+./stats.h \
+./telemetry.h \
+./trace.h \
+./watchdog.h \
 
+LIBS += -lm -lpthread -lrt -lSDL -lSDL_gfx -lSDL_image -lxmp
+
+# Tracing of hot paths: qmake CONFIG+=trace
+trace {
+    DEFINES += ENABLE_TRACE
+}
+
+CONFIG(debug, debug|release) {
+    DEFINES += _DEBUG
+    QMAKE_CFLAGS_DEBUG += -fno-builtin
+}
+CONFIG(release, debug|release) {
+    DEFINES += NDEBUG
+    QMAKE_CFLAGS_RELEASE += -flto
+    QMAKE_LFLAGS_RELEASE += -flto
+}
@@ -0,0 +1,237 @@
+/**
+ * @file        stats.c
+ * @brief       Live counters in shared memory for monitoring
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-24 18:05:21
+ * Licence:     GPL
+ *
+ * Counters are collected in a private copy and published into the shared
+ * segment once per iteration of the game loop. Publishing is a copy of a
+ * few hundred bytes between two stores of the sequence number, there is no
+ * lock and no system call, so readers cannot slow down the game.
+ *
+ * Save times are collected by the I/O thread, which is their only writer.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+#include "game_common.h"
+
+static stats_shm_t  stats;                  /* Private copy, written by game loop */
+static stats_hist_t stats_save;             /* Written by I/O thread */
+static stats_shm_t* stats_shm = NULL;       /* Shared segment, NULL: not published */
+static char         stats_shm_name[32];
+static uint64_t     stats_last_flip_us = 0;
+
+/**
+ * @brief statsBucket
+ * @return Histogram bucket of a time.
+ */
+static uint8_t statsBucket (uint32_t aUs)
+{
+    uint8_t bucket = aUs > 1 ? 31 - __builtin_clz (aUs) : 0;
+
+    return bucket < STATS_HIST_BUCKETS ? bucket : STATS_HIST_BUCKETS - 1;
+}
+
+static void addSample (stats_hist_t* aHist, uint64_t aUs)
+{
+    uint32_t us = aUs < UINT32_MAX ? aUs : UINT32_MAX;
+
+    aHist->count++;
+    aHist->sum_us += us;
+    if (us > aHist->max_us)
+    {
+        aHist->max_us = us;
+    }
+    aHist->buckets[statsBucket (us)]++;
+}
+
+/**
+ * @brief removeStale
+ * Remove the segments of games which were killed or crashed.
+ */
+static void removeStale (void)
+{
+    DIR* dir = opendir (STATS_SHM_DIR);
+    struct dirent* entry;
+    char name[sizeof (stats_shm_name)];
+    unsigned pid;
+
+    if (!dir)
+    {
+        return;
+    }
+    while ((entry = readdir (dir)) != NULL)
+    {
+        /* Names in the directory have no leading slash */
+        if (sscanf (entry->d_name, &STATS_SHM_NAME[1], &pid) == 1 && pid
+                && kill (pid, 0) != 0 && errno == ESRCH)
+        {
+            snprintf (name, sizeof (name), STATS_SHM_NAME, pid);
+            shm_unlink (name);
+        }
+    }
+    closedir (dir);
+}
+
+/**
+ * @brief statsInit
+ * Create the shared segment. Counters are collected even if it fails.
+ *
+ * @return TRUE: counters are published.
+ */
+bool_t statsInit (void)
+{
+    int fd;
+
+    removeStale ();
+    snprintf (stats_shm_name, sizeof (stats_shm_name), STATS_SHM_NAME, (uint32_t) getpid ());
+    fd = shm_open (stats_shm_name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        printf("%s: cannot open shared memory %s\n", __FUNCTION__, stats_shm_name);
+        return FALSE;
+    }
+    if (ftruncate (fd, sizeof (stats_shm_t)) == 0)
+    {
+        stats_shm = mmap (NULL, sizeof (stats_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (stats_shm == MAP_FAILED)
+        {
+            stats_shm = NULL;
+        }
+    }
+    close (fd);
+    if (!stats_shm)
+    {
+        printf("%s: cannot map shared memory %s\n", __FUNCTION__, stats_shm_name);
+        shm_unlink (stats_shm_name);
+        return FALSE;
+    }
+    /* An old reader may still see the segment of a previous game of the pid */
+    __atomic_store_n (&stats_shm->seq, stats_shm->seq | 1u, __ATOMIC_RELAXED);
+    stats_shm->magic = STATS_MAGIC;
+    stats_shm->version = STATS_VERSION;
+    stats_shm->pid = getpid ();
+    statsPublish ();
+
+    return TRUE;
+}
+
+/**
+ * @brief statsFrame
+ * Called after every flip of screen.
+ */
+void statsFrame (void)
+{
+    uint64_t now = getTimeUs ();
+
+    if (stats_last_flip_us)
+    {
+        addSample (&stats.frame, now - stats_last_flip_us);
+    }
+    stats_last_flip_us = now;
+}
+
+/**
+ * @brief statsInput
+ * Called when an input event is handled.
+ *
+ * @param aEventUs Time when the event was taken from SDL.
+ */
+void statsInput (uint64_t aEventUs)
+{
+    uint64_t now = getTimeUs ();
+
+    addSample (&stats.input_latency, now > aEventUs ? now - aEventUs : 0);
+}
+
+/**
+ * @brief statsSave
+ * Called by the I/O thread when a file is written.
+ *
+ * @param aStartUs Start of writing.
+ */
+void statsSave (uint64_t aStartUs)
+{
+    uint64_t us = getTimeUs () - aStartUs;
+    uint8_t bucket;
+
+    if (us > UINT32_MAX)
+    {
+        us = UINT32_MAX;
+    }
+    bucket = statsBucket (us);
+    /* The game loop reads the counters meanwhile */
+    __atomic_store_n (&stats_save.count, stats_save.count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n (&stats_save.sum_us, stats_save.sum_us + us, __ATOMIC_RELAXED);
+    if (us > stats_save.max_us)
+    {
+        __atomic_store_n (&stats_save.max_us, (uint32_t) us, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n (&stats_save.buckets[bucket], stats_save.buckets[bucket] + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief statsPublish
+ * Copy counters into the shared segment. Called by game loop only.
+ */
+void statsPublish (void)
+{
+    const size_t offset = offsetof (stats_shm_t, update_us);
+    uint32_t seq;
+    uint8_t i;
+
+    if (!stats_shm)
+    {
+        return;
+    }
+    stats.update_us = getTimeUs ();
+    stats.state = main_state_machine;
+    stats.score = game.score;
+    stats.level = game.level;
+    stats.figure_counter = game.figure_counter;
+    stats.block_types = game.block_types;
+    stats.game_counter = config.game_counter;
+    stats.save.count = __atomic_load_n (&stats_save.count, __ATOMIC_RELAXED);
+    stats.save.sum_us = __atomic_load_n (&stats_save.sum_us, __ATOMIC_RELAXED);
+    stats.save.max_us = __atomic_load_n (&stats_save.max_us, __ATOMIC_RELAXED);
+    for (i = 0; i < STATS_HIST_BUCKETS; i++)
+    {
+        stats.save.buckets[i] = __atomic_load_n (&stats_save.buckets[i], __ATOMIC_RELAXED);
+    }
+
+    /* Odd sequence number: readers retry until it is written */
+    seq = (stats_shm->seq | 1u) + 1;
+    __atomic_store_n (&stats_shm->seq, seq - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    memcpy ((uint8_t*) stats_shm + offset, (const uint8_t*) &stats + offset,
+            sizeof (stats_shm_t) - offset);
+    __atomic_store_n (&stats_shm->seq, seq, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief statsDone
+ * Remove the shared segment, readers see that the game is not running.
+ */
+void statsDone (void)
+{
+    if (stats_shm)
+    {
+        munmap (stats_shm, sizeof (stats_shm_t));
+        stats_shm = NULL;
+        shm_unlink (stats_shm_name);
+    }
+}
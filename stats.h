@@ -0,0 +1,66 @@
+/**
+ * @file        stats.h
+ * @brief       Live counters in shared memory for monitoring
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-24 18:05:21
+ * Licence:     GPL
+ *
+ * The game publishes stats_shm_t in the POSIX shared memory segment
+ * STATS_SHM_NAME of its pid, so instances do not share it; segments left
+ * by crashed games are removed by the next one. Readers map it read-only
+ * and never block the game: they read seq, copy the segment and read seq
+ * again; the copy is valid if seq was even and did not change.
+ * tools/sometris_stat.c is a reader.
+ *
+ * Histograms have power of two buckets: bucket 0 counts values below 2 us,
+ * bucket i counts [2^i, 2^(i+1)) us, the last one counts longer values too.
+ */
+
+#ifndef INCLUDE_STATS_H
+#define INCLUDE_STATS_H
+
+#include <stdint.h>
+
+#include "common.h"
+
+#define STATS_SHM_NAME          "/sometris.%u"  /* Parameter: pid of the game */
+#define STATS_SHM_DIR           "/dev/shm"      /* Segments are listed here */
+#define STATS_MAGIC             0x54535453u /* "STST" */
+#define STATS_VERSION           1           /* Changed when layout changes */
+#define STATS_HIST_BUCKETS      24          /* Last bucket starts at 8.4 s */
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[STATS_HIST_BUCKETS];
+} stats_hist_t;
+
+typedef struct
+{
+    uint32_t magic;             /* STATS_MAGIC */
+    uint32_t version;           /* STATS_VERSION */
+    uint32_t seq;               /* Odd: being written */
+    uint32_t pid;               /* Process of the game */
+    uint64_t update_us;         /* Time of publishing, see getTimeUs() */
+    uint32_t state;             /* main_state_machine_t */
+    uint32_t score;
+    uint32_t level;
+    uint32_t figure_counter;
+    uint32_t block_types;
+    uint32_t game_counter;      /* Games played, see config_t */
+    stats_hist_t frame;         /* Time between flips of screen */
+    stats_hist_t input_latency; /* Time from taking an event from SDL to handling it */
+    stats_hist_t save;          /* Time of writing a file by the I/O thread */
+} stats_shm_t;
+
+bool_t statsInit (void);
+void statsFrame (void);
+void statsInput (uint64_t aEventUs);
+void statsSave (uint64_t aStartUs);
+void statsPublish (void);
+void statsDone (void);
+
+#endif /* INCLUDE_STATS_H */
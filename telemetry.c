@@ -0,0 +1,268 @@
+/**
+ * @file        telemetry.c
+ * @brief       Telemetry of figures and games in columnar files
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-25 20:03:35
+ * Licence:     GPL
+ *
+ * Every locked figure is a row of the figures file, every finished game is
+ * a row of the games file, see telemetry_figure_columns and
+ * telemetry_game_columns. Files are appended by the I/O thread, see
+ * colstore.h for the format and tools/sometris_query.c for reading.
+ *
+ * Figures of a game are appended when the game ends. Games are appended
+ * every TELEMETRY_GAMES_FLUSH games and at exit, so a block is not needed
+ * for every game; if the game crashes, rows of the last games are lost, but
+ * their figures are kept.
+ *
+ * Times are in milliseconds without pauses, time column is the wall clock
+ * in seconds.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "telemetry.h"
+#include "colstore.h"
+#include "iothread.h"
+
+typedef enum
+{
+    FIGURE_time,
+    FIGURE_game,
+    FIGURE_figure,
+    FIGURE_x,
+    FIGURE_y,
+    FIGURE_vertical,
+    FIGURE_lock_ms,
+    FIGURE_cascade,
+    FIGURE_score_delta,
+    FIGURE_score,
+    FIGURE_level,
+    FIGURE_block_types,
+    FIGURE_size
+} telemetry_figure_column_t;
+
+typedef enum
+{
+    GAME_time,
+    GAME_game,
+    GAME_resumed,
+    GAME_duration_ms,
+    GAME_figures,
+    GAME_score,
+    GAME_level,
+    GAME_block_types,
+    GAME_longest_cascade,
+    GAME_saved,
+    GAME_size
+} telemetry_game_column_t;
+
+static const char* const telemetry_figure_columns[FIGURE_size] =
+{
+    [FIGURE_time] = "time",                 /* When figure was locked */
+    [FIGURE_game] = "game",                 /* Identifier of game */
+    [FIGURE_figure] = "figure",             /* figure_counter of game */
+    [FIGURE_x] = "x",
+    [FIGURE_y] = "y",
+    [FIGURE_vertical] = "vertical",
+    [FIGURE_lock_ms] = "lock_ms",           /* From lock of the previous figure */
+    [FIGURE_cascade] = "cascade",           /* Rounds of collapse */
+    [FIGURE_score_delta] = "score_delta",
+    [FIGURE_score] = "score",
+    [FIGURE_level] = "level",
+    [FIGURE_block_types] = "block_types"    /* Difficulty */
+};
+
+static const char* const telemetry_game_columns[GAME_size] =
+{
+    [GAME_time] = "time",                   /* Start of game */
+    [GAME_game] = "game",
+    [GAME_resumed] = "resumed",             /* 1: saved game was loaded */
+    [GAME_duration_ms] = "duration_ms",
+    [GAME_figures] = "figures",
+    [GAME_score] = "score",
+    [GAME_level] = "level",
+    [GAME_block_types] = "block_types",
+    [GAME_longest_cascade] = "longest_cascade",
+    [GAME_saved] = "saved"                  /* 1: game was saved at exit, 0: game over */
+};
+
+static colstore_writer_t telemetry_figures;
+static colstore_writer_t telemetry_games;
+static char     telemetry_figures_path[FSYS_FILENAME_MAX];
+static char     telemetry_games_path[FSYS_FILENAME_MAX];
+static bool_t   telemetry_enabled = FALSE;
+static bool_t   telemetry_playing = FALSE;      /* Between start and end of game */
+static uint32_t telemetry_game_id = 0;
+static bool_t   telemetry_resumed = FALSE;
+static int64_t  telemetry_game_time = 0;        /* Wall clock at start */
+static uint64_t telemetry_game_start_ms = 0;
+static uint64_t telemetry_figure_start_ms = 0;
+static uint64_t telemetry_pause_start_ms = 0;   /* 0: not paused */
+
+static uint64_t getTimeMs (void)
+{
+    return getTimeUs () / 1000u;
+}
+
+/**
+ * @brief flush
+ * Append collected rows to the file.
+ */
+static void flush (colstore_writer_t* aWriter, const char* aPath)
+{
+    uint8_t* buf;
+    uint32_t length;
+
+    if (!aWriter->rows)
+    {
+        return;
+    }
+    buf = malloc (colstoreEncodedSize (aWriter));
+    if (!buf)
+    {
+        printf("%s: out of memory\n", __FUNCTION__);
+        aWriter->rows = 0;
+        return;
+    }
+    length = colstoreEncode (aWriter, buf);
+    ioAppendFile (aPath, buf, length);
+    free (buf);
+}
+
+/**
+ * @brief telemetryInit
+ * Start collecting telemetry.
+ */
+void telemetryInit (const char* aFiguresPath, const char* aGamesPath)
+{
+    strncpy (telemetry_figures_path, aFiguresPath, sizeof (telemetry_figures_path) - 1);
+    strncpy (telemetry_games_path, aGamesPath, sizeof (telemetry_games_path) - 1);
+    /* Blocks appended after a cut one could not be read */
+    colstoreRepair (telemetry_figures_path);
+    colstoreRepair (telemetry_games_path);
+    colstoreWriterInit (&telemetry_figures, telemetry_figure_columns, FIGURE_size);
+    colstoreWriterInit (&telemetry_games, telemetry_game_columns, GAME_size);
+    telemetry_enabled = TRUE;
+}
+
+/**
+ * @brief telemetryGameStart
+ * Called when a new game is started or a saved one is loaded.
+ */
+void telemetryGameStart (uint32_t aGameId, bool_t aResumed)
+{
+    telemetry_playing = telemetry_enabled;
+    telemetry_game_id = aGameId;
+    telemetry_resumed = aResumed;
+    telemetry_game_time = time (NULL);
+    telemetry_game_start_ms = getTimeMs ();
+    telemetry_figure_start_ms = telemetry_game_start_ms;
+    telemetry_pause_start_ms = 0;
+}
+
+/**
+ * @brief telemetryPause
+ * Time of pause is not part of the times of figure and game.
+ */
+void telemetryPause (bool_t aPaused)
+{
+    uint64_t now = getTimeMs ();
+
+    if (aPaused && !telemetry_pause_start_ms)
+    {
+        telemetry_pause_start_ms = now;
+    }
+    else if (!aPaused && telemetry_pause_start_ms)
+    {
+        telemetry_game_start_ms += now - telemetry_pause_start_ms;
+        telemetry_figure_start_ms += now - telemetry_pause_start_ms;
+        telemetry_pause_start_ms = 0;
+    }
+}
+
+/**
+ * @brief telemetryLock
+ * Called when figure is locked and the map is collapsed, before the next
+ * figure is generated.
+ *
+ * @param aCascade Rounds of collapse.
+ * @param aScoreDelta Score of the figure.
+ */
+void telemetryLock (uint8_t aCascade, uint32_t aScoreDelta)
+{
+    int64_t row[FIGURE_size];
+    uint64_t now = getTimeMs ();
+
+    if (!telemetry_playing)
+    {
+        return;
+    }
+    row[FIGURE_time] = time (NULL);
+    row[FIGURE_game] = telemetry_game_id;
+    row[FIGURE_figure] = game.figure_counter;
+    row[FIGURE_x] = game.figure_x;
+    row[FIGURE_y] = game.figure_y;
+    row[FIGURE_vertical] = game.figure_is_vertical;
+    row[FIGURE_lock_ms] = now - telemetry_figure_start_ms;
+    row[FIGURE_cascade] = aCascade;
+    row[FIGURE_score_delta] = aScoreDelta;
+    row[FIGURE_score] = game.score;
+    row[FIGURE_level] = game.level;
+    row[FIGURE_block_types] = game.block_types;
+    telemetry_figure_start_ms = now;
+    if (colstoreAppendRow (&telemetry_figures, row))
+    {
+        flush (&telemetry_figures, telemetry_figures_path);
+    }
+}
+
+/**
+ * @brief telemetryGameEnd
+ * Called when game is over or it is saved at exit.
+ */
+void telemetryGameEnd (bool_t aSaved)
+{
+    int64_t row[GAME_size];
+
+    if (!telemetry_playing)
+    {
+        return;
+    }
+    telemetryPause (FALSE);
+    row[GAME_time] = telemetry_game_time;
+    row[GAME_game] = telemetry_game_id;
+    row[GAME_resumed] = telemetry_resumed;
+    row[GAME_duration_ms] = getTimeMs () - telemetry_game_start_ms;
+    row[GAME_figures] = game.figure_counter;
+    row[GAME_score] = game.score;
+    row[GAME_level] = game.level;
+    row[GAME_block_types] = game.block_types;
+    row[GAME_longest_cascade] = game.longest_cascade;
+    row[GAME_saved] = aSaved;
+    telemetry_playing = FALSE;
+    flush (&telemetry_figures, telemetry_figures_path);
+    if (colstoreAppendRow (&telemetry_games, row) || telemetry_games.rows >= TELEMETRY_GAMES_FLUSH)
+    {
+        flush (&telemetry_games, telemetry_games_path);
+    }
+}
+
+/**
+ * @brief telemetryDone
+ * Append rows which are not written yet. The I/O thread shall still run.
+ */
+void telemetryDone (void)
+{
+    if (telemetry_enabled)
+    {
+        flush (&telemetry_figures, telemetry_figures_path);
+        flush (&telemetry_games, telemetry_games_path);
+        telemetry_enabled = FALSE;
+    }
+}
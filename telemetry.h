@@ -0,0 +1,26 @@
+/**
+ * @file        telemetry.h
+ * @brief       Telemetry of figures and games in columnar files
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-25 20:03:35
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_TELEMETRY_H
+#define INCLUDE_TELEMETRY_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define TELEMETRY_GAMES_FLUSH   16  /* Games are appended in blocks of this many rows */
+
+void telemetryInit (const char* aFiguresPath, const char* aGamesPath);
+void telemetryGameStart (uint32_t aGameId, bool_t aResumed);
+void telemetryPause (bool_t aPaused);
+void telemetryLock (uint8_t aCascade, uint32_t aScoreDelta);
+void telemetryGameEnd (bool_t aSaved);
+void telemetryDone (void);
+
+#endif /* INCLUDE_TELEMETRY_H */
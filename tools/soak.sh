@@ -0,0 +1,111 @@
+#!/bin/sh
+#
+# @file        soak.sh
+# @brief       Long running test of the whole game without window
+# @author      Copyright (C) Peter Ivanov, 2016
+#
+# Created      2016-05-27 18:52:06
+# Licence:     GPL
+#
+# Usage: soak.sh sometris sometris-stat [samples.csv]
+#
+# The game plays bot games with the dummy video and audio drivers and a
+# clean home directory, with the loop delay of a real cabinet. Blinking is
+# off: it stalls the loop by design and its share depends on the games, so
+# it would hide the drift.
+# Every SOAK_INTERVAL seconds FPS and frame time (from the shared memory
+# counters, see stats.h), RSS and number of open files are sampled into
+# the CSV file. Samples of the first SOAK_WARMUP seconds are not checked.
+#
+# Exit code is 1 if a threshold is exceeded, 2 if the game stopped:
+#
+#   SOAK_MIN_FPS            average FPS after warm-up
+#   SOAK_MAX_RSS_GROWTH_KB  RSS at the end minus RSS after warm-up
+#   SOAK_MAX_FD_GROWTH      open files at the end minus after warm-up
+#   SOAK_MAX_DRIFT_PCT      frame time of the last tenth of the samples
+#                           compared to the first tenth
+
+SOAK_SECONDS=${SOAK_SECONDS:-3600}
+SOAK_INTERVAL=${SOAK_INTERVAL:-10}
+SOAK_WARMUP=${SOAK_WARMUP:-60}
+SOAK_MIN_FPS=${SOAK_MIN_FPS:-30}
+SOAK_MAX_RSS_GROWTH_KB=${SOAK_MAX_RSS_GROWTH_KB:-4096}
+SOAK_MAX_FD_GROWTH=${SOAK_MAX_FD_GROWTH:-0}
+SOAK_MAX_DRIFT_PCT=${SOAK_MAX_DRIFT_PCT:-10}
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 sometris sometris-stat [samples.csv]" >&2
+    exit 2
+fi
+game=$1
+stat=$2
+csv=${3:-soak.csv}
+
+seconds () {
+    awk '{ print $1 }' /proc/uptime
+}
+
+home=`mktemp -d`
+HOME=$home SDL_VIDEODRIVER=dummy SDL_AUDIODRIVER=dummy "$game" --bot-games 1000000 --blink-delay-ms 0 \
+    > "$home/game.log" 2>&1 &
+pid=$!
+
+stop () {
+    kill $pid 2> /dev/null
+    # Game exits on SDL_QUIT, it is killed if it does not
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        kill -0 $pid 2> /dev/null || break
+        sleep 1
+    done
+    kill -9 $pid 2> /dev/null
+    rm -rf "$home"
+}
+trap stop EXIT
+trap 'exit 2' INT TERM
+
+echo "seconds,frames,fps,frame_ms,rss_kb,fds,figures,games" > "$csv"
+start=`seconds`
+now=$start
+prev_time=$start
+prev_frames=0
+end=`awk "BEGIN { print $start + $SOAK_SECONDS }"`
+while awk "BEGIN { exit !($now < $end) }"; do
+    sleep "$SOAK_INTERVAL"
+    now=`seconds`
+    if ! kill -0 $pid 2> /dev/null; then
+        echo "soak: game stopped, its output:" >&2
+        tail -20 "$home/game.log" >&2
+        exit 2
+    fi
+    stats=`"$stat" -p $pid` || continue
+    frames=`echo "$stats" | awk '$1 == "frame_count" { print $2 }'`
+    figures=`echo "$stats" | awk '$1 == "figure_counter" { print $2 }'`
+    games=`echo "$stats" | awk '$1 == "game_counter" { print $2 }'`
+    rss=`awk '$1 == "VmRSS:" { print $2 }' /proc/$pid/status`
+    fds=`ls /proc/$pid/fd | wc -l`
+    awk "BEGIN { t = $now - $prev_time; f = $frames - $prev_frames;
+                 printf \"%.1f,%u,%.1f,%.3f,%u,%u,%u,%u\\n\", $now - $start, $frames,
+                        f / t, f ? t * 1000 / f : 0, $rss, $fds, $figures, $games }" >> "$csv"
+    tail -1 "$csv"
+    prev_time=$now
+    prev_frames=$frames
+done
+
+awk -F, -v warmup="$SOAK_WARMUP" -v min_fps="$SOAK_MIN_FPS" \
+    -v max_rss="$SOAK_MAX_RSS_GROWTH_KB" -v max_fd="$SOAK_MAX_FD_GROWTH" \
+    -v max_drift="$SOAK_MAX_DRIFT_PCT" '
+    NR > 1 && $1 >= warmup { n++; fps[n] = $3; ms[n] = $4; rss[n] = $5; fds[n] = $6 }
+    END {
+        if (n < 2) { print "soak: too few samples after warm-up"; exit 1 }
+        w = int (n / 10); if (w < 1) w = 1
+        for (i = 1; i <= n; i++) sum += fps[i]
+        for (i = 1; i <= w; i++) { first += ms[i]; last += ms[n - w + i] }
+        drift = first ? (last - first) * 100 / first : 0
+        printf "soak: fps %.1f, rss growth %d kB, fd growth %d, frame time drift %.1f%%\n",
+               sum / n, rss[n] - rss[1], fds[n] - fds[1], drift
+        if (sum / n < min_fps) { print "soak: FPS below " min_fps; failed = 1 }
+        if (rss[n] - rss[1] > max_rss) { print "soak: RSS grew more than " max_rss " kB"; failed = 1 }
+        if (fds[n] - fds[1] > max_fd) { print "soak: open files grew more than " max_fd; failed = 1 }
+        if (drift > max_drift) { print "soak: frame time drifted more than " max_drift "%"; failed = 1 }
+        exit failed
+    }' "$csv"
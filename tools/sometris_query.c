@@ -0,0 +1,613 @@
+/**
+ * @file        sometris_query.c
+ * @brief       Filters and aggregates of the telemetry files
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-26 18:27:14
+ * Licence:     GPL
+ *
+ * Usage: sometris-query [-d dir] [-s days] [-w filter]... [-g column] table [aggregate...]
+ *
+ *   table      figures or games, file <dir>/<table>.col, dir is ~/.sometris
+ *   -s days    only rows of the last days, filter of the time column
+ *   -w filter  column=value, also !=, <, <=, > and >=
+ *   -g column  one result row for every value of column
+ *   aggregate  count (default), sum:column, avg:column, min:column,
+ *              max:column or pNN:column for the NN-th percentile
+ *
+ * Example, 95th percentile of cascade depth by difficulty in the last week:
+ *
+ *   sometris-query -s 7 -g block_types figures count p95:cascade
+ *
+ * Only the needed columns of a block are decoded. Filters are applied to
+ * whole columns and they shrink a vector of selected rows, aggregates
+ * loop over the selected rows of one column. Result is tab separated.
+ * If the file is damaged, the result of the rows before the damage is
+ * printed and the exit code is 1.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "colstore.h"
+
+#define QUERY_MAX_FILTERS       16
+#define QUERY_MAX_AGGREGATES    16
+#define QUERY_MAX_COLUMNS       (QUERY_MAX_FILTERS + QUERY_MAX_AGGREGATES + 1)
+#define QUERY_MAX_GROUPS        4096    /* Power of two */
+
+/* Selected row is kept if it matches, used by filterRows() */
+#define FILTER_LOOP(cmp)                            \
+    for (i = 0; i < aCount; i++)                    \
+    {                                               \
+        aSel[n] = aSel[i];                          \
+        n += aValues[aSel[i]] cmp aValue;           \
+    }
+
+typedef enum
+{
+    OP_eq,
+    OP_ne,
+    OP_lt,
+    OP_le,
+    OP_gt,
+    OP_ge
+} query_op_t;
+
+typedef enum
+{
+    AGG_count,
+    AGG_sum,
+    AGG_avg,
+    AGG_min,
+    AGG_max,
+    AGG_percentile
+} query_agg_type_t;
+
+typedef struct
+{
+    uint8_t column;         /* Index of needed column */
+    query_op_t op;
+    int64_t value;
+} query_filter_t;
+
+typedef struct
+{
+    const char* label;
+    query_agg_type_t type;
+    uint8_t column;
+    uint8_t percent;
+} query_agg_t;
+
+typedef struct
+{
+    int64_t* values;
+    uint64_t count;
+    uint64_t size;
+} query_values_t;
+
+typedef struct
+{
+    bool_t used;
+    int64_t key;
+    uint64_t rows;
+    int64_t sums[QUERY_MAX_AGGREGATES];
+    int64_t mins[QUERY_MAX_AGGREGATES];
+    int64_t maxs[QUERY_MAX_AGGREGATES];
+    query_values_t values[QUERY_MAX_AGGREGATES];   /* Values of percentiles */
+} query_group_t;
+
+static const char*      query_columns[QUERY_MAX_COLUMNS];  /* Needed columns */
+static uint8_t          query_column_cntr = 0;
+static query_filter_t   query_filters[QUERY_MAX_FILTERS];
+static uint8_t          query_filter_cntr = 0;
+static query_agg_t      query_aggs[QUERY_MAX_AGGREGATES];
+static uint8_t          query_agg_cntr = 0;
+static int16_t          query_group_column = -1;           /* -1: no grouping */
+static query_group_t    query_groups[QUERY_MAX_GROUPS];
+static uint32_t         query_group_cntr = 0;
+static int64_t          query_vectors[QUERY_MAX_COLUMNS][COLSTORE_BLOCK_ROWS];
+
+/**
+ * @brief neededColumn
+ * @return Index of column among the needed ones, it is added if it is new.
+ */
+static uint8_t neededColumn (const char* aName)
+{
+    uint8_t i;
+
+    for (i = 0; i < query_column_cntr; i++)
+    {
+        if (!strcmp (query_columns[i], aName))
+        {
+            return i;
+        }
+    }
+    query_columns[query_column_cntr] = aName;
+
+    return query_column_cntr++;
+}
+
+static bool_t parseFilter (char* aFilter)
+{
+    static const struct
+    {
+        const char* text;
+        query_op_t op;
+    } ops[] =
+    {
+        { "!=", OP_ne }, { "<=", OP_le }, { ">=", OP_ge }, { "==", OP_eq },
+        { "=", OP_eq }, { "<", OP_lt }, { ">", OP_gt }
+    };
+    query_filter_t* filter = &query_filters[query_filter_cntr];
+    char* pos;
+    uint8_t i;
+
+    if (query_filter_cntr >= QUERY_MAX_FILTERS)
+    {
+        return FALSE;
+    }
+    for (i = 0; i < sizeof (ops) / sizeof (ops[0]); i++)
+    {
+        pos = strstr (aFilter, ops[i].text);
+        if (pos && pos != aFilter)
+        {
+            filter->op = ops[i].op;
+            filter->value = strtoll (pos + strlen (ops[i].text), NULL, 0);
+            *pos = 0;
+            filter->column = neededColumn (aFilter);
+            query_filter_cntr++;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static bool_t parseAggregate (const char* aAggregate)
+{
+    static const char* names[] = { "count", "sum", "avg", "min", "max" };
+    query_agg_t* agg = &query_aggs[query_agg_cntr];
+    const char* colon = strchr (aAggregate, ':');
+    size_t length = colon ? (size_t) (colon - aAggregate) : strlen (aAggregate);
+    uint8_t i;
+
+    if (query_agg_cntr >= QUERY_MAX_AGGREGATES)
+    {
+        return FALSE;
+    }
+    agg->label = aAggregate;
+    if (!colon)
+    {
+        agg->type = AGG_count;
+        query_agg_cntr++;
+        return !strcmp (aAggregate, "count");
+    }
+    if (aAggregate[0] == 'p' && length > 1 && length <= 4)
+    {
+        agg->type = AGG_percentile;
+        agg->percent = atoi (aAggregate + 1);
+        if (!agg->percent || agg->percent > 100)
+        {
+            return FALSE;
+        }
+    }
+    else
+    {
+        for (i = AGG_sum; i < sizeof (names) / sizeof (names[0]); i++)
+        {
+            if (strlen (names[i]) == length && !strncmp (aAggregate, names[i], length))
+            {
+                break;
+            }
+        }
+        if (i >= sizeof (names) / sizeof (names[0]))
+        {
+            return FALSE;
+        }
+        agg->type = i;
+    }
+    agg->column = neededColumn (colon + 1);
+    query_agg_cntr++;
+
+    return TRUE;
+}
+
+/**
+ * @brief filterRows
+ * Keep selected rows which match the filter.
+ *
+ * @return Number of rows kept.
+ */
+static uint32_t filterRows (const int64_t* aValues, uint32_t* aSel, uint32_t aCount,
+                            query_op_t aOp, int64_t aValue)
+{
+    uint32_t i, n = 0;
+
+    /* Without branches in the loops, so they are vectorized */
+    switch (aOp)
+    {
+        case OP_eq:
+            FILTER_LOOP (==);
+            break;
+        case OP_ne:
+            FILTER_LOOP (!=);
+            break;
+        case OP_lt:
+            FILTER_LOOP (<);
+            break;
+        case OP_le:
+            FILTER_LOOP (<=);
+            break;
+        case OP_gt:
+            FILTER_LOOP (>);
+            break;
+        case OP_ge:
+            FILTER_LOOP (>=);
+            break;
+    }
+
+    return n;
+}
+
+/**
+ * @brief findGroup
+ * @return Group of key, NULL: too many groups.
+ */
+static query_group_t* findGroup (int64_t aKey)
+{
+    uint32_t hash = (uint32_t) (((uint64_t) aKey * 0x9E3779B97F4A7C15ull) >> 40);
+    query_group_t* group;
+    uint32_t i;
+    uint8_t j;
+
+    for (i = 0; i < QUERY_MAX_GROUPS; i++)
+    {
+        group = &query_groups[(hash + i) & (QUERY_MAX_GROUPS - 1)];
+        if (group->used && group->key == aKey)
+        {
+            return group;
+        }
+        if (!group->used)
+        {
+            if (query_group_cntr >= QUERY_MAX_GROUPS / 2)
+            {
+                return NULL;
+            }
+            group->used = TRUE;
+            group->key = aKey;
+            for (j = 0; j < query_agg_cntr; j++)
+            {
+                group->mins[j] = INT64_MAX;
+                group->maxs[j] = INT64_MIN;
+            }
+            query_group_cntr++;
+            return group;
+        }
+    }
+
+    return NULL;
+}
+
+static bool_t addValue (query_values_t* aValues, int64_t aValue)
+{
+    int64_t* values;
+
+    if (aValues->count >= aValues->size)
+    {
+        values = realloc (aValues->values, (aValues->size ? aValues->size * 2 : 256) * sizeof (int64_t));
+        if (!values)
+        {
+            return FALSE;
+        }
+        aValues->values = values;
+        aValues->size = aValues->size ? aValues->size * 2 : 256;
+    }
+    aValues->values[aValues->count++] = aValue;
+
+    return TRUE;
+}
+
+/**
+ * @brief aggregateRows
+ * Add selected rows of a block to their groups.
+ *
+ * @return FALSE: out of memory or too many groups.
+ */
+static bool_t aggregateRows (const uint32_t* aSel, uint32_t aCount)
+{
+    static query_group_t* groups[COLSTORE_BLOCK_ROWS];
+    const int64_t* values;
+    query_group_t* group;
+    uint32_t i;
+    uint8_t j;
+
+    for (i = 0; i < aCount; i++)
+    {
+        groups[i] = findGroup (query_group_column < 0 ? 0 : query_vectors[query_group_column][aSel[i]]);
+        if (!groups[i])
+        {
+            fprintf (stderr, "Too many groups\n");
+            return FALSE;
+        }
+        groups[i]->rows++;
+    }
+    for (j = 0; j < query_agg_cntr; j++)
+    {
+        values = query_vectors[query_aggs[j].column];
+        switch (query_aggs[j].type)
+        {
+            case AGG_sum:
+            case AGG_avg:
+                for (i = 0; i < aCount; i++)
+                {
+                    groups[i]->sums[j] += values[aSel[i]];
+                }
+                break;
+            case AGG_min:
+                for (i = 0; i < aCount; i++)
+                {
+                    group = groups[i];
+                    group->mins[j] = MIN (group->mins[j], values[aSel[i]]);
+                }
+                break;
+            case AGG_max:
+                for (i = 0; i < aCount; i++)
+                {
+                    group = groups[i];
+                    group->maxs[j] = MAX (group->maxs[j], values[aSel[i]]);
+                }
+                break;
+            case AGG_percentile:
+                for (i = 0; i < aCount; i++)
+                {
+                    if (!addValue (&groups[i]->values[j], values[aSel[i]]))
+                    {
+                        fprintf (stderr, "Out of memory\n");
+                        return FALSE;
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief scanFile
+ * @param aDamaged Set if the file is damaged, rows before the damage are
+ *                 aggregated.
+ * @return Number of blocks which have no needed column, -1: error.
+ */
+static int32_t scanFile (FILE* aFile, bool_t* aDamaged)
+{
+    static uint32_t sel[COLSTORE_BLOCK_ROWS];
+    colstore_block_t block;
+    int8_t idx;
+    int32_t skipped = 0;
+    uint32_t count, i;
+    uint8_t c;
+    bool_t ok = TRUE;
+
+    memset (&block, 0, sizeof (block));
+    while (ok && colstoreReadBlock (aFile, &block))
+    {
+        for (c = 0; c < query_column_cntr; c++)
+        {
+            idx = colstoreFindColumn (&block, query_columns[c]);
+            if (idx < 0 || !colstoreDecodeColumn (&block, idx, query_vectors[c]))
+            {
+                break;
+            }
+        }
+        if (c < query_column_cntr)
+        {
+            skipped++;
+            continue;
+        }
+        for (i = 0; i < block.rows; i++)
+        {
+            sel[i] = i;
+        }
+        count = block.rows;
+        for (i = 0; i < query_filter_cntr && count; i++)
+        {
+            count = filterRows (query_vectors[query_filters[i].column], sel, count,
+                                query_filters[i].op, query_filters[i].value);
+        }
+        ok = aggregateRows (sel, count);
+    }
+    *aDamaged = block.damaged;
+    colstoreFreeBlock (&block);
+
+    return ok ? skipped : -1;
+}
+
+static int compareInt64 (const void* aA, const void* aB)
+{
+    int64_t a = *(const int64_t*) aA;
+    int64_t b = *(const int64_t*) aB;
+
+    return a < b ? -1 : a > b;
+}
+
+static int compareGroups (const void* aA, const void* aB)
+{
+    const query_group_t* a = *(query_group_t* const*) aA;
+    const query_group_t* b = *(query_group_t* const*) aB;
+
+    return compareInt64 (&a->key, &b->key);
+}
+
+static void printResult (const char* aGroupName)
+{
+    query_group_t* groups[QUERY_MAX_GROUPS];
+    query_group_t* group;
+    query_values_t* values;
+    uint32_t n = 0;
+    uint32_t i;
+    uint8_t j;
+
+    for (i = 0; i < QUERY_MAX_GROUPS; i++)
+    {
+        if (query_groups[i].used)
+        {
+            groups[n++] = &query_groups[i];
+        }
+    }
+    qsort (groups, n, sizeof (groups[0]), compareGroups);
+
+    if (aGroupName)
+    {
+        printf("%s\t", aGroupName);
+    }
+    for (j = 0; j < query_agg_cntr; j++)
+    {
+        printf("%s%s", query_aggs[j].label, j + 1 < query_agg_cntr ? "\t" : "\n");
+    }
+    for (i = 0; i < n; i++)
+    {
+        group = groups[i];
+        if (aGroupName)
+        {
+            printf("%lli\t", (long long) group->key);
+        }
+        for (j = 0; j < query_agg_cntr; j++)
+        {
+            values = &group->values[j];
+            switch (query_aggs[j].type)
+            {
+                case AGG_count:
+                    printf("%llu", (unsigned long long) group->rows);
+                    break;
+                case AGG_sum:
+                    printf("%lli", (long long) group->sums[j]);
+                    break;
+                case AGG_avg:
+                    printf("%.2f", (double) group->sums[j] / group->rows);
+                    break;
+                case AGG_min:
+                    printf("%lli", (long long) group->mins[j]);
+                    break;
+                case AGG_max:
+                    printf("%lli", (long long) group->maxs[j]);
+                    break;
+                case AGG_percentile:
+                    /* Nearest rank */
+                    qsort (values->values, values->count, sizeof (int64_t), compareInt64);
+                    printf("%lli", (long long) values->values[(values->count * query_aggs[j].percent + 99) / 100 - 1]);
+                    break;
+            }
+            printf("%s", j + 1 < query_agg_cntr ? "\t" : "\n");
+        }
+    }
+}
+
+static void usage (const char* aName)
+{
+    fprintf (stderr, "Usage: %s [-d dir] [-s days] [-w filter]... [-g column] table [aggregate...]\n"
+             "  filter: column=value, also !=, <, <=, > and >=\n"
+             "  aggregate: count, sum:column, avg:column, min:column, max:column, pNN:column\n", aName);
+}
+
+int main (int argc, char* argv[])
+{
+    char path[FSYS_FILENAME_MAX];
+    char since[32];
+    const char* dir = NULL;
+    const char* group_name = NULL;
+    FILE* file;
+    int32_t skipped;
+    bool_t damaged;
+    int opt;
+    int i;
+
+    while ((opt = getopt (argc, argv, "d:s:w:g:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                dir = optarg;
+                break;
+            case 's':
+                snprintf (since, sizeof (since), "time>=%lli",
+                          (long long) time (NULL) - (long long) (atof (optarg) * 86400));
+                if (!parseFilter (strdup (since)))
+                {
+                    return 2;
+                }
+                break;
+            case 'w':
+                if (!parseFilter (optarg))
+                {
+                    fprintf (stderr, "Bad filter: %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'g':
+                group_name = optarg;
+                query_group_column = neededColumn (optarg);
+                break;
+            default:
+                usage (argv[0]);
+                return 2;
+        }
+    }
+    if (optind >= argc)
+    {
+        usage (argv[0]);
+        return 2;
+    }
+    for (i = optind + 1; i < argc; i++)
+    {
+        if (!parseAggregate (argv[i]))
+        {
+            fprintf (stderr, "Bad aggregate: %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (!query_agg_cntr)
+    {
+        parseAggregate ("count");
+    }
+
+    if (dir)
+    {
+        snprintf (path, sizeof (path), "%s/%s.col", dir, argv[optind]);
+    }
+    else
+    {
+        snprintf (path, sizeof (path), "%s/.sometris/%s.col", getenv ("HOME") ? getenv ("HOME") : ".", argv[optind]);
+    }
+    file = fopen (path, "rb");
+    if (!file)
+    {
+        fprintf (stderr, "Cannot open %s\n", path);
+        return 1;
+    }
+    skipped = scanFile (file, &damaged);
+    fclose (file);
+    if (skipped < 0)
+    {
+        return 1;
+    }
+    if (skipped)
+    {
+        fprintf (stderr, "%i blocks have no needed column\n", skipped);
+    }
+    printResult (group_name);
+    if (damaged)
+    {
+        fprintf (stderr, "%s is damaged, rows after the damage are missing\n", path);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,256 @@
+/**
+ * @file        sometris_stat.c
+ * @brief       Reader of the live counters of a running game
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-24 19:22:48
+ * Licence:     GPL
+ *
+ * Usage: sometris-stat [-p pid] [-i interval_ms] [-n count]
+ *
+ * One snapshot is printed, or count snapshots every interval_ms, forever
+ * without count. Every game has its own segment, pid selects the game; it
+ * can be omitted while only one game is running.
+ *
+ * Counters of stats.h are printed as "name value" lines, snapshots are
+ * separated by an empty line. Percentiles are upper bounds of histogram
+ * buckets. The segment is only read, the game is never waited for.
+ *
+ * Exit code: 0: counters were read, 1: game is not running, 2: segment is
+ * not compatible, or more games are running and pid is not given.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+
+#define STAT_MAX_TRIES      1000    /* Copies of a segment being written */
+
+static const char* stat_state_names[STATE_size] =
+{
+    [STATE_undefined] = "undefined",
+    [STATE_load_game] = "load_game",
+    [STATE_difficulty_selection] = "difficulty_selection",
+    [STATE_running] = "running",
+    [STATE_paused] = "paused",
+    [STATE_select_name] = "select_name",
+    [STATE_set_name] = "set_name",
+    [STATE_game_over] = "game_over"
+};
+
+uint64_t getTimeUs (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000u + ts.tv_nsec / 1000u;
+}
+
+/**
+ * @brief readStats
+ * Copy the segment with the sequence lock.
+ *
+ * @return TRUE: copy is consistent.
+ */
+static bool_t readStats (const stats_shm_t* aShm, stats_shm_t* aCopy)
+{
+    uint32_t seq;
+    uint32_t tries;
+
+    for (tries = 0; tries < STAT_MAX_TRIES; tries++)
+    {
+        seq = __atomic_load_n (&aShm->seq, __ATOMIC_ACQUIRE);
+        if (!(seq & 1u))
+        {
+            memcpy (aCopy, aShm, sizeof (*aCopy));
+            __atomic_thread_fence (__ATOMIC_ACQUIRE);
+            if (__atomic_load_n (&aShm->seq, __ATOMIC_RELAXED) == seq)
+            {
+                return TRUE;
+            }
+        }
+        sched_yield ();
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief percentile
+ * @return Upper bound of the bucket of the percentile in microseconds.
+ */
+static uint32_t percentile (const stats_hist_t* aHist, uint8_t aPercent)
+{
+    uint64_t rank = ((uint64_t) aHist->count * aPercent + 99) / 100;
+    uint64_t sum = 0;
+    uint8_t i;
+
+    for (i = 0; i < STATS_HIST_BUCKETS - 1; i++)
+    {
+        sum += aHist->buckets[i];
+        if (sum >= rank)
+        {
+            return MIN (2u << i, aHist->max_us);
+        }
+    }
+
+    return aHist->max_us;
+}
+
+/**
+ * @brief findGame
+ * Find the running game by the segments, segments of games which crashed
+ * are left out.
+ *
+ * @return pid of the game. 0: no game is running, -1: more games are running.
+ */
+static int32_t findGame (void)
+{
+    DIR* dir = opendir (STATS_SHM_DIR);
+    struct dirent* entry;
+    unsigned pid;
+    int32_t found = 0;
+
+    if (!dir)
+    {
+        return 0;
+    }
+    while ((entry = readdir (dir)) != NULL)
+    {
+        /* Names in the directory have no leading slash */
+        if (sscanf (entry->d_name, &STATS_SHM_NAME[1], &pid) == 1 && pid && kill (pid, 0) == 0)
+        {
+            found = found ? -1 : (int32_t) pid;
+        }
+    }
+    closedir (dir);
+
+    return found;
+}
+
+static void printHist (const char* aName, const stats_hist_t* aHist)
+{
+    printf("%s_count %u\n", aName, aHist->count);
+    printf("%s_avg_us %llu\n", aName,
+           (unsigned long long) (aHist->count ? aHist->sum_us / aHist->count : 0));
+    printf("%s_p50_us %u\n", aName, percentile (aHist, 50));
+    printf("%s_p99_us %u\n", aName, percentile (aHist, 99));
+    printf("%s_max_us %u\n", aName, aHist->max_us);
+}
+
+static void printStats (const stats_shm_t* aStats)
+{
+    uint64_t now = getTimeUs ();
+
+    printf("pid %u\n", aStats->pid);
+    printf("alive %i\n", kill (aStats->pid, 0) == 0);
+    printf("age_ms %llu\n", (unsigned long long)
+           (now > aStats->update_us ? (now - aStats->update_us) / 1000 : 0));
+    printf("state %s\n", aStats->state < STATE_size && stat_state_names[aStats->state]
+           ? stat_state_names[aStats->state] : "unknown");
+    printf("score %u\n", aStats->score);
+    printf("level %u\n", aStats->level);
+    printf("figure_counter %u\n", aStats->figure_counter);
+    printf("block_types %u\n", aStats->block_types);
+    printf("game_counter %u\n", aStats->game_counter);
+    printHist ("frame", &aStats->frame);
+    printHist ("input_latency", &aStats->input_latency);
+    printHist ("save", &aStats->save);
+}
+
+int main (int argc, char* argv[])
+{
+    stats_shm_t* shm;
+    stats_shm_t copy;
+    uint32_t interval_ms = 0;
+    uint32_t count = 0;
+    uint32_t i;
+    int32_t pid = 0;
+    char name[32];
+    int fd;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "p:i:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p':
+                pid = strtoul (optarg, NULL, 0);
+                break;
+            case 'i':
+                interval_ms = strtoul (optarg, NULL, 0);
+                break;
+            case 'n':
+                count = strtoul (optarg, NULL, 0);
+                break;
+            default:
+                fprintf (stderr, "Usage: %s [-p pid] [-i interval_ms] [-n count]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (!interval_ms && !count)
+    {
+        count = 1;
+    }
+
+    if (!pid)
+    {
+        pid = findGame ();
+        if (pid < 0)
+        {
+            fprintf (stderr, "%s: more games are running, select one by -p\n", argv[0]);
+            return 2;
+        }
+    }
+    snprintf (name, sizeof (name), STATS_SHM_NAME, (uint32_t) pid);
+    fd = pid ? shm_open (name, O_RDONLY, 0) : -1;
+    if (fd < 0)
+    {
+        fprintf (stderr, "%s: game is not running\n", argv[0]);
+        return 1;
+    }
+    shm = mmap (NULL, sizeof (stats_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (shm == MAP_FAILED)
+    {
+        fprintf (stderr, "%s: cannot map %s\n", argv[0], name);
+        return 1;
+    }
+
+    for (i = 0; !count || i < count; i++)
+    {
+        if (i)
+        {
+            usleep (interval_ms * 1000u);
+            printf("\n");
+        }
+        if (!readStats (shm, &copy))
+        {
+            fprintf (stderr, "%s: segment is being written too long\n", argv[0]);
+            return 1;
+        }
+        if (copy.magic != STATS_MAGIC || copy.version != STATS_VERSION)
+        {
+            fprintf (stderr, "%s: segment version %u, expected %u\n", argv[0],
+                     copy.version, STATS_VERSION);
+            return 2;
+        }
+        printStats (&copy);
+        fflush (stdout);
+    }
+    munmap (shm, sizeof (stats_shm_t));
+
+    return 0;
+}
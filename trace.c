@@ -0,0 +1,270 @@
+/**
+ * @file        trace.c
+ * @brief       Tracing of hot paths into Chrome trace JSON
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-22 09:12:40
+ * Licence:     GPL
+ *
+ * Every thread writes its spans into its own ring, the last TRACE_RING_SIZE
+ * spans are kept. Writing a span is a clock read and a store, there is no
+ * lock. A ring is taken by the first span of the thread.
+ *
+ * traceDump() may be called while other threads are writing: events which
+ * were overwritten during the copy are dropped. The JSON can be opened in
+ * chrome://tracing or https://ui.perfetto.dev.
+ */
+
+#ifdef ENABLE_TRACE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "trace.h"
+#include "iothread.h"
+
+#define TRACE_JSON_EVENT_SIZE   160     /* Longest JSON of an event */
+
+typedef struct
+{
+    uint32_t head;          /* Number of events written, written only by owner */
+    char name[TRACE_THREAD_NAME_SIZE];
+    trace_event_t events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+static trace_ring_t     trace_rings[TRACE_MAX_THREADS];
+static uint32_t         trace_ring_cntr = 0;    /* Rings taken */
+static uint64_t         trace_start_ns = 0;     /* Time 0 of trace */
+static __thread trace_ring_t* trace_ring = NULL;
+static __thread bool_t  trace_no_ring = FALSE;  /* All rings are taken */
+
+/**
+ * @brief traceTimeNs
+ * @return Monotonic time in nanoseconds.
+ */
+uint64_t traceTimeNs (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * @brief getRing
+ * @return Ring of the calling thread, NULL: there are too many threads.
+ */
+static trace_ring_t* getRing (void)
+{
+    uint32_t idx;
+
+    if (!trace_ring && !trace_no_ring)
+    {
+        idx = __atomic_fetch_add (&trace_ring_cntr, 1, __ATOMIC_RELAXED);
+        if (idx < TRACE_MAX_THREADS)
+        {
+            trace_ring = &trace_rings[idx];
+            if (!trace_ring->name[0])
+            {
+                snprintf (trace_ring->name, sizeof (trace_ring->name), "thread %u", idx + 1);
+            }
+        }
+        else
+        {
+            trace_no_ring = TRUE;
+        }
+    }
+
+    return trace_ring;
+}
+
+/**
+ * @brief traceInit
+ * Start of trace, it is called by the main thread.
+ */
+void traceInit (void)
+{
+    trace_start_ns = traceTimeNs ();
+    traceThreadName ("main");
+}
+
+/**
+ * @brief traceThreadName
+ * Name of the calling thread in the trace.
+ */
+void traceThreadName (const char* aName)
+{
+    trace_ring_t* ring = getRing ();
+
+    if (ring)
+    {
+        strncpy (ring->name, aName, sizeof (ring->name) - 1);
+    }
+}
+
+/**
+ * @brief traceSpan
+ * Record a span which is finished now.
+ *
+ * @param aName Name of span, string literal.
+ * @param aStartNs Start of span, see TRACE_BEGIN.
+ * @param aArgName Name of argument, string literal, NULL: no argument.
+ * @param aArg Value of argument.
+ */
+void traceSpan (const char* aName, uint64_t aStartNs, const char* aArgName, int32_t aArg)
+{
+    trace_ring_t* ring = getRing ();
+    trace_event_t* event;
+    uint64_t now = traceTimeNs ();
+
+    if (!ring)
+    {
+        return;
+    }
+    event = &ring->events[ring->head & (TRACE_RING_SIZE - 1)];
+    event->name = aName;
+    event->arg_name = aArgName;
+    event->start_ns = aStartNs;
+    event->duration_ns = now - aStartNs;
+    event->arg = aArg;
+    __atomic_store_n (&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief traceRecent
+ * Copy the last spans of the calling thread which started at aSinceNs or
+ * later.
+ *
+ * @param aSinceNs Start of the period, see traceTimeNs().
+ * @param aEvents Buffer of spans, the oldest one is the first.
+ * @param aCount Size of aEvents.
+ * @return Number of spans copied, the newest ones are kept.
+ */
+uint32_t traceRecent (uint64_t aSinceNs, trace_event_t* aEvents, uint32_t aCount)
+{
+    trace_ring_t* ring = getRing ();
+    uint32_t start, i;
+
+    if (!ring)
+    {
+        return 0;
+    }
+    /* Spans are stored when they end, spans of the period are the last ones */
+    start = ring->head;
+    while (ring->head - start < TRACE_RING_SIZE && start
+           && ring->events[(start - 1) & (TRACE_RING_SIZE - 1)].start_ns >= aSinceNs)
+    {
+        start--;
+    }
+    if (ring->head - start > aCount)
+    {
+        start = ring->head - aCount;
+    }
+    for (i = start; i != ring->head; i++)
+    {
+        aEvents[i - start] = ring->events[i & (TRACE_RING_SIZE - 1)];
+    }
+
+    return ring->head - start;
+}
+
+/**
+ * @brief dumpRing
+ * Format the events of a ring into aJson.
+ *
+ * @return Length of JSON.
+ */
+static uint32_t dumpRing (trace_ring_t* aRing, uint32_t aTid, char* aJson, bool_t* aFirst)
+{
+    trace_event_t* events = malloc (TRACE_RING_SIZE * sizeof (trace_event_t));
+    trace_event_t* event;
+    uint32_t head, start, valid, i;
+    uint32_t len = 0;
+    uint64_t start_ns;
+
+    if (!events)
+    {
+        return 0;
+    }
+    head = __atomic_load_n (&aRing->head, __ATOMIC_ACQUIRE);
+    start = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    for (i = start; i != head; i++)
+    {
+        events[i & (TRACE_RING_SIZE - 1)] = aRing->events[i & (TRACE_RING_SIZE - 1)];
+    }
+    /* Slot of the event being written now was overwritten too */
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    valid = __atomic_load_n (&aRing->head, __ATOMIC_ACQUIRE) + 1;
+    if (valid > TRACE_RING_SIZE && valid - TRACE_RING_SIZE > start)
+    {
+        start = valid - TRACE_RING_SIZE;
+    }
+
+    len += sprintf (aJson + len, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                    "\"args\":{\"name\":\"%s\"}}", *aFirst ? "" : ",", aTid, aRing->name);
+    *aFirst = FALSE;
+    for (i = start; i < head; i++)
+    {
+        event = &events[i & (TRACE_RING_SIZE - 1)];
+        start_ns = event->start_ns > trace_start_ns ? event->start_ns - trace_start_ns : 0;
+        len += sprintf (aJson + len, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                        "\"ts\":%llu.%03u,\"dur\":%u.%03u",
+                        event->name, aTid,
+                        (unsigned long long) (start_ns / 1000), (unsigned) (start_ns % 1000),
+                        event->duration_ns / 1000, event->duration_ns % 1000);
+        if (event->arg_name)
+        {
+            len += sprintf (aJson + len, ",\"args\":{\"%s\":%i}", event->arg_name, event->arg);
+        }
+        len += sprintf (aJson + len, "}");
+    }
+    free (events);
+
+    return len;
+}
+
+/**
+ * @brief traceDump
+ * Write trace of all threads as Chrome trace JSON by the I/O thread.
+ *
+ * @return TRUE: file was queued to be written.
+ */
+bool_t traceDump (const char* aPath)
+{
+    uint32_t rings = __atomic_load_n (&trace_ring_cntr, __ATOMIC_RELAXED);
+    uint32_t size;
+    uint32_t len = 0;
+    uint32_t i;
+    bool_t first = TRUE;
+    bool_t ok;
+    char* json;
+
+    if (rings > TRACE_MAX_THREADS)
+    {
+        rings = TRACE_MAX_THREADS;
+    }
+    size = 64 + rings * (TRACE_RING_SIZE + 1) * TRACE_JSON_EVENT_SIZE;
+    json = malloc (size);
+    if (!json)
+    {
+        printf("%s: out of memory\n", __FUNCTION__);
+        return FALSE;
+    }
+    len += sprintf (json + len, "{\"traceEvents\":[");
+    for (i = 0; i < rings; i++)
+    {
+        len += dumpRing (&trace_rings[i], i + 1, json + len, &first);
+    }
+    len += sprintf (json + len, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    ok = ioWriteFile (aPath, (uint8_t*) json, len);
+    free (json);
+    printf("%s: %s\n", __FUNCTION__, aPath);
+
+    return ok;
+}
+
+#endif /* ENABLE_TRACE */
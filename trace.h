@@ -0,0 +1,62 @@
+/**
+ * @file        trace.h
+ * @brief       Tracing of hot paths into Chrome trace JSON
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-22 09:12:40
+ * Licence:     GPL
+ *
+ * Spans are recorded only if the game is built with ENABLE_TRACE
+ * (make TRACE=1), otherwise the macros are empty:
+ *
+ *     TRACE_BEGIN(span);
+ *     ...
+ *     TRACE_END(span, "name");
+ *
+ * Name and argument name shall be string literals.
+ */
+
+#ifndef INCLUDE_TRACE_H
+#define INCLUDE_TRACE_H
+
+#include <stdint.h>
+
+#include "common.h"
+
+#define TRACE_MAX_THREADS       8
+#define TRACE_RING_SIZE         16384   /* Events per thread, power of 2 */
+#define TRACE_THREAD_NAME_SIZE  16
+
+#ifdef ENABLE_TRACE
+
+#define TRACE_BEGIN(span)                           uint64_t span = traceTimeNs ()
+#define TRACE_END(span, name)                       traceSpan (name, span, NULL, 0)
+#define TRACE_END_ARG(span, name, arg_name, arg)    traceSpan (name, span, arg_name, arg)
+#define TRACE_THREAD(name)                          traceThreadName (name)
+
+typedef struct
+{
+    const char* name;
+    const char* arg_name;   /* NULL: no argument */
+    uint64_t start_ns;
+    uint32_t duration_ns;
+    int32_t arg;
+} trace_event_t;
+
+void traceInit (void);
+void traceThreadName (const char* aName);
+uint64_t traceTimeNs (void);
+void traceSpan (const char* aName, uint64_t aStartNs, const char* aArgName, int32_t aArg);
+uint32_t traceRecent (uint64_t aSinceNs, trace_event_t* aEvents, uint32_t aCount);
+bool_t traceDump (const char* aPath);
+
+#else
+
+#define TRACE_BEGIN(span)
+#define TRACE_END(span, name)
+#define TRACE_END_ARG(span, name, arg_name, arg)
+#define TRACE_THREAD(name)
+
+#endif /* ENABLE_TRACE */
+
+#endif /* INCLUDE_TRACE_H */
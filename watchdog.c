@@ -0,0 +1,254 @@
+/**
+ * @file        watchdog.c
+ * @brief       Frame budget watchdog with slow frame log
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-23 19:36:52
+ * Licence:     GPL
+ *
+ * Work of every iteration of the game loop is measured, waiting for input,
+ * the sleep of the loop, the delays of blinkMap() and lateInit() are not
+ * part of it. When it is longer than the budget, state of the game, the
+ * board, the figure, events waiting in the input queue and, if the game is
+ * built with ENABLE_TRACE, spans of the iteration are appended to the log
+ * by the I/O thread.
+ *
+ * The log has two generations like the journal: when a file would grow
+ * over WATCHDOG_LOG_MAX, the other one is truncated and continued. Every
+ * line except the board starts with '#', so an entry cut out of the log is
+ * a board of bench/corpus.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <SDL/SDL.h>
+
+#include "watchdog.h"
+#include "input.h"
+#include "iothread.h"
+#include "trace.h"
+
+#define WATCHDOG_MAX_EVENTS     16      /* Events of input queue in an entry */
+#define WATCHDOG_MAX_SPANS      48      /* Spans in an entry */
+#define WATCHDOG_ENTRY_SIZE     8192
+
+uint32_t watchdog_budget_us = WATCHDOG_BUDGET_US;
+
+static const char* watchdog_state_names[STATE_size] =
+{
+    [STATE_undefined] = "undefined",
+    [STATE_load_game] = "load_game",
+    [STATE_difficulty_selection] = "difficulty_selection",
+    [STATE_running] = "running",
+    [STATE_paused] = "paused",
+    [STATE_select_name] = "select_name",
+    [STATE_set_name] = "set_name",
+    [STATE_game_over] = "game_over"
+};
+
+static char     watchdog_path_format[FSYS_FILENAME_MAX];    /* "" : not initialized */
+static uint8_t  watchdog_generation = 0;    /* Log file being appended */
+static uint32_t watchdog_log_size = 0;      /* Size of log file being appended */
+static uint64_t watchdog_start_us = 0;      /* Start of iteration, 0: not measured */
+#ifdef ENABLE_TRACE
+static uint64_t watchdog_start_ns = 0;
+#endif
+static uint64_t watchdog_last_log_us = 0;
+static uint32_t watchdog_frame_cntr = 0;    /* Iterations measured */
+static uint32_t watchdog_slow_cntr = 0;     /* Iterations over budget */
+static uint32_t watchdog_skipped = 0;       /* Slow iterations not logged since the last entry */
+
+static char* getLogPath (char* aPath, size_t aSize, uint8_t aGeneration)
+{
+    snprintf (aPath, aSize, watchdog_path_format, aGeneration);
+
+    return aPath;
+}
+
+/**
+ * @brief watchdogInit
+ * Continue the newer log file.
+ *
+ * @param aPathFormat Path of log with %u for generation.
+ */
+void watchdogInit (const char* aPathFormat)
+{
+    char path[FSYS_FILENAME_MAX];
+    struct stat st[2];
+    bool_t exists[2];
+    uint8_t i;
+
+    strncpy (watchdog_path_format, aPathFormat, sizeof (watchdog_path_format) - 1);
+    for (i = 0; i < 2; i++)
+    {
+        exists[i] = !stat (getLogPath (path, sizeof (path), i), &st[i]);
+    }
+    watchdog_generation = exists[1] && (!exists[0] || st[1].st_mtime > st[0].st_mtime);
+    watchdog_log_size = exists[watchdog_generation] ? st[watchdog_generation].st_size : 0;
+}
+
+/**
+ * @brief watchdogBegin
+ * Start of the work of an iteration of the game loop.
+ */
+void watchdogBegin (void)
+{
+    watchdog_start_us = getTimeUs ();
+#ifdef ENABLE_TRACE
+    watchdog_start_ns = traceTimeNs ();
+#endif
+}
+
+/**
+ * @brief append
+ * printf to the end of the entry, output is truncated at the end of buffer.
+ */
+static void append (char* aEntry, uint32_t* aLength, const char* aFormat, ...)
+{
+    va_list args;
+    int len;
+
+    va_start (args, aFormat);
+    len = vsnprintf (aEntry + *aLength, WATCHDOG_ENTRY_SIZE - *aLength, aFormat, args);
+    va_end (args);
+    if (len > 0)
+    {
+        *aLength = MIN (*aLength + len, WATCHDOG_ENTRY_SIZE - 1u);
+    }
+}
+
+static void appendEvents (char* aEntry, uint32_t* aLength, uint64_t aNowUs)
+{
+    input_event_t events[WATCHDOG_MAX_EVENTS];
+    uint32_t cnt = inputPeek (events, WATCHDOG_MAX_EVENTS);
+    uint32_t i;
+
+    append (aEntry, aLength, "# input queue: %u events%s\n", cnt,
+            cnt == WATCHDOG_MAX_EVENTS ? " or more" : "");
+    for (i = 0; i < cnt; i++)
+    {
+        append (aEntry, aLength, "#   %s sym %u mod %u",
+                events[i].type == SDL_KEYDOWN ? "keydown" :
+                events[i].type == SDL_KEYUP ? "keyup" :
+                events[i].type == SDL_QUIT ? "quit" : "window",
+                events[i].sym, events[i].mod);
+        if (events[i].timeUs)
+        {
+            append (aEntry, aLength, ", waits %.3f ms", (aNowUs - events[i].timeUs) / 1000.0);
+        }
+        append (aEntry, aLength, "\n");
+    }
+}
+
+#ifdef ENABLE_TRACE
+static void appendSpans (char* aEntry, uint32_t* aLength)
+{
+    trace_event_t spans[WATCHDOG_MAX_SPANS];
+    uint32_t cnt = traceRecent (watchdog_start_ns, spans, WATCHDOG_MAX_SPANS);
+    uint32_t i;
+
+    append (aEntry, aLength, "# spans: %u\n", cnt);
+    for (i = 0; i < cnt; i++)
+    {
+        append (aEntry, aLength, "#   +%.3f ms %s %.3f ms",
+                (spans[i].start_ns - watchdog_start_ns) / 1e6, spans[i].name,
+                spans[i].duration_ns / 1e6);
+        if (spans[i].arg_name)
+        {
+            append (aEntry, aLength, " %s %i", spans[i].arg_name, spans[i].arg);
+        }
+        append (aEntry, aLength, "\n");
+    }
+}
+#endif
+
+/**
+ * @brief writeEntry
+ * Append the slow iteration to the log.
+ */
+static void writeEntry (uint64_t aNowUs, uint64_t aElapsedUs)
+{
+    char path[FSYS_FILENAME_MAX];
+    char entry[WATCHDOG_ENTRY_SIZE];
+    char date[32];
+    uint32_t len = 0;
+    time_t now = time (NULL);
+    uint8_t x, y;
+
+    strftime (date, sizeof (date), "%Y-%m-%d %H:%M:%S", localtime (&now));
+    append (entry, &len, "# slow frame %u of %u: %.3f ms, budget %.3f ms, %s\n",
+            watchdog_slow_cntr, watchdog_frame_cntr, aElapsedUs / 1000.0,
+            watchdog_budget_us / 1000.0, date);
+    if (watchdog_skipped)
+    {
+        append (entry, &len, "# not logged: %u slow frames since the last entry\n", watchdog_skipped);
+    }
+    append (entry, &len, "# state %s, score %u, level %u, figures %u, block types %u\n",
+            main_state_machine < STATE_size ? watchdog_state_names[main_state_machine] : "?",
+            game.score, game.level, game.figure_counter, game.block_types);
+    append (entry, &len, "# figure %u %u %u at %u,%u %s\n",
+            game.figure[0], game.figure[1], game.figure[2], game.figure_x, game.figure_y,
+            game.figure_is_vertical ? "vertical" : "horizontal");
+    appendEvents (entry, &len, aNowUs);
+#ifdef ENABLE_TRACE
+    appendSpans (entry, &len);
+#endif
+    for (y = 0; y < MAP_SIZE_Y; y++)
+    {
+        for (x = 0; x < MAP_SIZE_X; x++)
+        {
+            append (entry, &len, "%c", MAP (x, y) ? '0' + MAP (x, y) : '.');
+        }
+        append (entry, &len, "\n");
+    }
+    append (entry, &len, "\n");
+
+    if (watchdog_log_size && watchdog_log_size + len > WATCHDOG_LOG_MAX)
+    {
+        watchdog_generation ^= 1;
+        watchdog_log_size = 0;
+        ioDeleteFile (getLogPath (path, sizeof (path), watchdog_generation));
+    }
+    if (ioAppendFile (getLogPath (path, sizeof (path), watchdog_generation), (uint8_t*) entry, len))
+    {
+        watchdog_log_size += len;
+    }
+    watchdog_last_log_us = aNowUs;
+    watchdog_skipped = 0;
+}
+
+/**
+ * @brief watchdogEnd
+ * End of the work of an iteration. Iterations which are not ended, e.g.
+ * waiting for input, are not measured.
+ */
+void watchdogEnd (void)
+{
+    uint64_t now = getTimeUs ();
+    uint64_t elapsed = now - watchdog_start_us;
+
+    if (!watchdog_budget_us || !watchdog_path_format[0] || !watchdog_start_us)
+    {
+        return;
+    }
+    watchdog_start_us = 0;
+    watchdog_frame_cntr++;
+    if (elapsed <= watchdog_budget_us)
+    {
+        return;
+    }
+    watchdog_slow_cntr++;
+    if (watchdog_last_log_us && now - watchdog_last_log_us < WATCHDOG_MIN_GAP_US)
+    {
+        /* Writing the log shall not make the game even slower */
+        watchdog_skipped++;
+        return;
+    }
+    writeEntry (now, elapsed);
+}
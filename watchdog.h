@@ -0,0 +1,27 @@
+/**
+ * @file        watchdog.h
+ * @brief       Frame budget watchdog with slow frame log
+ * @author      Copyright (C) Peter Ivanov, 2016
+ *
+ * Created      2016-05-23 19:36:52
+ * Licence:     GPL
+ */
+
+#ifndef INCLUDE_WATCHDOG_H
+#define INCLUDE_WATCHDOG_H
+
+#include <stdint.h>
+
+#include "game_common.h"
+
+#define WATCHDOG_BUDGET_US      16667   /* Default budget of a frame */
+#define WATCHDOG_LOG_MAX        (256 * 1024)    /* Size of a log generation */
+#define WATCHDOG_MIN_GAP_US     1000000 /* Slow frames are logged at most this often */
+
+extern uint32_t watchdog_budget_us;     /* 0: watchdog is off (--frame-budget-us) */
+
+void watchdogInit (const char* aPathFormat);
+void watchdogBegin (void);
+void watchdogEnd (void);
+
+#endif /* INCLUDE_WATCHDOG_H */